@@ -51,6 +51,7 @@ struct alldata {
 	useridset unloaded_db_user_ids;
 	unsigned int next_media_id = 1;
 	cached_id_sets cids;
+	cached_id_sets_journal cids_journal;
 	std::vector<twin_layout_desc> twinlayout;
 	std::vector<mf_layout_desc> mflayout;
 	bool twinlayout_final = false;
@@ -24,6 +24,7 @@
 #include "log.h"
 #include <wx/stdpaths.h>
 #include <wx/tokenzr.h>
+#include <cstdlib>
 
 globconf gc;
 
@@ -70,6 +71,9 @@ genoptconf gcdefaults {
 #define CFGDEFAULT_proxyhttptunnel                          wxT("0")
 #define CFGDEFAULT_noproxylist                              wxT("")
 #define CFGDEFAULT_netiface                                 wxT("")
+#define CFGDEFAULT_apiredirect                              wxT("")
+#define CFGDEFAULT_mediadlmaxconns                          wxT("8")
+#define CFGDEFAULT_mediadlmaxhostconns                      wxT("6")
 #define CFGDEFAULT_inlinereplyloadcount                     wxT("1")
 #define CFGDEFAULT_inlinereplyloadmorecount                 wxT("3")
 #define CFGDEFAULT_showdeletedtweetsbydefault               wxT("0")
@@ -85,6 +89,15 @@ genoptconf gcdefaults {
 #define CFGDEFAULT_hideallthumbs                            wxT("0")
 #define CFGDEFAULT_loadhiddenthumbs                         wxT("0")
 #define CFGDEFAULT_threadpoollimit                          wxT("8")
+#define CFGDEFAULT_dbreadpoolthreads                        wxT("2")
+#define CFGDEFAULT_dbwalmode                                wxT("1")
+#define CFGDEFAULT_dbdurability                             wxT("1")
+#define CFGDEFAULT_dbgroupcommitmaxms                       wxT("200")
+#define CFGDEFAULT_dbgroupcommitmaxmsgs                     wxT("256")
+#define CFGDEFAULT_dbwalcheckpointintervalsecs              wxT("60")
+#define CFGDEFAULT_dbzstd                                   wxT("1")
+#define CFGDEFAULT_dbidsnapshot                             wxT("1")
+#define CFGDEFAULT_dbsearchindex                            wxT("0")
 #define CFGDEFAULT_mediacachesavedays                       wxT("7")
 #define CFGDEFAULT_profimgcachesavedays                     wxT("14")
 #define CFGDEFAULT_showunhighlightallbtn                    wxT("1")
@@ -221,6 +234,29 @@ void globconf::CFGReadIn(DBReadConfig &twfc) {
 	CFGParamConv();
 }
 
+// Accepts host:port, where host is localhost, an IPv4 loopback address or [::1]
+// Returns the empty string if in is not of that form
+static std::string CheckLoopbackRedirect(const std::string &in) {
+	std::string::size_type colon = in.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == in.size()) {
+		return "";
+	}
+	for (std::string::size_type i = colon + 1; i < in.size(); i++) {
+		if (in[i] < '0' || in[i] > '9') {
+			return "";
+		}
+	}
+	unsigned long port = strtoul(in.c_str() + colon + 1, nullptr, 10);
+	if (port == 0 || port > 65535) {
+		return "";
+	}
+	std::string host = in.substr(0, colon);
+	if (host == "localhost" || host == "[::1]" || (host.compare(0, 4, "127.") == 0 && host.find_first_not_of("0123456789.") == std::string::npos)) {
+		return in;
+	}
+	return "";
+}
+
 void globconf::CFGParamConv() {
 #define CFGTEMPL(x)
 #define CFGTEMPL_UL(x) gcfg.x.val.ToULong(&x);
@@ -252,6 +288,13 @@ void globconf::CFGParamConv() {
 
 	netiface = stdstrwx(gc.gcfg.netiface.val);
 
+	const wxString &apiredirect_val = apiredirect_override.IsEmpty() ? gc.gcfg.apiredirect.val : apiredirect_override;
+	std::string apiredirect_str = stdstrwx(apiredirect_val.Strip(wxString::both));
+	apiredirect = CheckLoopbackRedirect(apiredirect_str);
+	if (apiredirect.empty() && !apiredirect_str.empty()) {
+		LogMsgFormat(LOGT::OTHERERR, "Ignoring API connection redirect: \"%s\", only loopback host:port targets are allowed", cstr(apiredirect_str));
+	}
+
 	const format_set &current_format_set = IndexToFormatSet(format_default_num);
 	auto do_format_param = [&](genopt &targ, const genopt &def) {
 		if (targ.val.IsEmpty() || !targ.enable) {
@@ -266,6 +309,10 @@ void globconf::CFGParamConv() {
 	unsigned long emoji_mode_tmp;
 	gc.gcfg.emoji_mode.val.ToULong(&emoji_mode_tmp);
 	emoji_mode = static_cast<EMOJI_MODE>(emoji_mode_tmp);
+
+	unsigned long dbdurability_tmp;
+	gc.gcfg.dbdurability.val.ToULong(&dbdurability_tmp);
+	dbdurability = static_cast<DB_DURABILITY>(dbdurability_tmp);
 }
 
 void genoptconf::CFGWriteOutCurDir(DBWriteConfig &twfc) const {
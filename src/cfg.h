@@ -51,6 +51,12 @@ enum class EMOJI_MODE {
 	SIZE_36                = 2,
 };
 
+enum class DB_DURABILITY {
+	FULL                   = 0,
+	NORMAL                 = 1,
+	OFF                    = 2,
+};
+
 struct genoptconf {
 	genopt tokenk;
 	genopt tokens;
@@ -100,6 +106,9 @@ struct genoptconf {
 	CFGTEMPL_BOOL(proxyhttptunnel) \
 	CFGTEMPL(noproxylist) \
 	CFGTEMPL(netiface) \
+	CFGTEMPL(apiredirect) \
+	CFGTEMPL_UL(mediadlmaxconns) \
+	CFGTEMPL_UL(mediadlmaxhostconns) \
 	CFGTEMPL_UL(inlinereplyloadcount) \
 	CFGTEMPL_UL(inlinereplyloadmorecount) \
 	CFGTEMPL_BOOL(showdeletedtweetsbydefault) \
@@ -115,6 +124,15 @@ struct genoptconf {
 	CFGTEMPL_BOOL(hideallthumbs) \
 	CFGTEMPL_BOOL(loadhiddenthumbs) \
 	CFGTEMPL_UL(threadpoollimit) \
+	CFGTEMPL_UL(dbreadpoolthreads) \
+	CFGTEMPL_BOOL(dbwalmode) \
+	CFGTEMPL(dbdurability) \
+	CFGTEMPL_UL(dbgroupcommitmaxms) \
+	CFGTEMPL_UL(dbgroupcommitmaxmsgs) \
+	CFGTEMPL_UL(dbwalcheckpointintervalsecs) \
+	CFGTEMPL_BOOL(dbzstd) \
+	CFGTEMPL_BOOL(dbidsnapshot) \
+	CFGTEMPL_BOOL(dbsearchindex) \
 	CFGTEMPL_UL(mediacachesavedays) \
 	CFGTEMPL_UL(profimgcachesavedays) \
 	CFGTEMPL_BOOL(showunhighlightallbtn) \
@@ -170,7 +188,9 @@ struct globconf : public globconf_base {
 	std::string proxyurl;
 	std::string noproxylist;
 	std::string netiface;
+	std::string apiredirect;    // validated loopback host:port, or empty
 	EMOJI_MODE emoji_mode;
+	DB_DURABILITY dbdurability;
 
 	void CFGReadIn(DBReadConfig &twfc);
 	void CFGParamConv();
@@ -179,6 +199,7 @@ struct globconf : public globconf_base {
 	bool readonlymode = false;
 	bool allaccsdisabled = false;
 	bool rescan_tweets_table = false;
+	wxString apiredirect_override;    // takes precedence over gcfg.apiredirect, not saved
 };
 
 struct format_set {
@@ -30,7 +30,7 @@
 typedef CSimpleOptTempl<wxChar> CSO;
 
 enum { OPT_LOGWIN, OPT_FILE, OPT_STDERR, OPT_FILEAUTO, OPT_DATADIR, OPT_FFLUSH, OPT_READONLY, OPT_ACCSDSBD, OPT_LOGMEMUSAGE, OPT_VERSION,
-		OPT_RESCAN_TWEETS };
+		OPT_RESCAN_TWEETS, OPT_APIREDIRECT };
 
 CSO::SOption g_rgOptions[] =
 {
@@ -55,6 +55,7 @@ CSO::SOption g_rgOptions[] =
 	{ OPT_LOGMEMUSAGE,  wxT("--log-mem-usage"),SO_NONE      },
 #endif
 	{ OPT_RESCAN_TWEETS,wxT("--rescan-tweets-table"),SO_NONE},
+	{ OPT_APIREDIRECT,  wxT("--api-redirect"), SO_REQ_SHRT  },
 	{ OPT_VERSION,      wxT("--version"),      SO_NONE      },
 
 	SO_END_OF_OPTIONS
@@ -143,6 +144,10 @@ int cmdlineproc(wxChar **argv, int argc) {
 				gc.rescan_tweets_table = true;
 				break;
 			}
+			case OPT_APIREDIRECT: {
+				gc.apiredirect_override = args.OptionArg();
+				break;
+			}
 			case OPT_VERSION: {
 				wxSafeShowMessage(wxT("Version"), wxString::Format(wxT("%s (%s)"), appversionname.c_str(), appbuildversion.c_str()));
 				wxGetApp().terms_requested++;
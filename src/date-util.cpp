@@ -0,0 +1,163 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "date-util.h"
+#include <cstring>
+
+#ifdef __WINDOWS__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "../deps/strptime.cpp"
+#pragma GCC diagnostic pop
+#endif
+
+// This function is from https://web.nlcindia.com/gpsd/gpsd-3.1/gpsutils.c (BSD license)
+static time_t our_mkgmtime(struct tm * t)
+/* struct tm to seconds since Unix epoch */
+{
+	const int MONTHSPERYEAR = 12;
+
+	int year;
+	time_t result;
+	static const int cumdays[MONTHSPERYEAR] =
+		{ 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+	/*@ +matchanyintegral @*/
+	year = 1900 + t->tm_year + t->tm_mon / MONTHSPERYEAR;
+	result = (year - 1970) * 365 + cumdays[t->tm_mon % MONTHSPERYEAR];
+	result += (year - 1968) / 4;
+	result -= (year - 1900) / 100;
+	result += (year - 1600) / 400;
+	if ((year % 4) == 0 && ((year % 100) != 0 || (year % 400) == 0) &&
+			(t->tm_mon % MONTHSPERYEAR) < 2) {
+		result--;
+	}
+	result += t->tm_mday - 1;
+	result *= 24;
+	result += t->tm_hour;
+	result *= 60;
+	result += t->tm_min;
+	result *= 60;
+	result += t->tm_sec;
+	/*@ -matchanyintegral @*/
+	return (result);
+}
+
+// Days since 1970-01-01 of the given proleptic Gregorian date, month is 1 - 12, year must not be negative
+// See: http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+static int64_t days_from_civil(int64_t y, unsigned int m, unsigned int d) {
+	y -= (m <= 2);
+	const int64_t era = y / 400;
+	const unsigned int yoe = static_cast<unsigned int>(y - era * 400);
+	const unsigned int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// Parses the fixed layout used by Twitter: "Www Mmm dd hh:mm:ss +0000 yyyy"
+// The fields are all extracted and range-checked unconditionally, and the result is only checked at the end
+// Returns false for anything which does not exactly match the layout, or which is outside the ranges accepted by strptime
+// Years before 1970 are also rejected, so that the result is always the same as that of the strptime/our_mkgmtime path
+bool ParseTwitterDateFixed(struct tm *createtm, time_t *createtm_t, const std::string &created_at) {
+	if (created_at.size() != 30) {
+		return false;
+	}
+
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(created_at.data());
+	unsigned int bad = 0;
+	auto digits = [&](size_t offset, size_t count) -> unsigned int {
+		unsigned int value = 0;
+		for (size_t i = 0; i < count; i++) {
+			unsigned int digit = p[offset + i] - '0';
+			bad |= (digit > 9);
+			value = (value * 10) + digit;
+		}
+		return value;
+	};
+	auto name_index = [&](size_t offset, const char * const *names, unsigned int count) -> unsigned int {
+		uint32_t key = p[offset] | (p[offset + 1] << 8) | (p[offset + 2] << 16);
+		unsigned int index = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			const unsigned char *n = reinterpret_cast<const unsigned char *>(names[i]);
+			uint32_t name_key = n[0] | (n[1] << 8) | (n[2] << 16);
+			index |= (i + 1) & -static_cast<unsigned int>(key == name_key);
+		}
+		bad |= (index == 0);
+		return index - 1;
+	};
+
+	static const char * const weekdays[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char * const months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+	unsigned int wday = name_index(0, weekdays, 7);
+	unsigned int mon = name_index(4, months, 12);
+	unsigned int mday = digits(8, 2);
+	unsigned int hour = digits(11, 2);
+	unsigned int min = digits(14, 2);
+	unsigned int sec = digits(17, 2);
+	unsigned int year = digits(26, 4);
+
+	bad |= (p[3] ^ ' ') | (p[7] ^ ' ') | (p[10] ^ ' ') | (p[13] ^ ':') | (p[16] ^ ':');
+	bad |= memcmp(p + 19, " +0000 ", 7);
+	bad |= (mday - 1 > 30) | (hour > 23) | (min > 59) | (sec > 61) | (year < 1970);
+	if (bad) {
+		return false;
+	}
+
+	if (createtm) {
+		memset(createtm, 0, sizeof(struct tm));
+		createtm->tm_sec = sec;
+		createtm->tm_min = min;
+		createtm->tm_hour = hour;
+		createtm->tm_mday = mday;
+		createtm->tm_mon = mon;
+		createtm->tm_year = year - 1900;
+		createtm->tm_wday = wday;
+	}
+	if (createtm_t) {
+		*createtm_t = static_cast<time_t>((((days_from_civil(year, mon + 1, mday) * 24) + hour) * 60 + min) * 60 + sec);
+	}
+	return true;
+}
+
+//wxDateTime performs some braindead timezone adjustments and so is unusable
+//mktime and friends also have onerous timezone behaviour
+//use strptime and an implementation of timegm instead
+void ParseTwitterDateStrptime(struct tm *createtm, time_t *createtm_t, const std::string &created_at) {
+	struct tm tmp_tm;
+	time_t tmp_time;
+	if (!createtm) {
+		createtm = &tmp_tm;
+	}
+	if (!createtm_t) {
+		createtm_t = &tmp_time;
+	}
+
+	memset(createtm, 0, sizeof(struct tm));
+	*createtm_t = 0;
+	strptime(created_at.c_str(), "%a %b %d %T +0000 %Y", createtm);
+	*createtm_t = our_mkgmtime(createtm);
+}
+
+//dates in the usual Twitter layout are handled by ParseTwitterDateFixed, this is the fallback for everything else
+void ParseTwitterDate(struct tm *createtm, time_t *createtm_t, const std::string &created_at) {
+	if (!ParseTwitterDateFixed(createtm, createtm_t, created_at)) {
+		ParseTwitterDateStrptime(createtm, createtm_t, created_at);
+	}
+}
@@ -0,0 +1,35 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#ifndef HGUARD_SRC_DATE_UTIL
+#define HGUARD_SRC_DATE_UTIL
+
+#include "univdefs.h"
+#include <ctime>
+#include <string>
+
+// Parses a created_at date as returned by Twitter, eg. "Wed Aug 27 13:08:45 +0000 2008", as UTC
+// Either output may be null
+void ParseTwitterDate(struct tm *createtm, time_t *createtm_t, const std::string &created_at);
+
+// The two paths used by ParseTwitterDate, these must give identical results for any input accepted by ParseTwitterDateFixed
+// They are only exposed for the differential test in tools/datetest
+bool ParseTwitterDateFixed(struct tm *createtm, time_t *createtm_t, const std::string &created_at);
+void ParseTwitterDateStrptime(struct tm *createtm, time_t *createtm_t, const std::string &created_at);
+
+#endif
@@ -27,12 +27,18 @@
 #include "rapidjson-inc.h"
 #include "tweetidset.h"
 #include "map.h"
+#include "fileutil.h"
 #include <cstdlib>
 #include <queue>
 #include <string>
 #include <set>
 #include <map>
 #include <forward_list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
 #include <exception>
 #include <stdexcept>
 #include <wx/string.h>
@@ -46,6 +52,8 @@
 
 struct dbconn;
 extern dbconn dbc;
+struct tweet_scan_statjson_parser;
+struct tweet_gc_state;
 
 typedef enum {
 	DBPSC_START = 0,
@@ -84,10 +92,34 @@ typedef enum {
 	DBPSC_SELTWEETIDBYTIMESTAMP,
 	DBPSC_SELEVENTLOGBYOBJ,
 	DBPSC_SELEVENTLOGBYOBJ_ACCID,
+	DBPSC_SELTWEETBATCH,
+	DBPSC_SELUSERBATCH,
+	DBPSC_INSTWEETSEARCH,
+	DBPSC_INSUSERSEARCH,
+	DBPSC_INSACCIDJOURNAL,
+	DBPSC_DELACCIDJOURNAL,
+	DBPSC_DELTPANEL,
+	DBPSC_INSCIDSJOURNAL,
+	DBPSC_DELCIDSJOURNAL,
 
 	DBPSC_NUM_STATEMENTS,
 } DBPSC_TYPE;
 
+// Number of ID parameters in the DBPSC_*BATCH statements, unused parameters are bound to NULL
+const unsigned int DBPSC_BATCH_SIZE = 64;
+
+// Values of accidjournal.type
+enum {
+	ACCIDJOURNAL_TWEET_IDS = 0,
+	ACCIDJOURNAL_DM_IDS = 1,
+};
+
+// Values of cidsjournal.type
+enum {
+	CIDSJOURNAL_INSERTED = 0,
+	CIDSJOURNAL_ERASED = 1,
+};
+
 struct dbpscache {
 	sqlite3_stmt *stmts[DBPSC_NUM_STATEMENTS];
 
@@ -106,24 +138,118 @@ struct dbpscache {
 	bool transaction_refcount_went_negative = false;
 };
 
-struct dbiothread : public wxThread {
+// Lock-free multi-producer, single-consumer queue of messages to the DB thread
+// Producers push onto an intrusive stack, the consumer takes the whole stack at once
+// The wakeup event is only signalled when the consumer is waiting, such that bursts of messages do not each need a syscall
+struct dbmsgqueue {
+	bool Init();
+	void DeInit();
+	void Push(dbsendmsg *msg);
+
+	// Returns all queued messages as a list in FIFO order, linked by dbsendmsg::queue_next
+	// If wait is true, this blocks until at least one message is available
+	dbsendmsg *PopAll(bool wait);
+
+	private:
+	std::atomic<dbsendmsg *> head { nullptr };
+	std::atomic<bool> consumer_waiting { false };
 	#ifdef __WINDOWS__
-	HANDLE iocp;
+	HANDLE event = nullptr;
 	#else
-	int pipefd;
+	int wakeup_read_fd = -1;
+	int wakeup_write_fd = -1;
 	#endif
+
+	void Signal();
+	void Wait();
+};
+
+// User IDs which have been loaded by one DB or read pool thread, but whose replies have not yet been posted to the main thread
+// See dbconn::AsyncReadInUsers
+struct db_user_load_claims {
+	std::vector<uint64_t> ids;
+};
+
+struct dbiothread : public wxThread {
+	dbmsgqueue *queue;
 	std::string filename;
 
 	sqlite3 *db;
 	dbpscache cache;
-	std::deque<std::pair<wxEvtHandler *, std::unique_ptr<wxEvent> > > reply_list;
+	db_reply_list reply_list;
+	db_user_load_claims user_load_claims;
 	dbconn *dbc;
 
+	// Group commit: messages which are already queued are processed in the same transaction, up to these limits
+	unsigned int group_commit_max_msgs = 1;
+	std::chrono::milliseconds group_commit_max_time { 0 };
+
 	dbiothread() : wxThread(wxTHREAD_JOINABLE) { }
 	wxThread::ExitCode Entry();
 	void MsgLoop();
 };
 
+// Pool of read-only connections, used for tweet/user selects and read-only function callbacks
+// This requires the DB to be in WAL mode, such that readers are not blocked by the DB thread
+// Each job waits until all read-dependent messages sent to the DB thread before it have been committed
+struct dbreadpool {
+	dbconn *dbc = nullptr;
+
+	bool Init(const std::string &filename, unsigned int thread_count);
+	void DeInit();
+	void Enqueue(std::unique_ptr<dbsendmsg> msg, uint64_t write_barrier);
+
+	private:
+	struct job {
+		std::unique_ptr<dbsendmsg> msg;
+		uint64_t write_barrier;
+	};
+
+	std::mutex lock;
+	std::condition_variable queue_cv;
+	std::deque<job> job_queue;
+	std::vector<std::thread> workers;
+	bool quit = false;
+
+	void WorkerLoop(sqlite3 *db);
+};
+
+// Periodically checkpoints the WAL using a separate connection
+// This is such that checkpoints are not performed by the DB thread on commit
+struct dbwalcheckpointer {
+	bool Init(const std::string &filename, unsigned int interval_secs);
+	void DeInit();
+
+	private:
+	std::mutex lock;
+	std::condition_variable cv;
+	std::thread thread;
+	bool quit = false;
+
+	void Loop(sqlite3 *db, std::chrono::seconds interval);
+};
+
+// ID sets to write to the startup snapshot file, see db-snapshot.cpp
+struct dbidsnapshotdata {
+	std::vector<std::pair<std::string, std::vector<uint64_t> > > sections;
+
+	void AddSection(std::string name, const tweetidset &set);
+};
+
+// Startup snapshot file, this is only kept open during dbconn::Init
+struct dbidsnapshot {
+	mapped_file file;
+	bool has_users = false;
+
+	bool Open(const std::string &filename, uint64_t generation, uint64_t session);
+	bool LoadSet(const std::string &name, tweetidset &out) const;
+
+	private:
+	std::map<std::string, std::pair<const uint64_t *, size_t> > sections;
+};
+
+bool DBWriteIdSnapshot(sqlite3 *db, dbpscache &cache, const std::string &filename, const dbidsnapshotdata &data, uint64_t session, bool has_users);
+
 struct dbfunctionmsg : public dbsendmsg {
 	dbfunctionmsg() : dbsendmsg(DBSM::FUNCTION) { }
 	std::vector<std::function<void(sqlite3 *, bool &, dbpscache &)> > funclist;
@@ -151,29 +277,63 @@ enum {
 enum {
 	DBCONNTIMER_ID_ASYNCSTATEWRITE = 1,
 	DBCONNTIMER_ID_ASYNCPURGEOLDTWEETS,
+	DBCONNTIMER_ID_ZSTDMAINTENANCE,
+	DBCONNTIMER_ID_SEARCHINDEX,
 };
 
 struct dbconn : public wxEvtHandler {
-	#ifdef __WINDOWS__
-	HANDLE iocp;
-	#else
-	int pipefd;
-	#endif
+	dbmsgqueue queue;
 	sqlite3 *syncdb;
 	dbiothread *th = nullptr;
+	std::unique_ptr<dbreadpool> readpool;
+	std::unique_ptr<dbwalcheckpointer> walcheckpointer;
+	std::unique_ptr<dbidsnapshot> idsnapshot;
+	std::string db_filename;
+	std::string idsnapshot_filename;
+	uint64_t startup_dirty_flag = 0;           // Value of the dirty flag before it was set for this session, 0 if the DB was cleanly closed
+	uint64_t session_dirty_flag = 0;
+	time_t tweet_gc_last_purge_delta = 0;
 	dbpscache cache;
 	std::unique_ptr<dbsendmsg_list> batchqueue;
 	std::unique_ptr<wxTimer> asyncstateflush_timer;
 	std::unique_ptr<wxTimer> asyncpurgeoldtweets_timer;
+	std::unique_ptr<wxTimer> zstdmaintenance_timer;
+	std::unique_ptr<wxTimer> searchindex_timer;
+	bool search_index_enabled = false;              // only changed before the DB thread is started
+	std::atomic<bool> search_index_complete { false };  // true once all pre-existing rows have been indexed
+
+	// Names of the tpanels which are in the tpanels table, such that removed tpanels can be deleted, see WriteBackTpanels
+	// This is only accessed on the main thread
+	std::set<std::string> tpanels_in_db;
 
 	// This has the same function as, but is distinct from ad.unloaded_db_user_ids.
 	// This is eventually consistent with ad.unloaded_db_user_ids, but not instantaneously consistent,
 	// mainly because the two sets are owned by different threads. The DB thread will clear an item
 	// from this before sending it to the main thread, whch will *then* clear the same item.
+	// This is also accessed by the read pool threads, hence the lock.
 	useridset unloaded_user_ids;
+	std::mutex unloaded_user_ids_lock;
+
+	// Users which are being loaded by a DB or read pool thread, and which thread's claims they are in
+	// Protected by unloaded_user_ids_lock
+	std::map<uint64_t, const db_user_load_claims *> users_being_loaded;
+	std::condition_variable users_being_loaded_cv;
 	unsigned int sync_load_user_count = 0;
 
+	// Unreferenced tweet garbage collector state which is shared with the DB thread and read pool threads
+	// A chunk of candidates is checked and deleted whilst holding the lock, see AsyncPurgeUnreferencedTweetsChunk
+	tweetidset tweet_gc_pending_ids;           // candidates of a chunk which has been sent to the DB thread but not yet run
+	tweetidset tweet_gc_deleted_ids;           // deleted by a chunk whose reply has not yet been handled by the main thread
+	std::mutex tweet_gc_lock;
+
 	private:
+	// Sequence numbers of messages sent to/completed by the DB thread, used to order read pool jobs after prior writes
+	uint64_t write_msg_sent_seq = 0;           // main thread only
+	uint64_t read_barrier_seq = 0;             // main thread only, last sent message which read pool jobs must wait for
+	uint64_t write_msg_done_seq = 0;           // protected by write_msg_done_lock
+	std::mutex write_msg_done_lock;
+	std::condition_variable write_msg_done_cv;
+
 	std::map<intptr_t, std::function<void(dbseltweetmsg &, dbconn *)> > generic_sel_funcs;
 	std::map<intptr_t, std::function<void(dbselusermsg &, dbconn *)> > generic_sel_user_funcs;
 	std::vector<std::function<void(dbconn *)> > post_init_callbacks;
@@ -185,6 +345,7 @@ struct dbconn : public wxEvtHandler {
 		REPLY_CLEARNOUPDF           = 1<<2,
 		REPLY_CHECKPENDINGS         = 1<<3,
 		TWEET_ID_CACHE_INVALID      = 1<<4,
+		TWEET_GC_DUE                = 1<<5,
 	};
 
 	flagwrapper<DBCF> dbc_flags = 0;
@@ -199,6 +360,7 @@ struct dbconn : public wxEvtHandler {
 	void AsyncWriteBackStateMinimal();
 
 	void SendMessage(std::unique_ptr<dbsendmsg> msg);
+	void SendReadMessage(std::unique_ptr<dbsendmsg> msg);
 	void SendMessageBatchedOrAddToList(std::unique_ptr<dbsendmsg> msg, optional_observer_ptr<dbsendmsg_list> msglist);
 	void SendMessageBatched(std::unique_ptr<dbsendmsg> msg);
 	void FlushBatchQueue();
@@ -218,7 +380,8 @@ struct dbconn : public wxEvtHandler {
 	void AsyncWriteBackAllUsers(dbfunctionmsg &msg);
 	void SyncReadInAllUserIDs(sqlite3 *adb);
 	udc_ptr SyncReadInUser(sqlite3 *syncdb, uint64_t id);
-	void AsyncReadInUser(sqlite3 *adb, uint64_t id, std::deque<dbretuserdata> &out);
+	void AsyncReadInUsers(sqlite3 *adb, dbpscache &acache, const container::set<uint64_t> &ids, std::deque<dbretuserdata> &out, db_user_load_claims &claims);
+	void ReleaseUserLoadClaims(db_user_load_claims &claims);
 	void SyncPostUserLoadCompletion();
 
 	void InsertMedia(media_entity &me, optional_observer_ptr<dbsendmsg_list> msglist = nullptr);
@@ -248,8 +411,13 @@ struct dbconn : public wxEvtHandler {
 
 	void OnSendBatchEvt(wxCommandEvent &event);
 	void OnDBReplyEvt(wxCommandEvent &event);
+	void PostDBReplies(db_reply_list &reply_list);
+
+	void NotifyWriteMsgDone(uint64_t seq);
+	void WaitForWriteMsgDone(uint64_t seq);
 
 	void SyncReadInCIDSLists(sqlite3 *adb);
+	void SyncReadInCIDSJournal(sqlite3 *adb, bool apply);
 	void SyncWriteBackCIDSLists(sqlite3 *adb);
 	void AsyncWriteBackCIDSLists(dbfunctionmsg &msg);
 
@@ -257,6 +425,7 @@ struct dbconn : public wxEvtHandler {
 	void SyncWriteBackWindowLayout(sqlite3 *adb);
 
 	void SyncReadInAllTweetIDs(sqlite3 *syncdb);
+	void SyncScanTweetsTable(sqlite3 *syncdb, tweet_scan_statjson_parser &tssp);
 	void SyncWriteBackTweetIDIndexCache(sqlite3 *syncdb);
 	void MergeTweetIdSets();
 
@@ -267,12 +436,16 @@ struct dbconn : public wxEvtHandler {
 	bool SyncDoUpdates(sqlite3 *adb);
 	bool SyncCheckReadOnlyDBVersion(sqlite3 *adb);
 	bool SyncWriteDBVersion(sqlite3 *adb);
+	bool SyncSetupJournalMode(sqlite3 *adb);
 
 	bool CheckIfPurgeDue(sqlite3 *db, time_t threshold, const char *settingname, const char *funcname, time_t &delta);
 	void UpdateLastPurged(sqlite3 *db, const char *settingname, const char *funcname);
 	void SyncPurgeMediaEntities(sqlite3 *db);
 	void SyncPurgeProfileImages(sqlite3 *adb);
-	void SyncPurgeUnreferencedTweets(sqlite3 *adb);
+	void SyncCheckPurgeUnreferencedTweetsDue(sqlite3 *adb);
+	void AsyncPurgeUnreferencedTweets();
+	void AsyncPurgeUnreferencedTweetsChunk(std::shared_ptr<tweet_gc_state> state);
+	void TweetGCRetainIds(std::vector<uint64_t> &ids);
 	void CheckPurgeTweets();
 	void CheckPurgeUsers();
 
@@ -292,6 +465,7 @@ struct dbconn : public wxEvtHandler {
 	void DBSelUserReturnDataHandler(std::deque<dbretuserdata> data, optional_observer_ptr<db_handle_msg_pending_guard> pending_guard);
 
 	void SendFunctionMsgCallback(std::unique_ptr<dbfunctionmsg_callback> insmsg);
+	void SendReadFunctionMsgCallback(std::unique_ptr<dbfunctionmsg_callback> insmsg);
 	void OnDBSendFunctionMsgCallback(wxCommandEvent &event);
 
 	void OnAsyncStateWriteTimer(wxTimerEvent& event);
@@ -302,9 +476,29 @@ struct dbconn : public wxEvtHandler {
 	void SyncPurgeOldTweets(sqlite3 *syncdb);
 	void AsyncPurgeOldTweets();
 
+	void SyncReadInZstdDictionaries(sqlite3 *adb);
+	void OnZstdMaintenanceTimer(wxTimerEvent& event);
+	void ResetZstdMaintenanceTimer(unsigned int delay_ms);
+	void AsyncZstdMaintenance();
+	void AsyncZstdStoreDictionary(std::string dict);
+
+	void SyncSetupSearchIndex(sqlite3 *adb);
+	void OnSearchIndexTimer(wxTimerEvent& event);
+	void ResetSearchIndexTimer(unsigned int delay_ms);
+	void AsyncSearchIndexBackfill();
+	void AsyncSearchTweets(std::string query, std::function<void(tweetidset, bool)> completion);
+
 	void AsyncGetNewestTweetOlderThan(time_t timestamp, std::function<void(uint64_t)> completion);
 
 	void SyncClearDirtyFlag(sqlite3 *db);
+	uint64_t SyncReadDirtyFlag(sqlite3 *adb);
+
+	void SyncReadInIdSnapshot(sqlite3 *adb);
+	bool SyncLoadTweetIdsFromSnapshot();
+	bool SyncLoadUserIdsFromSnapshot();
+	void GetIdSnapshotData(dbidsnapshotdata &data);
+	void AsyncWriteIdSnapshot();
+	void SyncWriteIdSnapshot(sqlite3 *adb);
 
 	void AsyncSelEventLogByObj(uint64_t obj_id, int acc_db_index, std::function<void(std::deque<dbeventlogdata>)> completion);
 
@@ -450,6 +644,9 @@ template <typename E> bool DBExecStringMulti(sqlite3 *adb, const char *sql, E er
 	}
 }
 
+int64_t GetStaticSettingInt(sqlite3 *db, dbpscache &cache, const char *name, int64_t default_value);
+void SetStaticSettingInt(sqlite3 *db, dbpscache &cache, const char *name, int64_t value);
+
 db_bind_buffer<dbb_compressed> DoCompress(const void *in, size_t insize, unsigned char tag = 'Z', bool *iscompressed = nullptr);
 db_bind_buffer<dbb_uncompressed> DoDecompress(db_bind_buffer<dbb_compressed> &&in);
 db_bind_buffer<dbb_uncompressed> column_get_compressed(sqlite3_stmt* stmt, int num);
@@ -661,4 +858,30 @@ inline void bind_compressed(sqlite3_stmt* stmt, int num, const std::string &in,
 	bind_compressed(stmt, num, in.data(), in.size(), tag);
 }
 
+// Binds/reads the ETag and Last-Modified validators to/from columns num and num + 1, empty values are NULL
+inline void bind_validators(sqlite3_stmt* stmt, int num, const http_validators &v) {
+	auto bind_opt_text = [&](int col, const std::string &str) {
+		if (str.empty()) {
+			sqlite3_bind_null(stmt, col);
+		} else {
+			sqlite3_bind_text(stmt, col, str.data(), (int) str.size(), SQLITE_TRANSIENT);
+		}
+	};
+	bind_opt_text(num, v.etag);
+	bind_opt_text(num + 1, v.last_modified);
+}
+
+inline void column_get_validators(sqlite3_stmt* stmt, int num, http_validators &v) {
+	auto get_opt_text = [&](int col, std::string &str) {
+		const char *text = (const char *) sqlite3_column_text(stmt, col);
+		if (text) {
+			str.assign(text, sqlite3_column_bytes(stmt, col));
+		} else {
+			str.clear();
+		}
+	};
+	get_opt_text(num, v.etag);
+	get_opt_text(num + 1, v.last_modified);
+}
+
 #endif
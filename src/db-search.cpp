@@ -0,0 +1,393 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "db.h"
+#include "db-intl.h"
+#include "db-search.h"
+#include "json-util.h"
+#include "cfg.h"
+#include "log.h"
+#include "util.h"
+#include <utility>
+
+static const char *search_index_create_sql =
+"CREATE VIRTUAL TABLE IF NOT EXISTS tweetsearch USING fts5(text, tokenize = 'unicode61');"
+"CREATE VIRTUAL TABLE IF NOT EXISTS usersearch USING fts5(name, screenname, description, location, tokenize = 'unicode61');"
+"CREATE INDEX IF NOT EXISTS tweets_userid_index ON tweets (userid);";
+
+static const char *search_index_drop_sql =
+"DROP TABLE IF EXISTS tweetsearch;"
+"DROP TABLE IF EXISTS usersearch;"
+"DROP INDEX IF EXISTS tweets_userid_index;"
+"DELETE FROM staticsettings WHERE name == 'searchindexstage' OR name == 'searchindexlastid';";
+
+static const unsigned int search_backfill_chunk_size = 1000;
+static const unsigned int search_backfill_chunk_interval_ms = 200;
+
+enum class SEARCHINDEX_STAGE {
+	TWEETS                 = 0,
+	USERS                  = 1,
+	DONE                   = 2,
+};
+
+std::string DBSearchMakeUserQuery(const std::string &input) {
+	std::string query;
+	size_t pos = 0;
+	while (pos < input.size()) {
+		while (pos < input.size() && isspace((unsigned char) input[pos])) pos++;
+		size_t start = pos;
+		while (pos < input.size() && !isspace((unsigned char) input[pos])) pos++;
+		if (start == pos) break;
+
+		std::string word = input.substr(start, pos - start);
+		bool prefix = false;
+		while (!word.empty() && word.back() == '*') {
+			word.pop_back();
+			prefix = true;
+		}
+		if (word.empty()) continue;
+
+		if (!query.empty()) query += ' ';
+		query += '"';
+		for (char c : word) {
+			if (c == '"') query += '"';
+			query += c;
+		}
+		query += '"';
+		if (prefix) query += " *";
+	}
+	return query;
+}
+
+// Note that PCRE's \b is ASCII-only (PCRE_UCP is not used), whereas the FTS tokeniser treats non-ASCII letters as part of words
+// So \bfoo would match "éfoo" but the index would not, this is accepted as such text is rare and the result is only a missed match
+bool DBSearchTermFromRegex(const std::string &regex, DBSEARCHCOL column, db_search_term &out) {
+	const char *pos = regex.c_str();
+	const char *end = pos + regex.size();
+
+	auto consume_prefix = [&](const char *str, size_t len) -> bool {
+		if ((size_t) (end - pos) >= len && memcmp(pos, str, len) == 0) {
+			pos += len;
+			return true;
+		}
+		return false;
+	};
+
+	consume_prefix("(?i)", 4);
+	if (!consume_prefix("\\b", 2)) return false;
+
+	bool word_end = false;
+	if (end - pos >= 2 && end[-2] == '\\' && end[-1] == 'b') {
+		end -= 2;
+		word_end = true;
+	}
+
+	std::string phrase;
+	for (; pos != end; ++pos) {
+		char c = *pos;
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+			phrase += c;
+		} else if (c == ' ' && !phrase.empty() && phrase.back() != ' ' && pos + 1 != end) {
+			phrase += c;
+		} else {
+			return false;
+		}
+	}
+	if (phrase.empty()) return false;
+
+	out.column = column;
+	out.phrase = std::move(phrase);
+	out.prefix = !word_end;
+	return true;
+}
+
+static std::string SearchTermQuery(const db_search_term &term) {
+	std::string query;
+	switch (term.column) {
+		case DBSEARCHCOL::TWEET_TEXT: break;
+		case DBSEARCHCOL::USER_NAME: query = "name : "; break;
+		case DBSEARCHCOL::USER_SCREENNAME: query = "screenname : "; break;
+		case DBSEARCHCOL::USER_DESCRIPTION: query = "description : "; break;
+		case DBSEARCHCOL::USER_LOCATION: query = "location : "; break;
+	}
+	query += '"' + term.phrase + '"';
+	if (term.prefix) query += " *";
+	return query;
+}
+
+bool DBSearchTweetIds(sqlite3 *db, const std::string &fts_query, tweetidset &out) {
+	return DBBindRowExec(db, "SELECT rowid FROM tweetsearch WHERE tweetsearch MATCH ? ORDER BY rowid DESC;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_text(stmt, 1, fts_query.c_str(), fts_query.size(), SQLITE_STATIC);
+		},
+		[&](sqlite3_stmt *stmt) {
+			out.insert(out.end(), (uint64_t) sqlite3_column_int64(stmt, 0));
+		},
+		"DBSearchTweetIds"
+	);
+}
+
+bool DBSearchCandidateTweetIds(sqlite3 *db, const std::vector<db_search_term> &terms, tweetidset &out) {
+	bool ok = true;
+	for (auto &term : terms) {
+		const char *sql;
+		if (term.column == DBSEARCHCOL::TWEET_TEXT) {
+			sql = "SELECT rowid FROM tweetsearch WHERE tweetsearch MATCH ?;";
+		} else {
+			sql = "SELECT id FROM tweets WHERE userid IN (SELECT rowid FROM usersearch WHERE usersearch MATCH ?);";
+		}
+		std::string query = SearchTermQuery(term);
+		ok &= DBBindRowExec(db, sql,
+			[&](sqlite3_stmt *stmt) {
+				sqlite3_bind_text(stmt, 1, query.c_str(), query.size(), SQLITE_STATIC);
+			},
+			[&](sqlite3_stmt *stmt) {
+				out.insert((uint64_t) sqlite3_column_int64(stmt, 0));
+			},
+			"DBSearchCandidateTweetIds"
+		);
+	}
+	return ok;
+}
+
+void DBSearchIndexTweet(sqlite3 *db, dbpscache &cache, uint64_t id, const std::string &text) {
+	DBBindExec(db, cache.GetStmt(db, DBPSC_INSTWEETSEARCH), [&](sqlite3_stmt *stmt) {
+		sqlite3_bind_int64(stmt, 1, (sqlite3_int64) id);
+		sqlite3_bind_text(stmt, 2, text.c_str(), text.size(), SQLITE_STATIC);
+	}, "DBSearchIndexTweet");
+}
+
+void DBSearchIndexUser(sqlite3 *db, dbpscache &cache, uint64_t id, const dbsearchuserfields &fields) {
+	DBBindExec(db, cache.GetStmt(db, DBPSC_INSUSERSEARCH), [&](sqlite3_stmt *stmt) {
+		sqlite3_bind_int64(stmt, 1, (sqlite3_int64) id);
+		sqlite3_bind_text(stmt, 2, fields.name.c_str(), fields.name.size(), SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 3, fields.screen_name.c_str(), fields.screen_name.size(), SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, fields.description.c_str(), fields.description.size(), SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 5, fields.location.c_str(), fields.location.size(), SQLITE_STATIC);
+	}, "DBSearchIndexUser");
+}
+
+void DBSearchFillUserFields(dbsearchuserfields &fields, const userdata &ud) {
+	fields.name = ud.name;
+	fields.screen_name = ud.screen_name;
+	fields.description = ud.description;
+	fields.location = ud.location;
+}
+
+// This must select the same text as genjsonparser::ParseTweetStatics, as live inserts index tweet::text
+// Otherwise search results for long tweets would depend on whether they were indexed here or when inserted
+static void GetTweetSearchText(std::string &text, const rapidjson::Value &val) {
+	parse_util::CheckTransJsonValueDef(text, val, "text", "");
+	parse_util::CheckTransJsonValue(text, val, "full_text");
+	const rapidjson::Value &ext = val["extended_tweet"];
+	if (ext.IsObject()) {
+		parse_util::CheckTransJsonValue(text, ext, "full_text");
+	}
+}
+
+static bool SearchIndexTweetsChunk(sqlite3 *db, dbpscache &cache, uint64_t &last_id, unsigned int &indexed) {
+	std::vector<std::pair<uint64_t, std::string> > rows;
+	DBBindRowExec(db, "SELECT id, statjson FROM tweets WHERE id > ? ORDER BY id LIMIT ?;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_int64(stmt, 1, (sqlite3_int64) last_id);
+			sqlite3_bind_int(stmt, 2, search_backfill_chunk_size);
+		},
+		[&](sqlite3_stmt *stmt) {
+			last_id = (uint64_t) sqlite3_column_int64(stmt, 0);
+			rapidjson::Document dc;
+			db_bind_buffer<dbb_uncompressed> statjson = column_get_compressed_and_parse(stmt, 1, dc);
+			std::string text;
+			if (dc.IsObject()) GetTweetSearchText(text, dc);
+			rows.emplace_back(last_id, std::move(text));
+		},
+		"SearchIndexTweetsChunk (select)"
+	);
+
+	for (auto &it : rows) {
+		DBSearchIndexTweet(db, cache, it.first, it.second);
+	}
+	indexed += rows.size();
+	return rows.size() < search_backfill_chunk_size;
+}
+
+static bool SearchIndexUsersChunk(sqlite3 *db, dbpscache &cache, uint64_t &last_id, unsigned int &indexed) {
+	std::vector<std::pair<uint64_t, dbsearchuserfields> > rows;
+	DBBindRowExec(db, "SELECT id, json FROM users WHERE id > ? ORDER BY id LIMIT ?;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_int64(stmt, 1, (sqlite3_int64) last_id);
+			sqlite3_bind_int(stmt, 2, search_backfill_chunk_size);
+		},
+		[&](sqlite3_stmt *stmt) {
+			last_id = (uint64_t) sqlite3_column_int64(stmt, 0);
+			rapidjson::Document dc;
+			db_bind_buffer<dbb_uncompressed> json = column_get_compressed_and_parse(stmt, 1, dc);
+			dbsearchuserfields fields;
+			if (dc.IsObject()) {
+				parse_util::CheckTransJsonValueDef(fields.name, dc, "name", "");
+				parse_util::CheckTransJsonValueDef(fields.screen_name, dc, "screen_name", "");
+				parse_util::CheckTransJsonValueDef(fields.description, dc, "description", "");
+				parse_util::CheckTransJsonValueDef(fields.location, dc, "location", "");
+			}
+			rows.emplace_back(last_id, std::move(fields));
+		},
+		"SearchIndexUsersChunk (select)"
+	);
+
+	for (auto &it : rows) {
+		DBSearchIndexUser(db, cache, it.first, it.second);
+	}
+	indexed += rows.size();
+	return rows.size() < search_backfill_chunk_size;
+}
+
+// This must be called before the DB thread is started
+void dbconn::SyncSetupSearchIndex(sqlite3 *adb) {
+	search_index_enabled = false;
+	search_index_complete = false;
+
+	if (gc.readonlymode) {
+		// Use an existing index for searches only
+		int table_count = 0;
+		DBRowExec(adb, "SELECT COUNT(*) FROM sqlite_master WHERE type == 'table' AND (name == 'tweetsearch' OR name == 'usersearch');", [&](sqlite3_stmt *stmt) {
+			table_count = sqlite3_column_int(stmt, 0);
+		}, "dbconn::SyncSetupSearchIndex (table count)");
+		if (table_count == 2 && gc.dbsearchindex) {
+			search_index_enabled = true;
+			search_index_complete = (GetStaticSettingInt(adb, cache, "searchindexstage", 0) == (int64_t) SEARCHINDEX_STAGE::DONE);
+		}
+	} else if (!gc.dbsearchindex) {
+		DBExecStringMulti(adb, search_index_drop_sql, "dbconn::SyncSetupSearchIndex (drop)");
+	} else if (!DBExecStringMulti(adb, search_index_create_sql, "dbconn::SyncSetupSearchIndex (create)")) {
+		LogMsgFormat(LOGT::DBERR, "dbconn::SyncSetupSearchIndex: could not create search index, SQLite may have been built without FTS5");
+	} else {
+		search_index_enabled = true;
+		search_index_complete = (GetStaticSettingInt(adb, cache, "searchindexstage", 0) == (int64_t) SEARCHINDEX_STAGE::DONE);
+	}
+
+	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncSetupSearchIndex: enabled: %d, complete: %d", search_index_enabled, search_index_complete.load());
+}
+
+void dbconn::OnSearchIndexTimer(wxTimerEvent& event) {
+	AsyncSearchIndexBackfill();
+}
+
+void dbconn::ResetSearchIndexTimer(unsigned int delay_ms) {
+	if (searchindex_timer && search_index_enabled && !search_index_complete && !gc.readonlymode) {
+		searchindex_timer->Start(delay_ms, wxTIMER_ONE_SHOT);
+	}
+}
+
+// This indexes one chunk of tweets or users which were in the DB before the search index was enabled
+// Each chunk is a separate message to the DB thread, the next chunk is scheduled when the reply is received
+void dbconn::AsyncSearchIndexBackfill() {
+	if (gc.readonlymode || !search_index_enabled || search_index_complete) {
+		return;
+	}
+
+	struct search_backfill_msg : public dbfunctionmsg_callback {
+		bool done = false;
+	};
+
+	std::unique_ptr<search_backfill_msg> msg(new search_backfill_msg());
+
+	// Searches and filters do not use the index until the backfill is complete
+	msg->msg_flags |= DBSMF::NO_READ_DEPENDENCY;
+
+	msg->db_func = [](sqlite3 *db, bool &ok, dbpscache &cache, dbfunctionmsg_callback &self_) {
+		// We are now in the DB thread
+		search_backfill_msg &self = static_cast<search_backfill_msg &>(self_);
+
+		SEARCHINDEX_STAGE stage = static_cast<SEARCHINDEX_STAGE>(GetStaticSettingInt(db, cache, "searchindexstage", 0));
+		uint64_t last_id = (uint64_t) GetStaticSettingInt(db, cache, "searchindexlastid", 0);
+
+		unsigned int indexed = 0;
+		switch (stage) {
+			case SEARCHINDEX_STAGE::TWEETS:
+				if (SearchIndexTweetsChunk(db, cache, last_id, indexed)) {
+					stage = SEARCHINDEX_STAGE::USERS;
+					last_id = 0;
+				}
+				break;
+
+			case SEARCHINDEX_STAGE::USERS:
+				if (SearchIndexUsersChunk(db, cache, last_id, indexed)) {
+					stage = SEARCHINDEX_STAGE::DONE;
+					last_id = 0;
+					self.done = true;
+				}
+				break;
+
+			default:
+				self.done = true;
+				return;
+		}
+		TSLogMsgFormat(LOGT::DBTRACE, "dbconn::AsyncSearchIndexBackfill: stage: %d, last id: %" llFmtSpec "d, indexed %u rows",
+				(int) stage, (sqlite3_int64) last_id, indexed);
+
+		SetStaticSettingInt(db, cache, "searchindexstage", (int64_t) stage);
+		SetStaticSettingInt(db, cache, "searchindexlastid", (int64_t) last_id);
+	};
+
+	msg->callback_func = [this](std::unique_ptr<dbfunctionmsg_callback> self_) {
+		search_backfill_msg &self = static_cast<search_backfill_msg &>(*self_);
+		if (self.done) {
+			search_index_complete = true;
+			LogMsg(LOGT::DBINFO, "dbconn::AsyncSearchIndexBackfill: search index complete");
+		} else {
+			ResetSearchIndexTimer(search_backfill_chunk_interval_ms);
+		}
+	};
+
+	SendFunctionMsgCallback(std::move(msg));
+}
+
+// The completion is called with false if the index is still being built, in which case older tweets may be missing
+void dbconn::AsyncSearchTweets(std::string query, std::function<void(tweetidset, bool)> completion) {
+	LogMsgFormat(LOGT::DBTRACE, "dbconn::AsyncSearchTweets: start: %s", cstr(query));
+
+	FlushBatchQueue();
+
+	struct search_msg : public dbfunctionmsg_callback {
+		std::string query;
+		tweetidset ids;
+		bool complete;
+		std::function<void(tweetidset, bool)> completion;
+	};
+
+	std::unique_ptr<search_msg> msg(new search_msg());
+	msg->query = DBSearchMakeUserQuery(query);
+	msg->complete = search_index_complete;
+	msg->completion = std::move(completion);
+
+	msg->db_func = [](sqlite3 *db, bool &ok, dbpscache &cache, dbfunctionmsg_callback &self_) {
+		// We are now in the DB thread, or a DB read pool thread
+		search_msg &self = static_cast<search_msg &>(self_);
+		if (!self.query.empty()) {
+			DBSearchTweetIds(db, self.query, self.ids);
+		}
+	};
+
+	msg->callback_func = [](std::unique_ptr<dbfunctionmsg_callback> self_) {
+		search_msg &self = static_cast<search_msg &>(*self_);
+		LogMsgFormat(LOGT::DBTRACE, "dbconn::AsyncSearchTweets: got %zu results", self.ids.size());
+		self.completion(std::move(self.ids), self.complete);
+	};
+
+	SendReadFunctionMsgCallback(std::move(msg));
+}
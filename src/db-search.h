@@ -0,0 +1,71 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#ifndef HGUARD_SRC_DB_SEARCH
+#define HGUARD_SRC_DB_SEARCH
+
+#include "univdefs.h"
+#include "tweetidset.h"
+#include <string>
+#include <vector>
+
+struct sqlite3;
+struct dbpscache;
+struct userdata;
+struct dbsearchuserfields;
+
+// Optional full-text search index, this is a pair of FTS5 tables:
+// tweetsearch(text): rowid is the tweet ID
+// usersearch(name, screenname, description, location): rowid is the user ID
+// Rows are added as tweets/users are written, existing rows are indexed in the background by dbconn::AsyncSearchIndexBackfill
+// The index is dropped at startup if it is disabled, such that it is rebuilt from scratch if it is re-enabled later
+
+enum class DBSEARCHCOL {
+	TWEET_TEXT,
+	USER_NAME,
+	USER_SCREENNAME,
+	USER_DESCRIPTION,
+	USER_LOCATION,
+};
+
+struct db_search_term {
+	DBSEARCHCOL column;
+	std::string phrase;    // ASCII alphanumeric words separated by single spaces
+	bool prefix;           // true if the last word is a prefix
+};
+
+// Each word is quoted, a trailing * on a word makes it a prefix search, all words must match
+std::string DBSearchMakeUserQuery(const std::string &input);
+
+// Returns true if the regex is a word-anchored literal or prefix, such as \bfoo\b, \bfoo bar or (?i)\bfoo
+// Anything else cannot be answered from a token index, as the regex could match within a word
+bool DBSearchTermFromRegex(const std::string &regex, DBSEARCHCOL column, db_search_term &out);
+
+// These may be called from the DB thread or a DB read pool thread
+bool DBSearchTweetIds(sqlite3 *db, const std::string &fts_query, tweetidset &out);
+
+// The output is the union of all terms, this is a superset of the tweets which the corresponding regexes would match
+bool DBSearchCandidateTweetIds(sqlite3 *db, const std::vector<db_search_term> &terms, tweetidset &out);
+
+// DB thread only
+void DBSearchIndexTweet(sqlite3 *db, dbpscache &cache, uint64_t id, const std::string &text);
+void DBSearchIndexUser(sqlite3 *db, dbpscache &cache, uint64_t id, const dbsearchuserfields &fields);
+
+void DBSearchFillUserFields(dbsearchuserfields &fields, const userdata &ud);
+
+#endif
@@ -0,0 +1,344 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "db.h"
+#include "db-intl.h"
+#include "alldata.h"
+#include "cfg.h"
+#include "log.h"
+#include "util.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <wx/filefn.h>
+
+// ID snapshot file format
+// This is a cache of the ID sets which are otherwise read in from the DB at startup, it is not portable between machines
+// All integers are in native byte order, ID arrays are 8-byte aligned and in descending order, such that they can be used directly from a mapping
+//
+// Header
+// Section table: snapshot_section * section_count
+// ID arrays
+//
+// The snapshot is only used if its generation matches the idsnapshotgeneration static setting,
+// and its session matches the value of the dirty flag at startup (0 if the DB was cleanly closed).
+// The generation is incremented in the same transaction which commits the DB state which the snapshot was taken after.
+
+static const char snapshot_magic[8] = { 'R', 'T', 'C', 'I', 'D', 'S', 'N', 'P' };
+static const uint32_t snapshot_byte_order_mark = 0x01020304;
+static const uint32_t snapshot_version = 1;
+
+static const uint64_t snapshot_flag_has_users = 1<<0;
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t byte_order_mark;
+	uint32_t version;
+	uint64_t generation;
+	uint64_t session;
+	uint64_t flags;
+	uint64_t section_count;
+};
+
+struct snapshot_section {
+	char name[48];
+	uint64_t offset;
+	uint64_t count;
+};
+
+void dbidsnapshotdata::AddSection(std::string name, const tweetidset &set) {
+	sections.emplace_back();
+	sections.back().first = std::move(name);
+	sections.back().second.assign(set.begin(), set.end());
+}
+
+bool dbidsnapshot::Open(const std::string &filename, uint64_t generation, uint64_t session) {
+	if (!file.Open(filename)) {
+		return false;
+	}
+
+	auto fail = [&](const char *reason) -> bool {
+		LogMsgFormat(LOGT::DBINFO, "dbidsnapshot::Open: Not using snapshot file: %s", reason);
+		file.Close();
+		return false;
+	};
+
+	if (file.size() < sizeof(snapshot_header)) {
+		return fail("too short");
+	}
+	const snapshot_header *header = reinterpret_cast<const snapshot_header *>(file.data());
+	if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header->byte_order_mark != snapshot_byte_order_mark) {
+		return fail("bad header");
+	}
+	if (header->version != snapshot_version) {
+		return fail("wrong version");
+	}
+	if (header->generation != generation) {
+		return fail("generation mismatch");
+	}
+	if (header->session != session) {
+		return fail("dirty flag mismatch");
+	}
+	if (header->section_count > (file.size() - sizeof(snapshot_header)) / sizeof(snapshot_section)) {
+		return fail("bad section count");
+	}
+
+	const snapshot_section *section_table = reinterpret_cast<const snapshot_section *>(file.data() + sizeof(snapshot_header));
+	for (uint64_t i = 0; i < header->section_count; i++) {
+		const snapshot_section &s = section_table[i];
+		if (s.name[sizeof(s.name) - 1] != 0 || s.offset % sizeof(uint64_t) || s.offset > file.size() ||
+				s.count > (file.size() - s.offset) / sizeof(uint64_t)) {
+			return fail("bad section");
+		}
+		sections[std::string(s.name)] = std::make_pair(reinterpret_cast<const uint64_t *>(file.data() + s.offset), (size_t) s.count);
+	}
+
+	has_users = header->flags & snapshot_flag_has_users;
+	return true;
+}
+
+// Returns false if the section is missing or invalid, in which case out is left empty
+bool dbidsnapshot::LoadSet(const std::string &name, tweetidset &out) const {
+	out.clear();
+
+	auto it = sections.find(name);
+	if (it == sections.end()) {
+		return false;
+	}
+
+	const uint64_t *ids = it->second.first;
+	size_t count = it->second.second;
+	for (size_t i = 0; i < count; i++) {
+		if (i && ids[i] >= ids[i - 1]) {
+			LogMsgFormat(LOGT::DBERR, "dbidsnapshot::LoadSet: Section %s is not in descending order", cstr(name));
+			out.clear();
+			return false;
+		}
+
+		// The IDs are in set order, so this is an append, which does not need to search the tree
+		out.insert(out.end(), ids[i]);
+	}
+	return true;
+}
+
+static uint64_t GetSnapshotGeneration(sqlite3 *db, dbpscache &cache) {
+	uint64_t generation = 0;
+	DBBindRowExec(db, cache.GetStmt(db, DBPSC_SELSTATICSETTING),
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_text(stmt, 1, "idsnapshotgeneration", -1, SQLITE_STATIC);
+		},
+		[&](sqlite3_stmt *stmt) {
+			generation = (uint64_t) sqlite3_column_int64(stmt, 0);
+		},
+		"GetSnapshotGeneration"
+	);
+	return generation;
+}
+
+// This writes the snapshot file and increments the generation in the DB
+// This should be called inside the transaction which commits the state that the snapshot corresponds to
+// If the transaction is not committed, the snapshot is not used, as the generation does not match
+bool DBWriteIdSnapshot(sqlite3 *db, dbpscache &cache, const std::string &filename, const dbidsnapshotdata &data, uint64_t session, bool has_users) {
+	uint64_t generation = GetSnapshotGeneration(db, cache) + 1;
+
+	snapshot_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+	header.byte_order_mark = snapshot_byte_order_mark;
+	header.version = snapshot_version;
+	header.generation = generation;
+	header.session = session;
+	header.flags = has_users ? snapshot_flag_has_users : 0;
+	header.section_count = data.sections.size();
+
+	std::vector<snapshot_section> section_table(data.sections.size());
+	uint64_t offset = sizeof(snapshot_header) + (sizeof(snapshot_section) * section_table.size());
+	for (size_t i = 0; i < data.sections.size(); i++) {
+		snapshot_section &s = section_table[i];
+		memset(&s, 0, sizeof(s));
+		strncpy(s.name, data.sections[i].first.c_str(), sizeof(s.name) - 1);
+		s.offset = offset;
+		s.count = data.sections[i].second.size();
+		offset += s.count * sizeof(uint64_t);
+	}
+
+	std::string tmp_filename = filename + ".tmp";
+	FILE *f = fopen(tmp_filename.c_str(), "wb");
+	if (!f) {
+		TSLogMsgFormat(LOGT::DBERR, "DBWriteIdSnapshot: Could not open %s for writing", cstr(tmp_filename));
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (ok && !section_table.empty()) {
+		ok = fwrite(section_table.data(), sizeof(snapshot_section), section_table.size(), f) == section_table.size();
+	}
+	for (auto &it : data.sections) {
+		if (ok && !it.second.empty()) {
+			ok = fwrite(it.second.data(), sizeof(uint64_t), it.second.size(), f) == it.second.size();
+		}
+	}
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok || !wxRenameFile(wxstrstd(tmp_filename), wxstrstd(filename), true)) {
+		TSLogMsgFormat(LOGT::DBERR, "DBWriteIdSnapshot: Could not write %s", cstr(filename));
+		remove(tmp_filename.c_str());
+		return false;
+	}
+
+	DBBindExec(db, cache.GetStmt(db, DBPSC_INSSTATICSETTING),
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_text(stmt, 1, "idsnapshotgeneration", -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, 2, (sqlite3_int64) generation);
+		},
+		"DBWriteIdSnapshot (generation)"
+	);
+
+	TSLogMsgFormat(LOGT::DBINFO, "DBWriteIdSnapshot: wrote generation %" llFmtSpec "u, %zu sections, %" llFmtSpec "u bytes",
+			(unsigned long long) generation, data.sections.size(), (unsigned long long) offset);
+	return true;
+}
+
+// Returns 0 if the dirty flag is not set
+uint64_t dbconn::SyncReadDirtyFlag(sqlite3 *adb) {
+	uint64_t value = 0;
+	DBBindRowExec(adb, cache.GetStmt(adb, DBPSC_SELSTATICSETTING),
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_text(stmt, 1, "dirtyflag", -1, SQLITE_STATIC);
+		},
+		[&](sqlite3_stmt *stmt) {
+			value = (uint64_t) sqlite3_column_int64(stmt, 0);
+		},
+		"dbconn::SyncReadDirtyFlag"
+	);
+	return value;
+}
+
+// This must be called before SyncReadInAllUserIDs and SyncReadInAllTweetIDs
+void dbconn::SyncReadInIdSnapshot(sqlite3 *adb) {
+	idsnapshot.reset();
+	if (!gc.dbidsnapshot || gc.rescan_tweets_table) {
+		return;
+	}
+
+	std::unique_ptr<dbidsnapshot> snapshot(new dbidsnapshot);
+	if (snapshot->Open(idsnapshot_filename, GetSnapshotGeneration(adb, cache), startup_dirty_flag)) {
+		LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInIdSnapshot: using snapshot file, has users: %d", snapshot->has_users);
+		idsnapshot = std::move(snapshot);
+	}
+}
+
+// Returns false if the snapshot is not usable, in which case nothing is loaded
+bool dbconn::SyncLoadTweetIdsFromSnapshot() {
+	if (!idsnapshot) {
+		return false;
+	}
+
+	tweetidset tweet_ids;
+	if (!idsnapshot->LoadSet("tweets", tweet_ids)) {
+		return false;
+	}
+	cached_id_sets cids;
+	bool ok = true;
+	cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
+		if (ok && !idsnapshot->LoadSet(name, cids.*mptr)) {
+			ok = false;
+		}
+	});
+	if (!ok) {
+		return false;
+	}
+
+	ad.unloaded_db_tweet_ids = std::move(tweet_ids);
+	ad.cids = std::move(cids);
+	return true;
+}
+
+// Returns false if the snapshot is not usable or does not include users, in which case nothing is loaded
+bool dbconn::SyncLoadUserIdsFromSnapshot() {
+	if (!idsnapshot || !idsnapshot->has_users) {
+		return false;
+	}
+
+	useridset user_ids;
+	if (!idsnapshot->LoadSet("users", user_ids)) {
+		return false;
+	}
+	unloaded_user_ids = std::move(user_ids);
+	return true;
+}
+
+void dbconn::GetIdSnapshotData(dbidsnapshotdata &data) {
+	if (ad.loaded_db_tweet_ids.empty()) {
+		data.AddSection("tweets", ad.unloaded_db_tweet_ids);
+	} else {
+		// This is the same as MergeTweetIdSets, without modifying either set
+		data.sections.emplace_back();
+		data.sections.back().first = "tweets";
+		std::vector<uint64_t> &ids = data.sections.back().second;
+		ids.reserve(ad.unloaded_db_tweet_ids.size() + ad.loaded_db_tweet_ids.size());
+		std::set_union(ad.unloaded_db_tweet_ids.begin(), ad.unloaded_db_tweet_ids.end(), ad.loaded_db_tweet_ids.begin(), ad.loaded_db_tweet_ids.end(),
+				std::back_inserter(ids), std::greater<uint64_t>());
+	}
+	cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
+		data.AddSection(name, ad.cids.*mptr);
+	});
+}
+
+// This is called from AsyncWriteBackState, after the messages which write back the state
+// The snapshot does not include users, as users inserted after this point would be missing after an unclean shutdown
+void dbconn::AsyncWriteIdSnapshot() {
+	if (!gc.dbidsnapshot || (dbc_flags & DBCF::TWEET_ID_CACHE_INVALID)) {
+		return;
+	}
+
+	std::shared_ptr<dbidsnapshotdata> data = std::make_shared<dbidsnapshotdata>();
+	GetIdSnapshotData(*data);
+
+	std::unique_ptr<dbfunctionmsg> msg(new dbfunctionmsg);
+	msg->msg_flags |= DBSMF::NO_READ_DEPENDENCY;
+	std::string filename = idsnapshot_filename;
+	uint64_t session = session_dirty_flag;
+	msg->funclist.emplace_back([data, filename, session](sqlite3 *db, bool &ok, dbpscache &cache) {
+		DBWriteIdSnapshot(db, cache, filename, *data, session, false);
+	});
+	SendMessage(std::move(msg));
+}
+
+// This is called from DeInit, after MergeTweetIdSets, and inside the transaction which clears the dirty flag
+void dbconn::SyncWriteIdSnapshot(sqlite3 *adb) {
+	if (!gc.dbidsnapshot || (dbc_flags & DBCF::TWEET_ID_CACHE_INVALID)) {
+		remove(idsnapshot_filename.c_str());
+		return;
+	}
+
+	dbidsnapshotdata data;
+	GetIdSnapshotData(data);
+
+	// All users have been written back at this point, so read the IDs back from the DB
+	data.sections.emplace_back();
+	data.sections.back().first = "users";
+	std::vector<uint64_t> &user_ids = data.sections.back().second;
+	DBRowExec(adb, "SELECT id FROM users ORDER BY id DESC;", [&](sqlite3_stmt *getstmt) {
+		user_ids.push_back((uint64_t) sqlite3_column_int64(getstmt, 0));
+	}, "dbconn::SyncWriteIdSnapshot (users)");
+
+	DBWriteIdSnapshot(adb, cache, idsnapshot_filename, data, 0, true);
+}
@@ -0,0 +1,609 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "db.h"
+#include "db-intl.h"
+#include "db-zstd.h"
+#include "cfg.h"
+#include "log.h"
+#include "util.h"
+#include "retcon.h"
+#include <mutex>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#ifdef USE_ZSTD
+
+static const int zstd_compression_level = 9;
+
+struct zstd_dict {
+	std::string data;
+	ZSTD_CDict *cdict = nullptr;
+	ZSTD_DDict *ddict = nullptr;
+
+	~zstd_dict() {
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+	}
+};
+
+struct zstd_dict_set {
+	std::mutex lock;
+	std::map<unsigned int, std::shared_ptr<zstd_dict> > dicts;
+	unsigned int current = 0;
+};
+
+static zstd_dict_set &GetDictSet() {
+	static zstd_dict_set dict_set;
+	return dict_set;
+}
+
+static std::shared_ptr<zstd_dict> GetDict(unsigned int version) {
+	zstd_dict_set &ds = GetDictSet();
+	std::lock_guard<std::mutex> guard(ds.lock);
+	auto it = ds.dicts.find(version);
+	if (it != ds.dicts.end()) {
+		return it->second;
+	} else {
+		return {};
+	}
+}
+
+// Compression/decompression contexts are re-used for all blobs in each thread
+struct zstd_thread_contexts {
+	ZSTD_CCtx *cctx = nullptr;
+	ZSTD_DCtx *dctx = nullptr;
+
+	ZSTD_CCtx *GetCCtx() {
+		if (!cctx) {
+			cctx = ZSTD_createCCtx();
+		}
+		return cctx;
+	}
+
+	ZSTD_DCtx *GetDCtx() {
+		if (!dctx) {
+			dctx = ZSTD_createDCtx();
+		}
+		return dctx;
+	}
+
+	~zstd_thread_contexts() {
+		ZSTD_freeCCtx(cctx);
+		ZSTD_freeDCtx(dctx);
+	}
+};
+
+static thread_local zstd_thread_contexts contexts;
+
+bool DBZstdAvailable() {
+	return true;
+}
+
+bool DBZstdCompress(const void *in, size_t insize, db_bind_buffer<dbb_compressed> &out) {
+	unsigned int version;
+	std::shared_ptr<zstd_dict> dict;
+	{
+		zstd_dict_set &ds = GetDictSet();
+		std::lock_guard<std::mutex> guard(ds.lock);
+		version = ds.current;
+		if (!version) {
+			return false;
+		}
+		dict = ds.dicts[version];
+	}
+
+	size_t maxsize = ZSTD_compressBound(insize);
+	db_bind_buffer<dbb_compressed> buffer;
+	buffer.allocate(maxsize + DB_ZSTD_HEADERSIZE);
+	unsigned char *data = reinterpret_cast<unsigned char *>(buffer.mutable_data());
+	data[0] = DB_ZSTD_TAG;
+	data[1] = (insize >> 24) & 0xFF;
+	data[2] = (insize >> 16) & 0xFF;
+	data[3] = (insize >> 8) & 0xFF;
+	data[4] = (insize >> 0) & 0xFF;
+	data[5] = (version >> 8) & 0xFF;
+	data[6] = (version >> 0) & 0xFF;
+	size_t res = ZSTD_compress_usingCDict(contexts.GetCCtx(), data + DB_ZSTD_HEADERSIZE, maxsize, in, insize, dict->cdict);
+	if (ZSTD_isError(res)) {
+		TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdCompress: error: %s", cstr(ZSTD_getErrorName(res)));
+		return false;
+	}
+	buffer.data_size = DB_ZSTD_HEADERSIZE + res;
+	out = std::move(buffer);
+	return true;
+}
+
+bool DBZstdDecompress(const unsigned char *in, size_t insize, db_bind_buffer<dbb_uncompressed> &out) {
+	if (insize < DB_ZSTD_HEADERSIZE) {
+		TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdDecompress: blob too short: %zu", insize);
+		return false;
+	}
+
+	size_t outsize = 0;
+	for (unsigned int i = 1; i < 5; i++) {
+		outsize <<= 8;
+		outsize += in[i];
+	}
+	unsigned int version = (in[5] << 8) | in[6];
+
+	std::shared_ptr<zstd_dict> dict;
+	if (version) {
+		dict = GetDict(version);
+		if (!dict) {
+			TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdDecompress: unknown dictionary version: %u", version);
+			return false;
+		}
+	}
+
+	out.allocate_nt(outsize);
+	void *data = out.mutable_data();
+	size_t res;
+	if (dict) {
+		res = ZSTD_decompress_usingDDict(contexts.GetDCtx(), data, outsize, in + DB_ZSTD_HEADERSIZE, insize - DB_ZSTD_HEADERSIZE, dict->ddict);
+	} else {
+		res = ZSTD_decompressDCtx(contexts.GetDCtx(), data, outsize, in + DB_ZSTD_HEADERSIZE, insize - DB_ZSTD_HEADERSIZE);
+	}
+	if (ZSTD_isError(res)) {
+		TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdDecompress: error: %s", cstr(ZSTD_getErrorName(res)));
+		out = db_bind_buffer<dbb_uncompressed>();
+		return false;
+	} else if (res != outsize) {
+		TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdDecompress: size mismatch: expected %zu, got %zu", outsize, res);
+		out = db_bind_buffer<dbb_uncompressed>();
+		return false;
+	}
+	return true;
+}
+
+void DBZstdAddDictionary(unsigned int version, std::string dict) {
+	std::shared_ptr<zstd_dict> d = std::make_shared<zstd_dict>();
+	d->data = std::move(dict);
+	d->cdict = ZSTD_createCDict(d->data.data(), d->data.size(), zstd_compression_level);
+	d->ddict = ZSTD_createDDict(d->data.data(), d->data.size());
+	if (!d->cdict || !d->ddict) {
+		TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdAddDictionary: could not load dictionary version: %u", version);
+		return;
+	}
+
+	zstd_dict_set &ds = GetDictSet();
+	std::lock_guard<std::mutex> guard(ds.lock);
+	ds.dicts[version] = std::move(d);
+}
+
+void DBZstdSetCurrentDictionary(unsigned int version) {
+	zstd_dict_set &ds = GetDictSet();
+	std::lock_guard<std::mutex> guard(ds.lock);
+	if (!version || ds.dicts.count(version)) {
+		ds.current = version;
+	}
+}
+
+unsigned int DBZstdGetCurrentDictionary() {
+	zstd_dict_set &ds = GetDictSet();
+	std::lock_guard<std::mutex> guard(ds.lock);
+	return ds.current;
+}
+
+bool DBZstdTrainDictionary(const std::vector<std::string> &samples, size_t dict_capacity, std::string &dict_out) {
+	std::string sample_buffer;
+	std::vector<size_t> sample_sizes;
+	for (auto &it : samples) {
+		sample_buffer += it;
+		sample_sizes.push_back(it.size());
+	}
+
+	dict_out.resize(dict_capacity);
+	size_t res = ZDICT_trainFromBuffer(&dict_out[0], dict_capacity, sample_buffer.data(), sample_sizes.data(), sample_sizes.size());
+	if (ZDICT_isError(res)) {
+		TSLogMsgFormat(LOGT::ZLIBERR, "DBZstdTrainDictionary: error: %s", cstr(ZDICT_getErrorName(res)));
+		dict_out.clear();
+		return false;
+	}
+	dict_out.resize(res);
+	return true;
+}
+
+#else
+
+bool DBZstdAvailable() {
+	return false;
+}
+
+bool DBZstdCompress(const void *in, size_t insize, db_bind_buffer<dbb_compressed> &out) {
+	return false;
+}
+
+bool DBZstdDecompress(const unsigned char *in, size_t insize, db_bind_buffer<dbb_uncompressed> &out) {
+	TSLogMsg(LOGT::ZLIBERR, "DBZstdDecompress: retcon was built without zstd support, cannot decompress blob");
+	return false;
+}
+
+void DBZstdAddDictionary(unsigned int version, std::string dict) { }
+
+void DBZstdSetCurrentDictionary(unsigned int version) { }
+
+unsigned int DBZstdGetCurrentDictionary() {
+	return 0;
+}
+
+bool DBZstdTrainDictionary(const std::vector<std::string> &samples, size_t dict_capacity, std::string &dict_out) {
+	return false;
+}
+
+#endif
+
+// Returns true if the blob is a zstd blob using the current dictionary
+bool DBZstdIsBlobCurrent(const unsigned char *in, size_t insize) {
+	if (insize < DB_ZSTD_HEADERSIZE || in[0] != DB_ZSTD_TAG) {
+		return false;
+	}
+	unsigned int version = (in[5] << 8) | in[6];
+	return version == DBZstdGetCurrentDictionary();
+}
+
+// Background dictionary training and recompression of existing rows
+
+static const size_t zstd_dict_capacity = 112640;
+static const unsigned int zstd_train_tweet_samples = 4000;
+static const unsigned int zstd_train_user_samples = 2000;
+static const unsigned int zstd_recompress_chunk_size = 1000;
+static const unsigned int zstd_recompress_chunk_interval_ms = 500;
+static const unsigned int zstd_retry_interval_ms = 3600 * 1000;
+
+enum class ZSTD_RECOMPRESS_STAGE {
+	TWEETS                 = 0,
+	USERS                  = 1,
+	DONE                   = 2,
+};
+
+// Returns true if this blob should be re-encoded using the current dictionary
+static bool ZstdBlobNeedsRecompress(sqlite3_stmt *stmt, int column) {
+	const unsigned char *blob = static_cast<const unsigned char *>(sqlite3_column_blob(stmt, column));
+	size_t size = sqlite3_column_bytes(stmt, column);
+	if (size < DB_ZSTD_HEADERSIZE) {
+		return false;
+	}
+	return blob[0] == 'J' || (blob[0] == DB_ZSTD_TAG && !DBZstdIsBlobCurrent(blob, size));
+}
+
+// This reads the most recent rows to use as dictionary training samples
+// Returns false if there are too few samples to train a useful dictionary
+static bool ZstdReadTrainingSamples(sqlite3 *db, std::vector<std::string> &samples) {
+	auto add_sample = [&](sqlite3_stmt *stmt, int column) {
+		db_bind_buffer<dbb_uncompressed> buffer = column_get_compressed(stmt, column);
+		if (buffer.data_size) {
+			samples.emplace_back(buffer.data, buffer.data_size);
+		}
+	};
+
+	DBBindRowExec(db, "SELECT statjson, dynjson FROM tweets ORDER BY id DESC LIMIT ?;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_int(stmt, 1, zstd_train_tweet_samples);
+		},
+		[&](sqlite3_stmt *stmt) {
+			add_sample(stmt, 0);
+			add_sample(stmt, 1);
+		},
+		"ZstdReadTrainingSamples (tweets)"
+	);
+	DBBindRowExec(db, "SELECT json FROM users ORDER BY id DESC LIMIT ?;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_int(stmt, 1, zstd_train_user_samples);
+		},
+		[&](sqlite3_stmt *stmt) {
+			add_sample(stmt, 0);
+		},
+		"ZstdReadTrainingSamples (users)"
+	);
+
+	if (samples.size() < 1000) {
+		TSLogMsgFormat(LOGT::DBINFO, "ZstdReadTrainingSamples: too few samples to train dictionary: %zu", samples.size());
+		return false;
+	}
+	return true;
+}
+
+// This stores a newly trained dictionary under the next unused version, and makes it current
+static bool ZstdStoreNewDictionary(sqlite3 *db, dbpscache &cache, std::string dict) {
+	unsigned int version = 1;
+	DBRowExec(db, "SELECT name FROM staticsettings WHERE name GLOB 'zstddict_*';", [&](sqlite3_stmt *stmt) {
+		const char *name = (const char *) sqlite3_column_text(stmt, 0);
+		if (name) {
+			unsigned int existing = strtoul(name + strlen("zstddict_"), nullptr, 10);
+			if (existing >= version) {
+				version = existing + 1;
+			}
+		}
+	}, "ZstdStoreNewDictionary (get versions)");
+
+	std::string name = string_format("zstddict_%u", version);
+	sqlite3_stmt *stmt = cache.GetStmt(db, DBPSC_INSSTATICSETTING);
+	sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_blob(stmt, 2, dict.data(), dict.size(), SQLITE_TRANSIENT);
+	if (!DBExec(db, stmt, "ZstdStoreNewDictionary (store)")) {
+		return false;
+	}
+	SetStaticSettingInt(db, cache, "zstddictcurrent", version);
+
+	TSLogMsgFormat(LOGT::DBINFO, "ZstdStoreNewDictionary: stored dictionary version %u, %zu bytes", version, dict.size());
+
+	DBZstdAddDictionary(version, std::move(dict));
+	DBZstdSetCurrentDictionary(version);
+	return true;
+}
+
+// Returns true if the end of the table has been reached
+static bool ZstdRecompressTweetsChunk(sqlite3 *db, uint64_t &last_id, unsigned int &recompressed) {
+	struct row {
+		uint64_t id;
+		db_bind_buffer_persistent<dbb_uncompressed> statjson;
+		db_bind_buffer_persistent<dbb_uncompressed> dynjson;
+	};
+	std::vector<row> rows;
+	unsigned int count = 0;
+
+	DBBindRowExec(db, "SELECT id, statjson, dynjson FROM tweets WHERE id > ? ORDER BY id LIMIT ?;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_int64(stmt, 1, (sqlite3_int64) last_id);
+			sqlite3_bind_int(stmt, 2, zstd_recompress_chunk_size);
+		},
+		[&](sqlite3_stmt *stmt) {
+			count++;
+			last_id = (uint64_t) sqlite3_column_int64(stmt, 0);
+			if (ZstdBlobNeedsRecompress(stmt, 1) || ZstdBlobNeedsRecompress(stmt, 2)) {
+				rows.emplace_back();
+				row &r = rows.back();
+				r.id = last_id;
+				r.statjson = column_get_compressed(stmt, 1);
+				r.dynjson = column_get_compressed(stmt, 2);
+			}
+		},
+		"ZstdRecompressTweetsChunk (select)"
+	);
+
+	auto s = DBInitialiseSql(db, "UPDATE tweets SET statjson = ?, dynjson = ? WHERE id == ?;");
+	for (auto &r : rows) {
+		DBBindExec(db, s.stmt(),
+			[&](sqlite3_stmt *stmt) {
+				bind_compressed(stmt, 1, std::move(r.statjson), 'J');
+				bind_compressed(stmt, 2, std::move(r.dynjson), 'J');
+				sqlite3_bind_int64(stmt, 3, (sqlite3_int64) r.id);
+			},
+			"ZstdRecompressTweetsChunk (update)"
+		);
+	}
+	recompressed += rows.size();
+	return count < zstd_recompress_chunk_size;
+}
+
+// Returns true if the end of the table has been reached
+static bool ZstdRecompressUsersChunk(sqlite3 *db, uint64_t &last_id, unsigned int &recompressed) {
+	struct row {
+		uint64_t id;
+		db_bind_buffer_persistent<dbb_uncompressed> json;
+	};
+	std::vector<row> rows;
+	unsigned int count = 0;
+
+	DBBindRowExec(db, "SELECT id, json FROM users WHERE id > ? ORDER BY id LIMIT ?;",
+		[&](sqlite3_stmt *stmt) {
+			sqlite3_bind_int64(stmt, 1, (sqlite3_int64) last_id);
+			sqlite3_bind_int(stmt, 2, zstd_recompress_chunk_size);
+		},
+		[&](sqlite3_stmt *stmt) {
+			count++;
+			last_id = (uint64_t) sqlite3_column_int64(stmt, 0);
+			if (ZstdBlobNeedsRecompress(stmt, 1)) {
+				rows.emplace_back();
+				row &r = rows.back();
+				r.id = last_id;
+				r.json = column_get_compressed(stmt, 1);
+			}
+		},
+		"ZstdRecompressUsersChunk (select)"
+	);
+
+	auto s = DBInitialiseSql(db, "UPDATE users SET json = ? WHERE id == ?;");
+	for (auto &r : rows) {
+		DBBindExec(db, s.stmt(),
+			[&](sqlite3_stmt *stmt) {
+				bind_compressed(stmt, 1, std::move(r.json), 'J');
+				sqlite3_bind_int64(stmt, 2, (sqlite3_int64) r.id);
+			},
+			"ZstdRecompressUsersChunk (update)"
+		);
+	}
+	recompressed += rows.size();
+	return count < zstd_recompress_chunk_size;
+}
+
+// This must be called after the config has been read in
+void dbconn::SyncReadInZstdDictionaries(sqlite3 *adb) {
+	unsigned int count = 0;
+	DBRowExec(adb, "SELECT name, value FROM staticsettings WHERE name GLOB 'zstddict_*';", [&](sqlite3_stmt *stmt) {
+		const char *name = (const char *) sqlite3_column_text(stmt, 0);
+		if (!name) {
+			return;
+		}
+		unsigned int version = strtoul(name + strlen("zstddict_"), nullptr, 10);
+		const char *blob = static_cast<const char *>(sqlite3_column_blob(stmt, 1));
+		int size = sqlite3_column_bytes(stmt, 1);
+		if (version && blob && size > 0) {
+			DBZstdAddDictionary(version, std::string(blob, size));
+			count++;
+		}
+	}, "dbconn::SyncReadInZstdDictionaries");
+
+	unsigned int current = 0;
+	if (gc.dbzstd) {
+		current = GetStaticSettingInt(adb, cache, "zstddictcurrent", 0);
+		DBZstdSetCurrentDictionary(current);
+	}
+
+	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInZstdDictionaries: read %u dictionaries, current: %u, zstd available: %d",
+			count, DBZstdGetCurrentDictionary(), DBZstdAvailable());
+}
+
+void dbconn::OnZstdMaintenanceTimer(wxTimerEvent& event) {
+	AsyncZstdMaintenance();
+}
+
+void dbconn::ResetZstdMaintenanceTimer(unsigned int delay_ms) {
+	if (zstdmaintenance_timer && !gc.readonlymode && gc.dbzstd && DBZstdAvailable()) {
+		zstdmaintenance_timer->Start(delay_ms, wxTIMER_ONE_SHOT);
+	}
+}
+
+// This trains a dictionary if there isn't one, and then recompresses one chunk of existing rows with it
+// Each chunk is a separate message to the DB thread, the next chunk is scheduled when the reply is received
+// Training is slow, so only the samples are read on the DB thread, the dictionary is trained on the thread pool
+// and then stored by AsyncZstdStoreDictionary before recompression starts
+void dbconn::AsyncZstdMaintenance() {
+	if (gc.readonlymode || !gc.dbzstd || !DBZstdAvailable()) {
+		return;
+	}
+
+	struct zstd_maintenance_msg : public dbfunctionmsg_callback {
+		bool failed = false;
+		bool done = false;
+		std::vector<std::string> training_samples;    // non-empty if a dictionary needs to be trained
+	};
+
+	std::unique_ptr<zstd_maintenance_msg> msg(new zstd_maintenance_msg());
+
+	// Nothing read by the read pool depends on this having been done
+	msg->msg_flags |= DBSMF::NO_READ_DEPENDENCY;
+
+	msg->db_func = [](sqlite3 *db, bool &ok, dbpscache &cache, dbfunctionmsg_callback &self_) {
+		// We are now in the DB thread
+		zstd_maintenance_msg &self = static_cast<zstd_maintenance_msg &>(self_);
+
+		if (!DBZstdGetCurrentDictionary()) {
+			if (!ZstdReadTrainingSamples(db, self.training_samples)) {
+				self.training_samples.clear();
+				self.failed = true;
+			}
+			return;
+		}
+
+		unsigned int version = DBZstdGetCurrentDictionary();
+		ZSTD_RECOMPRESS_STAGE stage = static_cast<ZSTD_RECOMPRESS_STAGE>(GetStaticSettingInt(db, cache, "zstdrecompressstage", 0));
+		uint64_t last_id = (uint64_t) GetStaticSettingInt(db, cache, "zstdrecompresslastid", 0);
+		if ((unsigned int) GetStaticSettingInt(db, cache, "zstdrecompressversion", 0) != version) {
+			// New dictionary, start again
+			stage = ZSTD_RECOMPRESS_STAGE::TWEETS;
+			last_id = 0;
+			SetStaticSettingInt(db, cache, "zstdrecompressversion", version);
+		}
+
+		unsigned int recompressed = 0;
+		switch (stage) {
+			case ZSTD_RECOMPRESS_STAGE::TWEETS:
+				if (ZstdRecompressTweetsChunk(db, last_id, recompressed)) {
+					stage = ZSTD_RECOMPRESS_STAGE::USERS;
+					last_id = 0;
+				}
+				break;
+
+			case ZSTD_RECOMPRESS_STAGE::USERS:
+				if (ZstdRecompressUsersChunk(db, last_id, recompressed)) {
+					stage = ZSTD_RECOMPRESS_STAGE::DONE;
+					last_id = 0;
+					TSLogMsgFormat(LOGT::DBINFO, "dbconn::AsyncZstdMaintenance: recompression with dictionary version %u complete", version);
+				}
+				break;
+
+			default:
+				self.done = true;
+				return;
+		}
+		TSLogMsgFormat(LOGT::DBTRACE, "dbconn::AsyncZstdMaintenance: stage: %d, last id: %" llFmtSpec "d, recompressed %u rows",
+				(int) stage, (sqlite3_int64) last_id, recompressed);
+
+		SetStaticSettingInt(db, cache, "zstdrecompressstage", (int64_t) stage);
+		SetStaticSettingInt(db, cache, "zstdrecompresslastid", (int64_t) last_id);
+	};
+
+	msg->callback_func = [this](std::unique_ptr<dbfunctionmsg_callback> self_) {
+		zstd_maintenance_msg &self = static_cast<zstd_maintenance_msg &>(*self_);
+		if (self.failed) {
+			ResetZstdMaintenanceTimer(zstd_retry_interval_ms);
+		} else if (!self.training_samples.empty()) {
+			struct train_job_data {
+				std::vector<std::string> samples;
+				std::string dict;
+				bool ok = false;
+			};
+			auto job = std::make_shared<train_job_data>();
+			job->samples = std::move(self.training_samples);
+			wxGetApp().EnqueueThreadJob([job]() {
+				job->ok = DBZstdTrainDictionary(job->samples, zstd_dict_capacity, job->dict);
+				TSLogMsgFormat(LOGT::DBINFO, "dbconn::AsyncZstdMaintenance: dictionary training from %zu samples %s",
+						job->samples.size(), job->ok ? "succeeded" : "failed");
+				job->samples.clear();
+			},
+			[this, job]() {
+				if (!(dbc_flags & DBCF::INITED)) {
+					return;
+				}
+				if (job->ok) {
+					AsyncZstdStoreDictionary(std::move(job->dict));
+				} else {
+					ResetZstdMaintenanceTimer(zstd_retry_interval_ms);
+				}
+			});
+		} else if (!self.done) {
+			ResetZstdMaintenanceTimer(zstd_recompress_chunk_interval_ms);
+		}
+	};
+
+	SendFunctionMsgCallback(std::move(msg));
+}
+
+// Recompression with the new dictionary starts on the next call to AsyncZstdMaintenance, after this has been stored
+void dbconn::AsyncZstdStoreDictionary(std::string dict) {
+	struct zstd_store_msg : public dbfunctionmsg_callback {
+		std::string dict;
+		bool ok = false;
+	};
+
+	std::unique_ptr<zstd_store_msg> msg(new zstd_store_msg());
+	msg->dict = std::move(dict);
+	msg->msg_flags |= DBSMF::NO_READ_DEPENDENCY;
+
+	msg->db_func = [](sqlite3 *db, bool &ok, dbpscache &cache, dbfunctionmsg_callback &self_) {
+		// We are now in the DB thread
+		zstd_store_msg &self = static_cast<zstd_store_msg &>(self_);
+		self.ok = ZstdStoreNewDictionary(db, cache, std::move(self.dict));
+	};
+
+	msg->callback_func = [this](std::unique_ptr<dbfunctionmsg_callback> self_) {
+		zstd_store_msg &self = static_cast<zstd_store_msg &>(*self_);
+		ResetZstdMaintenanceTimer(self.ok ? zstd_recompress_chunk_interval_ms : zstd_retry_interval_ms);
+	};
+
+	SendFunctionMsgCallback(std::move(msg));
+}
@@ -0,0 +1,49 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#ifndef HGUARD_SRC_DB_ZSTD
+#define HGUARD_SRC_DB_ZSTD
+
+#include "univdefs.h"
+#include "db.h"
+#include <string>
+#include <vector>
+
+// zstd compressed blob format:
+// tag, 4 byte big-endian uncompressed size, 2 byte big-endian dictionary version (0 for none), zstd frame
+// Dictionaries are trained from the DB contents, and are stored in the staticsettings table as zstddict_<version>
+// Old dictionary versions are never removed, such that existing blobs can always be decompressed
+#define DB_ZSTD_TAG 'X'
+#define DB_ZSTD_HEADERSIZE 7
+
+// Returns false if retcon was built without zstd support
+bool DBZstdAvailable();
+
+// All of these may be called from any thread
+
+// Uses the current dictionary, returns false if there isn't one, or zstd is not available
+bool DBZstdCompress(const void *in, size_t insize, db_bind_buffer<dbb_compressed> &out);
+bool DBZstdDecompress(const unsigned char *in, size_t insize, db_bind_buffer<dbb_uncompressed> &out);
+
+void DBZstdAddDictionary(unsigned int version, std::string dict);
+void DBZstdSetCurrentDictionary(unsigned int version);
+unsigned int DBZstdGetCurrentDictionary();
+bool DBZstdIsBlobCurrent(const unsigned char *in, size_t insize);
+bool DBZstdTrainDictionary(const std::vector<std::string> &samples, size_t dict_capacity, std::string &dict_out);
+
+#endif
@@ -20,6 +20,8 @@
 #include "db.h"
 #include "db-intl.h"
 #include "db-cfg.h"
+#include "db-zstd.h"
+#include "db-search.h"
 #include "taccount.h"
 #include "log.h"
 #include "twit.h"
@@ -41,7 +43,16 @@
 #ifdef _GNU_SOURCE
 #include <pthread.h>
 #endif
+#ifndef __WINDOWS__
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <zlib.h>
+#include <limits>
+#include <algorithm>
 #include <wx/msgdlg.h>
 #include <wx/filefn.h>
 
@@ -90,7 +101,7 @@ static const char *startup_sql=
 "PRAGMA locking_mode = EXCLUSIVE;"
 "BEGIN EXCLUSIVE;"
 "CREATE TABLE IF NOT EXISTS tweets(id INTEGER PRIMARY KEY NOT NULL, statjson BLOB, dynjson BLOB, userid INTEGER, userrecipid INTEGER, flags INTEGER, timestamp INTEGER, rtid INTEGER);"
-"CREATE TABLE IF NOT EXISTS users(id INTEGER PRIMARY KEY NOT NULL, json BLOB, cachedprofimgurl BLOB, createtimestamp INTEGER, lastupdatetimestamp INTEGER, cachedprofileimgchecksum BLOB, mentionindex BLOB, profimglastusedtimestamp INTEGER);"
+"CREATE TABLE IF NOT EXISTS users(id INTEGER PRIMARY KEY NOT NULL, json BLOB, cachedprofimgurl BLOB, createtimestamp INTEGER, lastupdatetimestamp INTEGER, cachedprofileimgchecksum BLOB, mentionindex BLOB, profimglastusedtimestamp INTEGER, cachedprofimgetag TEXT, cachedprofimglastmodified TEXT);"
 "CREATE TABLE IF NOT EXISTS acc(id INTEGER PRIMARY KEY NOT NULL, name TEXT, dispname TEXT, json BLOB, tweetids BLOB, dmids BLOB, blockedids BLOB, mutedids BLOB, nortids BLOB, userid INTEGER);"
 "CREATE TABLE IF NOT EXISTS settings(accid BLOB, name TEXT, value BLOB, PRIMARY KEY (accid, name));"
 "CREATE TABLE IF NOT EXISTS rbfspending(accid INTEGER, type INTEGER, startid INTEGER, endid INTEGER, maxleft INTEGER);"
@@ -100,6 +111,8 @@ static const char *startup_sql=
 "CREATE TABLE IF NOT EXISTS tpanelwinudcautos(tpw INTEGER, userid INTEGER, autoflags INTEGER);"
 "CREATE TABLE IF NOT EXISTS mainframewins(mainframeindex INTEGER, x INTEGER, y INTEGER, w INTEGER, h INTEGER, maximised INTEGER);"
 "CREATE TABLE IF NOT EXISTS tpanels(name TEXT, dispname TEXT, flags INTEGER, ids BLOB);"
+"CREATE TABLE IF NOT EXISTS accidjournal(accid INTEGER, type INTEGER, ids BLOB);"
+"CREATE TABLE IF NOT EXISTS cidsjournal(name TEXT, type INTEGER, ids BLOB);"
 "CREATE TABLE IF NOT EXISTS staticsettings(name TEXT PRIMARY KEY NOT NULL, value BLOB);"
 "CREATE TABLE IF NOT EXISTS userrelationships(accid INTEGER, userid INTEGER, flags INTEGER, followmetime INTEGER, ifollowtime INTEGER);"
 "CREATE TABLE IF NOT EXISTS userdmsets(userid INTEGER PRIMARY KEY NOT NULL, dmindex BLOB);"
@@ -114,12 +127,17 @@ static const char *startup_sql=
 "INSERT OR REPLACE INTO staticsettings(name, value) VALUES ('dirtyflag', strftime('%s','now'));"
 "COMMIT;";
 
+// This must have DBPSC_BATCH_SIZE parameters
+#define DBPSC_BATCH_PARAMS_4 "?,?,?,?"
+#define DBPSC_BATCH_PARAMS_16 DBPSC_BATCH_PARAMS_4 "," DBPSC_BATCH_PARAMS_4 "," DBPSC_BATCH_PARAMS_4 "," DBPSC_BATCH_PARAMS_4
+#define DBPSC_BATCH_PARAMS DBPSC_BATCH_PARAMS_16 "," DBPSC_BATCH_PARAMS_16 "," DBPSC_BATCH_PARAMS_16 "," DBPSC_BATCH_PARAMS_16
+
 static const char *std_sql_stmts[DBPSC_NUM_STATEMENTS]={
 	"INSERT OR REPLACE INTO tweets(id, statjson, dynjson, userid, userrecipid, flags, timestamp, rtid) VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
 	"UPDATE tweets SET dynjson = ?, flags = ? WHERE id == ?;",
 	"BEGIN;",
 	"COMMIT;",
-	"INSERT OR REPLACE INTO users(id, json, cachedprofimgurl, createtimestamp, lastupdatetimestamp, cachedprofileimgchecksum, mentionindex, profimglastusedtimestamp) VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+	"INSERT OR REPLACE INTO users(id, json, cachedprofimgurl, createtimestamp, lastupdatetimestamp, cachedprofileimgchecksum, mentionindex, profimglastusedtimestamp, cachedprofimgetag, cachedprofimglastmodified) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
 	"INSERT INTO acc(name, dispname, userid) VALUES (?, ?, ?);",
 	"UPDATE acc SET tweetids = ?, dmids = ?, blockedids = ?, mutedids = ?, nortids = ?, dispname = ? WHERE id == ?;",
 	"SELECT statjson, dynjson, userid, userrecipid, flags, timestamp, rtid FROM tweets WHERE id == ?;",
@@ -140,7 +158,7 @@ static const char *std_sql_stmts[DBPSC_NUM_STATEMENTS]={
 	"SELECT value FROM staticsettings WHERE (name IS ?);",
 	"INSERT INTO tpanels (name, dispname, flags, ids) VALUES (?, ?, ?, ?);",
 	"INSERT OR REPLACE INTO userdmsets (userid, dmindex) VALUES (?, ?);",
-	"SELECT json, cachedprofimgurl, createtimestamp, lastupdatetimestamp, cachedprofileimgchecksum, mentionindex, profimglastusedtimestamp FROM users WHERE id == ?;",
+	"SELECT json, cachedprofimgurl, createtimestamp, lastupdatetimestamp, cachedprofileimgchecksum, mentionindex, profimglastusedtimestamp, cachedprofimgetag, cachedprofimglastmodified FROM users WHERE id == ?;",
 	"DELETE FROM handlenewpending;",
 	"INSERT INTO handlenewpending (accid, arrivalflags, tweetid) VALUES (?, ?, ?);",
 	"INSERT OR IGNORE INTO incrementaltweetids(id) VALUES (?);",
@@ -149,6 +167,15 @@ static const char *std_sql_stmts[DBPSC_NUM_STATEMENTS]={
 	"SELECT id FROM tweets WHERE timestamp < ? ORDER BY timestamp DESC LIMIT 1;",
 	"SELECT id, accid, type, flags, timestamp, extrajson FROM eventlog WHERE obj == ?;",
 	"SELECT id, accid, type, flags, timestamp, extrajson, obj FROM eventlog WHERE obj == ? OR accid == ?;",
+	"SELECT statjson, dynjson, userid, userrecipid, flags, timestamp, rtid, id FROM tweets WHERE id IN (" DBPSC_BATCH_PARAMS ") ORDER BY id;",
+	"SELECT json, cachedprofimgurl, createtimestamp, lastupdatetimestamp, cachedprofileimgchecksum, mentionindex, profimglastusedtimestamp, cachedprofimgetag, cachedprofimglastmodified, id FROM users WHERE id IN (" DBPSC_BATCH_PARAMS ");",
+	"INSERT OR REPLACE INTO tweetsearch(rowid, text) VALUES (?, ?);",
+	"INSERT OR REPLACE INTO usersearch(rowid, name, screenname, description, location) VALUES (?, ?, ?, ?, ?);",
+	"INSERT INTO accidjournal(accid, type, ids) VALUES (?, ?, ?);",
+	"DELETE FROM accidjournal WHERE accid == ?;",
+	"DELETE FROM tpanels WHERE name == ?;",
+	"INSERT INTO cidsjournal(name, type, ids) VALUES (?, ?, ?);",
+	"DELETE FROM cidsjournal WHERE name == ?;",
 };
 
 static const std::string globstr = "G";
@@ -228,6 +255,23 @@ void dbpscache::CheckTransactionRefcountState() {
 	}
 }
 
+int64_t GetStaticSettingInt(sqlite3 *db, dbpscache &cache, const char *name, int64_t default_value) {
+	int64_t value = default_value;
+	sqlite3_stmt *getstmt = cache.GetStmt(db, DBPSC_SELSTATICSETTING);
+	sqlite3_bind_text(getstmt, 1, name, -1, SQLITE_STATIC);
+	DBRowExec(db, getstmt, [&](sqlite3_stmt *stmt) {
+		value = sqlite3_column_int64(stmt, 0);
+	}, string_format("GetStaticSettingInt: %s", name));
+	return value;
+}
+
+void SetStaticSettingInt(sqlite3 *db, dbpscache &cache, const char *name, int64_t value) {
+	sqlite3_stmt *stmt = cache.GetStmt(db, DBPSC_INSSTATICSETTING);
+	sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, value);
+	DBExec(db, stmt, string_format("SetStaticSettingInt: %s", name));
+}
+
 static bool TagToDict(unsigned char tag, const unsigned char *&dict, size_t &dict_size) {
 	switch (tag) {
 		case 'Z': {
@@ -274,6 +318,13 @@ scoped_stmt_holder DBInitialiseSql(sqlite3 *adb, std::string sql) {
 db_bind_buffer<dbb_compressed> DoCompress(const void *in, size_t insize, unsigned char tag, bool *iscompressed) {
 	db_bind_buffer<dbb_compressed> out;
 
+	if (tag == 'J' && insize >= 100 && DBZstdCompress(in, insize, out)) {
+		if (iscompressed) {
+			*iscompressed = true;
+		}
+		return std::move(out);
+	}
+
 	if (insize) {
 		const unsigned char *dict = nullptr;
 		size_t dict_size = 0;
@@ -367,6 +418,14 @@ db_bind_buffer<dbb_uncompressed> DoDecompress(db_bind_buffer<dbb_compressed> &&i
 			return std::move(out);
 		}
 
+		case DB_ZSTD_TAG: {
+			db_bind_buffer<dbb_uncompressed> out;
+			if (!DBZstdDecompress(input, in.data_size, out)) {
+				return {};
+			}
+			return std::move(out);
+		}
+
 		default: {
 			bool compress = TagToDict(input[0], dict, dict_size);
 			if (compress) {
@@ -452,54 +511,138 @@ db_bind_buffer<dbb_uncompressed> column_get_compressed_and_parse(sqlite3_stmt* s
 	return std::move(buffer);
 }
 
-//! This calls itself for retweet sources, *unless* the retweet source ID is in idset
-//! This expects to be called in *ascending* ID order
-static void ProcessMessage_SelTweet(sqlite3 *db, sqlite3_stmt *stmt, dbseltweetmsg &m, std::deque<dbrettweetdata> &recv_data, uint64_t id,
-		const container::set<uint64_t> &idset, dbconn *dbc, bool front_insert = false) {
-	sqlite3_bind_int64(stmt, 1, (sqlite3_int64) id);
-	int res = sqlite3_step(stmt);
-	uint64_t rtid = 0;
-	if (res == SQLITE_ROW) {
-		#if DB_COPIOUS_LOGGING
-			TSLogMsgFormat(LOGT::DBTRACE, "DBSM::SELTWEET got id:%" llFmtSpec "d", (sqlite3_int64) id);
-		#endif
+// This binds up to DBPSC_BATCH_SIZE IDs at a time from [begin, end) to the given batch statement, and calls func for each row returned
+template <typename I, typename F> static void DBBatchIdRowExec(sqlite3 *db, dbpscache &cache, DBPSC_TYPE type, I begin, I end, F func, const char *errspec) {
+	sqlite3_stmt *stmt = cache.GetStmt(db, type);
+	while (begin != end) {
+		unsigned int param = 1;
+		for (; param <= DBPSC_BATCH_SIZE && begin != end; ++param, ++begin) {
+			sqlite3_bind_int64(stmt, param, (sqlite3_int64) *begin);
+		}
+		for (; param <= DBPSC_BATCH_SIZE; ++param) {
+			sqlite3_bind_null(stmt, param);
+		}
+		DBRowExecStmt(db, stmt, func, errspec);
+		sqlite3_reset(stmt);
+	}
+}
+
+//! This loads all tweets in m.id_set, followed by any retweet sources which are not in m.id_set, in batches
+//! Each pass is in *ascending* ID order, retweet sources loaded in a later pass are inserted in *front* of the earlier passes
+//! This ensures that tweets come before any retweets which use them as a source
+static void ProcessMessage_SelTweet(sqlite3 *db, dbpscache &cache, dbseltweetmsg &m, std::deque<dbrettweetdata> &recv_data, dbconn *dbc, db_user_load_claims &claims) {
+	container::set<uint64_t> user_ids;
+	container::set<uint64_t> extra_ids;
+	std::vector<uint64_t> pass_ids(m.id_set.begin(), m.id_set.end());
+	bool first_pass = true;
+
+	while (!pass_ids.empty()) {
+		dbc->TweetGCRetainIds(pass_ids);
+
+		std::deque<dbrettweetdata> pass_data;
+		DBBatchIdRowExec(db, cache, DBPSC_SELTWEETBATCH, pass_ids.begin(), pass_ids.end(), [&](sqlite3_stmt *stmt) {
+			pass_data.emplace_back();
+			dbrettweetdata &rd = pass_data.back();
+
+			rd.statjson = column_get_compressed(stmt, 0);
+			rd.dynjson = column_get_compressed(stmt, 1);
+			rd.user1 = (uint64_t) sqlite3_column_int64(stmt, 2);
+			rd.user2 = (uint64_t) sqlite3_column_int64(stmt, 3);
+			rd.flags = (uint64_t) sqlite3_column_int64(stmt, 4);
+			rd.timestamp = (uint64_t) sqlite3_column_int64(stmt, 5);
+			rd.rtid = (uint64_t) sqlite3_column_int64(stmt, 6);
+			rd.id = (uint64_t) sqlite3_column_int64(stmt, 7);
 
-		// emplacing at the *back* in the normal case is to ensure that the resulting deque is (mostly) in *ascending* order of ID
-		// This ensures that tweets come before any retweets which use them as a source
-		// *front* emplacing is used to ensure that any missing retweet sources come before any tweets which use them
-		if (front_insert) {
-			recv_data.emplace_front();
+			#if DB_COPIOUS_LOGGING
+				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::SELTWEET got id:%" llFmtSpec "d", (sqlite3_int64) rd.id);
+			#endif
+
+			if (rd.user1) {
+				user_ids.insert(rd.user1);
+			}
+			if (rd.user2) {
+				user_ids.insert(rd.user2);
+			}
+		}, "DBSM::SELTWEET");
+
+		// Both pass_ids and pass_data are in ascending order
+		auto data_it = pass_data.begin();
+		for (uint64_t id : pass_ids) {
+			if (data_it != pass_data.end() && data_it->id == id) {
+				++data_it;
+			} else {
+				TSLogMsgFormat((m.flags & DBSTMF::NO_ERR) ? LOGT::DBTRACE : LOGT::DBERR,
+						"DBSM::SELTWEET could not find id: %" llFmtSpec "d", (sqlite3_int64) id);
+			}
+		}
+
+		// If we're not already loading the retweet source, load it in the next pass
+		container::set<uint64_t> next_ids;
+		for (auto &rd : pass_data) {
+			if (rd.rtid && m.id_set.find(rd.rtid) == m.id_set.end() && extra_ids.insert(rd.rtid).second) {
+				next_ids.insert(rd.rtid);
+			}
+		}
+
+		if (first_pass) {
+			recv_data = std::move(pass_data);
+			first_pass = false;
 		} else {
-			recv_data.emplace_back();
+			recv_data.insert(recv_data.begin(), std::make_move_iterator(pass_data.begin()), std::make_move_iterator(pass_data.end()));
 		}
-		dbrettweetdata &rd = front_insert ? recv_data.front() : recv_data.back();
+		pass_ids.assign(next_ids.begin(), next_ids.end());
+	}
 
-		rd.id = id;
-		rd.statjson = column_get_compressed(stmt, 0);
-		rd.dynjson = column_get_compressed(stmt, 1);
-		rd.user1 = (uint64_t) sqlite3_column_int64(stmt, 2);
-		rd.user2 = (uint64_t) sqlite3_column_int64(stmt, 3);
-		rd.flags = (uint64_t) sqlite3_column_int64(stmt, 4);
-		rd.timestamp = (uint64_t) sqlite3_column_int64(stmt, 5);
-		rd.rtid = rtid = (uint64_t) sqlite3_column_int64(stmt, 6);
+	if (!user_ids.empty()) {
+		dbc->AsyncReadInUsers(db, cache, user_ids, m.user_data, claims);
+	}
+}
 
-		if (rd.user1) {
-			dbc->AsyncReadInUser(db, rd.user1, m.user_data);
+//This handles the message types which only read from the DB
+//These may be processed either by the DB thread or by the read pool
+//claims must be released after reply_list has been posted
+static void ProcessMessage_Read(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool &ok, dbpscache &cache, db_reply_list &reply_list, db_user_load_claims &claims, dbconn *dbc) {
+	dbsendmsg *msg = themsg.get();
+	switch (msg->type) {
+		case DBSM::SELTWEET: {
+			dbseltweetmsg *m = static_cast<dbseltweetmsg*>(msg);
+			std::deque<dbrettweetdata> recv_data;
+			ProcessMessage_SelTweet(db, cache, *m, recv_data, dbc, claims);
+			if (!recv_data.empty()) {
+				m->data = std::move(recv_data);
+				m->SendReply(std::move(themsg), reply_list);
+				return;
+			}
+			break;
 		}
-		if (rd.user2) {
-			dbc->AsyncReadInUser(db, rd.user2, m.user_data);
+
+		case DBSM::SELUSER: {
+			dbselusermsg *m = static_cast<dbselusermsg*>(msg);
+			for (uint64_t id : m->id_set) {
+				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::SELUSER got request for user: %" llFmtSpec "u", id);
+			}
+			dbc->AsyncReadInUsers(db, cache, m->id_set, m->data, claims);
+			// Always reply, even if empty.
+			// This avoids a race conditions if the main thread sends multiple requests
+			// for the same user with reply handlers, before the first reply is
+			// received.
+			// AsyncReadInUsers waits for any other thread which is loading the same users to post its reply first,
+			// such that an empty reply does not overtake the reply which contains the user.
+			m->SendReply(std::move(themsg), reply_list);
+			return;
+		}
+
+		case DBSM::FUNCTION_CALLBACK: {
+			cache.BeginTransaction(db);
+			dbfunctionmsg_callback *m = static_cast<dbfunctionmsg_callback *>(msg);
+			m->db_func(db, ok, cache, *m);
+			cache.EndTransaction(db);
+			m->SendReply(std::move(themsg), reply_list);
+			return;
 		}
-	} else {
-		TSLogMsgFormat((m.flags & DBSTMF::NO_ERR) ? LOGT::DBTRACE : LOGT::DBERR,
-				"DBSM::SELTWEET got error: %d (%s) for id: %" llFmtSpec "d",
-				res, cstr(sqlite3_errmsg(db)), (sqlite3_int64) id);
-	}
-	sqlite3_reset(stmt);
 
-	if (rtid && idset.find(rtid) == idset.end()) {
-		// This is a retweet, if we're not already loading the retweet source, load it here
-		// Note that this is front emplaced in *front* of the retweet which needs it
-		ProcessMessage_SelTweet(db, stmt, m, recv_data, rtid, idset, dbc, true);
+		default:
+			break;
 	}
 }
 
@@ -516,6 +659,15 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 		case DBSM::INSERTTWEET: {
 			if (gc.readonlymode) break;
 			dbinserttweetmsg *m = static_cast<dbinserttweetmsg*>(msg);
+			{
+				// Neither this tweet, nor anything which it refers to, should now be garbage collected by a chunk which has not yet run
+				std::vector<uint64_t> gc_ids = m->xref_tweet_ids;
+				gc_ids.push_back(m->id);
+				if (m->rtid) {
+					gc_ids.push_back(m->rtid);
+				}
+				dbc->TweetGCRetainIds(gc_ids);
+			}
 			sqlite3_stmt *stmt = cache.GetStmt(db, DBPSC_INSTWEET);
 			sqlite3_bind_int64(stmt, 1, (sqlite3_int64) m->id);
 			bind_compressed(stmt, 2, m->statjson, 'J');
@@ -532,6 +684,9 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 				dbc->dbc_flags |= dbconn::DBCF::TWEET_ID_CACHE_INVALID;
 			} else {
 				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::INSERTTWEET inserted row id: %" llFmtSpec "d", (sqlite3_int64) m->id);
+				if (dbc->search_index_enabled) {
+					DBSearchIndexTweet(db, cache, m->id, m->search_text);
+				}
 				if (m->rtid) {
 					DBBindExec(db, cache.GetStmt(db, DBPSC_INSERTTWEETXREF), [&](sqlite3_stmt *incstmt) {
 						sqlite3_bind_int64(incstmt, 1, (sqlite3_int64) m->id);
@@ -575,22 +730,11 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 			break;
 		}
 
-		case DBSM::SELTWEET: {
-			dbseltweetmsg *m = static_cast<dbseltweetmsg*>(msg);
-			sqlite3_stmt *stmt = cache.GetStmt(db, DBPSC_SELTWEET);
-			std::deque<dbrettweetdata> recv_data;
-
-			//This is *ascending* ID order
-			for (auto it = m->id_set.cbegin(); it != m->id_set.cend(); ++it) {
-				ProcessMessage_SelTweet(db, stmt, *m, recv_data, *it, m->id_set, dbc);
-			}
-			if (!recv_data.empty()) {
-				m->data = std::move(recv_data);
-				m->SendReply(std::move(themsg), th);
-				return;
-			}
+		case DBSM::SELTWEET:
+		case DBSM::SELUSER:
+		case DBSM::FUNCTION_CALLBACK:
+			ProcessMessage_Read(db, themsg, ok, cache, th->reply_list, th->user_load_claims, dbc);
 			break;
-		}
 
 		case DBSM::INSERTUSER: {
 			if (gc.readonlymode) break;
@@ -608,6 +752,7 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 			}
 			bind_compressed(stmt, 7, std::move(m->mentionindex));
 			sqlite3_bind_int64(stmt, 8, (sqlite3_int64) m->profile_img_last_used);
+			bind_validators(stmt, 9, m->cached_profile_img_validators);
 			int res = sqlite3_step(stmt);
 			if (res != SQLITE_DONE) {
 				TSLogMsgFormat(LOGT::DBERR, "DBSM::INSERTUSER got error: %d (%s) for id: %" llFmtSpec "d",
@@ -616,26 +761,15 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::INSERTUSER inserted id: %" llFmtSpec "d", (sqlite3_int64) m->id);
 			}
 			sqlite3_reset(stmt);
-			break;
-		}
-
-		case DBSM::SELUSER: {
-			dbselusermsg *m = static_cast<dbselusermsg*>(msg);
-			for (uint64_t id : m->id_set) {
-				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::SELUSER got request for user: %" llFmtSpec "u", id);
-
-				dbc->AsyncReadInUser(db, id, m->data);
+			if (res == SQLITE_DONE && m->search_fields) {
+				DBSearchIndexUser(db, cache, m->id, *(m->search_fields));
 			}
-			// Always reply, even if empty.
-			// This avoids a race conditions if the main thread sends multiple requests
-			// for the same user with reply handlers, before the first reply is
-			// received.
-			m->SendReply(std::move(themsg), th);
-			return;
+			break;
 		}
 
 		case DBSM::NOTIFYUSERSPURGED: {
 			dbnotifyuserspurgedmsg *m = static_cast<dbnotifyuserspurgedmsg*>(msg);
+			std::lock_guard<std::mutex> guard(dbc->unloaded_user_ids_lock);
 			dbc->unloaded_user_ids.insert(m->ids.begin(), m->ids.end());
 			TSLogMsgFormat(LOGT::DBTRACE, "DBSM::NOTIFYUSERSPURGED inserted %d ids", m->ids.size());
 			break;
@@ -657,7 +791,7 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::INSERTACC inserted account dbindex: %d, name: %s", m->dbindex, cstr(m->dispname));
 			}
 			sqlite3_reset(stmt);
-			m->SendReply(std::move(themsg), th);
+			m->SendReply(std::move(themsg), th->reply_list);
 			return;
 		}
 
@@ -674,6 +808,9 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 				TSLogMsgFormat(LOGT::DBTRACE, "DBSM::DELACC deleted account dbindex: %d", m->dbindex);
 			}
 			sqlite3_reset(stmt);
+			DBBindExec(db, cache.GetStmt(db, DBPSC_DELACCIDJOURNAL), [&](sqlite3_stmt *delstmt) {
+				sqlite3_bind_int64(delstmt, 1, (sqlite3_int64) m->dbindex);
+			}, "DBSM::DELACC (journal)");
 			break;
 		}
 
@@ -846,15 +983,6 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 			break;
 		}
 
-		case DBSM::FUNCTION_CALLBACK: {
-			cache.BeginTransaction(db);
-			dbfunctionmsg_callback *m = static_cast<dbfunctionmsg_callback *>(msg);
-			m->db_func(db, ok, cache, *m);
-			cache.EndTransaction(db);
-			m->SendReply(std::move(themsg), th);
-			return;
-		}
-
 		default:
 			break;
 	}
@@ -862,51 +990,321 @@ static void ProcessMessage(sqlite3 *db, std::unique_ptr<dbsendmsg> &themsg, bool
 
 wxThread::ExitCode dbiothread::Entry() {
 	MsgLoop();
+
+	// Make sure that nothing in the read pool is left waiting for this thread
+	dbc->NotifyWriteMsgDone(std::numeric_limits<uint64_t>::max());
 	return 0;
 }
 
+bool dbmsgqueue::Init() {
+	#ifdef __WINDOWS__
+	event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (!event) {
+		LogMsgFormat(LOGT::DBERR, "dbmsgqueue::Init(): CreateEvent failed: %u", (unsigned int) GetLastError());
+		return false;
+	}
+	#elif defined(__linux__)
+	wakeup_read_fd = wakeup_write_fd = eventfd(0, EFD_CLOEXEC);
+	if (wakeup_read_fd < 0) {
+		LogMsgFormat(LOGT::DBERR, "dbmsgqueue::Init(): eventfd failed: %d, %s", errno, cstr(strerror(errno)));
+		return false;
+	}
+	#else
+	int pipepair[2];
+	if (pipe(pipepair) < 0) {
+		LogMsgFormat(LOGT::DBERR, "dbmsgqueue::Init(): pipe failed: %d, %s", errno, cstr(strerror(errno)));
+		return false;
+	}
+	wakeup_read_fd = pipepair[0];
+	wakeup_write_fd = pipepair[1];
+	#endif
+	return true;
+}
+
+// This must only be called after the consumer thread has exited
+void dbmsgqueue::DeInit() {
+	dbsendmsg *msg = head.exchange(nullptr);
+	while (msg) {
+		std::unique_ptr<dbsendmsg> msgcont(msg);
+		msg = msg->queue_next;
+	}
+
+	#ifdef __WINDOWS__
+	if (event) {
+		CloseHandle(event);
+		event = nullptr;
+	}
+	#else
+	if (wakeup_write_fd >= 0 && wakeup_write_fd != wakeup_read_fd) {
+		close(wakeup_write_fd);
+	}
+	if (wakeup_read_fd >= 0) {
+		close(wakeup_read_fd);
+	}
+	wakeup_read_fd = wakeup_write_fd = -1;
+	#endif
+}
+
+// May be called from any thread, takes ownership of msg
+void dbmsgqueue::Push(dbsendmsg *msg) {
+	dbsendmsg *old_head = head.load(std::memory_order_relaxed);
+	do {
+		msg->queue_next = old_head;
+	} while (!head.compare_exchange_weak(old_head, msg));
+
+	// This must be sequentially consistent with the push above, see Wait()
+	if (consumer_waiting.load() && consumer_waiting.exchange(false)) {
+		Signal();
+	}
+}
+
+dbsendmsg *dbmsgqueue::PopAll(bool wait) {
+	dbsendmsg *list = head.exchange(nullptr, std::memory_order_acquire);
+	while (!list && wait) {
+		Wait();
+		list = head.exchange(nullptr, std::memory_order_acquire);
+	}
+
+	// The stack is in LIFO order, reverse it
+	dbsendmsg *out = nullptr;
+	while (list) {
+		dbsendmsg *next = list->queue_next;
+		list->queue_next = out;
+		out = list;
+		list = next;
+	}
+	return out;
+}
+
+void dbmsgqueue::Signal() {
+	#ifdef __WINDOWS__
+	SetEvent(event);
+	#else
+	uint64_t value = 1;
+	while (write(wakeup_write_fd, &value, sizeof(value)) < 0) {
+		int err = errno;
+		if (err == EINTR) {
+			continue;
+		} else if (err != EAGAIN) {
+			TSLogMsgFormat(LOGT::DBERR, "dbmsgqueue::Signal(): Could not wake DB thread: %d, %s", err, cstr(strerror(err)));
+		}
+		break;
+	}
+	#endif
+}
+
+void dbmsgqueue::Wait() {
+	// Producers check consumer_waiting after pushing, so re-check the queue after setting it to avoid a lost wakeup
+	consumer_waiting.store(true);
+	if (head.load()) {
+		consumer_waiting.store(false);
+		return;
+	}
+
+	#ifdef __WINDOWS__
+	WaitForSingleObject(event, INFINITE);
+	#else
+	uint64_t value;
+	while (read(wakeup_read_fd, &value, sizeof(value)) < 0) {
+		int err = errno;
+		if (err == EINTR) {
+			continue;
+		}
+		TSLogMsgFormat(LOGT::DBERR, "dbmsgqueue::Wait(): Could not read wakeup event: %d, %s", err, cstr(strerror(err)));
+		break;
+	}
+	#endif
+	consumer_waiting.store(false);
+}
+
 void dbiothread::MsgLoop() {
+	uint64_t msg_seq = 0;
 	bool ok = true;
+	dbsendmsg *pending = nullptr;
 	while (ok) {
-		dbsendmsg *msg;
-		#ifdef __WINDOWS__
-		DWORD num;
-		OVERLAPPED *ovlp;
-		bool res = GetQueuedCompletionStatus(iocp, &num, (PULONG_PTR) &msg, &ovlp, INFINITE);
-		if (!res) {
-			return;
+		if (!pending) {
+			pending = queue->PopAll(true);
 		}
-		#else
-		size_t bytes_to_read = sizeof(msg);
-		size_t bytes_read = 0;
-		while (bytes_to_read) {
-			ssize_t l_bytes_read = read(pipefd, ((char *) &msg) + bytes_read, bytes_to_read);
-			if (l_bytes_read >= 0) {
-				bytes_read += l_bytes_read;
-				bytes_to_read -= l_bytes_read;
-			} else {
-				if (l_bytes_read == EINTR) {
-					continue;
-				} else {
-					close(pipefd);
-					return;
-				}
+
+		// Group commit: process all messages which are already waiting in the same transaction
+		// Replies and read pool notifications are deferred until the transaction has been committed
+		unsigned int group_count = 0;
+		auto group_start = std::chrono::steady_clock::now();
+		cache.BeginTransaction(db);
+		while (pending) {
+			std::unique_ptr<dbsendmsg> msgcont(pending);
+			pending = pending->queue_next;
+			ProcessMessage(db, msgcont, ok, cache, this, dbc);
+			msg_seq++;
+			group_count++;
+
+			if (!ok || group_count >= group_commit_max_msgs || std::chrono::steady_clock::now() - group_start >= group_commit_max_time) {
+				break;
+			}
+			if (!pending) {
+				pending = queue->PopAll(false);
 			}
 		}
+		cache.EndTransaction(db);
+
+		#if DB_COPIOUS_LOGGING
+			if (group_count > 1) {
+				TSLogMsgFormat(LOGT::DBTRACE, "dbiothread::MsgLoop: committed %u messages in one transaction", group_count);
+			}
 		#endif
-		std::unique_ptr<dbsendmsg> msgcont(msg);
-		ProcessMessage(db, msgcont, ok, cache, this, dbc);
-		if (!reply_list.empty()) {
-			dbreplyevtstruct *rs = new dbreplyevtstruct;
-			rs->reply_list = std::move(reply_list);
 
-			wxCommandEvent evt(wxextDBCONN_NOTIFY, wxDBCONNEVT_ID_REPLY);
-			evt.SetClientData(rs);
-			dbc->AddPendingEvent(evt);
+		dbc->NotifyWriteMsgDone(msg_seq);
+		dbc->PostDBReplies(reply_list);
+		dbc->ReleaseUserLoadClaims(user_load_claims);
+	}
+
+	while (pending) {
+		std::unique_ptr<dbsendmsg> msgcont(pending);
+		pending = pending->queue_next;
+	}
+}
+
+bool dbreadpool::Init(const std::string &filename, unsigned int thread_count) {
+	std::vector<sqlite3 *> dbs;
+	for (unsigned int i = 0; i < thread_count; i++) {
+		sqlite3 *db = nullptr;
+		int res = sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+		if (res != SQLITE_OK) {
+			LogMsgFormat(LOGT::DBERR, "dbreadpool::Init(): Could not open read-only database connection, got error: %d (%s)",
+					res, cstr(sqlite3_errmsg(db)));
+			sqlite3_close(db);
+			for (auto &it : dbs) {
+				sqlite3_close(it);
+			}
+			return false;
+		}
+		sqlite3_busy_handler(db, &busy_handler_callback, 0);
+		dbs.push_back(db);
+	}
+
+	for (auto &it : dbs) {
+		sqlite3 *db = it;
+		workers.emplace_back([this, db]() {
+			WorkerLoop(db);
+		});
+	}
+	LogMsgFormat(LOGT::DBINFO | LOGT::THREADTRACE, "dbreadpool::Init(): Created %u database read threads", thread_count);
+	return true;
+}
+
+bool dbwalcheckpointer::Init(const std::string &filename, unsigned int interval_secs) {
+	sqlite3 *db = nullptr;
+	int res = sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr);
+	if (res != SQLITE_OK) {
+		LogMsgFormat(LOGT::DBERR, "dbwalcheckpointer::Init(): Could not open database connection, got error: %d (%s)",
+				res, cstr(sqlite3_errmsg(db)));
+		sqlite3_close(db);
+		return false;
+	}
+	thread = std::thread([this, db, interval_secs]() {
+		Loop(db, std::chrono::seconds(interval_secs));
+	});
+	return true;
+}
+
+void dbwalcheckpointer::DeInit() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	cv.notify_all();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+void dbwalcheckpointer::Loop(sqlite3 *db, std::chrono::seconds interval) {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 12)
+	pthread_setname_np(pthread_self(), "retcon-dbckpt");
+#endif
+#endif
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		cv.wait_for(guard, interval, [&]() { return quit; });
+		if (quit) {
+			break;
+		}
+		guard.unlock();
+
+		// Passive checkpoints do not wait for, or block, the DB thread or any readers
+		int log_frames = 0;
+		int checkpointed_frames = 0;
+		int res = sqlite3_wal_checkpoint_v2(db, nullptr, SQLITE_CHECKPOINT_PASSIVE, &log_frames, &checkpointed_frames);
+		if (res == SQLITE_OK) {
+			TSLogMsgFormat(LOGT::DBTRACE, "dbwalcheckpointer: checkpointed %d of %d frames", checkpointed_frames, log_frames);
+		} else {
+			TSLogMsgFormat(LOGT::DBERR, "dbwalcheckpointer: checkpoint failed: %d (%s)", res, cstr(sqlite3_errmsg(db)));
+		}
+
+		guard.lock();
+	}
+
+	sqlite3_close(db);
+}
+
+// This processes all remaining jobs before returning
+void dbreadpool::DeInit() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	queue_cv.notify_all();
+	for (auto &it : workers) {
+		it.join();
+	}
+	workers.clear();
+}
 
-			reply_list.clear();
+void dbreadpool::Enqueue(std::unique_ptr<dbsendmsg> msg, uint64_t write_barrier) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job_queue.push_back({ std::move(msg), write_barrier });
+	}
+	queue_cv.notify_one();
+}
+
+void dbreadpool::WorkerLoop(sqlite3 *db) {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 12)
+	pthread_setname_np(pthread_self(), "retcon-dbread");
+#endif
+#endif
+
+	dbpscache cache;
+	db_reply_list reply_list;
+	db_user_load_claims user_load_claims;
+	while (true) {
+		job j;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			queue_cv.wait(guard, [&]() { return quit || !job_queue.empty(); });
+			if (job_queue.empty()) {
+				break;
+			}
+			j = std::move(job_queue.front());
+			job_queue.pop_front();
 		}
+
+		dbc->WaitForWriteMsgDone(j.write_barrier);
+
+		bool ok = true;
+		cache.BeginTransaction(db);
+		ProcessMessage_Read(db, j.msg, ok, cache, reply_list, user_load_claims, dbc);
+		cache.EndTransaction(db);
+		dbc->PostDBReplies(reply_list);
+		dbc->ReleaseUserLoadClaims(user_load_claims);
 	}
+
+	cache.DeAllocAll();
+	cache.CheckTransactionRefcountState();
+	sqlite3_close(db);
 }
 
 DEFINE_EVENT_TYPE(wxextDBCONN_NOTIFY)
@@ -922,6 +1320,8 @@ EVT_COMMAND(wxDBCONNEVT_ID_GENERICSELUSER, wxextDBCONN_NOTIFY, dbconn::GenericDB
 EVT_COMMAND(wxDBCONNEVT_ID_FUNCTIONCALLBACK, wxextDBCONN_NOTIFY, dbconn::OnDBSendFunctionMsgCallback)
 EVT_TIMER(DBCONNTIMER_ID_ASYNCSTATEWRITE, dbconn::OnAsyncStateWriteTimer)
 EVT_TIMER(DBCONNTIMER_ID_ASYNCPURGEOLDTWEETS, dbconn::OnAsyncPurgeOldTweetsTimer)
+EVT_TIMER(DBCONNTIMER_ID_ZSTDMAINTENANCE, dbconn::OnZstdMaintenanceTimer)
+EVT_TIMER(DBCONNTIMER_ID_SEARCHINDEX, dbconn::OnSearchIndexTimer)
 END_EVENT_TABLE()
 
 void dbconn::OnStdTweetLoadFromDB(wxCommandEvent &event) {
@@ -1071,6 +1471,7 @@ void dbconn::DBSelUserReturnDataHandler(std::deque<dbretuserdata> data, optional
 		u->lastupdate_wrotetodb = std::move(du.lastupdate_wrotetodb);
 		u->cached_profile_img_url = std::move(du.cached_profile_img_url);
 		u->cached_profile_img_sha1 = std::move(du.cached_profile_img_sha1);
+		u->cached_profile_img_validators = std::move(du.cached_profile_img_validators);
 		u->profile_img_last_used = std::move(du.profile_img_last_used);
 		u->profile_img_last_used_db = std::move(du.profile_img_last_used_db);
 
@@ -1191,6 +1592,35 @@ void dbconn::OnDBReplyEvt(wxCommandEvent &event) {
 	}
 }
 
+// This may be called from any thread
+void dbconn::PostDBReplies(db_reply_list &reply_list) {
+	if (!reply_list.empty()) {
+		dbreplyevtstruct *rs = new dbreplyevtstruct;
+		rs->reply_list = std::move(reply_list);
+
+		wxCommandEvent evt(wxextDBCONN_NOTIFY, wxDBCONNEVT_ID_REPLY);
+		evt.SetClientData(rs);
+		AddPendingEvent(evt);
+
+		reply_list.clear();
+	}
+}
+
+// Called by the DB thread after each message has been processed (and committed)
+void dbconn::NotifyWriteMsgDone(uint64_t seq) {
+	{
+		std::lock_guard<std::mutex> guard(write_msg_done_lock);
+		write_msg_done_seq = seq;
+	}
+	write_msg_done_cv.notify_all();
+}
+
+// Called by read pool threads to wait for all messages up to and including seq to be processed by the DB thread
+void dbconn::WaitForWriteMsgDone(uint64_t seq) {
+	std::unique_lock<std::mutex> guard(write_msg_done_lock);
+	write_msg_done_cv.wait(guard, [&]() { return write_msg_done_seq >= seq; });
+}
+
 void dbconn::SendMessageBatchedOrAddToList(std::unique_ptr<dbsendmsg> msg, optional_observer_ptr<dbsendmsg_list> msglist) {
 	if (msglist) {
 		msglist->msglist.emplace_back(std::move(msg));
@@ -1200,32 +1630,17 @@ void dbconn::SendMessageBatchedOrAddToList(std::unique_ptr<dbsendmsg> msg, optio
 }
 
 void dbconn::SendMessage(std::unique_ptr<dbsendmsg> msgp) {
-	dbsendmsg *msg = msgp.release();
-	#ifdef __WINDOWS__
-	bool result = PostQueuedCompletionStatus(iocp, 0, (ULONG_PTR) msg, 0);
-	if (!result) {
-		LogMsgFormat(LOGT::DBERR, "dbconn::SendMessage(): Could not communicate with DB thread");
-		CloseHandle(iocp);
-		iocp = INVALID_HANDLE_VALUE;
+	if (readpool && (msgp->type == DBSM::SELTWEET || msgp->type == DBSM::SELUSER)) {
+		readpool->Enqueue(std::move(msgp), read_barrier_seq);
+		return;
 	}
-	#else
-	size_t offset = 0;
-	while (offset < sizeof(msg)) {
-		ssize_t result = write(pipefd, ((const char *) &msg) + offset, sizeof(msg) - offset);
-		if (result < 0) {
-			int err = errno;
-			if (err == EINTR) {
-				continue;
-			} else {
-				LogMsgFormat(LOGT::DBERR, "dbconn::SendMessage(): Could not communicate with DB thread: %d, %s", err, cstr(strerror(err)));
-				close(pipefd);
-				pipefd = -1;
-			}
-		} else {
-			offset += result;
-		}
+
+	write_msg_sent_seq++;
+	if (!(msgp->msg_flags & DBSMF::NO_READ_DEPENDENCY)) {
+		read_barrier_seq = write_msg_sent_seq;
 	}
-	#endif
+
+	queue.Push(msgp.release());
 }
 
 void dbconn::SendAccDBUpdate(std::unique_ptr<dbinsertaccmsg> insmsg) {
@@ -1242,12 +1657,79 @@ void dbconn::SendFunctionMsgCallback(std::unique_ptr<dbfunctionmsg_callback> ins
 	dbc.SendMessage(std::move(insmsg));
 }
 
+// The DB function of insmsg must not write to the DB
+// If the read pool is enabled, it is run there, otherwise this is the same as SendFunctionMsgCallback
+void dbconn::SendReadFunctionMsgCallback(std::unique_ptr<dbfunctionmsg_callback> insmsg) {
+	if (readpool) {
+		insmsg->targ = this;
+		insmsg->cmdevtype = wxextDBCONN_NOTIFY;
+		insmsg->winid = wxDBCONNEVT_ID_FUNCTIONCALLBACK;
+		readpool->Enqueue(std::move(insmsg), read_barrier_seq);
+	} else {
+		SendFunctionMsgCallback(std::move(insmsg));
+	}
+}
+
+// This sets the journal mode and durability level of the connection which is later used by the DB thread
+// Returns true if the DB is in WAL mode
+bool dbconn::SyncSetupJournalMode(sqlite3 *adb) {
+	auto exec_pragma = [&](const char *sql) -> std::string {
+		std::string value;
+		DBRowExec(adb, sql, [&](sqlite3_stmt *getstmt) {
+			const char *text = (const char *) sqlite3_column_text(getstmt, 0);
+			if (text) {
+				value = text;
+			}
+		}, "dbconn::SyncSetupJournalMode");
+		return value;
+	};
+
+	std::string journal_mode = exec_pragma("PRAGMA journal_mode;");
+	if (gc.dbwalmode) {
+		// The read pool and WAL checkpointer use their own connections, so the DB thread must not hold an exclusive lock.
+		// Note that the DB has already been accessed in normal locking mode before startup_sql is run,
+		// this is required as the locking mode cannot be changed if the DB was already in WAL mode when first accessed in exclusive mode.
+		exec_pragma("PRAGMA locking_mode = NORMAL;");
+		if (journal_mode != "wal") {
+			journal_mode = exec_pragma("PRAGMA journal_mode = WAL;");
+		}
+		if (journal_mode != "wal") {
+			LogMsgFormat(LOGT::DBERR, "dbconn::SyncSetupJournalMode: Could not switch database to WAL mode (%s)", cstr(journal_mode));
+			exec_pragma("PRAGMA locking_mode = EXCLUSIVE;");
+		}
+	} else if (journal_mode == "wal") {
+		journal_mode = exec_pragma("PRAGMA journal_mode = DELETE;");
+	}
+
+	const char *synchronous_sql = "PRAGMA synchronous = NORMAL;";
+	switch (gc.dbdurability) {
+		case DB_DURABILITY::FULL:
+			synchronous_sql = "PRAGMA synchronous = FULL;";
+			break;
+		case DB_DURABILITY::NORMAL:
+			break;
+		case DB_DURABILITY::OFF:
+			synchronous_sql = "PRAGMA synchronous = OFF;";
+			break;
+	}
+	DBExec(adb, synchronous_sql, "dbconn::SyncSetupJournalMode (synchronous)");
+
+	bool wal = (journal_mode == "wal");
+	if (wal && gc.dbwalcheckpointintervalsecs > 0) {
+		// Checkpoints are done by dbwalcheckpointer instead
+		exec_pragma("PRAGMA wal_autocheckpoint = 0;");
+	}
+
+	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncSetupJournalMode: journal mode: %s, durability: %d", cstr(journal_mode), (int) gc.dbdurability);
+	return wal;
+}
+
 bool dbconn::Init(const std::string &filename /*UTF-8*/) {
 	if (dbc_flags & DBCF::INITED) return true;
 
 	LogMsgFormat(LOGT::DBINFO, "dbconn::Init(): About to initialise database connection");
 
-	sqlite3_config(SQLITE_CONFIG_SINGLETHREAD);		//only use sqlite from one thread at any given time
+	sqlite3_config(SQLITE_CONFIG_MULTITHREAD);		//each connection is only used from one thread at any given time
 	sqlite3_initialize();
 
 	int res = sqlite3_open_v2(filename.c_str(), &syncdb, gc.readonlymode ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
@@ -1260,6 +1742,9 @@ bool dbconn::Init(const std::string &filename /*UTF-8*/) {
 
 	sqlite3_busy_handler(syncdb, &busy_handler_callback, 0);
 
+	db_filename = filename;
+	idsnapshot_filename = filename + ".idsnapshot";
+
 	if (!gc.readonlymode) {
 		int table_count = -1;
 		DBRowExec(syncdb, "SELECT COUNT(*) FROM sqlite_master WHERE type == \"table\" AND name NOT LIKE \"sqlite%\";", [&](sqlite3_stmt *getstmt) {
@@ -1276,11 +1761,16 @@ bool dbconn::Init(const std::string &filename /*UTF-8*/) {
 			syncdb = 0;
 		};
 
+		if (table_count > 0) {
+			startup_dirty_flag = SyncReadDirtyFlag(syncdb);
+		}
+
 		res = sqlite3_exec(syncdb, startup_sql, 0, 0, 0);
 		if (res != SQLITE_OK) {
 			db_startup_fatal();
 			return false;
 		}
+		session_dirty_flag = SyncReadDirtyFlag(syncdb);
 
 		if (table_count <= 0) {
 			// This is a new DB, no need to do update check, just write version
@@ -1305,54 +1795,55 @@ bool dbconn::Init(const std::string &filename /*UTF-8*/) {
 			syncdb = 0;
 			return false;
 		}
+		startup_dirty_flag = SyncReadDirtyFlag(syncdb);
 	}
 
 	LogMsgFormat(LOGT::DBINFO, "dbconn::Init(): About to read in state from database");
 
+	SyncReadInIdSnapshot(syncdb);
 	SyncReadInAllUserIDs(syncdb);
 	SyncReadInUserDMIndexes(syncdb);
 	AccountSync(syncdb);
 	ReadAllCFGIn(syncdb, gc, alist);
+	SyncReadInZstdDictionaries(syncdb);
+	SyncSetupSearchIndex(syncdb);
 	SortAccounts();
 	SyncReadInRBFSs(syncdb);
 	SyncReadInHandleNewPendingOps(syncdb);
 	SyncReadInAllMediaEntities(syncdb);
 	SyncReadInAllTweetIDs(syncdb);
+	idsnapshot.reset();
 	SyncPurgeOldTweets(syncdb);
+	SyncCheckPurgeUnreferencedTweetsDue(syncdb);
 	SyncReadInTpanels(syncdb);
 	SyncReadInWindowLayout(syncdb);
 	SyncReadInUserRelationships(syncdb);
 	SyncPostUserLoadCompletion();
 
+	bool use_wal = false;
+	if (!gc.readonlymode) {
+		use_wal = SyncSetupJournalMode(syncdb);
+	}
+	bool use_read_pool = use_wal && gc.dbreadpoolthreads > 0;
+
 	LogMsgFormat(LOGT::DBINFO, "dbconn::Init(): State read in from database complete, about to create database thread");
 
 	th = new dbiothread();
 	th->filename = filename;
 	th->db = syncdb;
 	th->dbc = this;
+	th->group_commit_max_msgs = std::max<unsigned long>(gc.dbgroupcommitmaxmsgs, 1);
+	th->group_commit_max_time = std::chrono::milliseconds(gc.dbgroupcommitmaxms);
 	syncdb = 0;
 
-#ifdef __WINDOWS__
-	iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1);
-	th->iocp = iocp;
-	if (!iocp) {
-		wxMessageDialog(0, wxT("DB IOCP creation failed."));
-		sqlite3_close(syncdb);
-		syncdb = 0;
-		return false;
-	}
-#else
-	int pipepair[2];
-	int result = pipe(pipepair);
-	if (result < 0) {
-		wxMessageDialog(0, wxString::Format(wxT("DB pipe creation failed: %d, %s"), errno, wxstrstd(strerror(errno)).c_str()));
-		sqlite3_close(syncdb);
-		syncdb = 0;
+	if (!queue.Init()) {
+		wxMessageDialog(0, wxT("DB message queue creation failed."));
+		sqlite3_close(th->db);
+		delete th;
+		th = nullptr;
 		return false;
 	}
-	th->pipefd = pipepair[0];
-	this->pipefd = pipepair[1];
-#endif
+	th->queue = &queue;
 	th->Create();
 #if defined(__GLIBC__)
 #if __GLIBC_PREREQ(2, 12)
@@ -1362,13 +1853,34 @@ bool dbconn::Init(const std::string &filename /*UTF-8*/) {
 	th->Run();
 	LogMsgFormat(LOGT::DBINFO | LOGT::THREADTRACE, "dbconn::Init(): Created database thread: %d", th->GetId());
 
+	if (use_read_pool) {
+		readpool.reset(new dbreadpool);
+		readpool->dbc = this;
+		if (!readpool->Init(filename, gc.dbreadpoolthreads)) {
+			readpool.reset();
+		}
+	}
+
+	if (use_wal && gc.dbwalcheckpointintervalsecs > 0) {
+		walcheckpointer.reset(new dbwalcheckpointer);
+		if (!walcheckpointer->Init(filename, gc.dbwalcheckpointintervalsecs)) {
+			walcheckpointer.reset();
+		}
+	}
+
 	asyncstateflush_timer.reset(new wxTimer(this, DBCONNTIMER_ID_ASYNCSTATEWRITE));
 	asyncpurgeoldtweets_timer.reset(new wxTimer(this, DBCONNTIMER_ID_ASYNCPURGEOLDTWEETS));
+	zstdmaintenance_timer.reset(new wxTimer(this, DBCONNTIMER_ID_ZSTDMAINTENANCE));
+	searchindex_timer.reset(new wxTimer(this, DBCONNTIMER_ID_SEARCHINDEX));
 	ResetAsyncStateWriteTimer();
 	ResetPurgeOldTweetsTimer();
+	ResetZstdMaintenanceTimer(60 * 1000);
+	ResetSearchIndexTimer(30 * 1000);
 
 	dbc_flags |= DBCF::INITED;
 
+	AsyncPurgeUnreferencedTweets();
+
 	for (auto &it : post_init_callbacks) {
 		it(this);
 	}
@@ -1382,24 +1894,33 @@ void dbconn::DeInit() {
 
 	asyncstateflush_timer.reset();
 	asyncpurgeoldtweets_timer.reset();
+	zstdmaintenance_timer.reset();
+	searchindex_timer.reset();
 
 	FlushBatchQueue();
 
 	dbc_flags &= ~DBCF::INITED;
 
+	if (readpool) {
+		LogMsg(LOGT::DBINFO | LOGT::THREADTRACE, "dbconn::DeInit: About to terminate database read threads");
+		readpool->DeInit();
+		readpool.reset();
+	}
+
+	if (walcheckpointer) {
+		walcheckpointer->DeInit();
+		walcheckpointer.reset();
+	}
+
 	LogMsg(LOGT::DBINFO | LOGT::THREADTRACE, "dbconn::DeInit: About to terminate database thread and write back state");
 
 	SendMessage(std::unique_ptr<dbsendmsg>(new dbsendmsg(DBSM::QUIT)));
 
-	#ifdef __WINDOWS__
-	CloseHandle(iocp);
-	#else
-	close(pipefd);
-	#endif
 	LogMsg(LOGT::DBINFO | LOGT::THREADTRACE, "dbconn::DeInit(): Waiting for database thread to terminate");
 	th->Wait();
 	syncdb = th->db;
 	delete th;
+	queue.DeInit();
 
 	LogMsg(LOGT::DBINFO | LOGT::THREADTRACE, "dbconn::DeInit(): Database thread terminated");
 
@@ -1423,7 +1944,6 @@ void dbconn::DeInit() {
 	if (!gc.readonlymode) {
 		cache.BeginTransaction(syncdb);
 	}
-	SyncPurgeUnreferencedTweets(syncdb); //this does a dry-run in read-only mode
 	if (!gc.readonlymode) {
 		WriteAllCFGOut(syncdb, gc, alist);
 		SyncWriteBackAllUsers(syncdb);
@@ -1435,6 +1955,7 @@ void dbconn::DeInit() {
 		SyncWriteBackUserRelationships(syncdb);
 		SyncWriteBackUserDMIndexes(syncdb);
 		SyncWriteBackTweetIDIndexCache(syncdb);
+		SyncWriteIdSnapshot(syncdb);
 		SyncClearDirtyFlag(syncdb);
 	}
 	SyncPurgeMediaEntities(syncdb); //this does a dry-run in read-only mode
@@ -1531,7 +2052,13 @@ void dbconn::AsyncWriteBackState() {
 
 		FlushBatchQueue();
 
+		// Users are written back in their own message, as read pool jobs need to wait for this, but not for the remainder
+		std::unique_ptr<dbfunctionmsg> usermsg(new dbfunctionmsg);
+		AsyncWriteBackAllUsers(*usermsg);
+		SendMessage(std::move(usermsg));
+
 		std::unique_ptr<dbfunctionmsg> msg(new dbfunctionmsg);
+		msg->msg_flags |= DBSMF::NO_READ_DEPENDENCY;
 		auto cfg_closure = WriteAllCFGOutClosure(gc, alist, true);
 		msg->funclist.emplace_back([cfg_closure](sqlite3 *db, bool &ok, dbpscache &cache) {
 			TSLogMsg(LOGT::DBTRACE, "dbconn::AsyncWriteBackState: CFG write start");
@@ -1539,7 +2066,6 @@ void dbconn::AsyncWriteBackState() {
 			cfg_closure(twfc);
 			TSLogMsg(LOGT::DBTRACE, "dbconn::AsyncWriteBackState: CFG write end");
 		});
-		AsyncWriteBackAllUsers(*msg);
 		AsyncWriteBackAccountIdLists(*msg);
 		AsyncWriteOutRBFSs(*msg);
 		AsyncWriteOutHandleNewPendingOps(*msg);
@@ -1549,6 +2075,8 @@ void dbconn::AsyncWriteBackState() {
 
 		SendMessage(std::move(msg));
 
+		AsyncWriteIdSnapshot();
+
 		LogMsg(LOGT::DBINFO, "dbconn::AsyncWriteBackState: message sent to DB thread");
 	}
 
@@ -1582,6 +2110,9 @@ void dbconn::InsertNewTweet(tweet_ptr_p tobj, std::string statjson, optional_obs
 	msg->user2 = tobj->user_recipient ? tobj->user_recipient->id : 0;
 	msg->timestamp = tobj->createtime;
 	msg->flags = tobj->flags.ToULLong();
+	if (search_index_enabled) {
+		msg->search_text = tobj->text;
+	}
 
 	msg->xref_tweet_ids = tobj->quoted_tweet_ids;
 	msg->xref_tweet_ids.push_back(tobj->in_reply_to_status_id);
@@ -1618,9 +2149,14 @@ void dbconn::InsertUser(udc_ptr_p u, optional_observer_ptr<dbsendmsg_list> msgli
 	msg->createtime = u->user.createtime;
 	msg->lastupdate = u->lastupdate;
 	msg->cached_profile_img_hash = u->cached_profile_img_sha1;
+	msg->cached_profile_img_validators = u->cached_profile_img_validators;
 	msg->mentionindex = settocompressedblob_desc(u->mention_set);
 	u->lastupdate_wrotetodb = u->lastupdate;
 	msg->profile_img_last_used = u->profile_img_last_used;
+	if (search_index_enabled) {
+		msg->search_fields.reset(new dbsearchuserfields());
+		DBSearchFillUserFields(*(msg->search_fields), u->user);
+	}
 	u->profile_img_last_used_db = u->profile_img_last_used;
 	u->udc_flags |= UDC::SAVED_IN_DB;
 	SendMessageBatchedOrAddToList(std::move(msg), msglist);
@@ -1705,17 +2241,42 @@ void dbconn::AccountSync(sqlite3 *adb) {
 		uint64_t userid = (uint64_t) sqlite3_column_int64(getstmt, 4);
 		ta->usercont = SyncReadInUser(adb, userid);
 		ta->dispname = wxString::FromUTF8((const char*) sqlite3_column_text(getstmt, 5));
+		ta->written_dispname = stdstrwx(ta->dispname);
 
 		LogMsgFormat(LOGT::DBINFO, "dbconn::AccountSync: Found account: dbindex: %d, "
 				"name: %s, tweet IDs: %u, DM IDs: %u, blocked IDs: %u, muted IDs: %u, no RT IDs: %u",
 				id, cstr(name), ta->tweet_ids.size(), ta->dm_ids.size(), ta->blocked_users.size(), ta->muted_users.size(), ta->no_rt_users.size());
 	}, "dbconn::AccountSync");
-	LogMsgFormat(LOGT::DBINFO, "dbconn::AccountSync end, total: %u IDs", total);
+
+	// Apply IDs which were journalled since the tweet/DM ID lists were last written in full, see WriteBackAccountIdLists
+	unsigned int journal_total = 0;
+	DBRowExec(adb, "SELECT accid, type, ids FROM accidjournal;", [&](sqlite3_stmt *getstmt) {
+		std::shared_ptr<taccount> ta;
+		if (!GetAccByDBIndex((unsigned int) sqlite3_column_int(getstmt, 0), ta)) {
+			return;
+		}
+		bool isdm = (sqlite3_column_int(getstmt, 1) == ACCIDJOURNAL_DM_IDS);
+		tweetidset &ids = isdm ? ta->dm_ids : ta->tweet_ids;
+		tweetidset_journal &journal = isdm ? ta->dm_ids_journal : ta->tweet_ids_journal;
+		size_t count = 0;
+		setfromcompressedblob_generic([&](uint64_t id) {
+			ids.insert(id);
+			count++;
+		}, getstmt, 2);
+		journal.written_entries++;
+		journal.written_ids += count;
+		journal_total += count;
+	}, "dbconn::AccountSync (journal)");
+	LogMsgFormat(LOGT::DBINFO, "dbconn::AccountSync end, total: %u IDs, of which %u journalled", total + journal_total, journal_total);
 }
 
 struct tweet_scan_dynjson_parser {
 	std::vector<observer_ptr<taccount>> accs;
 
+	// These are indexed by account DB index, parse() only modifies these, such that it can be used from scan threads
+	std::vector<tweetidset> tweet_ids;
+	std::vector<tweetidset> dm_ids;
+
 	tweet_scan_dynjson_parser() {
 		for (auto &it : alist) {
 			if (it->dbindex >= accs.size()) {
@@ -1723,6 +2284,8 @@ struct tweet_scan_dynjson_parser {
 			}
 			accs[it->dbindex] = it.get();
 		}
+		tweet_ids.resize(accs.size());
+		dm_ids.resize(accs.size());
 	}
 
 	void parse(uint64_t id, sqlite3_stmt* stmt, int col_num, bool isdm) {
@@ -1740,9 +2303,9 @@ struct tweet_scan_dynjson_parser {
 					if (tweet_perspective::IsFlagsArrivedHere(flags)) {
 						if (dbindex < accs.size() && accs[dbindex]) {
 							if (isdm) {
-								accs[dbindex]->dm_ids.insert(id);
+								dm_ids[dbindex].insert(id);
 							} else {
-								accs[dbindex]->tweet_ids.insert(id);
+								tweet_ids[dbindex].insert(id);
 							}
 						}
 					}
@@ -1750,6 +2313,18 @@ struct tweet_scan_dynjson_parser {
 			}
 		}
 	}
+
+	// This must be called from the main thread
+	void apply() {
+		for (size_t i = 0; i < accs.size(); i++) {
+			if (accs[i]) {
+				accs[i]->tweet_ids_journal.Insert(accs[i]->tweet_ids, tweet_ids[i].begin(), tweet_ids[i].end());
+				accs[i]->dm_ids_journal.Insert(accs[i]->dm_ids, dm_ids[i].begin(), dm_ids[i].end());
+			}
+			tweet_ids[i].clear();
+			dm_ids[i].clear();
+		}
+	}
 };
 
 struct tweet_scan_statjson_parser {
@@ -1784,58 +2359,209 @@ struct tweet_scan_statjson_parser {
 		}
 	}
 
-	void execute(sqlite3 *syncdb, dbpscache &cache) {
-		auto select = DBInitialiseSql(syncdb, "SELECT mentionindex FROM users WHERE id == ?;");
-		auto update = DBInitialiseSql(syncdb, "UPDATE users SET mentionindex = ? WHERE id == ?;");
-
-		for (auto &it : user_mention_insert_map) {
-			uint64_t id = it.first;
-			optional_udc_ptr u = ad.GetExistingUserContainerById(id);
-			if (u && u->udc_flags & UDC::SAVED_IN_DB) {
-				u->mention_set.insert(it.second.begin(), it.second.end());
-				u->lastupdate_wrotetodb = 0;		//force flush of user to DB
-			} else if (!gc.readonlymode) {
-				// read and write back to DB
-				cache.BeginTransaction(syncdb);
-				DBBindRowExec(syncdb, select.stmt(),
-					[&](sqlite3_stmt *getstmt) {
-						sqlite3_bind_int64(getstmt, 1, (sqlite3_int64) id);
-					},
-					[&](sqlite3_stmt *getstmt) {
-						tweetidset ids;
-						setfromcompressedblob(ids, getstmt, 0);
+	void merge(tweet_scan_statjson_parser &&other) {
+		for (auto &it : other.user_mention_insert_map) {
+			tweetidset &idset = user_mention_insert_map[it.first];
+			if (idset.empty()) {
+				idset = std::move(it.second);
+			} else {
+				idset.insert(it.second.begin(), it.second.end());
+			}
+		}
+		other.user_mention_insert_map.clear();
+	}
+
+	void execute(sqlite3 *syncdb, dbpscache &cache) {
+		auto select = DBInitialiseSql(syncdb, "SELECT mentionindex FROM users WHERE id == ?;");
+		auto update = DBInitialiseSql(syncdb, "UPDATE users SET mentionindex = ? WHERE id == ?;");
+
+		for (auto &it : user_mention_insert_map) {
+			uint64_t id = it.first;
+			optional_udc_ptr u = ad.GetExistingUserContainerById(id);
+			if (u && u->udc_flags & UDC::SAVED_IN_DB) {
+				u->mention_set.insert(it.second.begin(), it.second.end());
+				u->lastupdate_wrotetodb = 0;		//force flush of user to DB
+			} else if (!gc.readonlymode) {
+				// read and write back to DB
+				cache.BeginTransaction(syncdb);
+				DBBindRowExec(syncdb, select.stmt(),
+					[&](sqlite3_stmt *getstmt) {
+						sqlite3_bind_int64(getstmt, 1, (sqlite3_int64) id);
+					},
+					[&](sqlite3_stmt *getstmt) {
+						tweetidset ids;
+						setfromcompressedblob(ids, getstmt, 0);
+
+						ids.insert(it.second.begin(), it.second.end());
+
+						DBBindExec(syncdb, update.stmt(),
+							[&](sqlite3_stmt *setstmt) {
+								sqlite3_bind_int64(setstmt, 1, (sqlite3_int64) id);
+								bind_compressed(setstmt, 2, settocompressedblob_desc(ids));
+							},
+							"tweet_scan_statjson_parser::execute (update)"
+						);
+					},
+					"tweet_scan_statjson_parser::execute (select)"
+				);
+				cache.EndTransaction(syncdb);
+			}
+		}
+	}
+};
+
+namespace {
+	// One ID range of a full tweets table scan, this is processed on its own thread and DB connection
+	struct tweet_scan_partition {
+		sqlite3_int64 upper_id;           // inclusive
+		sqlite3_int64 lower_id;           // exclusive
+		bool done = false;
+
+		std::vector<uint64_t> ids;        // descending order
+		cached_id_sets cids;
+		std::vector<std::pair<uint64_t, uint64_t> > dm_users;    // tweet ID, user ID
+		tweet_scan_dynjson_parser tsdp;
+		tweet_scan_statjson_parser tssp;
+
+		void scan(sqlite3 *db) {
+			DBBindRowExec(db, "SELECT id, flags, dynjson, statjson, userid, userrecipid FROM tweets WHERE id <= ? AND id > ? ORDER BY id DESC;",
+				[&](sqlite3_stmt *getstmt) {
+					sqlite3_bind_int64(getstmt, 1, upper_id);
+					sqlite3_bind_int64(getstmt, 2, lower_id);
+				},
+				[&](sqlite3_stmt *getstmt) {
+					uint64_t id = (uint64_t) sqlite3_column_int64(getstmt, 0);
+					ids.push_back(id);
+
+					uint64_t flags = (uint64_t) sqlite3_column_int64(getstmt, 1);
+					cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
+						if (flags & flagvalue) {
+							(cids.*mptr).insert((cids.*mptr).end(), id);
+						}
+					});
+
+					bool isdm = flags & tweet_flags::GetFlagValue('D');
+					tsdp.parse(id, getstmt, 2, isdm);
+					tssp.parse(id, getstmt, 3);
+					if (isdm) {
+						for (int col_num = 4; col_num <= 5; col_num++) {
+							uint64_t user_id = (uint64_t) sqlite3_column_int64(getstmt, col_num);
+							if (user_id) {
+								dm_users.emplace_back(id, user_id);
+							}
+						}
+					}
+				},
+				"tweet_scan_partition::scan"
+			);
+			done = true;
+		}
+	};
+}
+
+// This scans the whole tweets table, to rebuild the tweet ID sets, CIDS sets, account tweet/DM ID sets and DM indexes
+// The table is split into ID ranges of roughly equal row count, which are each scanned on their own read-only connection and thread
+// The results are then merged in ID order on the calling (main) thread
+void dbconn::SyncScanTweetsTable(sqlite3 *syncdb, tweet_scan_statjson_parser &tssp) {
+	uint64_t row_count = 0;
+	DBRowExec(syncdb, "SELECT COUNT(*) FROM tweets;", [&](sqlite3_stmt *getstmt) {
+		row_count = (uint64_t) sqlite3_column_int64(getstmt, 0);
+	}, "dbconn::SyncScanTweetsTable (count)");
+
+	unsigned int partition_count = 1;
+	if (row_count >= 10000 && !db_filename.empty()) {
+		partition_count = std::max(std::min(std::thread::hardware_concurrency(), 16U), 1U);
+	}
+
+	// Partitions are in descending ID order
+	std::vector<std::unique_ptr<tweet_scan_partition> > partitions;
+	sqlite3_int64 upper_id = std::numeric_limits<sqlite3_int64>::max();
+	for (unsigned int i = 1; i <= partition_count; i++) {
+		sqlite3_int64 lower_id = std::numeric_limits<sqlite3_int64>::min();
+		if (i < partition_count) {
+			DBBindRowExec(syncdb, "SELECT id FROM tweets ORDER BY id DESC LIMIT 1 OFFSET ?;",
+				[&](sqlite3_stmt *getstmt) {
+					sqlite3_bind_int64(getstmt, 1, (sqlite3_int64) ((row_count * i) / partition_count));
+				},
+				[&](sqlite3_stmt *getstmt) {
+					lower_id = sqlite3_column_int64(getstmt, 0);
+				},
+				"dbconn::SyncScanTweetsTable (partition)"
+			);
+		}
+		partitions.emplace_back(new tweet_scan_partition());
+		partitions.back()->upper_id = upper_id;
+		partitions.back()->lower_id = lower_id;
+		upper_id = lower_id;
+	}
+
+	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncScanTweetsTable: scanning %" llFmtSpec "u rows in %u partitions", (unsigned long long) row_count, partition_count);
+
+	if (partition_count > 1) {
+		std::vector<std::thread> threads;
+		for (auto &it : partitions) {
+			tweet_scan_partition *p = it.get();
+			std::string filename = db_filename;
+			threads.emplace_back([p, filename]() {
+				sqlite3 *db = nullptr;
+				int res = sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+				if (res != SQLITE_OK) {
+					TSLogMsgFormat(LOGT::DBERR, "dbconn::SyncScanTweetsTable: Could not open read-only database connection, got error: %d (%s)",
+							res, cstr(sqlite3_errmsg(db)));
+				} else {
+					sqlite3_busy_handler(db, &busy_handler_callback, 0);
+					p->scan(db);
+				}
+				sqlite3_close(db);
+			});
+		}
+		for (auto &it : threads) {
+			it.join();
+		}
+	}
 
-						ids.insert(it.second.begin(), it.second.end());
+	for (auto &it : partitions) {
+		tweet_scan_partition &p = *it;
+		if (!p.done) {
+			// Single partition, or the scan thread could not open a connection
+			p.scan(syncdb);
+		}
 
-						DBBindExec(syncdb, update.stmt(),
-							[&](sqlite3_stmt *setstmt) {
-								sqlite3_bind_int64(setstmt, 1, (sqlite3_int64) id);
-								bind_compressed(setstmt, 2, settocompressedblob_desc(ids));
-							},
-							"tweet_scan_statjson_parser::execute (update)"
-						);
-					},
-					"tweet_scan_statjson_parser::execute (select)"
-				);
-				cache.EndTransaction(syncdb);
+		for (uint64_t id : p.ids) {
+			ad.unloaded_db_tweet_ids.insert(ad.unloaded_db_tweet_ids.end(), id);
+		}
+		cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
+			tweetidset &target = ad.cids.*mptr;
+			for (uint64_t id : p.cids.*mptr) {
+				target.insert(target.end(), id);
 			}
+		});
+		p.tsdp.apply();
+		tssp.merge(std::move(p.tssp));
+		for (auto &dm : p.dm_users) {
+			ad.GetUserDMIndexById(dm.second).AddDMId(dm.first);
+			SyncReadInUser(syncdb, dm.second);
 		}
+		it.reset();
 	}
-};
+}
 
 // This must be called after SyncReadInUserDMIndexes
 void dbconn::SyncReadInAllTweetIDs(sqlite3 *syncdb) {
 	LogMsg(LOGT::DBINFO, "dbconn::SyncReadInAllTweetIDs start");
 
-	DBBindRowExec(syncdb, cache.GetStmt(syncdb, DBPSC_SELSTATICSETTING),
-		[&](sqlite3_stmt *getstmt) {
-			sqlite3_bind_text(getstmt, 1, "tweetidsetcache", -1, SQLITE_STATIC);
-		},
-		[&](sqlite3_stmt *getstmt) {
-			setfromcompressedblob(ad.unloaded_db_tweet_ids, getstmt, 0);
-		},
-		"dbconn::SyncReadInAllTweetIDs (cache load)"
-	);
+	bool from_snapshot = SyncLoadTweetIdsFromSnapshot();
+	if (!from_snapshot) {
+		DBBindRowExec(syncdb, cache.GetStmt(syncdb, DBPSC_SELSTATICSETTING),
+			[&](sqlite3_stmt *getstmt) {
+				sqlite3_bind_text(getstmt, 1, "tweetidsetcache", -1, SQLITE_STATIC);
+			},
+			[&](sqlite3_stmt *getstmt) {
+				setfromcompressedblob(ad.unloaded_db_tweet_ids, getstmt, 0);
+			},
+			"dbconn::SyncReadInAllTweetIDs (cache load)"
+		);
+	}
 
 	tweetidset incremental_ids;
 
@@ -1851,34 +2577,17 @@ void dbconn::SyncReadInAllTweetIDs(sqlite3 *syncdb) {
 		exec(5);
 	};
 
-	if (ad.unloaded_db_tweet_ids.empty() || gc.rescan_tweets_table) {
+	if (!from_snapshot && (ad.unloaded_db_tweet_ids.empty() || gc.rescan_tweets_table)) {
 		// Didn't find any cache
 		LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInAllTweetIDs table scan");
 
 		cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
 			(ad.cids.*mptr).clear();
 		});
+		ad.cids_journal.Modified();
 
-		tweet_scan_dynjson_parser tsdp;
 		tweet_scan_statjson_parser tssp;
-
-		DBRowExec(syncdb, "SELECT id, flags, dynjson, statjson, userid, userrecipid FROM tweets ORDER BY id DESC;", [&](sqlite3_stmt *getstmt) {
-			uint64_t id = (uint64_t) sqlite3_column_int64(getstmt, 0);
-			ad.unloaded_db_tweet_ids.insert(ad.unloaded_db_tweet_ids.end(), id);
-
-			uint64_t flags = (uint64_t) sqlite3_column_int64(getstmt, 1);
-			cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
-				if (flags & flagvalue) {
-					(ad.cids.*mptr).insert(id);
-				}
-			});
-
-			tsdp.parse(id, getstmt, 2, flags & tweet_flags::GetFlagValue('D'));
-			tssp.parse(id, getstmt, 3);
-			if (flags & tweet_flags::GetFlagValue('D')) {
-				add_dm_index(id, getstmt);
-			}
-		}, "dbconn::SyncReadInAllTweetIDs (table scan)");
+		SyncScanTweetsTable(syncdb, tssp);
 
 		if (!gc.readonlymode) {
 			cache.BeginTransaction(syncdb);
@@ -1889,7 +2598,10 @@ void dbconn::SyncReadInAllTweetIDs(sqlite3 *syncdb) {
 		}
 		tssp.execute(syncdb, cache);
 	} else {
-		SyncReadInCIDSLists(syncdb);
+		if (!from_snapshot) {
+			SyncReadInCIDSLists(syncdb);
+		}
+		SyncReadInCIDSJournal(syncdb, !from_snapshot);
 
 		DBRowExec(syncdb, "SELECT id FROM incrementaltweetids ORDER BY id DESC;", [&](sqlite3_stmt *getstmt) {
 			incremental_ids.insert(incremental_ids.end(), (uint64_t) sqlite3_column_int64(getstmt, 0));
@@ -1897,6 +2609,7 @@ void dbconn::SyncReadInAllTweetIDs(sqlite3 *syncdb) {
 		if (!incremental_ids.empty()) {
 			tweet_scan_dynjson_parser tsdp;
 			tweet_scan_statjson_parser tssp;
+			tweetidset found_ids;
 
 			DBRangeBindRowExec(
 				syncdb, "SELECT id, flags, dynjson, statjson, userid, userrecipid FROM tweets WHERE id == ?;", incremental_ids.begin(), incremental_ids.end(),
@@ -1906,13 +2619,14 @@ void dbconn::SyncReadInAllTweetIDs(sqlite3 *syncdb) {
 				[&](sqlite3_stmt *getstmt) {
 					uint64_t id = (uint64_t) sqlite3_column_int64(getstmt, 0);
 					ad.unloaded_db_tweet_ids.insert(ad.unloaded_db_tweet_ids.end(), id);
+					found_ids.insert(found_ids.end(), id);
 
 					uint64_t flags = (uint64_t) sqlite3_column_int64(getstmt, 1);
 					cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
 						if (flags & flagvalue) {
-							(ad.cids.*mptr).insert(id);
+							ad.cids_journal.Get(mptr).Insert(ad.cids.*mptr, id);
 						} else {
-							(ad.cids.*mptr).erase(id);
+							ad.cids_journal.Get(mptr).Erase(ad.cids.*mptr, id);
 						}
 					});
 
@@ -1925,12 +2639,23 @@ void dbconn::SyncReadInAllTweetIDs(sqlite3 *syncdb) {
 				"dbconn::SyncReadInAllTweetIDs (incrementaltweetids)"
 			);
 
+			// Incremental IDs which are no longer in the tweets table have been deleted by the garbage collector
+			for (uint64_t id : incremental_ids) {
+				if (found_ids.find(id) == found_ids.end()) {
+					ad.unloaded_db_tweet_ids.erase(id);
+					cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
+						ad.cids_journal.Get(mptr).Erase(ad.cids.*mptr, id);
+					});
+				}
+			}
+
+			tsdp.apply();
 			tssp.execute(syncdb, cache);
 		}
 	}
 
-	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInAllTweetIDs end, read: incremental %zu, total: %zu",
-			incremental_ids.size(), ad.unloaded_db_tweet_ids.size());
+	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInAllTweetIDs end, read: incremental %zu, total: %zu, from snapshot: %d",
+			incremental_ids.size(), ad.unloaded_db_tweet_ids.size(), from_snapshot);
 }
 
 void dbconn::MergeTweetIdSets() {
@@ -1984,6 +2709,41 @@ void dbconn::SyncReadInCIDSLists(sqlite3 *adb) {
 	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInCIDSLists end, total: %u IDs", total);
 }
 
+// This applies the changes which were journalled since the CIDS lists were last written in full, see WriteBackCIDSLists
+// If apply is false, the lists have been loaded from elsewhere (the ID snapshot) and already include these, so the journal is only counted
+// This is called by SyncReadInAllTweetIDs
+void dbconn::SyncReadInCIDSJournal(sqlite3 *adb, bool apply) {
+	unsigned int entries = 0;
+	size_t total = 0;
+	DBRowExec(adb, "SELECT name, type, ids FROM cidsjournal ORDER BY rowid;", [&](sqlite3_stmt *getstmt) {
+		const char *name = (const char *) sqlite3_column_text(getstmt, 0);
+		bool erased = (sqlite3_column_int(getstmt, 1) == CIDSJOURNAL_ERASED);
+		cached_id_sets::IterateLists([&](const char *listname, tweetidset cached_id_sets::*ptr, unsigned long long tweetflag) {
+			if (!name || strcmp(name, listname) != 0) {
+				return;
+			}
+			tweetidset &set = ad.cids.*ptr;
+			size_t count = 0;
+			setfromcompressedblob_generic([&](uint64_t id) {
+				if (apply) {
+					if (erased) {
+						set.erase(id);
+					} else {
+						set.insert(id);
+					}
+				}
+				count++;
+			}, getstmt, 2);
+			tweetidset_journal &journal = ad.cids_journal.Get(ptr);
+			journal.written_entries++;
+			journal.written_ids += count;
+			entries++;
+			total += count;
+		});
+	}, "dbconn::SyncReadInCIDSJournal");
+	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInCIDSJournal: %u entries, %zu IDs, applied: %d", entries, total, apply);
+}
+
 namespace {
 	template <typename T> struct WriteBackOutputter {
 		std::shared_ptr<T> data;
@@ -2006,6 +2766,7 @@ namespace {
 	};
 
 	//Where T looks like WriteBackCIDSLists et al.
+	//The item generator runs on the main thread, so should only take snapshots of state, encoding and compression is left to dbexec
 	template <typename T> void DoGenericAsyncWriteBack(dbfunctionmsg &msg, T obj, std::string funcname) {
 		auto items = std::make_shared<std::vector<typename T::itemdata> >();
 		obj([&](typename T::itemdata data) {
@@ -2015,22 +2776,71 @@ namespace {
 			obj.dbexec(db, cache, funcname, true, MakeWriteBackOutputter(items));
 		});
 	};
+
+	// Tweet ID sets which have a tweetidset_journal are written in full when they are first written, and then periodically thereafter.
+	// In between, only the journalled changes are written, as rows of a journal table which are applied when the set is read in.
+	// A full write (compaction) deletes the set's journal rows in the same transaction.
+	const unsigned int idjournal_max_entries = 32;
+	const size_t idjournal_max_ids_ratio = 4; // full write if the journalled IDs are more than 1/4 of the size of the set
+
+	bool IdJournalNeedsFullWrite(const tweetidset_journal &journal, const tweetidset &ids) {
+		return journal.full_rewrite || journal.written_entries >= idjournal_max_entries ||
+				(journal.written_ids + journal.PendingIds()) * idjournal_max_ids_ratio > ids.size();
+	}
 };
 
 namespace {
+	// The CIDS lists are journalled in cidsjournal, see IdJournalNeedsFullWrite
+	// Journal rows are applied in rowid order by SyncReadInCIDSJournal
+	// Lists which have not changed since they were last written are skipped, if full is true all other lists are written in full
 	struct WriteBackCIDSLists {
+		bool full;
+
+		WriteBackCIDSLists(bool full_) : full(full_) { }
+
 		struct itemdata {
 			const char *name;
-			db_bind_buffer_persistent<dbb_compressed> index;
-			size_t list_size;
+			bool full_write;
+
+			// If full_write is false, ids are the journalled IDs which are now in the list, and removed_ids are those which are not
+			tweetidset_snapshot ids;
+			tweetidset_snapshot removed_ids;
 		};
 
 		//Where F is a functor of the form void(itemdata &&)
-		//F must free() itemdata::index
 		template <typename F> void operator()(F func) const {
-			cached_id_sets::IterateLists([&](const char *name, const tweetidset cached_id_sets::*ptr, unsigned long long tweetflag) {
-				const tweetidset &tlist = ad.cids.*ptr;
-				func(itemdata { name, settocompressedblob_desc(tlist), tlist.size() });
+			cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*ptr, unsigned long long tweetflag) {
+				const tweetidset &set = ad.cids.*ptr;
+				tweetidset_journal &journal = ad.cids_journal.Get(ptr);
+				if (!journal.IsDirty() && !(full && journal.written_entries)) {
+					return;
+				}
+
+				itemdata data;
+				data.name = name;
+				data.full_write = full || IdJournalNeedsFullWrite(journal, set);
+				if (data.full_write) {
+					data.ids = TweetIdSetSnapshot(set);
+				} else {
+					// An ID may have been inserted and erased any number of times, only whether it is now in the set matters
+					std::vector<uint64_t> changed = std::move(journal.added);
+					changed.insert(changed.end(), journal.removed.begin(), journal.removed.end());
+					std::sort(changed.begin(), changed.end(), std::greater<uint64_t>());
+					changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+					for (uint64_t id : changed) {
+						if (set.find(id) != set.end()) {
+							data.ids.push_back(id);
+						} else {
+							data.removed_ids.push_back(id);
+						}
+					}
+					if (!changed.empty()) {
+						journal.written_entries++;
+						journal.written_ids += changed.size();
+					}
+				}
+				journal.MarkWritten(data.full_write);
+				func(std::move(data));
 			});
 		};
 
@@ -2041,77 +2851,134 @@ namespace {
 			sqlite3_stmt *setstmt = cache.GetStmt(adb, DBPSC_INSSTATICSETTING);
 
 			unsigned int total = 0;
+			unsigned int full_count = 0;
+			unsigned int journal_count = 0;
 			getfunc([&](itemdata &&data) {
+				total += data.ids.size() + data.removed_ids.size();
+
+				if (!data.full_write) {
+					journal_count++;
+					auto add_journal = [&](const tweetidset_snapshot &ids, int type) {
+						if (ids.empty()) return;
+						DBBindExec(adb, cache.GetStmt(adb, DBPSC_INSCIDSJOURNAL), [&](sqlite3_stmt *stmt) {
+							sqlite3_bind_text(stmt, 1, data.name, -1, SQLITE_STATIC);
+							sqlite3_bind_int(stmt, 2, type);
+							bind_compressed(stmt, 3, settocompressedblob_desc(ids));
+						}, "WriteBackCIDSLists (journal)");
+					};
+					add_journal(data.ids, CIDSJOURNAL_INSERTED);
+					add_journal(data.removed_ids, CIDSJOURNAL_ERASED);
+					SLogMsgFormat(LOGT::DBTRACE, TSLogging, "%s journalled set: %s, inserted: %zu, erased: %zu",
+							cstr(funcname), cstr(data.name), data.ids.size(), data.removed_ids.size());
+					return;
+				}
+
+				full_count++;
 				sqlite3_bind_text(setstmt, 1, data.name, -1, SQLITE_STATIC);
-				bind_compressed(setstmt, 2, std::move(data.index));
+				bind_compressed(setstmt, 2, settocompressedblob_desc(data.ids));
 				int res = sqlite3_step(setstmt);
 				if (res != SQLITE_DONE) {
 					SLogMsgFormat(LOGT::DBERR, TSLogging, "%s got error: %d (%s), for set: %s",
 						cstr(funcname), res, cstr(sqlite3_errmsg(adb)), cstr(data.name));
+				} else {
+					DBBindExec(adb, cache.GetStmt(adb, DBPSC_DELCIDSJOURNAL), [&](sqlite3_stmt *stmt) {
+						sqlite3_bind_text(stmt, 1, data.name, -1, SQLITE_STATIC);
+					}, "WriteBackCIDSLists (clear journal)");
 				}
 				sqlite3_reset(setstmt);
-				total += data.list_size;
 			});
 
 			cache.EndTransaction(adb);
-			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s end, total: %u IDs", cstr(funcname), total);
+			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s end, total: %u IDs, lists written in full: %u, journalled: %u",
+					cstr(funcname), total, full_count, journal_count);
 		}
 	};
 };
 
 void dbconn::SyncWriteBackCIDSLists(sqlite3 *adb) {
-	DoGenericSyncWriteBack(adb, cache, WriteBackCIDSLists(), "dbconn::SyncWriteBackCIDSLists");
+	DoGenericSyncWriteBack(adb, cache, WriteBackCIDSLists(true), "dbconn::SyncWriteBackCIDSLists");
 }
 
 void dbconn::AsyncWriteBackCIDSLists(dbfunctionmsg &msg) {
-	DoGenericAsyncWriteBack(msg, WriteBackCIDSLists(), "dbconn::AsyncWriteBackCIDSLists");
+	DoGenericAsyncWriteBack(msg, WriteBackCIDSLists(false), "dbconn::AsyncWriteBackCIDSLists");
 }
 
 namespace {
+	// The tweet and DM ID lists of an account are journalled in accidjournal, see IdJournalNeedsFullWrite
+	// Journal rows are merged back in by AccountSync.
+	// Changes to the block lists or display name, or erasures from the tweet/DM ID lists, always cause a full write.
+	bool AccountIdListNeedsFullWrite(const tweetidset_journal &journal, const tweetidset &ids) {
+		return !journal.removed.empty() || IdJournalNeedsFullWrite(journal, ids);
+	}
+
+	db_bind_buffer<dbb_compressed> AccountIdJournalBlob(std::vector<uint64_t> &ids) {
+		std::sort(ids.begin(), ids.end(), std::greater<uint64_t>());
+		return settocompressedblob_desc(ids);
+	}
+
 	struct WriteBackAccountIdLists {
+		bool full;
+
+		// If full is true, all accounts which have a journal or have changed are written in full
+		WriteBackAccountIdLists(bool full_) : full(full_) { }
+
 		struct itemdata {
 			std::string dispname;
 			unsigned int dbindex;
 
-			db_bind_buffer_persistent<dbb_compressed> tweet_blob;
-			size_t tweet_count;
-
-			db_bind_buffer_persistent<dbb_compressed> dm_blob;
-			size_t dm_count;
-
-			db_bind_buffer_persistent<dbb_compressed> blocked_blob;
-			size_t blocked_count;
+			// If this is false, tweet_ids and dm_ids are unsorted journal entries, and the remaining snapshots are empty
+			bool full_write;
 
-			db_bind_buffer_persistent<dbb_compressed> muted_blob;
-			size_t muted_count;
-
-			db_bind_buffer_persistent<dbb_compressed> no_rt_blob;
-			size_t no_rt_count;
+			tweetidset_snapshot tweet_ids;
+			tweetidset_snapshot dm_ids;
+			tweetidset_snapshot blocked_ids;
+			tweetidset_snapshot muted_ids;
+			tweetidset_snapshot no_rt_ids;
 		};
 
 		//Where F is a functor of the form void(itemdata &&)
-		//F must free() itemdata::index
 		template <typename F> void operator()(F func) const {
 			for (auto &it : alist) {
-				itemdata data;
-
-				data.tweet_count = it->tweet_ids.size();
-				data.tweet_blob = settocompressedblob_desc(it->tweet_ids);
-
-				data.dm_count = it->dm_ids.size();
-				data.dm_blob = settocompressedblob_desc(it->dm_ids);
-
-				data.blocked_count = it->blocked_users.size();
-				data.blocked_blob = settocompressedblob_desc(it->blocked_users);
-
-				data.muted_count = it->muted_users.size();
-				data.muted_blob = settocompressedblob_desc(it->muted_users);
-
-				data.no_rt_count = it->no_rt_users.size();
-				data.no_rt_blob = settocompressedblob_desc(it->no_rt_users);
+				tweetidset_journal &tweet_journal = it->tweet_ids_journal;
+				tweetidset_journal &dm_journal = it->dm_ids_journal;
+				std::string dispname = stdstrwx(it->dispname);
+				bool row_changed = it->block_lists_generation != it->block_lists_written_generation || dispname != it->written_dispname;
+				bool has_journal = tweet_journal.written_entries || dm_journal.written_entries;
+
+				if (!row_changed && !tweet_journal.IsDirty() && !dm_journal.IsDirty() && !(full && has_journal)) {
+					continue;    //nothing to do for this account
+				}
 
-				data.dispname = stdstrwx(it->dispname);
+				itemdata data;
+				data.dispname = dispname;
 				data.dbindex = it->dbindex;
+				data.full_write = full || row_changed || AccountIdListNeedsFullWrite(tweet_journal, it->tweet_ids) ||
+						AccountIdListNeedsFullWrite(dm_journal, it->dm_ids);
+
+				if (data.full_write) {
+					data.tweet_ids = TweetIdSetSnapshot(it->tweet_ids);
+					data.dm_ids = TweetIdSetSnapshot(it->dm_ids);
+					data.blocked_ids = TweetIdSetSnapshot(it->blocked_users);
+					data.muted_ids = TweetIdSetSnapshot(it->muted_users);
+					data.no_rt_ids = TweetIdSetSnapshot(it->no_rt_users);
+
+					it->block_lists_written_generation = it->block_lists_generation;
+					it->written_dispname = std::move(dispname);
+				} else {
+					data.tweet_ids = std::move(tweet_journal.added);
+					if (!data.tweet_ids.empty()) {
+						tweet_journal.written_entries++;
+						tweet_journal.written_ids += data.tweet_ids.size();
+					}
+
+					data.dm_ids = std::move(dm_journal.added);
+					if (!data.dm_ids.empty()) {
+						dm_journal.written_entries++;
+						dm_journal.written_ids += data.dm_ids.size();
+					}
+				}
+				tweet_journal.MarkWritten(data.full_write);
+				dm_journal.MarkWritten(data.full_write);
 
 				func(std::move(data));
 			}
@@ -2124,42 +2991,66 @@ namespace {
 			sqlite3_stmt *setstmt = cache.GetStmt(adb, DBPSC_UPDATEACCIDLISTS);
 
 			unsigned int total = 0;
+			unsigned int full_count = 0;
+			unsigned int journal_count = 0;
 			getfunc([&](itemdata &&data) {
-				bind_compressed(setstmt, 1, std::move(data.tweet_blob), 'Z');
-				bind_compressed(setstmt, 2, std::move(data.dm_blob), 'Z');
-				bind_compressed(setstmt, 3, std::move(data.blocked_blob), 'Z');
-				bind_compressed(setstmt, 4, std::move(data.muted_blob), 'Z');
-				bind_compressed(setstmt, 5, std::move(data.no_rt_blob), 'Z');
+				total += data.tweet_ids.size() + data.dm_ids.size() + data.blocked_ids.size() + data.muted_ids.size() + data.no_rt_ids.size();
+
+				if (!data.full_write) {
+					journal_count++;
+					auto add_journal = [&](std::vector<uint64_t> &ids, int type) {
+						if (ids.empty()) return;
+						DBBindExec(adb, cache.GetStmt(adb, DBPSC_INSACCIDJOURNAL), [&](sqlite3_stmt *stmt) {
+							sqlite3_bind_int(stmt, 1, data.dbindex);
+							sqlite3_bind_int(stmt, 2, type);
+							bind_compressed(stmt, 3, AccountIdJournalBlob(ids), 'Z');
+						}, "WriteBackAccountIdLists (journal)");
+					};
+					add_journal(data.tweet_ids, ACCIDJOURNAL_TWEET_IDS);
+					add_journal(data.dm_ids, ACCIDJOURNAL_DM_IDS);
+					SLogMsgFormat(LOGT::DBTRACE, TSLogging, "%s journalled account: dbindex: %d, name: %s, tweet IDs: %zu, DM IDs: %zu",
+							cstr(funcname), data.dbindex, cstr(data.dispname), data.tweet_ids.size(), data.dm_ids.size());
+					return;
+				}
+
+				full_count++;
+				bind_compressed(setstmt, 1, settocompressedblob_desc(data.tweet_ids), 'Z');
+				bind_compressed(setstmt, 2, settocompressedblob_desc(data.dm_ids), 'Z');
+				bind_compressed(setstmt, 3, settocompressedblob_desc(data.blocked_ids), 'Z');
+				bind_compressed(setstmt, 4, settocompressedblob_desc(data.muted_ids), 'Z');
+				bind_compressed(setstmt, 5, settocompressedblob_desc(data.no_rt_ids), 'Z');
 				sqlite3_bind_text(setstmt, 6, data.dispname.c_str(), data.dispname.size(), SQLITE_TRANSIENT);
 				sqlite3_bind_int(setstmt, 7, data.dbindex);
 
-				total += data.tweet_count + data.dm_count + data.blocked_count + data.muted_count + data.no_rt_count;
-
 				int res = sqlite3_step(setstmt);
 				if (res != SQLITE_DONE) {
 					SLogMsgFormat(LOGT::DBERR, TSLogging, "%s got error: %d (%s) for user dbindex: %d, name: %s",
 							cstr(funcname), res, cstr(sqlite3_errmsg(adb)), data.dbindex, cstr(data.dispname));
 				} else {
 					SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s inserted account: dbindex: %d, name: %s, "
-							"tweet IDs: %u, DM IDs: %u, blocked IDs: %u, muted IDs: %u, no RT IDs: %u",
-							cstr(funcname), data.dbindex, cstr(data.dispname), data.tweet_count, data.dm_count, data.blocked_count,
-							data.muted_count, data.no_rt_count);
+							"tweet IDs: %zu, DM IDs: %zu, blocked IDs: %zu, muted IDs: %zu, no RT IDs: %zu",
+							cstr(funcname), data.dbindex, cstr(data.dispname), data.tweet_ids.size(), data.dm_ids.size(), data.blocked_ids.size(),
+							data.muted_ids.size(), data.no_rt_ids.size());
+					DBBindExec(adb, cache.GetStmt(adb, DBPSC_DELACCIDJOURNAL), [&](sqlite3_stmt *stmt) {
+						sqlite3_bind_int(stmt, 1, data.dbindex);
+					}, "WriteBackAccountIdLists (clear journal)");
 				}
 				sqlite3_reset(setstmt);
 			});
 
 			cache.EndTransaction(adb);
-			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s end, total: %u IDs", cstr(funcname), total);
+			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s end, total: %u IDs, accounts written in full: %u, journalled: %u",
+					cstr(funcname), total, full_count, journal_count);
 		}
 	};
 };
 
 void dbconn::SyncWriteBackAccountIdLists(sqlite3 *adb) {
-	DoGenericSyncWriteBack(adb, cache, WriteBackAccountIdLists(), "dbconn::SyncWriteBackAccountIdLists");
+	DoGenericSyncWriteBack(adb, cache, WriteBackAccountIdLists(true), "dbconn::SyncWriteBackAccountIdLists");
 }
 
 void dbconn::AsyncWriteBackAccountIdLists(dbfunctionmsg &msg) {
-	DoGenericAsyncWriteBack(msg, WriteBackAccountIdLists(), "dbconn::AsyncWriteBackAccountIdLists");
+	DoGenericAsyncWriteBack(msg, WriteBackAccountIdLists(false), "dbconn::AsyncWriteBackAccountIdLists");
 }
 
 namespace {
@@ -2168,23 +3059,26 @@ namespace {
 			uint64_t id;
 			unsigned int dbindex;
 
-			db_bind_buffer_persistent<dbb_compressed> json_blob;
-			db_bind_buffer_persistent<dbb_compressed> profimg_blob;
+			// These are compressed/encoded by dbexec
+			std::string json;
+			std::string profimg_url;
 
 			time_t createtime;
 			uint64_t lastupdate;
 			shb_iptr cached_profile_img_sha1;
+			http_validators cached_profile_img_validators;
 
-			db_bind_buffer_persistent<dbb_compressed> mention_blob;
+			tweetidset_snapshot mention_ids;
 
 			uint64_t profile_img_last_used;
 
 			bool user_needs_updating;
 			bool profimgtime_needs_updating;
+
+			std::unique_ptr<dbsearchuserfields> search_fields;
 		};
 
 		//Where F is a functor of the form void(itemdata &&)
-		//F must free() itemdata blobs
 		template <typename F> void operator()(F func) const {
 			for (auto &it : ad.userconts) {
 				udc_ptr_p u = it.second;
@@ -2214,20 +3108,26 @@ namespace {
 				itemdata data;
 
 				data.id = it.first;
-				data.json_blob = DoCompress(u->mkjson(), 'J');
-				data.profimg_blob = DoCompress(u->cached_profile_img_url, 'P');
+				data.json = u->mkjson();
+				data.profimg_url = u->cached_profile_img_url;
 
 				data.createtime = u->user.createtime;
 				data.lastupdate = u->lastupdate;
 				data.cached_profile_img_sha1 = u->cached_profile_img_sha1;
+				data.cached_profile_img_validators = u->cached_profile_img_validators;
 
-				data.mention_blob = settocompressedblob_desc(u->mention_set);
+				data.mention_ids = TweetIdSetSnapshot(u->mention_set);
 
 				data.profile_img_last_used = u->profile_img_last_used;
 
 				data.user_needs_updating = user_needs_updating;
 				data.profimgtime_needs_updating = profimgtime_needs_updating;
 
+				if (user_needs_updating && dbc.search_index_enabled) {
+					data.search_fields.reset(new dbsearchuserfields());
+					DBSearchFillUserFields(*(data.search_fields), u->user);
+				}
+
 				func(std::move(data));
 			}
 		};
@@ -2244,8 +3144,8 @@ namespace {
 			getfunc([&](itemdata &&data) {
 				user_count++;
 				sqlite3_bind_int64(stmt, 1, (sqlite3_int64) data.id);
-				bind_compressed(stmt, 2, std::move(data.json_blob));
-				bind_compressed(stmt, 3, std::move(data.profimg_blob));
+				bind_compressed(stmt, 2, data.json, 'J');
+				bind_compressed(stmt, 3, data.profimg_url, 'P');
 				sqlite3_bind_int64(stmt, 4, (sqlite3_int64) data.createtime);
 				sqlite3_bind_int64(stmt, 5, (sqlite3_int64) data.lastupdate);
 				if (data.cached_profile_img_sha1) {
@@ -2253,8 +3153,9 @@ namespace {
 				} else {
 					sqlite3_bind_null(stmt, 6);
 				}
-				bind_compressed(stmt, 7, std::move(data.mention_blob));
+				bind_compressed(stmt, 7, settocompressedblob_desc(data.mention_ids));
 				sqlite3_bind_int64(stmt, 8, (sqlite3_int64) data.profile_img_last_used);
+				bind_validators(stmt, 9, data.cached_profile_img_validators);
 
 				if (data.user_needs_updating) lastupdate_count++;
 				if (data.profimgtime_needs_updating) profimgtime_count++;
@@ -2267,6 +3168,9 @@ namespace {
 					SLogMsgFormat(LOGT::DBTRACE, TSLogging, "%s inserted user id: %" llFmtSpec "u", cstr(funcname), data.id);
 				}
 				sqlite3_reset(stmt);
+				if (res == SQLITE_DONE && data.search_fields) {
+					DBSearchIndexUser(adb, cache, data.id, *(data.search_fields));
+				}
 			});
 
 			cache.EndTransaction(adb);
@@ -2315,6 +3219,7 @@ template <typename UDC> static void ReadInUserObject(sqlite3_stmt *stmt, uint64_
 	setfromcompressedblob(u.mention_set, stmt, 5);
 	u.profile_img_last_used = (uint64_t) sqlite3_column_int64(stmt, 6);
 	u.profile_img_last_used_db = u.profile_img_last_used;
+	column_get_validators(stmt, 7, u.cached_profile_img_validators);
 }
 
 // Anything loaded here will be marked non-purgable
@@ -2338,27 +3243,66 @@ udc_ptr dbconn::SyncReadInUser(sqlite3 *syncdb, uint64_t id) {
 	return u;
 }
 
-void dbconn::AsyncReadInUser(sqlite3 *adb, uint64_t id, std::deque<dbretuserdata> &out) {
-	// Fetch only if in unloaded_user_ids, ie. in DB but not already loaded
-	if (unloaded_user_ids.erase(id) > 0) {
-		DBBindRowExec(adb, cache.GetStmt(adb, DBPSC_SELUSER),
-			[&](sqlite3_stmt *getstmt) {
-				sqlite3_bind_int64(getstmt, 1, (sqlite3_int64) id);
-			},
-			[&](sqlite3_stmt *getstmt) {
-				out.emplace_back();
-				dbretuserdata &u = out.back();
-				u.id = id;
-				ReadInUserObject(getstmt, id, u, u.ud, "dbconn::AsyncReadInUser");
-			},
-			"dbconn::AsyncReadInUser"
-		);
+// This may be called from the DB thread or a read pool thread
+// Loaded IDs are added to claims, which the caller must release using ReleaseUserLoadClaims after posting its replies
+// If another thread's claims include any of ids, this first waits for those to be released.
+// Otherwise a reply without the user could reach the main thread before the reply which loads it.
+// The waiting thread must not hold any claims of its own, this is the case as only the DB thread uses
+// AsyncReadInUsers when there is no read pool, and read pool threads release their claims after each message.
+void dbconn::AsyncReadInUsers(sqlite3 *adb, dbpscache &acache, const container::set<uint64_t> &ids, std::deque<dbretuserdata> &out, db_user_load_claims &claims) {
+	// Fetch only those in unloaded_user_ids, ie. in DB but not already loaded
+	std::vector<uint64_t> load_ids;
+	{
+		std::unique_lock<std::mutex> guard(unloaded_user_ids_lock);
+		users_being_loaded_cv.wait(guard, [&]() {
+			for (uint64_t id : ids) {
+				auto it = users_being_loaded.find(id);
+				if (it != users_being_loaded.end() && it->second != &claims) {
+					return false;
+				}
+			}
+			return true;
+		});
+		for (uint64_t id : ids) {
+			if (unloaded_user_ids.erase(id) > 0) {
+				load_ids.push_back(id);
+				users_being_loaded[id] = &claims;
+				claims.ids.push_back(id);
+			}
+		}
+	}
+
+	DBBatchIdRowExec(adb, acache, DBPSC_SELUSERBATCH, load_ids.begin(), load_ids.end(), [&](sqlite3_stmt *getstmt) {
+		uint64_t id = (uint64_t) sqlite3_column_int64(getstmt, 9);
+		out.emplace_back();
+		dbretuserdata &u = out.back();
+		u.id = id;
+		ReadInUserObject(getstmt, id, u, u.ud, "dbconn::AsyncReadInUsers");
+	}, "dbconn::AsyncReadInUsers");
+}
+
+// Called after the replies of the thread which owns claims have been posted to the main thread
+void dbconn::ReleaseUserLoadClaims(db_user_load_claims &claims) {
+	if (claims.ids.empty()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> guard(unloaded_user_ids_lock);
+		for (uint64_t id : claims.ids) {
+			users_being_loaded.erase(id);
+		}
 	}
+	claims.ids.clear();
+	users_being_loaded_cv.notify_all();
 }
 
 // This must be called before all calls to SyncReadInUser and SyncPostUserLoadCompletion
 void dbconn::SyncReadInAllUserIDs(sqlite3 *adb) {
 	LogMsg(LOGT::DBINFO, "dbconn::SyncReadInAllUserIDs start");
+	if (SyncLoadUserIdsFromSnapshot()) {
+		LogMsgFormat(LOGT::DBINFO, "dbconn::SyncReadInAllUserIDs end, read %u from snapshot", unloaded_user_ids.size());
+		return;
+	}
 	DBRowExec(adb, "SELECT id FROM users ORDER BY id DESC;", [&](sqlite3_stmt *getstmt) {
 		uint64_t id = (uint64_t) sqlite3_column_int64(getstmt, 0);
 		unloaded_user_ids.insert(unloaded_user_ids.end(), id);
@@ -2380,11 +3324,10 @@ namespace {
 		struct itemdata {
 			uint64_t id;
 
-			db_bind_buffer_persistent<dbb_compressed> dmset_blob;
+			tweetidset_snapshot dm_ids;
 		};
 
 		//Where F is a functor of the form void(itemdata &&)
-		//F must free() itemdata blobs
 		template <typename F> void operator()(F func) const {
 			for (auto &it : ad.user_dm_indexes) {
 				user_dm_index &udi = it.second;
@@ -2395,7 +3338,7 @@ namespace {
 
 				itemdata data;
 				data.id = it.first;
-				data.dmset_blob = settocompressedblob_desc(udi.ids);
+				data.dm_ids = TweetIdSetSnapshot(udi.ids);
 				udi.flags &= ~user_dm_index::UDIF::ISDIRTY;
 
 				func(std::move(data));
@@ -2412,7 +3355,7 @@ namespace {
 			getfunc([&](itemdata &&data) {
 				count++;
 				sqlite3_bind_int64(stmt, 1, (sqlite3_int64) data.id);
-				bind_compressed(stmt, 2, std::move(data.dmset_blob));
+				bind_compressed(stmt, 2, settocompressedblob_desc(data.dm_ids));
 
 				int res = sqlite3_step(stmt);
 				if (res != SQLITE_DONE) {
@@ -2863,6 +3806,8 @@ void dbconn::SyncReadInTpanels(sqlite3 *adb) {
 			flagwrapper<TPF> flags = static_cast<TPF>(sqlite3_column_int(stmt, 2));
 			std::shared_ptr<tpanel> tp = tpanel::MkTPanel(name, dispname, flags);
 			setfromcompressedblob(tp->tweetlist, stmt, 3);
+			tp->tweetlist_written_generation = tp->tweetlist_generation;
+			tpanels_in_db.insert(name);
 			id_count += tp->tweetlist.size();
 			tp->RecalculateCIDS();
 			read_count++;
@@ -2874,31 +3819,54 @@ void dbconn::SyncReadInTpanels(sqlite3 *adb) {
 }
 
 namespace {
+	// If full is false, only tpanels which have changed since they were last written, or which have been removed, are written
+	// Otherwise the table is rewritten
+	// The name, display name and flags of a tpanel do not change after it is created
 	struct WriteBackTpanels {
+		bool full;
+
+		WriteBackTpanels(bool full_) : full(full_) { }
+
 		struct itemdata {
 			std::string name;
+			bool removed;               // the remaining fields are not set if this is true
 			std::string dispname;
 			flagwrapper<TPF> flags;
-
-			db_bind_buffer_persistent<dbb_compressed> tweetlist_blob;
-			size_t tweetlist_count;
+			tweetidset_snapshot tweetlist;
 		};
 
 		//Where F is a functor of the form void(itemdata &&)
-		//F must free() itemdata::tweetlist_blob
 		template <typename F> void operator()(F func) const {
+			std::set<std::string> current;
 			for (auto &it : ad.tpanels) {
 				tpanel &tp = *(it.second);
-				if (tp.flags & TPF::SAVETODB) {
-					itemdata data;
-					data.name = tp.name;
-					data.dispname = tp.dispname;
-					data.flags = tp.flags;
-					data.tweetlist_blob = settocompressedblob_desc(tp.tweetlist);
-					data.tweetlist_count = tp.tweetlist.size();
-					func(std::move(data));
+				if (!(tp.flags & TPF::SAVETODB)) {
+					continue;
+				}
+				current.insert(tp.name);
+				if (!full && tp.tweetlist_generation == tp.tweetlist_written_generation && dbc.tpanels_in_db.count(tp.name)) {
+					continue;
+				}
+				itemdata data;
+				data.name = tp.name;
+				data.removed = false;
+				data.dispname = tp.dispname;
+				data.flags = tp.flags;
+				data.tweetlist = TweetIdSetSnapshot(tp.tweetlist);
+				tp.tweetlist_written_generation = tp.tweetlist_generation;
+				func(std::move(data));
+			}
+			if (!full) {
+				for (auto &name : dbc.tpanels_in_db) {
+					if (!current.count(name)) {
+						itemdata data;
+						data.name = name;
+						data.removed = true;
+						func(std::move(data));
+					}
 				}
 			}
+			dbc.tpanels_in_db = std::move(current);
 		};
 
 		//Where F is a functor with an operator() as above
@@ -2906,37 +3874,49 @@ namespace {
 			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s start", cstr(funcname));
 
 			cache.BeginTransaction(adb);
-			sqlite3_exec(adb, "DELETE FROM tpanels", 0, 0, 0);
+			if (full) {
+				sqlite3_exec(adb, "DELETE FROM tpanels", 0, 0, 0);
+			}
 			sqlite3_stmt *stmt = cache.GetStmt(adb, DBPSC_INSTPANEL);
 
 			unsigned int write_count = 0;
+			unsigned int remove_count = 0;
 			unsigned int id_count = 0;
 			getfunc([&](itemdata &&data) {
+				if (!full) {
+					DBBindExec(adb, cache.GetStmt(adb, DBPSC_DELTPANEL), [&](sqlite3_stmt *delstmt) {
+						sqlite3_bind_text(delstmt, 1, data.name.c_str(), data.name.size(), SQLITE_TRANSIENT);
+					}, "WriteBackTpanels (delete)");
+				}
+				if (data.removed) {
+					remove_count++;
+					return;
+				}
 				sqlite3_bind_text(stmt, 1, data.name.c_str(), data.name.size(), SQLITE_TRANSIENT);
 				sqlite3_bind_text(stmt, 2, data.dispname.c_str(), data.dispname.size(), SQLITE_TRANSIENT);
 				sqlite3_bind_int(stmt, 3, flag_unwrap<TPF>(data.flags));
-				bind_compressed(stmt, 4, std::move(data.tweetlist_blob));
+				bind_compressed(stmt, 4, settocompressedblob_desc(data.tweetlist));
 				int res = sqlite3_step(stmt);
 				if (res != SQLITE_DONE) {
 					SLogMsgFormat(LOGT::DBERR, TSLogging, "%s got error: %d (%s)", cstr(funcname), res, cstr(sqlite3_errmsg(adb)));
 				}
 				sqlite3_reset(stmt);
 				write_count++;
-				id_count += data.tweetlist_count;
+				id_count += data.tweetlist.size();
 			});
 
 			cache.EndTransaction(adb);
-			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s end, wrote %u, IDs: %u", cstr(funcname), write_count, id_count);
+			SLogMsgFormat(LOGT::DBINFO, TSLogging, "%s end, wrote %u, removed %u, IDs: %u", cstr(funcname), write_count, remove_count, id_count);
 		}
 	};
 };
 
 void dbconn::SyncWriteBackTpanels(sqlite3 *adb) {
-	DoGenericSyncWriteBack(adb, cache, WriteBackTpanels(), "dbconn::SyncWriteBackTpanels");
+	DoGenericSyncWriteBack(adb, cache, WriteBackTpanels(true), "dbconn::SyncWriteBackTpanels");
 }
 
 void dbconn::AsyncWriteBackTpanels(dbfunctionmsg &msg) {
-	DoGenericAsyncWriteBack(msg, WriteBackTpanels(), "dbconn::AsyncWriteBackTpanels");
+	DoGenericAsyncWriteBack(msg, WriteBackTpanels(false), "dbconn::AsyncWriteBackTpanels");
 }
 
 void dbconn::SyncReadInUserRelationships(sqlite3 *adb) {
@@ -3113,7 +4093,7 @@ void dbconn::SyncPurgeProfileImages(sqlite3 *syncdb) {
 		if (!gc.readonlymode && expire_list.size()) {
 			cache.BeginTransaction(syncdb);
 
-			DBRangeBindExec(syncdb, "UPDATE users SET cachedprofimgurl = NULL, cachedprofileimgchecksum = NULL WHERE id == ?;",
+			DBRangeBindExec(syncdb, "UPDATE users SET cachedprofimgurl = NULL, cachedprofileimgchecksum = NULL, cachedprofimgetag = NULL, cachedprofimglastmodified = NULL WHERE id == ?;",
 					expire_list.begin(), expire_list.end(),
 					[&](sqlite3_stmt *stmt, uint64_t id) {
 						sqlite3_bind_int64(stmt, 1, id);
@@ -3133,117 +4113,271 @@ void dbconn::SyncPurgeProfileImages(sqlite3 *syncdb) {
 	}
 }
 
-void dbconn::SyncPurgeUnreferencedTweets(sqlite3 *syncdb) {
-	LogMsgFormat(LOGT::DBINFO, "dbconn::SyncPurgeUnreferencedTweets start: %zd tweets in total", ad.unloaded_db_tweet_ids.size());
+// Unreferenced tweet garbage collector
+// Candidates are all tweets in the DB which are not in memory, and are not in any ID set which is saved to the DB
+// These are checked and deleted in chunks on the DB thread, in descending ID order,
+// such that startup/shutdown is not blocked and other DB messages are not held up for long
+// A candidate can only be deleted if all tweets which refer to it (via tweetxref) are also deleted
+// As the main thread and read pool carry on whilst this is in progress, a candidate may be loaded, or inserted or referred to
+// by a newly inserted tweet, after the chunk which contains it has been sent. These are handled by TweetGCRetainIds.
 
-	auto erase_ids_from = [&](tweetidset &set, const tweetidset &ids_to_remove) {
-		for (uint64_t id : ids_to_remove) {
-			set.erase(id);
-		}
-	};
+static const size_t tweet_gc_chunk_size = 5000;
 
-	try {
-		const char *lastpurgesetting = "lastunreferencedtweetspurge";
-		const char *funcname = "dbconn::SyncPurgeUnreferencedTweets";
-		const time_t day = 60 * 60 * 24;
-		time_t delta;
-		if (CheckIfPurgeDue(syncdb, day, lastpurgesetting, funcname, delta)) {
-			std::vector<observer_ptr<tweetidset>> save_id_sets;
+struct tweet_gc_state {
+	std::vector<uint64_t> candidates;          // descending order
+	size_t next = 0;
+	size_t checked = 0;
+	size_t deleted = 0;
+	time_t delta;
+	std::chrono::steady_clock::time_point start_time;
+};
 
-			save_id_sets.push_back(&(ad.cids.highlightids));
-			save_id_sets.push_back(&(ad.cids.unreadids));
+// This is called from the DB thread
+// The newer tweets in previous chunks which referred to tweets in this chunk have either been deleted along with their xrefs, or are still referenced
+static void TweetGCChunk(sqlite3 *db, const std::vector<uint64_t> &ids, std::vector<uint64_t> &delete_ids, bool dry_run) {
+	const char *funcname = "TweetGCChunk";
 
-			for (auto &it : alist) {
-				save_id_sets.push_back(&(it->dm_ids));
-				save_id_sets.push_back(&(it->tweet_ids));
-				save_id_sets.push_back(&(it->usercont->mention_set));
-			}
+	try {
+		DBExec(db, "SAVEPOINT tweet_gc;", db_throw_on_error("TweetGCChunk (savepoint)"));
+		auto finaliser = scope_guard([&]() {
+			DBExec(db, "ROLLBACK TO SAVEPOINT tweet_gc;", "TweetGCChunk (rollback)");
+			DBExec(db, "RELEASE SAVEPOINT tweet_gc;", "TweetGCChunk (rollback release)");
+			delete_ids.clear();
+		});
 
-			for (auto &it : ad.user_dm_indexes) {
-				save_id_sets.push_back(&(it.second.ids));
-			}
+		DBExec(db, "CREATE TEMP TABLE IF NOT EXISTS tweetgcids(id INTEGER PRIMARY KEY NOT NULL);", db_throw_on_error("TweetGCChunk (create temp)"));
+		auto fill_temp_table = [&](const std::vector<uint64_t> &fill_ids) {
+			DBExec(db, "DELETE FROM tweetgcids;", db_throw_on_error("TweetGCChunk (clear temp)"));
+			DBRangeBindExec(db, "INSERT INTO tweetgcids(id) VALUES (?);",
+					fill_ids.begin(), fill_ids.end(),
+					[&](sqlite3_stmt *stmt, uint64_t id) {
+						sqlite3_bind_int64(stmt, 1, id);
+					},
+					db_throw_on_error("TweetGCChunk (fill temp)"));
+		};
 
-			for (auto &it : ad.tpanels) {
-				if (it.second->flags & TPF::MANUAL) {
-					save_id_sets.push_back(&(it.second->tweetlist));
+		fill_temp_table(ids);
+
+		// All xrefs to candidates in this chunk, in one query
+		container::map<uint64_t, std::vector<uint64_t> > referrers;
+		DBRowExec(db, "SELECT x.toid, x.fromid FROM tweetxref AS x INNER JOIN tweetgcids AS c ON x.toid == c.id;", [&](sqlite3_stmt *stmt) {
+			referrers[(uint64_t) sqlite3_column_int64(stmt, 0)].push_back((uint64_t) sqlite3_column_int64(stmt, 1));
+		}, db_throw_on_error("TweetGCChunk (xref check)"));
+
+		// iterate in descending ID order
+		// newer tweets may depend on older ones, but not vice versa
+		// the fromid field is the newer id, toid is the older id
+		tweetidset delete_set;
+		for (uint64_t id : ids) {
+			bool can_delete = true;
+			auto it = referrers.find(id);
+			if (it != referrers.end()) {
+				for (uint64_t fromid : it->second) {
+					if (delete_set.find(fromid) == delete_set.end()) {
+						// xref to something which was not found in the list of ids marked for deletion
+						can_delete = false;
+						break;
+					}
 				}
 			}
+			if (can_delete) {
+				delete_set.insert(delete_set.end(), id);
+				delete_ids.push_back(id);
+			}
+		}
 
-			tweetidset delete_candidates = ad.unloaded_db_tweet_ids;
-			for (auto &it : save_id_sets) {
-				erase_ids_from(delete_candidates, *it);
+		if (!dry_run && !delete_ids.empty()) {
+			fill_temp_table(delete_ids);
+			DBExec(db, "DELETE FROM tweets WHERE id IN (SELECT id FROM tweetgcids);", db_throw_on_error("TweetGCChunk (delete tweets)"));
+			DBExec(db, "DELETE FROM tweetxref WHERE fromid IN (SELECT id FROM tweetgcids);", db_throw_on_error("TweetGCChunk (delete xref from)"));
+			DBExec(db, "DELETE FROM tweetxref WHERE toid IN (SELECT id FROM tweetgcids);", db_throw_on_error("TweetGCChunk (delete xref to)"));
+			if (dbc.search_index_enabled) {
+				DBExec(db, "DELETE FROM tweetsearch WHERE rowid IN (SELECT id FROM tweetgcids);", db_throw_on_error("TweetGCChunk (delete search)"));
 			}
 
-			LogMsgFormat(LOGT::DBINFO, "dbconn::SyncPurgeUnreferencedTweets: %zd candidate tweets to check", delete_candidates.size());
+			// Such that cached tweet ID sets which were written before this are corrected at next startup
+			DBExec(db, "INSERT OR IGNORE INTO incrementaltweetids(id) SELECT id FROM tweetgcids;", db_throw_on_error("TweetGCChunk (incrementaltweetids)"));
+		}
+		DBExec(db, "DELETE FROM tweetgcids;", db_throw_on_error("TweetGCChunk (clear temp)"));
+
+		DBExec(db, "RELEASE SAVEPOINT tweet_gc;", db_throw_on_error("TweetGCChunk (release)"));
+		finaliser.cancel();
+	} catch (std::exception &e) {
+		TSLogMsgFormat(LOGT::DBERR, "%s failed, rolling back. Exception: %s", funcname, cstr(e.what()));
+	}
+}
 
-			tweetidset delete_ids;
+// This checks whether a purge is due, it must be called before the DB thread is started
+void dbconn::SyncCheckPurgeUnreferencedTweetsDue(sqlite3 *syncdb) {
+	time_t delta;
+	if (CheckIfPurgeDue(syncdb, 60 * 60 * 24, "lastunreferencedtweetspurge", "dbconn::SyncCheckPurgeUnreferencedTweetsDue", delta)) {
+		dbc_flags |= DBCF::TWEET_GC_DUE;
+		tweet_gc_last_purge_delta = delta;
+	}
+}
 
-			auto stmt = DBInitialiseSql(syncdb, "SELECT fromid FROM tweetxref WHERE toid = ?;");
+// This does a dry-run in read-only mode
+void dbconn::AsyncPurgeUnreferencedTweets() {
+	if (!(dbc_flags & DBCF::TWEET_GC_DUE)) {
+		return;
+	}
+	dbc_flags &= ~DBCF::TWEET_GC_DUE;
 
-			// iterate in descending ID order
-			// newer tweets may depend on older ones, but not vice versa
-			// the fromid field is the newer id, toid is the older id
-			for (auto it = delete_candidates.begin(); it != delete_candidates.end(); ++it) {
-				bool can_delete = true;
-				DBBindRowExec(syncdb, stmt.stmt(),
-						[&](sqlite3_stmt *stmt) {
-							sqlite3_bind_int64(stmt, 1, *it);
-						},
-						[&](sqlite3_stmt *stmt) {
-							if (!can_delete) return;
+	std::shared_ptr<tweet_gc_state> state = std::make_shared<tweet_gc_state>();
+	state->delta = tweet_gc_last_purge_delta;
+	state->start_time = std::chrono::steady_clock::now();
 
-							uint64_t fromid = (uint64_t) sqlite3_column_int64(stmt, 0);
-							if (delete_ids.find(fromid) == delete_ids.end()) {
-								// xref to something which was not found in the list of ids marked for deletion
-								can_delete = false;
-							}
-						}, db_throw_on_error("dbconn::SyncPurgeUnreferencedTweets (xref check)"));
-				if (can_delete) {
-					delete_ids.insert(*it);
-				}
-			}
+	// Tweets which are in memory are in ad.loaded_db_tweet_ids, so are not candidates
+	tweetidset saved_ids;
+	auto add_saved = [&](const tweetidset &ids) {
+		TweetIdSetMergeRange(saved_ids, ids.begin(), ids.end());
+	};
 
-			if (!gc.readonlymode) {
-				DBExec(syncdb, "SAVEPOINT tweet_gc;", db_throw_on_error("dbconn::SyncPurgeUnreferencedTweets (savepoint)"));
+	add_saved(ad.cids.highlightids);
+	add_saved(ad.cids.unreadids);
 
-				auto finaliser = scope_guard([&]() {
-					DBExec(syncdb, "ROLLBACK TO SAVEPOINT tweet_gc;", "dbconn::SyncPurgeUnreferencedTweets (rollback)");
-				});
+	for (auto &it : alist) {
+		add_saved(it->dm_ids);
+		add_saved(it->tweet_ids);
+		add_saved(it->usercont->mention_set);
+	}
+
+	for (auto &it : ad.user_dm_indexes) {
+		add_saved(it.second.ids);
+	}
+
+	for (auto &it : ad.tpanels) {
+		if (it.second->flags & TPF::MANUAL) {
+			add_saved(it.second->tweetlist);
+		}
+	}
+
+	tweetidset candidates;
+	TweetIdSetDifference(candidates, ad.unloaded_db_tweet_ids, saved_ids);
+	state->candidates = TweetIdSetSnapshot(candidates);
+
+	LogMsgFormat(LOGT::DBINFO, "dbconn::AsyncPurgeUnreferencedTweets start: %zu tweets in total, %zu candidate tweets to check",
+			ad.unloaded_db_tweet_ids.size(), state->candidates.size());
+
+	AsyncPurgeUnreferencedTweetsChunk(std::move(state));
+}
+
+void dbconn::AsyncPurgeUnreferencedTweetsChunk(std::shared_ptr<tweet_gc_state> state) {
+	struct tweet_gc_msg : public dbfunctionmsg_callback {
+		std::vector<uint64_t> ids;
+		std::vector<uint64_t> delete_ids;
+		bool last = false;
+	};
+
+	std::unique_ptr<tweet_gc_msg> msg(new tweet_gc_msg());
+
+	// Skip any candidates which have since been loaded, or which are being loaded
+	// TweetGCRetainIds only handles loads which are read from the DB after this chunk has been sent,
+	// the reply to a load which has already been read may not be handled until after this chunk has run
+	while (state->next < state->candidates.size() && msg->ids.size() < tweet_gc_chunk_size) {
+		uint64_t id = state->candidates[state->next++];
+		if (ad.unloaded_db_tweet_ids.find(id) == ad.unloaded_db_tweet_ids.end()) {
+			continue;
+		}
+		auto it = ad.tweetobjs.find(id);
+		if (it != ad.tweetobjs.end() && it->second->lflags & TLF::BEINGLOADEDFROMDB) {
+			continue;
+		}
+		msg->ids.push_back(id);
+	}
+	msg->last = state->next >= state->candidates.size();
+	if (msg->last) {
+		state->candidates.clear();
+		state->candidates.shrink_to_fit();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(tweet_gc_lock);
+		tweet_gc_pending_ids.insert(msg->ids.begin(), msg->ids.end());
+	}
+
+	msg->db_func = [](sqlite3 *db, bool &ok, dbpscache &cache, dbfunctionmsg_callback &self_) {
+		// We are now in the DB thread
+		tweet_gc_msg &self = static_cast<tweet_gc_msg &>(self_);
 
-				DBRangeBindExec(syncdb, "DELETE FROM tweets WHERE id = ?;",
-						delete_ids.begin(), delete_ids.end(),
-						[&](sqlite3_stmt *stmt, uint64_t id) {
-							sqlite3_bind_int64(stmt, 1, id);
-						},
-						db_throw_on_error("dbconn::SyncPurgeUnreferencedTweets (xref check)"));
+		// This is held until the deleted IDs have been added to tweet_gc_deleted_ids, such that a concurrent read pool load
+		// either retains the tweet before it is checked, or does not see it
+		std::lock_guard<std::mutex> guard(dbc.tweet_gc_lock);
 
-				DBRangeBindExec(syncdb, "DELETE FROM tweetxref WHERE fromid = ? OR toid = ?;",
-						delete_ids.begin(), delete_ids.end(),
-						[&](sqlite3_stmt *stmt, uint64_t id) {
-							sqlite3_bind_int64(stmt, 1, id);
-							sqlite3_bind_int64(stmt, 2, id);
-						},
-						db_throw_on_error("dbconn::SyncPurgeUnreferencedTweets (xref check)"));
+		// Drop any candidates which have been retained since the chunk was sent
+		self.ids.erase(std::remove_if(self.ids.begin(), self.ids.end(), [&](uint64_t id) {
+			return dbc.tweet_gc_pending_ids.erase(id) == 0;
+		}), self.ids.end());
 
-				UpdateLastPurged(syncdb, lastpurgesetting, funcname);
+		TweetGCChunk(db, self.ids, self.delete_ids, gc.readonlymode);
+		if (!gc.readonlymode) {
+			dbc.tweet_gc_deleted_ids.insert(self.delete_ids.begin(), self.delete_ids.end());
+		}
+
+		if (self.last && !gc.readonlymode) {
+			DBBindExec(db, cache.GetStmt(db, DBPSC_INSSTATICSETTING),
+				[&](sqlite3_stmt *stmt) {
+					sqlite3_bind_text(stmt, 1, "lastunreferencedtweetspurge", -1, SQLITE_STATIC);
+					sqlite3_bind_int64(stmt, 2, time(nullptr));
+				},
+				"dbconn::AsyncPurgeUnreferencedTweetsChunk (write last purged)"
+			);
+		}
+	};
 
-				DBExec(syncdb, "RELEASE SAVEPOINT tweet_gc;", db_throw_on_error("dbconn::SyncPurgeUnreferencedTweets (unlock)"));
+	msg->callback_func = [this, state](std::unique_ptr<dbfunctionmsg_callback> self_) {
+		// We are now in the main thread
+		tweet_gc_msg &self = static_cast<tweet_gc_msg &>(*self_);
 
-				// do this after DB operations
-				erase_ids_from(ad.cids.hiddenids, delete_ids);
-				erase_ids_from(ad.cids.timelinehiddenids, delete_ids);
-				erase_ids_from(ad.cids.deletedids, delete_ids);
-				erase_ids_from(ad.unloaded_db_tweet_ids, delete_ids);
+		state->checked += self.ids.size();
+		state->deleted += self.delete_ids.size();
 
-				finaliser.cancel();
+		if (!gc.readonlymode) {
+			{
+				// Any load sent after this point will not find these in the DB, and any earlier load has been filtered
+				std::lock_guard<std::mutex> guard(tweet_gc_lock);
+				for (uint64_t id : self.delete_ids) {
+					tweet_gc_deleted_ids.erase(id);
+				}
 			}
+			for (uint64_t id : self.delete_ids) {
+				ad.cids_journal.hiddenids.Erase(ad.cids.hiddenids, id);
+				ad.cids_journal.timelinehiddenids.Erase(ad.cids.timelinehiddenids, id);
+				ad.cids_journal.deletedids.Erase(ad.cids.deletedids, id);
+				ad.unloaded_db_tweet_ids.erase(id);
+			}
+		}
 
-			LogMsgFormat(LOGT::DBINFO, "dbconn::SyncPurgeUnreferencedTweets end, last purged %" llFmtSpec "ds ago, %spurged %zd",
-					(int64_t) delta, gc.readonlymode ? "would have " : "", delete_ids.size());
+		if (self.last) {
+			LogMsgFormat(LOGT::DBINFO, "dbconn::AsyncPurgeUnreferencedTweets end, last purged %" llFmtSpec "ds ago, checked %zu, %spurged %zu, took %" llFmtSpec "dms",
+					(int64_t) state->delta, state->checked, gc.readonlymode ? "would have " : "", state->deleted,
+					(int64_t) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - state->start_time).count());
+		} else if (!(dbc_flags & DBCF::INITED)) {
+			// Shutting down, the remainder will be done next time
+			LogMsgFormat(LOGT::DBINFO, "dbconn::AsyncPurgeUnreferencedTweets stopped at shutdown, checked %zu, %spurged %zu",
+					state->checked, gc.readonlymode ? "would have " : "", state->deleted);
+		} else {
+			LogMsgFormat(LOGT::DBTRACE, "dbconn::AsyncPurgeUnreferencedTweets progress: %zu of %zu candidates, %spurged %zu",
+					state->next, state->candidates.size(), gc.readonlymode ? "would have " : "", state->deleted);
+			AsyncPurgeUnreferencedTweetsChunk(state);
 		}
-	} catch (std::exception &e) {
-		LogMsgFormat(LOGT::DBERR, "dbconn::SyncPurgeUnreferencedTweets failed, rolling back. Exception: %s", cstr(e.what()));
+	};
+
+	SendFunctionMsgCallback(std::move(msg));
+}
+
+// This may be called from the DB thread or the read pool threads, before tweets are loaded from, or inserted into, the DB
+// ids are removed from the candidates of any garbage collector chunk which has not yet run
+// Any ids which have already been deleted by a chunk are removed from ids, as the main thread has not yet been told
+void dbconn::TweetGCRetainIds(std::vector<uint64_t> &ids) {
+	std::lock_guard<std::mutex> guard(tweet_gc_lock);
+	if (tweet_gc_pending_ids.empty() && tweet_gc_deleted_ids.empty()) {
+		return;
 	}
+	ids.erase(std::remove_if(ids.begin(), ids.end(), [&](uint64_t id) {
+		tweet_gc_pending_ids.erase(id);
+		return tweet_gc_deleted_ids.find(id) != tweet_gc_deleted_ids.end();
+	}), ids.end());
 }
 
 void dbconn::OnAsyncStateWriteTimer(wxTimerEvent& event) {
@@ -3325,6 +4459,7 @@ static void TimelineExpireOldTweets(const tweet_id_timestamp_info &info) {
 				}
 
 				if (old_size != acc->tweet_ids.size()) {
+					acc->tweet_ids_journal.Modified();
 					for (auto &it : ad.tpanels) {
 						tpanel &tp = *(it.second);
 						if (tp.AccountTimelineMatches(acc)) {
@@ -3485,10 +4620,10 @@ void dbconn::AsyncSelEventLogByObj(uint64_t obj_id, int acc_db_index, std::funct
 
 //The contents of data will be released and stashed in the event sent to the main thread
 //The main thread will then unstash it from the event and stick it back in a unique_ptr
-void dbsendmsg_callback::SendReply(std::unique_ptr<dbsendmsg> data, dbiothread *th) {
+void dbsendmsg_callback::SendReply(std::unique_ptr<dbsendmsg> data, db_reply_list &reply_list) {
 	wxCommandEvent *evt = new wxCommandEvent(cmdevtype, winid);
 	evt->SetClientData(data.release());
-	th->reply_list.emplace_back(targ, std::unique_ptr<wxEvent>(evt));
+	reply_list.emplace_back(targ, std::unique_ptr<wxEvent>(evt));
 }
 
 db_handle_msg_pending_guard::~db_handle_msg_pending_guard() {
@@ -3739,3 +4874,11 @@ void DBC_AsyncGetNewestTweetOlderThan(time_t timestamp, std::function<void(uint6
 void DBC_AsyncSelEventLogByObj(uint64_t obj_id, int acc_db_index, std::function<void(std::deque<dbeventlogdata>)> completion) {
 	dbc.AsyncSelEventLogByObj(obj_id, acc_db_index, std::move(completion));
 }
+
+bool DBC_IsSearchIndexEnabled() {
+	return dbc.search_index_enabled;
+}
+
+void DBC_AsyncSearchTweets(std::string query, std::function<void(tweetidset, bool)> completion) {
+	dbc.AsyncSearchTweets(std::move(query), std::move(completion));
+}
@@ -23,6 +23,7 @@
 #include "tweetidset.h"
 #include "flags.h"
 #include "hash.h"
+#include "socket-common.h"
 #include "media_id_type.h"
 #include "ptr_types.h"
 #include "set.h"
@@ -137,12 +138,21 @@ struct db_bind_buffer_persistent : public db_bind_buffer<TAG> {
 	}
 };
 
+typedef std::deque<std::pair<wxEvtHandler *, std::unique_ptr<wxEvent> > > db_reply_list;
+
 struct dbreplyevtstruct {
-	std::deque<std::pair<wxEvtHandler *, std::unique_ptr<wxEvent> > > reply_list;
+	db_reply_list reply_list;
+};
+
+enum class DBSMF {
+	NO_READ_DEPENDENCY      = 1<<0,    // Messages sent to the read pool after this one need not wait for it to be committed
 };
+template<> struct enum_traits<DBSMF> { static constexpr bool flags = true; };
 
 struct dbsendmsg {
 	DBSM type;
+	flagwrapper<DBSMF> msg_flags = 0;
+	dbsendmsg *queue_next = nullptr;       // Used by dbmsgqueue
 
 	dbsendmsg(DBSM type_) : type(type_) { }
 	virtual ~dbsendmsg() { }
@@ -163,7 +173,7 @@ struct dbsendmsg_callback : public dbsendmsg {
 	WXTYPE cmdevtype;
 	int winid;
 
-	void SendReply(std::unique_ptr<dbsendmsg> data, dbiothread *th);
+	void SendReply(std::unique_ptr<dbsendmsg> data, db_reply_list &reply_list);
 };
 
 struct dbinserttweetmsg : public dbsendmsg {
@@ -174,6 +184,7 @@ struct dbinserttweetmsg : public dbsendmsg {
 	uint64_t id, user1, user2, rtid, timestamp;
 	uint64_t flags;
 	std::vector<uint64_t> xref_tweet_ids;
+	std::string search_text;                 // only set if the search index is enabled
 };
 
 struct dbupdatetweetmsg : public dbsendmsg {
@@ -198,6 +209,7 @@ struct dbretuserdata {
 	uint64_t lastupdate_wrotetodb;
 	std::string cached_profile_img_url;
 	shb_iptr cached_profile_img_sha1;
+	http_validators cached_profile_img_validators;
 	tweetidset mention_set;
 	uint64_t profile_img_last_used;
 	uint64_t profile_img_last_used_db;
@@ -228,6 +240,14 @@ struct dbselusermsg : public dbsendmsg_callback {
 	std::deque<dbretuserdata> data;          // return data
 };
 
+// User fields which are added to the search index
+struct dbsearchuserfields {
+	std::string name;
+	std::string screen_name;
+	std::string description;
+	std::string location;
+};
+
 struct dbinsertusermsg : public dbsendmsg {
 	dbinsertusermsg() : dbsendmsg(DBSM::INSERTUSER) { }
 	uint64_t id;
@@ -236,8 +256,10 @@ struct dbinsertusermsg : public dbsendmsg {
 	time_t createtime;
 	uint64_t lastupdate;
 	shb_iptr cached_profile_img_hash;
+	http_validators cached_profile_img_validators;
 	db_bind_buffer_persistent<dbb_compressed> mentionindex;
 	uint64_t profile_img_last_used;
+	std::unique_ptr<dbsearchuserfields> search_fields;    // only set if the search index is enabled
 };
 
 struct dbinsertaccmsg : public dbsendmsg_callback {
@@ -367,5 +389,7 @@ void DBC_PrepareStdUserLoadMsg(dbselusermsg &loadmsg);
 void DBC_AsyncPurgeOldTweets();
 void DBC_AsyncGetNewestTweetOlderThan(time_t timestamp, std::function<void(uint64_t)> completion);
 void DBC_AsyncSelEventLogByObj(uint64_t obj_id, int acc_db_index, std::function<void(std::deque<dbeventlogdata>)> completion);
+bool DBC_IsSearchIndexEnabled();
+void DBC_AsyncSearchTweets(std::string query, std::function<void(tweetidset, bool)> completion);
 
 #endif
@@ -25,9 +25,10 @@
 #include "raii.h"
 #include "json-util.h"
 #include "parse.h"
+#include "url-util.h"
 #include <wx/msgdlg.h>
 
-static const unsigned int db_version = 11;
+static const unsigned int db_version = 12;
 
 static const char *update_sql[] = {
 	"ALTER TABLE mediacache ADD COLUMN lastusedtimestamp INTEGER;"
@@ -68,6 +69,10 @@ static const char *update_sql[] = {
 	,
 	nullptr
 	// added timelinehiddenids
+	,
+	"ALTER TABLE users ADD COLUMN cachedprofimgetag TEXT;"
+	"ALTER TABLE users ADD COLUMN cachedprofimglastmodified TEXT;"
+	// add profile image HTTP cache validator columns to users table
 };
 
 // return false if all bets are off and DB should not be read
@@ -234,8 +239,7 @@ void dbconn::SyncDoUpdates_FillTweetXrefTable(sqlite3 *adb) {
 					for (rapidjson::SizeType i = 0; i < urls.Size(); i++) {
 						std::string url_str;
 						if (parse_util::CheckTransJsonValue(url_str, urls[i], "expanded_url") || parse_util::CheckTransJsonValue(url_str, urls[i], "display_url")) {
-							wxURI wxuri(wxstrstd(url_str));
-							uint64_t quoted_tweet_id = genjsonparser::ParseQuotedTweetUrl(wxuri);
+							uint64_t quoted_tweet_id = genjsonparser::ParseQuotedTweetUrl(url_parts(url_str));
 							if (quoted_tweet_id) {
 								xref_ids.push_back(quoted_tweet_id);
 							}
@@ -58,6 +58,7 @@ void DebugDestructAlldata() {
 	ad.cids.foreach([](tweetidset &ids) {
 		ids.clear();
 	});
+	ad.cids_journal.Modified();
 	LogMsgFormat(logflags, "Cleared: ad.cids");
 
 	ad.incoming_filter.clear();
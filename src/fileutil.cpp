@@ -27,6 +27,14 @@
 #include <wx/filename.h>
 #include <stdio.h>
 #include <random>
+#ifdef __WINDOWS__
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 bool LoadFromFile(const wxString &filename, std::string &out) {
@@ -131,3 +139,70 @@ std::string make_temp_dir(const std::string &prefix) {
 	}
 	return stdstrwx(wxFileName::GetTempDir());
 }
+
+bool mapped_file::Open(const std::string &filename) {
+	Close();
+
+	#ifdef __WINDOWS__
+	HANDLE file = CreateFileW(wxstrstd(filename).wc_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 || (unsigned long long) file_size.QuadPart > SIZE_MAX) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	ptr = static_cast<const unsigned char *>(view);
+	length = file_size.QuadPart;
+	#else
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	ptr = static_cast<const unsigned char *>(view);
+	length = st.st_size;
+	#endif
+	return true;
+}
+
+void mapped_file::Close() {
+	if (!ptr) {
+		return;
+	}
+
+	#ifdef __WINDOWS__
+	UnmapViewOfFile(ptr);
+	CloseHandle(mapping_handle);
+	CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+	#else
+	munmap(const_cast<unsigned char *>(ptr), length);
+	#endif
+	ptr = nullptr;
+	length = 0;
+}
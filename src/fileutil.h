@@ -53,4 +53,28 @@ struct temp_file_holder : public safe_observer_ptr_contained<temp_file_holder> {
 
 std::string make_temp_dir(const std::string &prefix);
 
+// Read-only memory mapping of a whole file
+struct mapped_file {
+	private:
+	const unsigned char *ptr = nullptr;
+	size_t length = 0;
+	#ifdef __WINDOWS__
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+	#endif
+
+	public:
+	mapped_file() { }
+	mapped_file(const mapped_file &other) = delete;
+	mapped_file& operator=(const mapped_file &other) = delete;
+	~mapped_file() { Close(); }
+
+	// filename is UTF-8
+	bool Open(const std::string &filename);
+	void Close();
+	const unsigned char *data() const { return ptr; }
+	size_t size() const { return length; }
+	bool IsOpen() const { return ptr != nullptr; }
+};
+
 #endif
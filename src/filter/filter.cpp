@@ -30,6 +30,7 @@
 #include "../map.h"
 #include "../db-lazy.h"
 #include "../db-intl.h"
+#include "../db-search.h"
 #define PCRE_STATIC
 #include <pcre.h>
 #include <list>
@@ -83,6 +84,11 @@ struct filter_item_cond : public filter_item {
 		return true;
 	}
 
+	// return true if all tweets for which test() returns true can be found using the search index term
+	virtual bool get_search_term(db_search_term &out) const {
+		return false;
+	}
+
 	// return true if OK to continue
 	bool pre_exec(filter_run_state &frs) {
 		if (flags & FIF::ENDIF) {
@@ -309,6 +315,8 @@ struct filter_item_cond_regex : public filter_item_cond {
 		return test_generic(generic_tweet_access_dblazy(state, tweet_id), frs);
 	}
 
+	bool get_search_term(db_search_term &out) const override;
+
 	virtual ~filter_item_cond_regex() {
 		if (ptn) {
 			pcre_free(ptn);
@@ -322,6 +330,28 @@ struct filter_item_cond_regex : public filter_item_cond {
 };
 template<> struct enum_traits<filter_item_cond_regex::TYPE_FLAGS> { static constexpr bool flags = true; };
 
+// Retweet and recipient variants are not handled as the index is keyed by the tweet's own text and user
+bool filter_item_cond_regex::get_search_term(db_search_term &out) const {
+	if (!type_flags && property == PROP::TWEET_TEXT) {
+		return DBSearchTermFromRegex(regexstr, DBSEARCHCOL::TWEET_TEXT, out);
+	}
+	if (type_flags == TYPE_FLAGS::IS_USER_TEST) {
+		switch (property) {
+			case PROP::USER_NAME:
+				return DBSearchTermFromRegex(regexstr, DBSEARCHCOL::USER_NAME, out);
+			case PROP::USER_SCREENNAME:
+				return DBSearchTermFromRegex(regexstr, DBSEARCHCOL::USER_SCREENNAME, out);
+			case PROP::USER_DESCRIPTION:
+				return DBSearchTermFromRegex(regexstr, DBSEARCHCOL::USER_DESCRIPTION, out);
+			case PROP::USER_LOCATION:
+				return DBSearchTermFromRegex(regexstr, DBSEARCHCOL::USER_LOCATION, out);
+			default:
+				break;
+		}
+	}
+	return false;
+}
+
 void filter_item_cond_regex::parse_setup(const std::string &part1, const std::string &part2, bool &ok, std::string &errmsgs) {
 	auto tweetmode = [&]() {
 		if (part2 == "text") {
@@ -854,6 +884,36 @@ std::unique_ptr<undo::action> filter_set::GetUndoAction() {
 	return std::move(filter_undo);
 }
 
+// Returns true if the filter can only have an effect on tweets which match at least one of the output search terms
+// This is the case if every action is within a top-level if/elif/orif branch, and every such condition is a search term
+// Negated conditions and top-level else branches can match tweets not in the index results, so are not handled
+static bool GetFilterSearchTerms(const filter_set &fs, std::vector<db_search_term> &terms) {
+	unsigned int depth = 0;
+	for (auto &it : fs.filters) {
+		if (!(it->flags & FIF::COND)) {
+			// This is an action
+			if (depth == 0) return false;
+			continue;
+		}
+
+		if (it->flags & FIF::ENDIF) {
+			depth--;
+			continue;
+		}
+
+		bool new_if = !(it->flags & (FIF::ELIF | FIF::ORIF | FIF::ELSE));
+		if (new_if) depth++;
+		if (depth != 1) continue;
+
+		if (it->flags & (FIF::ELSE | FIF::NEG)) return false;
+
+		db_search_term term;
+		if (!static_cast<const filter_item_cond &>(*it).get_search_term(term)) return false;
+		terms.emplace_back(std::move(term));
+	}
+	return !terms.empty();
+}
+
 void filter_set::DBFilterTweetIDs(filter_set fs, tweetidset ids, bool enable_undo, std::function<void(std::unique_ptr<undo::action>)> completion) {
 	dbc.AsyncWriteBackStateMinimal();
 
@@ -871,9 +931,22 @@ void filter_set::DBFilterTweetIDs(filter_set fs, tweetidset ids, bool enable_und
 
 	msg->db_func = [](sqlite3 *db, bool &ok, dbpscache &cache, dbfunctionmsg_callback &self_) {
 		db_filter_msg &self = static_cast<db_filter_msg &>(self_);
-		// We are now in the DB thread
+		// We are now in the DB thread, or a DB read pool thread
 
 		filter_db_lazy_state state(db);
+
+		std::vector<db_search_term> terms;
+		if (dbc.search_index_complete && GetFilterSearchTerms(self.fs, terms)) {
+			tweetidset candidates;
+			if (DBSearchCandidateTweetIds(db, terms, candidates)) {
+				tweetidset filtered;
+				TweetIdSetIntersection(filtered, self.ids, candidates);
+				TSLogMsgFormat(LOGT::FILTERTRACE, "filter_set::DBFilterTweetIDs: using search index, %zu terms, %zu of %zu tweets to test",
+						terms.size(), filtered.size(), self.ids.size());
+				self.ids = std::move(filtered);
+			}
+		}
+
 		for (uint64_t id : self.ids) {
 			self.fs.FilterTweet(state, id);
 		}
@@ -896,5 +969,5 @@ void filter_set::DBFilterTweetIDs(filter_set fs, tweetidset ids, bool enable_und
 		completion(std::move(undo_action));
 	};
 
-	dbc.SendFunctionMsgCallback(std::move(msg));
+	dbc.SendReadFunctionMsgCallback(std::move(msg));
 }
@@ -32,4 +32,23 @@ typedef std::shared_ptr<const sha1_hash_block> shb_iptr;
 shb_iptr hash_block(const void *data, size_t length);
 void hash_block(sha1_hash_block &out, const void *data, size_t length);
 
+class CSHA1;
+
+// Incremental equivalent of hash_block, for data which arrives in pieces
+struct sha1_hasher {
+	sha1_hasher();
+	~sha1_hasher();
+	sha1_hasher(const sha1_hasher &other) = delete;
+	sha1_hasher& operator=(const sha1_hasher &other) = delete;
+
+	void Update(const void *data, size_t length);
+	void Reset();
+
+	// No further updates should be made after this
+	shb_iptr Final();
+
+	private:
+	std::unique_ptr<CSHA1> ctx;
+};
+
 #endif
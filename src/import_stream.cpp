@@ -28,6 +28,7 @@
 #include <wx/filename.h>
 #include <wx/arrstr.h>
 #include <wx/choicdlg.h>
+#include <chrono>
 
 static std::shared_ptr<taccount> GetAccountByFilename(const wxString &filename) {
 	for (auto &it : alist) {
@@ -131,11 +132,20 @@ void StreamImport(std::shared_ptr<taccount> acc, const wxString &filename) {
 
 	std::unique_ptr<dbsendmsg_list> dbmsglist(new dbsendmsg_list());
 
+	// Ingest statistics, this makes stream import usable as a replay benchmark of the parse/process path
+	typedef std::chrono::steady_clock ingest_clock;
+	ingest_clock::time_point import_start = ingest_clock::now();
+	ingest_clock::duration max_line_time = ingest_clock::duration::zero();
+	unsigned int lines = 0;
+
 	auto do_line = [&](size_t start, size_t end) {
 		if (start == end) {
 			return;
 		}
 
+		ingest_clock::time_point line_start = ingest_clock::now();
+		lines++;
+
 		jsonparser jp(acc, nullptr);
 		jp.dbmsglist = std::move(dbmsglist);
 		try {
@@ -144,11 +154,16 @@ void StreamImport(std::shared_ptr<taccount> acc, const wxString &filename) {
 				jp.ProcessStreamResponse(true);
 			}
 		} catch (std::exception &e) {
-			LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream import: %s\n%s", cstr(e.what()), cstr(jp.data->source_str));
+			LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream import: %s\n%s", cstr(e.what()), cstr(jp.data->GetSourceString()));
 		} catch (...) {
-			LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream import: %s", cstr(jp.data->source_str));
+			LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream import: %s", cstr(jp.data->GetSourceString()));
 		}
 		dbmsglist = std::move(jp.dbmsglist);
+
+		ingest_clock::duration line_time = ingest_clock::now() - line_start;
+		if (line_time > max_line_time) {
+			max_line_time = line_time;
+		}
 	};
 
 	size_t line_start = 0;
@@ -167,4 +182,11 @@ void StreamImport(std::shared_ptr<taccount> acc, const wxString &filename) {
 	if (dbmsglist && !dbmsglist->msglist.empty()) {
 		DBC_SendMessage(std::move(dbmsglist));
 	}
+
+	double total_secs = std::chrono::duration<double>(ingest_clock::now() - import_start).count();
+	double max_line_ms = std::chrono::duration<double, std::milli>(max_line_time).count();
+	LogMsgFormat(LOGT::OTHERTRACE, "Stream import: %s: %u messages, %zu bytes in %.3fs (%.0f msg/s, %.2f MB/s), mean: %.3fms/msg, max: %.3fms/msg",
+			cstr(filename), lines, data.size(), total_secs,
+			(total_secs > 0) ? lines / total_secs : 0.0, (total_secs > 0) ? data.size() / (total_secs * 1024 * 1024) : 0.0,
+			lines ? (total_secs * 1000 / lines) : 0.0, max_line_ms);
 }
@@ -126,6 +126,11 @@ namespace parse_util {
 	}
 
 	bool ParseStringInPlace(rapidjson::Document &dc, char *mutable_string, const std::string &name);
+
+	// As ParseStringInPlace, but members which are never read from Twitter API responses are dropped without being added to the DOM
+	// dc must use a MemoryPoolAllocator
+	bool ParseStringInPlaceFiltered(rapidjson::Document &dc, char *mutable_string, const std::string &name);
+
 	void DisplayParseErrorMsg(rapidjson::Document &dc, const std::string &name, const char *data);
 
 };
@@ -1,5 +1,6 @@
 #include <memory.h>
 #include <cstdlib>
+#include <algorithm>
 #include "twitcurl.h"
 #include "urlencode.h"
 
@@ -1728,7 +1729,7 @@ void twitCurl::StreamingApiGenericPrepare( bool accept_encoding )
     curl_easy_setopt( m_curlHandle, CURLOPT_WRITEDATA, this );
 
     /* Stream does not start in a chunk */
-    m_curchunklength = 0;
+    m_streamSplitter.reset();
 }
 
 /*++
@@ -1754,55 +1755,223 @@ int twitCurl::curlStreamingCallback( char* data, size_t size, size_t nmemb, twit
     int writtenSize = 0;
     if( ( NULL != pTwitCurlObj ) && ( NULL != data ) )
     {
-        /* Save http response in twitcurl object's buffer */
-        writtenSize = pTwitCurlObj->saveLastWebResponse( data, ( size*nmemb ) );
+        long httpCode = 0;
+        curl_easy_getinfo( pTwitCurlObj->m_curlHandle, CURLINFO_RESPONSE_CODE, &httpCode );
+        if( httpCode < 200 || httpCode >= 300 )
+        {
+            /* Error responses are not length delimited, save them as for non-streaming requests */
+            return pTwitCurlObj->saveLastWebResponse( data, ( size*nmemb ) );
+        }
 
-        while( true ) {
-            if( pTwitCurlObj->m_curchunklength )
+        streamChunkSplitter& splitter = pTwitCurlObj->m_streamSplitter;
+        splitter.append( data, size*nmemb );
+        writtenSize = (int)( size*nmemb );
+
+        const char* message;
+        size_t messageSize;
+        while( splitter.nextMessage( message, messageSize ) )
+        {
+            if( pTwitCurlObj->m_streamapicallback )
             {
-                if( pTwitCurlObj->m_callbackData.length() >= pTwitCurlObj->m_curchunklength )
-                {
-                    /* Splice off m_curchunklength bytes into new string */
-                    std::string streamevent = pTwitCurlObj->m_callbackData.substr( 0, pTwitCurlObj->m_curchunklength );
-                    pTwitCurlObj->m_callbackData = pTwitCurlObj->m_callbackData.substr( pTwitCurlObj->m_curchunklength );
-                    if( pTwitCurlObj->m_streamapicallback )
-                    {
-                        (*pTwitCurlObj->m_streamapicallback)( streamevent, pTwitCurlObj, pTwitCurlObj->m_streamapicallback_data );
-                    }
-                    pTwitCurlObj->m_curchunklength = 0;
-                }
-                else
+                (*pTwitCurlObj->m_streamapicallback)( message, messageSize, pTwitCurlObj, pTwitCurlObj->m_streamapicallback_data );
+            }
+        }
+    }
+    return writtenSize;
+}
+
+/*++
+* @method: streamChunkSplitter::streamChunkSplitter
+*
+* @description: constructor
+*
+* @input: none
+*
+* @output: none
+*
+*--*/
+streamChunkSplitter::streamChunkSplitter():
+m_maxMessageSize( twitCurlDefaults::TWITCURL_STREAM_MAXMESSAGESIZE )
+{
+    reset();
+}
+
+/*++
+* @method: streamChunkSplitter::reset
+*
+* @description: method to discard any buffered data and reset the counters, for use at the start of a stream.
+*               the maximum message size is not changed.
+*
+* @input: none
+*
+* @output: none
+*
+*--*/
+void streamChunkSplitter::reset()
+{
+    m_buffer.clear();
+    m_start = 0;
+    m_scanPos = 0;
+    m_chunkLength = 0;
+    m_skipLength = 0;
+    m_discardLine = false;
+    m_droppedCount = 0;
+    m_resyncCount = 0;
+}
+
+/*++
+* @method: streamChunkSplitter::append
+*
+* @description: method to add received data to the end of the buffer.
+*               data which is to be skipped is discarded here where possible, instead of being buffered.
+*
+* @input: data - received data,
+*         size - size of received data
+*
+* @output: none
+*
+*--*/
+void streamChunkSplitter::append( const char* data, size_t size )
+{
+    if( m_start == m_buffer.size() )
+    {
+        m_buffer.clear();
+        m_start = 0;
+        m_scanPos = 0;
+
+        if( m_skipLength )
+        {
+            size_t skip = std::min( m_skipLength, size );
+            m_skipLength -= skip;
+            data += skip;
+            size -= skip;
+        }
+        if( m_discardLine )
+        {
+            const char* lineEnd = static_cast<const char*>( memchr( data, '\n', size ) );
+            if( !lineEnd )
+            {
+                return;
+            }
+            m_discardLine = false;
+            size -= ( lineEnd + 1 ) - data;
+            data = lineEnd + 1;
+        }
+    }
+    else if( m_start >= m_buffer.size() - m_start )
+    {
+        /* At least half of the buffer has been consumed, move the remainder to the front */
+        m_buffer.erase( 0, m_start );
+        m_scanPos = ( m_scanPos > m_start ) ? ( m_scanPos - m_start ) : 0;
+        m_start = 0;
+    }
+    m_buffer.append( data, size );
+}
+
+/*++
+* @method: streamChunkSplitter::nextMessage
+*
+* @description: method to get the next complete message from the buffer, if there is one.
+*               keep-alive empty lines, oversize messages and invalid length lines are consumed here.
+*
+* @input: data - set to the start of the message,
+*         size - set to the size of the message, including the trailing line end
+*
+* @output: true if a message was returned
+*
+*--*/
+bool streamChunkSplitter::nextMessage( const char*& data, size_t& size )
+{
+    while( m_start < m_buffer.size() )
+    {
+        size_t available = m_buffer.size() - m_start;
+        if( m_skipLength )
+        {
+            size_t skip = std::min( m_skipLength, available );
+            m_skipLength -= skip;
+            m_start += skip;
+            continue;
+        }
+
+        if( m_chunkLength )
+        {
+            if( available < m_chunkLength )
+            {
+                return false;
+            }
+            data = m_buffer.data() + m_start;
+            size = m_chunkLength;
+            m_start += m_chunkLength;
+            m_chunkLength = 0;
+            return true;
+        }
+
+        /* Look for a length line, only searching data which has not been searched before */
+        m_scanPos = std::max( m_scanPos, m_start );
+        const char* lineStart = m_buffer.data() + m_start;
+        const char* lineEnd = static_cast<const char*>( memchr( m_buffer.data() + m_scanPos, '\n', m_buffer.size() - m_scanPos ) );
+        if( !lineEnd )
+        {
+            m_scanPos = m_buffer.size();
+            if( m_discardLine || available > twitCurlDefaults::TWITCURL_STREAM_MAXLENGTHLINE )
+            {
+                /* This is not a length line, discard everything up to the next line end */
+                if( !m_discardLine )
                 {
-                    break;
+                    m_resyncCount++;
+                    m_discardLine = true;
                 }
+                m_start = m_buffer.size();
+            }
+            return false;
+        }
+        m_start = ( lineEnd + 1 ) - m_buffer.data();
+        if( m_discardLine )
+        {
+            m_discardLine = false;
+            continue;
+        }
+
+        if( lineEnd > lineStart && lineEnd[ -1 ] == '\r' )
+        {
+            lineEnd--;
+        }
+        if( lineEnd == lineStart )
+        {
+            /* Empty line (used as a keep-alive) */
+            continue;
+        }
+
+        size_t length = 0;
+        bool valid = ( lineEnd - lineStart ) <= 18;
+        for( const char* c = lineStart; valid && c != lineEnd; ++c )
+        {
+            if( *c >= '0' && *c <= '9' )
+            {
+                length = ( length * 10 ) + ( *c - '0' );
             }
             else
             {
-                std::string::size_type pos = pTwitCurlObj->m_callbackData.find( "\r\n" );
-                if( pos == 0 )
-                {
-                    /* Chop off empty line (used as a keep-alive) */
-                    pTwitCurlObj->m_callbackData = pTwitCurlObj->m_callbackData.substr( 2 );
-                }
-                else if( pos == std::string::npos )
-                {
-                    /* Newline not found, keep reading */
-                    break;
-                }
-                else
-                {
-                    /* Newline found at non-zero offset, must be a number */
-                    /* pTwitCurlObj->m_curchunklength = std::stoul( pTwitCurlObj->m_callbackData ); */ /* This is C++11 */
-                    pTwitCurlObj->m_curchunklength = std::atoi( pTwitCurlObj->m_callbackData.c_str() );
-                    pTwitCurlObj->m_callbackData = pTwitCurlObj->m_callbackData.substr( 2 + pos );
-                }
+                valid = false;
             }
         }
+        if( !valid )
+        {
+            m_resyncCount++;
+        }
+        else if( length > m_maxMessageSize )
+        {
+            m_droppedCount++;
+            m_skipLength = length;
+        }
+        else
+        {
+            m_chunkLength = length;
+        }
     }
-    return writtenSize;
+    return false;
 }
 
-
 /*++
 * @method: twitCurl::SetStreamApiCallback
 *
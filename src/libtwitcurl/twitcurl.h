@@ -26,7 +26,7 @@ namespace twitCurlTypes
         eTwitCurlProtocolMax
     } eTwitCurlProtocolType;
 
-    typedef void ( *fpStreamApiCallback )( std::string &data, twitCurl* pTwitCurlObj, void *userdata );
+    typedef void ( *fpStreamApiCallback )( const char* data, size_t size, twitCurl* pTwitCurlObj, void *userdata );
     typedef void ( *fpStreamApiActivityCallback )( twitCurl* pTwitCurlObj, void *userdata );
 
 };
@@ -36,6 +36,8 @@ namespace twitCurlDefaults
 {
     /* Constants */
     const int TWITCURL_DEFAULT_BUFFSIZE = 1024;
+    const size_t TWITCURL_STREAM_MAXMESSAGESIZE = 8 * 1024 * 1024;
+    const size_t TWITCURL_STREAM_MAXLENGTHLINE = 32;
     const std::string TWITCURL_COLON = ":";
     const char TWITCURL_EOS = '\0';
     const unsigned int MAX_TIMELINE_TWEET_COUNT = 200;
@@ -181,6 +183,42 @@ struct timelineparams {
 	signed char alt_text;	//"
 };
 
+/* Splits a length-delimited streaming API response (delimited=length) into messages.
+ * Received data is appended to the end of a single buffer, and delivered messages are consumed from the front
+ * without moving the remainder. The consumed space is only reclaimed once it is at least half of the buffer,
+ * so each byte is moved at most a constant number of times however large the backlog gets.
+ * Messages longer than the maximum message size are skipped without being buffered, and counted as dropped.
+ * Length lines which are not a valid number cause the splitter to skip to the next line, and are counted as resyncs. */
+class streamChunkSplitter
+{
+public:
+    streamChunkSplitter();
+
+    void reset();
+    void setMaxMessageSize( size_t maxSize ) { m_maxMessageSize = maxSize; }
+    size_t getMaxMessageSize() const { return m_maxMessageSize; }
+    unsigned int getDroppedCount() const { return m_droppedCount; }
+    unsigned int getResyncCount() const { return m_resyncCount; }
+
+    /* This invalidates any message previously returned by nextMessage */
+    void append( const char* data, size_t size );
+
+    /* Returns false if there is not a complete message available.
+     * The returned message is valid until the next call to append or reset. */
+    bool nextMessage( const char*& data /* out */, size_t& size /* out */ );
+
+private:
+    std::string m_buffer;
+    size_t m_start;            /* start of unconsumed data in m_buffer */
+    size_t m_scanPos;          /* data between m_start and here has already been searched for a line end */
+    size_t m_chunkLength;      /* length of the current message, 0 if waiting for a length line */
+    size_t m_skipLength;       /* remaining bytes of an oversize message to be skipped */
+    bool m_discardLine;        /* skipping to the end of an overlong length line */
+    size_t m_maxMessageSize;
+    unsigned int m_droppedCount;
+    unsigned int m_resyncCount;
+};
+
 /* twitCurl class */
 class twitCurl
 {
@@ -309,6 +347,7 @@ public:
     bool PublicSampleStreamingApi( bool accept_encoding=true, bool stall_warnings=false );
     void SetStreamApiCallback( twitCurlTypes::fpStreamApiCallback func, void *userdata );
     void SetStreamApiActivityCallback( twitCurlTypes::fpStreamApiActivityCallback func);
+    streamChunkSplitter& getStreamSplitter() { return m_streamSplitter; }
 
     /* Methods to allow the use of the Curl multi API (asynchronous IO) */
     CURL* GetCurlHandle() { return m_curlHandle; }
@@ -348,7 +387,7 @@ private:
     oAuth m_oAuth;
 
     /* Streaming API data */
-    unsigned int m_curchunklength;
+    streamChunkSplitter m_streamSplitter;
     twitCurlTypes::fpStreamApiCallback m_streamapicallback;
     twitCurlTypes::fpStreamApiActivityCallback m_streamapiactivitycallback;
     void *m_streamapicallback_data;
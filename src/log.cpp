@@ -21,6 +21,7 @@
 #include "log-impl.h"
 #include "log-util.h"
 #include "socket.h"
+#include "socket-ops.h"
 #include "twit.h"
 #include "taccount.h"
 #include "util.h"
@@ -674,6 +675,7 @@ void dump_pending_active_conn(LOGT logflags, const std::string &indent, const st
 		LogMsgFormat(logflags, "%s%sSocket: %s, ID: %d, Error Count: %d, mcflags: 0x%X",
 				cstr(indent), cstr(indentstep), cstr(it.cs->GetConnTypeName()), it.cs->id, it.cs->errorcount, it.cs->mcflags);
 	}
+	LogMsgFormat(logflags, "%sDownload scheduler: %s", cstr(indent), cstr(sm.dlsched->GetStatsString()));
 }
 
 void dump_pending_retry_conn(LOGT logflags, const std::string &indent, const std::string &indentstep) {
@@ -733,6 +733,19 @@ settings_window::settings_window(wxWindow* parent, wxWindowID id, const wxString
 
 	AddSettingRow_Bool(OPTWIN_MISC, panel, fgs,  wxT("Show Import Stream File menu item"), DBCV::ISGLOBALCFG | DBCV::ADVOPTION, gc.gcfg.show_import_stream_menu_item, gcglobdefaults.show_import_stream_menu_item);
 	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Thread pool limit, 0 to disable\nDo not set this too high\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.threadpoollimit, gcglobdefaults.threadpoollimit, wxFILTER_NUMERIC);
+	AddSettingRow_Bool(OPTWIN_MISC, panel, fgs,  wxT("Use database write-ahead log (WAL) mode\nThis is required for database read threads\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbwalmode, gcglobdefaults.dbwalmode);
+	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Database read thread count, 0 to disable\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbreadpoolthreads, gcglobdefaults.dbreadpoolthreads, wxFILTER_NUMERIC);
+	auto dbdurability_choice = new wxChoice(panel, wxID_ANY, wxDefaultPosition, wxDefaultSize, 0, nullptr, 0, GenericChoiceValidator(gc.gcfg.dbdurability));
+	dbdurability_choice->Append(wxT("Full: sync on every commit"), (void *) nullptr);
+	dbdurability_choice->Append(wxT("Normal: sync on checkpoint (WAL mode)"), (void *) nullptr);
+	dbdurability_choice->Append(wxT("Off: never sync"), (void *) nullptr);
+	AddSettingRow_Common(OPTWIN_MISC, panel, fgs, wxT("Database durability\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, dbdurability_choice, GenericChoiceDefaultChkBoxValidator(gc.gcfg.dbdurability, gcglobdefaults.dbdurability, dbdurability_choice));
+	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Database group commit time limit / ms\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbgroupcommitmaxms, gcglobdefaults.dbgroupcommitmaxms, wxFILTER_NUMERIC);
+	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Database group commit message limit, 1 to disable\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbgroupcommitmaxmsgs, gcglobdefaults.dbgroupcommitmaxmsgs, wxFILTER_NUMERIC);
+	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Database WAL background checkpoint interval / s\n0 to checkpoint automatically on commit\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbwalcheckpointintervalsecs, gcglobdefaults.dbwalcheckpointintervalsecs, wxFILTER_NUMERIC);
+	AddSettingRow_Bool(OPTWIN_MISC, panel, fgs,  wxT("Compress database JSON using zstd with trained dictionaries\nExisting rows are recompressed in the background\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbzstd, gcglobdefaults.dbzstd);
+	AddSettingRow_Bool(OPTWIN_MISC, panel, fgs,  wxT("Use startup ID snapshot file\nThis is stored next to the database"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbidsnapshot, gcglobdefaults.dbidsnapshot);
+	AddSettingRow_Bool(OPTWIN_MISC, panel, fgs,  wxT("Maintain a full-text search index of tweet text and user fields\nExisting rows are indexed in the background\nRestart retcon for this to take effect"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.dbsearchindex, gcglobdefaults.dbsearchindex);
 	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Flush all state to DB interval / mins, 0 to disable\nChanges take effect after the next flush"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.asyncstatewritebackintervalmins, gcglobdefaults.asyncstatewritebackintervalmins, wxFILTER_NUMERIC);
 	AddSettingRow_String(OPTWIN_MISC, panel, fgs, wxT("Purge old tweets from timeline interval / mins, 0 to disable\nChanges take effect after the next flush"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.asyncpurgeoldtweetsintervalmins, gcglobdefaults.asyncpurgeoldtweetsintervalmins, wxFILTER_NUMERIC);
 	AddSettingRow_Bool(OPTWIN_MISC, panel, fgs,  wxT("Show debug actions in tweet menu"), DBCV::ISGLOBALCFG | DBCV::VERYADVOPTION, gc.gcfg.tweetdebugactions, gcglobdefaults.tweetdebugactions);
@@ -757,6 +770,11 @@ settings_window::settings_window(wxWindow* parent, wxWindowID id, const wxString
 	wxString netifacelabel = wxT("Outgoing network interface (interface name, IP or host)");
 #endif
 	AddSettingRow_String(OPTWIN_NETWORK, panel, fgs, netifacelabel, DBCV::ISGLOBALCFG | DBCV::ADVOPTION, gc.gcfg.netiface, gcglobdefaults.netiface);
+#if LIBCURL_VERSION_NUM >= 0x073100
+	AddSettingRow_String(OPTWIN_NETWORK, panel, fgs, wxT("Redirect all connections to a local test server (loopback host:port).\nCertificates are not verified whilst set. Leave empty for normal use."), DBCV::ISGLOBALCFG | DBCV::ADVOPTION, gc.gcfg.apiredirect, gcglobdefaults.apiredirect);
+#endif
+	AddSettingRow_String(OPTWIN_NETWORK, panel, fgs, wxT("Maximum simultaneous image downloads, 0 for no limit"), DBCV::ISGLOBALCFG | DBCV::ADVOPTION, gc.gcfg.mediadlmaxconns, gcglobdefaults.mediadlmaxconns, wxFILTER_NUMERIC);
+	AddSettingRow_String(OPTWIN_NETWORK, panel, fgs, wxT("Maximum simultaneous image downloads per host, 0 for no limit"), DBCV::ISGLOBALCFG | DBCV::ADVOPTION, gc.gcfg.mediadlmaxhostconns, gcglobdefaults.mediadlmaxhostconns, wxFILTER_NUMERIC);
 
 	lb = new wxChoice(panel, SWID_ACC_CHOICE);
 
@@ -0,0 +1,312 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "packed-idset.h"
+#include <algorithm>
+
+namespace container {
+
+namespace {
+	const size_t max_block_count = 128;
+
+	// Blocks smaller than this are merged with a neighbour on erase, where possible
+	const size_t min_block_count = max_block_count / 4;
+
+	void write_varint(std::vector<unsigned char> &out, uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back(static_cast<unsigned char>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<unsigned char>(value));
+	}
+
+	size_t read_varint(const std::vector<unsigned char> &in, size_t pos, uint64_t &value) {
+		value = 0;
+		unsigned int shift = 0;
+		unsigned char byte;
+		do {
+			byte = in[pos++];
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		return pos;
+	}
+
+	// Returns the start offset of the varint which ends just before pos
+	size_t varint_start(const std::vector<unsigned char> &in, size_t pos) {
+		size_t start = pos - 1;
+		while (start > 0 && (in[start - 1] & 0x80)) start--;
+		return start;
+	}
+};
+
+packed_id_set::const_iterator &packed_id_set::const_iterator::operator++() {
+	const block &b = set->blocks[block_index];
+	if (pos >= b.deltas.size()) {
+		block_index++;
+		pos = 0;
+		value = (block_index < set->blocks.size()) ? set->blocks[block_index].first : 0;
+	} else {
+		uint64_t delta;
+		pos = read_varint(b.deltas, pos, delta);
+		value -= delta;
+	}
+	return *this;
+}
+
+packed_id_set::const_iterator &packed_id_set::const_iterator::operator--() {
+	if (pos == 0) {
+		block_index--;
+		const block &b = set->blocks[block_index];
+		pos = b.deltas.size();
+		value = b.last;
+	} else {
+		const block &b = set->blocks[block_index];
+		size_t start = varint_start(b.deltas, pos);
+		uint64_t delta;
+		read_varint(b.deltas, start, delta);
+		value += delta;
+		pos = start;
+	}
+	return *this;
+}
+
+packed_id_set::const_iterator packed_id_set::begin() const {
+	if (blocks.empty()) return end();
+	return const_iterator(this, 0, 0, blocks.front().first);
+}
+
+// Returns the index of the first block whose last (smallest) ID is <= id (or < id if strict)
+packed_id_set::size_type packed_id_set::find_block(uint64_t id, bool strict) const {
+	auto it = std::partition_point(blocks.begin(), blocks.end(), [&](const block &b) {
+		return strict ? b.last >= id : b.last > id;
+	});
+	return it - blocks.begin();
+}
+
+packed_id_set::const_iterator packed_id_set::scan_block(size_type block_index, uint64_t id, bool strict) const {
+	if (block_index >= blocks.size()) return end();
+
+	// The block's last ID is known to satisfy the bound, so this always terminates within the block
+	const_iterator it(this, block_index, 0, blocks[block_index].first);
+	while (strict ? *it >= id : *it > id) ++it;
+	return it;
+}
+
+packed_id_set::const_iterator packed_id_set::lower_bound(uint64_t id) const {
+	return scan_block(find_block(id, false), id, false);
+}
+
+packed_id_set::const_iterator packed_id_set::upper_bound(uint64_t id) const {
+	return scan_block(find_block(id, true), id, true);
+}
+
+packed_id_set::const_iterator packed_id_set::find(uint64_t id) const {
+	const_iterator it = lower_bound(id);
+	if (it != end() && *it == id) return it;
+	return end();
+}
+
+void packed_id_set::decode_block(const block &b, std::vector<uint64_t> &out) const {
+	out.clear();
+	out.reserve(b.count + 1);
+	uint64_t value = b.first;
+	out.push_back(value);
+	size_t pos = 0;
+	while (pos < b.deltas.size()) {
+		uint64_t delta;
+		pos = read_varint(b.deltas, pos, delta);
+		value -= delta;
+		out.push_back(value);
+	}
+}
+
+void packed_id_set::encode_block(block &b, const uint64_t *ids, size_t count) {
+	b.first = ids[0];
+	b.last = ids[count - 1];
+	b.count = count;
+	b.deltas.clear();
+	for (size_t i = 1; i < count; i++) {
+		write_varint(b.deltas, ids[i - 1] - ids[i]);
+	}
+	b.deltas.shrink_to_fit();
+}
+
+// Does not adjust total
+void packed_id_set::rewrite_block(size_type block_index, const std::vector<uint64_t> &ids) {
+	if (ids.empty()) {
+		blocks.erase(blocks.begin() + block_index);
+	} else if (ids.size() > max_block_count) {
+		size_t first_half = ids.size() / 2;
+		encode_block(blocks[block_index], ids.data(), first_half);
+		block second;
+		encode_block(second, ids.data() + first_half, ids.size() - first_half);
+		blocks.insert(blocks.begin() + block_index + 1, std::move(second));
+	} else {
+		encode_block(blocks[block_index], ids.data(), ids.size());
+	}
+}
+
+// Appends id to the end of the last block, if it is lower than all existing IDs
+bool packed_id_set::append(uint64_t id) {
+	if (!blocks.empty() && blocks.back().last <= id) return false;
+
+	if (blocks.empty() || blocks.back().count >= max_block_count) {
+		if (!blocks.empty()) blocks.back().deltas.shrink_to_fit();
+		blocks.emplace_back();
+		block &b = blocks.back();
+		b.first = b.last = id;
+		b.count = 1;
+	} else {
+		block &b = blocks.back();
+		write_varint(b.deltas, b.last - id);
+		b.last = id;
+		b.count++;
+	}
+	total++;
+	return true;
+}
+
+std::pair<packed_id_set::iterator, bool> packed_id_set::insert(uint64_t id) {
+	size_type block_index = find_block(id, false);
+	if (block_index >= blocks.size()) {
+		// Lower than all existing IDs (or empty)
+		append(id);
+		return std::make_pair(const_iterator(this, blocks.size() - 1, blocks.back().deltas.size(), id), true);
+	}
+
+	if (blocks[block_index].first >= id) {
+		// Within range of this block
+		const_iterator it = scan_block(block_index, id, false);
+		if (*it == id) return std::make_pair(it, false);
+	} else if (block_index > 0 && blocks[block_index - 1].count < blocks[block_index].count) {
+		// Between two blocks, add to the end of the smaller of the two
+		block_index--;
+	}
+
+	std::vector<uint64_t> ids;
+	decode_block(blocks[block_index], ids);
+	ids.insert(std::lower_bound(ids.begin(), ids.end(), id, key_compare()), id);
+	rewrite_block(block_index, ids);
+	total++;
+	return std::make_pair(lower_bound(id), true);
+}
+
+packed_id_set::iterator packed_id_set::insert(const_iterator hint, uint64_t id) {
+	if (hint == end() && append(id)) {
+		return const_iterator(this, blocks.size() - 1, blocks.back().deltas.size(), id);
+	}
+	return insert(id).first;
+}
+
+void packed_id_set::merge_small_block(size_type block_index) {
+	if (block_index >= blocks.size() || blocks[block_index].count >= min_block_count) return;
+
+	auto can_merge = [&](size_type index) {
+		return index + 1 < blocks.size() && blocks[index].count + blocks[index + 1].count <= max_block_count;
+	};
+	if (!can_merge(block_index)) {
+		if (block_index == 0 || !can_merge(block_index - 1)) return;
+		block_index--;
+	}
+
+	// The deltas of the second block can be appended as-is, only the join needs a new delta
+	block &a = blocks[block_index];
+	block &b = blocks[block_index + 1];
+	write_varint(a.deltas, a.last - b.first);
+	a.deltas.insert(a.deltas.end(), b.deltas.begin(), b.deltas.end());
+	a.deltas.shrink_to_fit();
+	a.last = b.last;
+	a.count += b.count;
+	blocks.erase(blocks.begin() + block_index + 1);
+}
+
+packed_id_set::size_type packed_id_set::erase(uint64_t id) {
+	size_type block_index = find_block(id, false);
+	if (block_index >= blocks.size() || blocks[block_index].first < id) return 0;
+
+	std::vector<uint64_t> ids;
+	decode_block(blocks[block_index], ids);
+	auto it = std::lower_bound(ids.begin(), ids.end(), id, key_compare());
+	if (it == ids.end() || *it != id) return 0;
+	ids.erase(it);
+	rewrite_block(block_index, ids);
+	total--;
+	merge_small_block(block_index);
+	return 1;
+}
+
+packed_id_set::iterator packed_id_set::erase(const_iterator it) {
+	uint64_t id = *it;
+	erase(id);
+	return upper_bound(id);
+}
+
+// Removes IDs <= high_inc and > low_exc (or all IDs <= high_inc if to_end) from a block, returns the number removed
+packed_id_set::size_type packed_id_set::erase_block_range(size_type block_index, uint64_t high_inc, uint64_t low_exc, bool to_end) {
+	std::vector<uint64_t> ids;
+	decode_block(blocks[block_index], ids);
+	size_t old_size = ids.size();
+	ids.erase(std::remove_if(ids.begin(), ids.end(), [&](uint64_t id) {
+		return id <= high_inc && (to_end || id > low_exc);
+	}), ids.end());
+	size_t removed = old_size - ids.size();
+	if (removed) rewrite_block(block_index, ids);
+	return removed;
+}
+
+packed_id_set::iterator packed_id_set::erase(const_iterator first, const_iterator last) {
+	if (first == last) return last;
+
+	const bool to_end = (last == end());
+	const uint64_t high_inc = *first;
+	const uint64_t low_exc = to_end ? 0 : *last;
+	const size_type start_block = first.block_index;
+	const size_type end_block = to_end ? blocks.size() : last.block_index;
+
+	size_type removed = 0;
+	if (start_block == end_block) {
+		removed += erase_block_range(start_block, high_inc, low_exc, false);
+	} else {
+		// Work from the highest block index downwards, such that lower indexes remain valid
+		if (!to_end) removed += erase_block_range(end_block, high_inc, low_exc, false);
+
+		// Blocks entirely within the range are dropped without decoding them
+		for (size_type i = start_block + 1; i < end_block; i++) {
+			removed += blocks[i].count;
+		}
+		blocks.erase(blocks.begin() + start_block + 1, blocks.begin() + end_block);
+
+		removed += erase_block_range(start_block, high_inc, low_exc, to_end);
+	}
+	total -= removed;
+
+	if (start_block < blocks.size()) {
+		merge_small_block(start_block);
+		if (start_block + 1 < blocks.size()) merge_small_block(start_block + 1);
+	}
+
+	return to_end ? end() : lower_bound(low_exc);
+}
+
+bool packed_id_set::operator==(const packed_id_set &other) const {
+	return total == other.total && std::equal(begin(), end(), other.begin());
+}
+
+};
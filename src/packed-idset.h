@@ -0,0 +1,199 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#ifndef HGUARD_SRC_PACKED_IDSET
+#define HGUARD_SRC_PACKED_IDSET
+
+#include "univdefs.h"
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace container {
+
+// Ordered set of uint64_t IDs, sorted in descending order (ie. as std::set<uint64_t, std::greater<uint64_t>>)
+// IDs are stored in blocks of up to 128 entries.
+// Each block stores its first (largest) ID, followed by LEB128 varint deltas from the previous ID.
+// Snowflake IDs which are close together therefore use 3-6 bytes each, instead of 8 bytes + tree overhead.
+// Any insertion or erasure invalidates all iterators (as for btree_set).
+// Iterators dereference to a value cached in the iterator, not to storage within the container.
+class packed_id_set {
+	public:
+	typedef uint64_t key_type;
+	typedef uint64_t value_type;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef std::greater<uint64_t> key_compare;
+	typedef std::greater<uint64_t> value_compare;
+	typedef const uint64_t &reference;
+	typedef const uint64_t &const_reference;
+
+	private:
+	struct block {
+		uint64_t first = 0;
+		uint64_t last = 0;
+		uint32_t count = 0;
+		std::vector<unsigned char> deltas;
+	};
+
+	std::vector<block> blocks;
+	size_type total = 0;
+
+	public:
+	class const_iterator {
+		friend packed_id_set;
+
+		const packed_id_set *set = nullptr;
+		size_type block_index = 0;
+		size_type pos = 0;        // byte offset just past the delta of the current ID, 0 for the first ID in a block
+		uint64_t value = 0;
+
+		const_iterator(const packed_id_set *set_, size_type block_index_, size_type pos_, uint64_t value_)
+				: set(set_), block_index(block_index_), pos(pos_), value(value_) { }
+
+		public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef uint64_t value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const uint64_t *pointer;
+		typedef const uint64_t &reference;
+
+		const_iterator() { }
+
+		reference operator*() const { return value; }
+		pointer operator->() const { return &value; }
+		const_iterator &operator++();
+		const_iterator &operator--();
+		const_iterator operator++(int) { const_iterator tmp = *this; ++(*this); return tmp; }
+		const_iterator operator--(int) { const_iterator tmp = *this; --(*this); return tmp; }
+		bool operator==(const const_iterator &other) const { return block_index == other.block_index && pos == other.pos; }
+		bool operator!=(const const_iterator &other) const { return !(*this == other); }
+	};
+	typedef const_iterator iterator;
+
+	// std::reverse_iterator cannot be used as it returns a reference to a temporary iterator
+	class const_reverse_iterator {
+		const_iterator current;
+		uint64_t value = 0;
+
+		void load() {
+			if (current != current.set->begin()) value = *std::prev(current);
+		}
+
+		public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef uint64_t value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const uint64_t *pointer;
+		typedef const uint64_t &reference;
+
+		const_reverse_iterator() { }
+		explicit const_reverse_iterator(const_iterator it) : current(it) { load(); }
+
+		const_iterator base() const { return current; }
+		reference operator*() const { return value; }
+		pointer operator->() const { return &value; }
+		const_reverse_iterator &operator++() { --current; load(); return *this; }
+		const_reverse_iterator &operator--() { ++current; load(); return *this; }
+		const_reverse_iterator operator++(int) { const_reverse_iterator tmp = *this; ++(*this); return tmp; }
+		const_reverse_iterator operator--(int) { const_reverse_iterator tmp = *this; --(*this); return tmp; }
+		bool operator==(const const_reverse_iterator &other) const { return current == other.current; }
+		bool operator!=(const const_reverse_iterator &other) const { return !(*this == other); }
+	};
+	typedef const_reverse_iterator reverse_iterator;
+
+	packed_id_set() { }
+	template <typename I> packed_id_set(I first, I last) { insert(first, last); }
+	packed_id_set(std::initializer_list<uint64_t> list) { insert(list.begin(), list.end()); }
+
+	const_iterator begin() const;
+	const_iterator end() const { return const_iterator(this, blocks.size(), 0, 0); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+	const_reverse_iterator crbegin() const { return rbegin(); }
+	const_reverse_iterator crend() const { return rend(); }
+
+	size_type size() const { return total; }
+	bool empty() const { return total == 0; }
+	key_compare key_comp() const { return key_compare(); }
+	value_compare value_comp() const { return value_compare(); }
+
+	void clear() {
+		blocks.clear();
+		total = 0;
+	}
+	void swap(packed_id_set &other) {
+		blocks.swap(other.blocks);
+		std::swap(total, other.total);
+	}
+
+	// First ID <= id
+	const_iterator lower_bound(uint64_t id) const;
+	// First ID < id
+	const_iterator upper_bound(uint64_t id) const;
+	std::pair<const_iterator, const_iterator> equal_range(uint64_t id) const {
+		return std::make_pair(lower_bound(id), upper_bound(id));
+	}
+	const_iterator find(uint64_t id) const;
+	size_type count(uint64_t id) const { return find(id) != end() ? 1 : 0; }
+
+	std::pair<iterator, bool> insert(uint64_t id);
+
+	// Appending in descending order with a hint of end() is O(1), this is what std::inserter(set, set.end()) does
+	iterator insert(const_iterator hint, uint64_t id);
+
+	template <typename I> void insert(I first, I last) {
+		const_iterator hint = end();
+		for (; first != last; ++first) {
+			hint = insert(hint, *first);
+			++hint;
+		}
+	}
+	void insert(std::initializer_list<uint64_t> list) { insert(list.begin(), list.end()); }
+
+	size_type erase(uint64_t id);
+	iterator erase(const_iterator it);
+	iterator erase(const_iterator first, const_iterator last);
+
+	bool operator==(const packed_id_set &other) const;
+	bool operator!=(const packed_id_set &other) const { return !(*this == other); }
+
+	private:
+	size_type find_block(uint64_t id, bool strict) const;
+	const_iterator scan_block(size_type block_index, uint64_t id, bool strict) const;
+	void decode_block(const block &b, std::vector<uint64_t> &out) const;
+	void encode_block(block &b, const uint64_t *ids, size_t count);
+	void rewrite_block(size_type block_index, const std::vector<uint64_t> &ids);
+	size_type erase_block_range(size_type block_index, uint64_t high_inc, uint64_t low_exc, bool to_end);
+	bool append(uint64_t id);
+	void merge_small_block(size_type block_index);
+};
+
+inline void swap(packed_id_set &a, packed_id_set &b) {
+	a.swap(b);
+}
+
+};
+
+#endif
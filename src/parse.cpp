@@ -34,9 +34,10 @@
 #include "userui.h"
 #include "retcon.h"
 #include "utf8.h"
+#include "url-util.h"
+#include "date-util.h"
 #include <cstring>
 #include <limits>
-#include <wx/uri.h>
 #include <wx/msgdlg.h>
 #include <algorithm>
 #include <pcre.h>
@@ -50,7 +51,7 @@ void parse_util::DisplayParseErrorMsg(rapidjson::Document &dc, const std::string
 	jw.StartArray();
 	jw.String(data);
 	jw.EndArray();
-	LogMsgFormat(LOGT::PARSEERR, "JSON parse error: %s, message: %s, offset: %d, data:\n%s", name.c_str(), dc.GetParseError(), dc.GetErrorOffset(), cstr(errjson));
+	TSLogMsgFormat(LOGT::PARSEERR, "JSON parse error: %s, message: %s, offset: %d, data:\n%s", name.c_str(), dc.GetParseError(), dc.GetErrorOffset(), cstr(errjson));
 }
 
 bool parse_util::ParseStringInPlace(rapidjson::Document &dc, char *mutable_string, const std::string &name) {
@@ -61,6 +62,196 @@ bool parse_util::ParseStringInPlace(rapidjson::Document &dc, char *mutable_strin
 	return true;
 }
 
+namespace {
+	// SAX handler which builds a DOM, in the same way as rapidjson::Document does for an in-situ parse,
+	// except that members named by IsSkippedKey are dropped along with their entire value.
+	// The values are built on a temporary stack, and only the kept values are added to the document allocator.
+	struct filtered_dom_builder {
+		typedef rapidjson::Value::Member Member;
+
+		struct frame {
+			bool is_object;
+			bool expect_key;
+			rapidjson::SizeType count;    // members or elements kept so far
+		};
+
+		rapidjson::MemoryPoolAllocator<> &allocator;
+		rapidjson::internal::Stack<rapidjson::CrtAllocator> stack;
+		std::vector<frame> frames;
+		unsigned int skip_depth = 0;      // > 0 whilst inside the value of a skipped member
+		bool skip_next_value = false;     // a skipped key has just been read
+
+		filtered_dom_builder(rapidjson::MemoryPoolAllocator<> &allocator_) : allocator(allocator_), stack(nullptr, 1024) { }
+
+		// Keys which are never read by the parsers in this file, nor stored by ParseTweetStatics or userdata::mkjson
+		static bool IsSkippedKey(const char *str, rapidjson::SizeType length) {
+			static const char suffix[] = "_str";    // string forms of numeric IDs
+			const size_t suffix_len = sizeof(suffix) - 1;
+			if (length > suffix_len && memcmp(str + length - suffix_len, suffix, suffix_len) == 0) {
+				return true;
+			}
+
+			static const char * const skipped_keys[] = {
+				"contributors", "coordinates", "display_text_range", "geo", "is_quote_status", "lang", "metadata", "place",
+				"quoted_status_permalink", "truncated", "withheld_in_countries",
+				"contributors_enabled", "default_profile", "default_profile_image", "geo_enabled", "has_extended_profile",
+				"is_translation_enabled", "is_translator", "profile_background_color", "profile_background_image_url",
+				"profile_background_image_url_https", "profile_background_tile", "profile_banner_url", "profile_link_color",
+				"profile_location", "profile_sidebar_border_color", "profile_sidebar_fill_color", "profile_text_color",
+				"profile_use_background_image", "time_zone", "translator_type", "utc_offset",
+			};
+			for (const char *key : skipped_keys) {
+				if (strlen(key) == length && memcmp(key, str, length) == 0) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Returns true if the value should be built
+		bool BeginValue(bool is_container) {
+			if (skip_depth) {
+				if (is_container) {
+					skip_depth++;
+				}
+				return false;
+			}
+			if (skip_next_value) {
+				skip_next_value = false;
+				if (is_container) {
+					skip_depth = 1;
+				} else {
+					EndValue(false);
+				}
+				return false;
+			}
+			return true;
+		}
+
+		void EndValue(bool kept) {
+			if (!frames.empty()) {
+				frame &f = frames.back();
+				if (kept) {
+					f.count++;
+				}
+				if (f.is_object) {
+					f.expect_key = true;
+				}
+			}
+		}
+
+		template <typename T> void Scalar(T value) {
+			if (BeginValue(false)) {
+				new (stack.Push<rapidjson::Value>()) rapidjson::Value(value);
+				EndValue(true);
+			}
+		}
+
+		void Null() {
+			if (BeginValue(false)) {
+				new (stack.Push<rapidjson::Value>()) rapidjson::Value();
+				EndValue(true);
+			}
+		}
+		void Bool(bool b) { Scalar(b); }
+		void Int(int i) { Scalar(i); }
+		void Uint(unsigned i) { Scalar(i); }
+		void Int64(int64_t i) { Scalar(i); }
+		void Uint64(uint64_t i) { Scalar(i); }
+		void Double(double d) { Scalar(d); }
+
+		// Object keys are pushed without being counted, the member is counted when its value ends
+		void String(const char *str, rapidjson::SizeType length, bool copy) {
+			bool is_key = !skip_depth && !skip_next_value && !frames.empty() && frames.back().is_object && frames.back().expect_key;
+			if (is_key) {
+				frames.back().expect_key = false;
+				if (IsSkippedKey(str, length)) {
+					skip_next_value = true;
+					return;
+				}
+			} else if (!BeginValue(false)) {
+				return;
+			}
+			if (copy) {
+				new (stack.Push<rapidjson::Value>()) rapidjson::Value(str, length, allocator);
+			} else {
+				new (stack.Push<rapidjson::Value>()) rapidjson::Value(str, length);
+			}
+			if (!is_key) {
+				EndValue(true);
+			}
+		}
+
+		void StartObject() {
+			if (BeginValue(true)) {
+				new (stack.Push<rapidjson::Value>()) rapidjson::Value(rapidjson::kObjectType);
+				frames.push_back({ true, true, 0 });
+			}
+		}
+
+		void EndObject(rapidjson::SizeType) {
+			if (EndSkipped()) {
+				return;
+			}
+			rapidjson::SizeType count = frames.back().count;
+			frames.pop_back();
+			Member *members = stack.Pop<Member>(count);
+			rapidjson::Value &obj = *stack.Top<rapidjson::Value>();
+			for (rapidjson::SizeType i = 0; i < count; i++) {
+				obj.AddMember(members[i].name, members[i].value, allocator);
+			}
+			EndValue(true);
+		}
+
+		void StartArray() {
+			if (BeginValue(true)) {
+				new (stack.Push<rapidjson::Value>()) rapidjson::Value(rapidjson::kArrayType);
+				frames.push_back({ false, false, 0 });
+			}
+		}
+
+		void EndArray(rapidjson::SizeType) {
+			if (EndSkipped()) {
+				return;
+			}
+			rapidjson::SizeType count = frames.back().count;
+			frames.pop_back();
+			rapidjson::Value *elements = stack.Pop<rapidjson::Value>(count);
+			rapidjson::Value &arr = *stack.Top<rapidjson::Value>();
+			arr.Reserve(count, allocator);
+			for (rapidjson::SizeType i = 0; i < count; i++) {
+				arr.PushBack(elements[i], allocator);
+			}
+			EndValue(true);
+		}
+
+		// Returns true if this is the end of a container inside a skipped value
+		bool EndSkipped() {
+			if (!skip_depth) {
+				return false;
+			}
+			skip_depth--;
+			if (!skip_depth) {
+				EndValue(false);
+			}
+			return true;
+		}
+	};
+};
+
+bool parse_util::ParseStringInPlaceFiltered(rapidjson::Document &dc, char *mutable_string, const std::string &name) {
+	filtered_dom_builder builder(dc.GetAllocator());
+	rapidjson::GenericReader<rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>> reader;
+	rapidjson::GenericInsituStringStream<rapidjson::UTF8<>> stream(mutable_string);
+	if (!reader.Parse<rapidjson::kParseInsituFlag>(stream, builder)) {
+		TSLogMsgFormat(LOGT::PARSEERR, "JSON parse error: %s, message: %s, offset: %zu", name.c_str(), reader.GetParseError(), reader.GetErrorOffset());
+		dc.SetNull();
+		return false;
+	}
+	static_cast<rapidjson::Value &>(dc) = *builder.stack.Pop<rapidjson::Value>(1);
+	return true;
+}
+
 //if jw, caller should already have called jw->StartObject(), etc
 void genjsonparser::ParseTweetStatics(const rapidjson::Value &val, tweet_ptr_p tobj, Handler *jw, bool isnew, optional_observer_ptr<dbsendmsg_list> dbmsglist, bool parse_entities) {
 	CheckTransJsonValueDef(tobj->in_reply_to_status_id, val, "in_reply_to_status_id", 0, jw);
@@ -68,6 +259,7 @@ void genjsonparser::ParseTweetStatics(const rapidjson::Value &val, tweet_ptr_p t
 	CheckTransJsonValue(tobj->retweet_count, val, "retweet_count");
 	CheckTransJsonValue(tobj->favourite_count, val, "favorite_count");
 	CheckTransJsonValueDef(tobj->source, val, "source", "", jw);
+	// The choice of text here must match GetTweetSearchText in db-search.cpp
 	CheckTransJsonValueDef(tobj->text, val, "text", "", jw);
 	CheckTransJsonValue(tobj->text, val, "full_text", jw);
 
@@ -167,12 +359,11 @@ static bool ReadEntityIndices(entity &en, const rapidjson::Value &val) {
 	return ReadEntityIndices(en.start, en.end, val);
 }
 
-static std::string ProcessMediaURL(std::string url, const wxURI &wxuri) {
-	if (!wxuri.HasServer()) return url;
+static std::string ProcessMediaURL(std::string url, const url_parts &parts) {
+	if (!parts.HasAuthority()) return url;
 
-	wxString host = wxuri.GetServer();
-	if (host == wxT("dropbox.com") || host.EndsWith(wxT(".dropbox.com"), nullptr)) {
-		if (wxuri.GetPath().StartsWith(wxT("/s/")) && !wxuri.HasQuery()) {
+	if (parts.host.EqualsNoCase("dropbox.com") || parts.host.EndsWithNoCase(".dropbox.com")) {
+		if (parts.path.StartsWith("/s/") && !parts.query.IsPresent()) {
 			return url + "?dl=1";
 		}
 	}
@@ -254,10 +445,22 @@ void genjsonparser::DoEntitiesParse(const rapidjson::Value &val, optional_observ
 			struct local {
 				static void try_net_dl(media_entity *me, std::string url, flagwrapper<MIDC> net_flags, flagwrapper<MELF> netloadmask, flagwrapper<MELF> mel_flags) {
 					if (mel_flags & MELF::NONETLOAD) return;
-					if (!(me->flags & MEF::HAVE_THUMB) && !(url.empty()) && (netloadmask & mel_flags) &&
-							!(me->flags & MEF::THUMB_NET_INPROGRESS) && !(me->flags & MEF::THUMB_FAILED)) {
-						std::shared_ptr<taccount> acc = me->dm_media_acc.lock();
-						mediaimgdlconn::NewConnWithOptAccOAuth(url, me->media_id, net_flags, acc.get());
+					if (!(me->flags & MEF::HAVE_THUMB) && !(url.empty()) && (netloadmask & mel_flags) && !(me->flags & MEF::THUMB_FAILED)) {
+						DLPRI pri = DLPRI::PREFETCH;
+						flagwrapper<DLSF> dlflags = 0;
+						if (mel_flags & MELF::FORCE) {
+							pri = DLPRI::VISIBLE;
+						} else if (mel_flags & MELF::DISPTIME) {
+							pri = DLPRI::VISIBLE;
+							dlflags = DLSF::CANCEL_ON_HIDE;
+						}
+						if (me->flags & MEF::THUMB_NET_INPROGRESS) {
+							// Already queued or loading, make sure that it is not behind less urgent downloads
+							sm.dlsched->RaiseMediaPriority(me->media_id, pri, dlflags);
+						} else {
+							std::shared_ptr<taccount> acc = me->dm_media_acc.lock();
+							mediaimgdlconn::NewConnWithOptAccOAuth(url, me->media_id, net_flags, acc.get(), pri, dlflags);
+						}
 					}
 				};
 			};
@@ -324,13 +527,13 @@ void genjsonparser::DoEntitiesParse(const rapidjson::Value &val, optional_observ
 			}
 			CheckTransJsonValueDef(en->fullurl, urls[i], "expanded_url", en->text);
 
-			wxURI wxuri(wxstrstd(en->fullurl));
-			wxString end = wxuri.GetPath();
-			if (end.EndsWith(wxT(".jpg")) || end.EndsWith(wxT(".png")) || end.EndsWith(wxT(".jpeg")) || end.EndsWith(wxT(".gif"))) {
+			url_parts parts(en->fullurl);
+			const url_part &end = parts.path;
+			if (end.EndsWith(".jpg") || end.EndsWith(".png") || end.EndsWith(".jpeg") || end.EndsWith(".gif")) {
 				en->type = ENT_URL_IMG;
 				t->flags.Set('I');
 
-				std::string url = ProcessMediaURL(en->fullurl, wxuri);
+				std::string url = ProcessMediaURL(en->fullurl, parts);
 
 				observer_ptr<media_entity> me = ad.img_media_map[url];
 				if (!me) {
@@ -361,7 +564,7 @@ void genjsonparser::DoEntitiesParse(const rapidjson::Value &val, optional_observ
 				me->CheckLoadThumb(MELF::LOADTIME);
 			}
 
-			uint64_t quoted_tweet_id = ParseQuotedTweetUrl(wxuri);
+			uint64_t quoted_tweet_id = ParseQuotedTweetUrl(parts);
 			if (quoted_tweet_id) {
 				t->AddQuotedTweetId(quoted_tweet_id);
 			}
@@ -563,8 +766,8 @@ void genjsonparser::DoEntitiesParse(const rapidjson::Value &val, optional_observ
 	}
 }
 
-uint64_t genjsonparser::ParseQuotedTweetUrl(const wxURI &wxuri) {
-	if (wxuri.GetServer() == wxT("twitter.com") && !wxuri.HasQuery()) {
+uint64_t genjsonparser::ParseQuotedTweetUrl(const url_parts &url) {
+	if (url.host.EqualsNoCase("twitter.com") && !url.query.IsPresent()) {
 		static pcre *pattern = 0;
 		static pcre_extra *patextra = 0;
 		static const char patsyntax[] = "^/[^/]+/status/(\\d+)$";
@@ -581,13 +784,13 @@ uint64_t genjsonparser::ParseQuotedTweetUrl(const wxURI &wxuri) {
 			patextra = pcre_study(pattern, 0, &errptr);
 		}
 
-		std::string path = stdstrwx(wxuri.GetPath());
+		const url_part &path = url.path;
 
 		const int ovecsize = 9;
 		int ovector[9];
-		if (pcre_exec(pattern, patextra, path.c_str(), path.size(), 0, 0, ovector, ovecsize) >= 2) {
+		if (path.IsPresent() && pcre_exec(pattern, patextra, path.data, path.size, 0, 0, ovector, ovecsize) >= 2) {
 			uint64_t id = 0;
-			bool ok = ownstrtonum(id, path.c_str() + ovector[2], ovector[3] - ovector[2]);
+			bool ok = ownstrtonum(id, path.data + ovector[2], ovector[3] - ovector[2]);
 			if (ok) return id;
 		}
 	}
@@ -716,14 +919,39 @@ void jsonparser::DoFriendLookupParse(const rapidjson::Value &val) {
 	}
 }
 
+// The DOM of a typical response is somewhat larger than its text, as strings are left in place in the source buffer
+// Sizing the first chunk from the input means that most documents need only one allocation, instead of one per 64kB
+static size_t ParseDataChunkSize(size_t size_hint) {
+	const size_t min_chunk_size = 64 * 1024;
+	return std::max(min_chunk_size, size_hint + (size_hint / 2));
+}
+
+jsonparser::parse_data::parse_data(size_t size_hint)
+		: allocator(ParseDataChunkSize(size_hint)), doc(&allocator) { }
+
+jsonparser::parse_data::~parse_data() { }
+
+// The source buffer is modified by the in-situ parse, so re-serialise the document instead
+std::string jsonparser::parse_data::GetSourceString() const {
+	std::string out;
+	if (doc.IsObject() || doc.IsArray()) {
+		writestream wr(out, json.size());
+		Handler jw(wr);
+		doc.Accept(jw);
+	}
+	return out;
+}
+
 bool jsonparser::ParseString(std::string str) {
-	data = std::make_shared<parse_data>();
-	data->json.assign(str.begin(), str.end());
-	data->json.push_back(0);
-	data->source_str = std::move(str);
-	rapidjson::Document &dc = data->doc;
+	data = std::make_shared<parse_data>(str.size());
+	return ParseStringToData(*data, std::move(str));
+}
+
+bool jsonparser::ParseStringToData(parse_data &pd, std::string str) {
+	pd.json = std::move(str);
 
-	return ParseStringInPlace(dc, data->json.data(), "jsonparser::ParseString");
+	// Since C++11 the buffer is contiguous and null terminated, the terminator is only read
+	return ParseStringInPlaceFiltered(pd.doc, &pd.json[0], "jsonparser::ParseString");
 }
 
 void jsonparser::ProcessTimelineResponse(flagwrapper<JDTP> sflags, optional_observer_ptr<restbackfillstate> rbfs) {
@@ -812,7 +1040,7 @@ void jsonparser::ProcessStreamResponse(bool out_of_date_parse) {
 			DoTweetParse(dc, JDTP::ARRIVED | JDTP::TIMELINERECV, out_of_date_state);
 		}
 	} else {
-		LogMsgFormat(LOGT::PARSEERR, "Stream Event Parser: Can't identify event: %s", cstr(data->source_str));
+		LogMsgFormat(LOGT::PARSEERR, "Stream Event Parser: Can't identify event: %s", cstr(data->GetSourceString()));
 	}
 }
 
@@ -1088,7 +1316,7 @@ udc_ptr jsonparser::DoUserParse(const rapidjson::Value &val, flagwrapper<UMPTF>
 			// Profile image was previously marked as failed
 			// The URL has changed, so download the new one now
 			userdatacont->udc_flags &= ~UDC::PROFILE_IMAGE_DL_FAILED;
-			userdatacont->ImgIsReady(PENDING_REQ::PROFIMG_DOWNLOAD);
+			userdatacont->ImgIsReady(PENDING_REQ::PROFIMG_DOWNLOAD | PENDING_REQ::PROFIMG_BACKGROUND);
 		}
 	}
 	if (parseresult & (genjsonparser::USERPARSERESULT::DISP_NAME_CHANGED | genjsonparser::USERPARSERESULT::SCREEN_NAME_CHANGED)) {
@@ -1395,9 +1623,9 @@ tweet_ptr jsonparser::DoTweetParse(const rapidjson::Value &val, flagwrapper<JDTP
 			tp->SetArrivedHere(true);
 
 			if (!(sflags & JDTP::ISDM)) {
-				tac->tweet_ids.insert(tweetid);
+				tac->tweet_ids_journal.Insert(tac->tweet_ids, tweetid);
 			} else {
-				tac->dm_ids.insert(tweetid);
+				tac->dm_ids_journal.Insert(tac->dm_ids, tweetid);
 			}
 		}
 		tp->SetReceivedHere(true);
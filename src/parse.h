@@ -28,7 +28,6 @@
 #include <wx/version.h>
 #include <wx/defs.h>
 #include <wx/string.h>
-#include <wx/uri.h>
 #include <string>
 #include <memory>
 #include <vector>
@@ -41,6 +40,7 @@ struct tweet;
 struct userdata;
 struct tpanelparentwin_userproplisting;
 struct TwitterErrorMsg;
+struct url_parts;
 
 struct genjsonparser {
 	enum class USERPARSERESULT {
@@ -58,7 +58,7 @@ struct genjsonparser {
 			Handler *jw = 0, bool isnew = false, optional_observer_ptr<dbsendmsg_list> dbmsglist = nullptr, bool parse_entities = true);
 	static void DoEntitiesParse(const rapidjson::Value& val, optional_observer_ptr<const rapidjson::Value> val_ex, tweet_ptr_p t,
 			bool isnew = false, optional_observer_ptr<dbsendmsg_list> dbmsglist = nullptr);
-	static uint64_t ParseQuotedTweetUrl(const wxURI &wxuri);
+	static uint64_t ParseQuotedTweetUrl(const url_parts &url);
 	static flagwrapper<USERPARSERESULT> ParseUserContents(const rapidjson::Value& val, userdata &userobj, flagwrapper<USERPARSEFLAGS> flags);
 	static void ParseTweetDyn(const rapidjson::Value& val, tweet_ptr_p tobj);
 };
@@ -90,14 +90,20 @@ struct jsonparser : public genjsonparser {
 	//This is saved for use of ProcessStreamResponse
 	optional_observer_ptr<twitcurlext> twit;
 
+	// json is parsed in place, and so no longer holds the original text once parsed, use GetSourceString for that
+	// The document's values are allocated from allocator, the first chunk of which is sized from size_hint
 	struct parse_data {
-		std::string source_str;
-		std::vector<char> json;
+		std::string json;
+		rapidjson::MemoryPoolAllocator<> allocator;
 		rapidjson::Document doc;
 		uint64_t rbfs_userid = 0;
 		RBFS_TYPE rbfs_type = RBFS_NULL;
 		flagwrapper<JDTP> base_sflags = 0;
 		std::unique_ptr<db_handle_msg_pending_guard> db_pending_guard;
+
+		parse_data(size_t size_hint = 0);
+		~parse_data();
+		std::string GetSourceString() const;
 	};
 	std::shared_ptr<parse_data> data;
 	std::unique_ptr<dbsendmsg_list> dbmsglist;
@@ -116,6 +122,11 @@ struct jsonparser : public genjsonparser {
 	jsonparser(std::shared_ptr<taccount> a, optional_observer_ptr<twitcurlext> tw = nullptr);
 	~jsonparser();
 	bool ParseString(std::string str);
+
+	// This does not touch any shared state, and so can be used off the main thread
+	// str is moved into pd and parsed in place, it is not copied
+	static bool ParseStringToData(parse_data &pd, std::string str);
+
 	void SetData(std::shared_ptr<parse_data> data_) {
 		data = std::move(data_);
 	}
@@ -0,0 +1,102 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "rbfs.h"
+#include "twitcurlext.h"
+#include <algorithm>
+
+// Used when a 429 response does not say when the rate limit window resets
+static const time_t default_rate_limit_window = 15 * 60;
+
+rbfs_planner::rbfs_planner() { }
+
+rbfs_planner::~rbfs_planner() { }
+
+bool rbfs_planner::TryIssue(RBFS_TYPE type, bool interactive, time_t now) {
+	api_rate_limit &rl = limits[type];
+	if (!rl.IsValid()) {
+		return true;
+	}
+	if (now >= rl.reset) {
+		// The window has reset, the new quota is not known until the next response
+		rl = api_rate_limit();
+		return true;
+	}
+
+	unsigned int reserve = interactive ? 0 : interactive_reserve;
+	if (rl.remaining <= reserve) {
+		return false;
+	}
+	rl.remaining--;
+	return true;
+}
+
+void rbfs_planner::UpdateRateLimit(RBFS_TYPE type, const api_rate_limit &rl) {
+	if (rl.IsValid()) {
+		limits[type] = rl;
+	}
+}
+
+void rbfs_planner::NotifyRateLimited(RBFS_TYPE type, const api_rate_limit &rl, time_t now) {
+	api_rate_limit &current = limits[type];
+	current.limit = rl.limit;
+	current.remaining = 0;
+	current.reset = (rl.IsValid() && rl.reset > now) ? rl.reset : now + default_rate_limit_window;
+}
+
+void rbfs_planner::Defer(std::unique_ptr<twitcurlext_rbfs> conn, RBFS_TYPE type, bool interactive) {
+	deferred.push_back({ std::move(conn), type, interactive });
+}
+
+time_t rbfs_planner::GetDueTime(RBFS_TYPE type, time_t now) const {
+	const api_rate_limit &rl = limits[type];
+	return rl.IsValid() ? rl.reset : now;
+}
+
+std::vector<std::unique_ptr<twitcurlext_rbfs>> rbfs_planner::TakeDue(time_t now) {
+	std::stable_partition(deferred.begin(), deferred.end(), [](const deferred_page &p) {
+		return p.interactive;
+	});
+
+	std::vector<std::unique_ptr<twitcurlext_rbfs>> out;
+	for (auto it = deferred.begin(); it != deferred.end();) {
+		if (GetDueTime(it->type, now) <= now) {
+			out.emplace_back(std::move(it->conn));
+			it = deferred.erase(it);
+		} else {
+			++it;
+		}
+	}
+	return out;
+}
+
+time_t rbfs_planner::GetNextDueTime(time_t now) const {
+	time_t next = 0;
+	for (auto &it : deferred) {
+		time_t due = GetDueTime(it.type, now);
+		if (!next || due < next) {
+			next = due;
+		}
+	}
+	return next;
+}
+
+void rbfs_planner::Clear() {
+	deferred.clear();
+}
@@ -20,6 +20,12 @@
 #define HGUARD_SRC_RBFS
 
 #include "univdefs.h"
+#include <ctime>
+#include <memory>
+#include <deque>
+#include <vector>
+
+struct twitcurlext_rbfs;
 
 typedef enum {    //do not change these values, they are saved/loaded to/from the DB
 	RBFS_NULL = 0,
@@ -44,5 +50,61 @@ struct restbackfillstate {
 	bool started;
 };
 
+// Rate limit state of a REST API endpoint, from the x-rate-limit-* response headers
+struct api_rate_limit {
+	unsigned int limit = 0;
+	unsigned int remaining = 0;
+	time_t reset = 0;    // 0 if not known
+
+	bool IsValid() const { return reset != 0; }
+};
+
+// This decides when RBFS pages can be issued, according to the remaining rate limit of each timeline endpoint
+// Pages which would exceed the limit are held until the rate limit window resets, instead of failing with 429 and being retried
+// Pages for panels which the user is looking at can use all of the remaining quota, background backfills leave interactive_reserve
+struct rbfs_planner {
+	static const unsigned int interactive_reserve = 2;
+
+	rbfs_planner();
+	~rbfs_planner();
+
+	// Returns true if a page of this type can be issued now, this counts it against the remaining quota
+	bool TryIssue(RBFS_TYPE type, bool interactive, time_t now);
+
+	void UpdateRateLimit(RBFS_TYPE type, const api_rate_limit &rl);
+
+	// Called for a 429 response, rl is not valid if the response did not include the rate limit headers
+	void NotifyRateLimited(RBFS_TYPE type, const api_rate_limit &rl, time_t now);
+
+	void Defer(std::unique_ptr<twitcurlext_rbfs> conn, RBFS_TYPE type, bool interactive);
+
+	// Removes and returns the held pages which can now be issued, interactive ones first
+	std::vector<std::unique_ptr<twitcurlext_rbfs>> TakeDue(time_t now);
+
+	// Returns 0 if no pages are held
+	time_t GetNextDueTime(time_t now) const;
+
+	void Clear();
+
+	// Where F is a functor of the form bool(const twitcurlext_rbfs &), return true to stop iterating
+	template <typename F> void IterateDeferred(F func) const {
+		for (auto &it : deferred) {
+			if (func(*(it.conn))) return;
+		}
+	}
+
+	private:
+	struct deferred_page {
+		std::unique_ptr<twitcurlext_rbfs> conn;
+		RBFS_TYPE type;
+		bool interactive;
+	};
+
+	api_rate_limit limits[RBFS_MAX + 1];
+	std::deque<deferred_page> deferred;
+
+	time_t GetDueTime(RBFS_TYPE type, time_t now) const;
+};
+
 #endif
 
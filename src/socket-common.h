@@ -0,0 +1,34 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#ifndef HGUARD_SRC_SOCKET_COMMON
+#define HGUARD_SRC_SOCKET_COMMON
+
+#include "univdefs.h"
+#include <string>
+
+// HTTP cache validators, as returned in the ETag and Last-Modified response headers
+struct http_validators {
+	std::string etag;
+	std::string last_modified;
+
+	bool IsValid() const { return !etag.empty() || !last_modified.empty(); }
+	void Clear() { etag.clear(); last_modified.clear(); }
+};
+
+#endif
@@ -36,6 +36,7 @@
 #include <wx/file.h>
 #include <wx/mstream.h>
 #include <algorithm>
+#include <cstring>
 
 bool socketmanager::AddConn(std::unique_ptr<twitcurlext> cs) {
 	CURL *ch = cs->GetCurlHandle(); // Do this before moving cs
@@ -43,6 +44,9 @@ bool socketmanager::AddConn(std::unique_ptr<twitcurlext> cs) {
 }
 
 dlconn::~dlconn() {
+	if (dlsched_active) {
+		sm.dlsched->NotifyConnDestroyed(*this);
+	}
 	if (curlHandle) {
 		curl_easy_cleanup(curlHandle);
 	}
@@ -53,7 +57,66 @@ dlconn::~dlconn() {
 	extra_headers = nullptr;
 }
 
+// Limits on downloads which are held in memory, and on videos which are written to disk
+static const uint64_t dl_image_max_size = 64 << 20;
+static const uint64_t dl_video_max_size = 1 << 30;
+
+bool dlsink_memory::Write(const char *data, size_t length) {
+	this->data.append(data, length);
+	return true;
+}
+
+dlsink_file::dlsink_file(const std::string &filename) : holder(filename) {
+	ok = file.Open(wxstrstd(filename), wxFile::write);
+	if (!ok) {
+		LogMsgFormat(LOGT::FILEIOERR, "dlsink_file: could not open file for writing: %s", cstr(filename));
+	}
+}
+
+bool dlsink_file::Write(const char *data, size_t length) {
+	if (!ok) {
+		return false;
+	}
+	if (file.Write(data, length) != length) {
+		LogMsgFormat(LOGT::FILEIOERR, "dlsink_file: write failed: %s", cstr(holder.GetFilename()));
+		ok = false;
+		return false;
+	}
+	size += length;
+	return true;
+}
+
+void dlsink_file::Reset() {
+	if (file.IsOpened()) {
+		file.Close();
+	}
+	ok = file.Open(wxstrstd(holder.GetFilename()), wxFile::write);
+	size = 0;
+}
+
+bool dlsink_file::Close() {
+	if (file.IsOpened()) {
+		ok = file.Close() && ok;
+	}
+	return ok;
+}
+
+bool dlsink_hash_tee::Write(const char *data, size_t length) {
+	hasher.Update(data, length);
+	return next->Write(data, length);
+}
+
+void dlsink_hash_tee::Reset() {
+	hasher.Reset();
+	next->Reset();
+}
+
+std::unique_ptr<dlsink> dlconn::MakeSink() {
+	return std::unique_ptr<dlsink>(new dlsink_memory);
+}
+
 // If this_owner is given, this will add it/itself to the socketmanager
+// If the sink supports it, a retry continues from where the previous attempt stopped
 void dlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &url_, std::unique_ptr<oAuth> auth_obj_) {
 	url = url_;
 	auth_obj = std::move(auth_obj_);
@@ -67,7 +130,14 @@ void dlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &ur
 		curl_slist_free_all(extra_headers);
 	}
 	extra_headers = nullptr;
-	data.clear();
+	if (!sink) {
+		sink = MakeSink();
+	} else if (!sink->CanResume()) {
+		sink->Reset();
+	}
+	body_checked = false;
+	discard_body = false;
+	resp_validators.Clear();
 
 	SetCurlHandleVerboseState(curlHandle, currentlogflags & LOGT::CURLVERB);
 	SetCacerts(curlHandle);
@@ -75,6 +145,8 @@ void dlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &ur
 	curl_easy_setopt(curlHandle, CURLOPT_URL, url.c_str());
 	curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, curlCallback );
 	curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, this );
+	curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+	curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, this);
 	curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curlHandle, CURLOPT_MAXREDIRS, 5);
 	if (auth_obj) {
@@ -85,7 +157,21 @@ void dlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &ur
 			extra_headers = curl_slist_append(extra_headers, oAuthHttpHeader.c_str());
 		}
 	}
+	mcflags &= ~MCF::CONDITIONAL;
+	if (req_validators.IsValid() && !sink->GetSize()) {
+		if (!req_validators.etag.empty()) {
+			extra_headers = curl_slist_append(extra_headers, ("If-None-Match: " + req_validators.etag).c_str());
+		}
+		if (!req_validators.last_modified.empty()) {
+			extra_headers = curl_slist_append(extra_headers, ("If-Modified-Since: " + req_validators.last_modified).c_str());
+		}
+		mcflags |= MCF::CONDITIONAL;
+	}
 	curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, extra_headers);
+	if (sink->GetSize()) {
+		LogMsgFormat(LOGT::NETACT, "Resuming download of %s from byte %" llFmtSpec "u, conn ID: %d", cstr(url), sink->GetSize(), id);
+		curl_easy_setopt(curlHandle, CURLOPT_RANGE, string_format("%" llFmtSpec "u-", sink->GetSize()).c_str());
+	}
 
 	if (this_owner) {
 		assert(this_owner.get() == this);
@@ -93,13 +179,73 @@ void dlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &ur
 	}
 }
 
-int dlconn::curlCallback(char* data, size_t size, size_t nmemb, dlconn *obj) {
-	int writtenSize = 0;
-	if (obj && data) {
-		writtenSize = size * nmemb;
-		obj->data.append(data, writtenSize);
+// This is called once for each complete header line, including the status line
+size_t dlconn::curlHeaderCallback(char* data, size_t size, size_t nmemb, dlconn *obj) {
+	size_t length = size * nmemb;
+	if (!obj || !data) {
+		return length;
+	}
+
+	auto match = [&](const char *name) -> bool {
+		size_t name_len = strlen(name);
+		return length > name_len && strncasecmp(data, name, name_len) == 0 && data[name_len] == ':';
+	};
+	auto value = [&](const char *name) -> std::string {
+		size_t start = strlen(name) + 1;
+		size_t end = length;
+		while (start < end && (data[start] == ' ' || data[start] == '\t')) start++;
+		while (end > start && (data[end - 1] == '\r' || data[end - 1] == '\n' || data[end - 1] == ' ')) end--;
+		return std::string(data + start, end - start);
+	};
+
+	if (length > 5 && strncmp(data, "HTTP/", 5) == 0) {
+		// New response, eg. after a redirect
+		obj->resp_validators.Clear();
+	} else if (match("ETag")) {
+		obj->resp_validators.etag = value("ETag");
+	} else if (match("Last-Modified")) {
+		obj->resp_validators.last_modified = value("Last-Modified");
+	}
+	return length;
+}
+
+size_t dlconn::curlCallback(char* data, size_t size, size_t nmemb, dlconn *obj) {
+	if (!obj || !data) {
+		return 0;
+	}
+	size_t length = size * nmemb;
+
+	if (!obj->body_checked) {
+		obj->body_checked = true;
+		long httpcode = 0;
+		curl_easy_getinfo(obj->curlHandle, CURLINFO_RESPONSE_CODE, &httpcode);
+		if (httpcode < 200 || httpcode >= 300) {
+			// This will be handled as an error, don't let the error body corrupt a partial download
+			obj->discard_body = true;
+			if (httpcode == 416) {
+				// Range not satisfiable, start again on the next attempt
+				obj->sink->Reset();
+			}
+		} else if (httpcode != 206 && obj->sink->GetSize()) {
+			// Server ignored the range request
+			obj->sink->Reset();
+		}
 	}
-	return writtenSize;
+	if (obj->discard_body) {
+		return length;
+	}
+
+	if (obj->max_size && obj->sink->GetSize() + length > obj->max_size) {
+		LogMsgFormat(LOGT::SOCKERR, "Download exceeded size limit of %" llFmtSpec "u bytes, aborting: type: %s, url: %s, conn ID: %u",
+				obj->max_size, cstr(obj->GetConnTypeName()), cstr(obj->url), obj->id);
+		obj->mcflags |= MCF::NORETRY;
+		return 0;
+	}
+	if (!obj->sink->Write(data, length)) {
+		obj->mcflags |= MCF::NORETRY;
+		return 0;
+	}
+	return length;
 }
 
 namespace profimglocal {
@@ -116,6 +262,16 @@ namespace profimglocal {
 		//Try again:
 		user->ImgIsReady(PENDING_REQ::PROFIMG_DOWNLOAD);
 	}
+
+	// True if a and b differ at most in whether they use http or https
+	bool same_resource(const std::string &a, const std::string &b) {
+		auto strip_scheme = [](const std::string &url) -> std::string {
+			if (url.compare(0, 7, "http://") == 0) return url.substr(7);
+			if (url.compare(0, 8, "https://") == 0) return url.substr(8);
+			return url;
+		};
+		return strip_scheme(a) == strip_scheme(b);
+	}
 };
 
 void profileimgdlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &imgurl_, udc_ptr_p user_) {
@@ -123,6 +279,12 @@ void profileimgdlconn::Init(std::unique_ptr<mcurlconn> &&this_owner, const std::
 	user->udc_flags |= UDC::IMAGE_DL_IN_PROGRESS;
 	LogMsgFormat(LOGT::NETACT, "Downloading profile image %s for user id %" llFmtSpec "d (@%s), conn ID: %d",
 			cstr(imgurl_), user_->id, cstr(user_->GetUser().screen_name), id);
+
+	// If the image is already cached under an equivalent URL, only fetch it if it has changed
+	req_validators.Clear();
+	if (user->cached_profile_img_sha1 && !user->cached_profile_img_url.empty() && profimglocal::same_resource(user->cached_profile_img_url, imgurl_)) {
+		req_validators = user->cached_profile_img_validators;
+	}
 	dlconn::Init(std::move(this_owner), imgurl_);
 }
 
@@ -152,10 +314,24 @@ void profileimgdlconn::HandleFailure(long httpcode, CURLcode res, std::unique_pt
 	}
 }
 
-void profileimgdlconn::NewConn(const std::string &imgurl_, udc_ptr_p user_) {
+void profileimgdlconn::NewConn(const std::string &imgurl_, udc_ptr_p user_, DLPRI pri) {
 	std::unique_ptr<profileimgdlconn> res(new profileimgdlconn);
-	profileimgdlconn *ptr = res.get();
-	ptr->Init(std::move(res), imgurl_, user_);
+	res->Init(nullptr, imgurl_, user_);
+	sm.dlsched->Submit(std::move(res), pri);
+}
+
+std::unique_ptr<dlsink> profileimgdlconn::MakeSink() {
+	max_size = dl_image_max_size;
+	return std::unique_ptr<dlsink>(new dlsink_hash_tee(dlconn::MakeSink()));
+}
+
+bool profileimgdlconn::MergeDuplicate(dlconn &other) {
+	profileimgdlconn *o = dynamic_cast<profileimgdlconn *>(&other);
+	return o && o->user.get() == user.get();
+}
+
+void profileimgdlconn::NotifyCancelled() {
+	profimglocal::clear_dl_flags(user);
 }
 
 void profileimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) {
@@ -175,12 +351,15 @@ void profileimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_p
 		udc_ptr user;
 		std::string url;
 		shb_iptr hash;
+		http_validators validators;
 	};
 	auto job_data = std::make_shared<profimg_job_data_struct>();
-	job_data->data = std::move(data);
+	job_data->data = std::move(FindSink<dlsink_memory>()->data);
+	job_data->hash = FindSink<dlsink_hash_tee>()->GetHash();
 	user->GetImageLocalFilename(job_data->filename);
 	job_data->user = user;
 	job_data->url = std::move(url);
+	job_data->validators = std::move(resp_validators);
 
 	wxGetApp().EnqueueThreadJob([job_data]() {
 		if (!gc.readonlymode) {
@@ -194,7 +373,6 @@ void profileimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_p
 			job_data->ok = false;
 		} else {
 			job_data->img = userdatacontainer::ScaleImageToProfileSize(img);
-			job_data->hash = hash_block(job_data->data.data(), job_data->data.size());
 		}
 	},
 	[job_data]() {
@@ -213,6 +391,7 @@ void profileimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_p
 
 			user->cached_profile_img_url = job_data->url;
 			user->cached_profile_img_sha1 = std::move(job_data->hash);
+			user->cached_profile_img_validators = std::move(job_data->validators);
 			user->lastupdate_wrotetodb = 0;    //force user to be written out to database
 
 			DBC_InsertUser(user);
@@ -221,6 +400,32 @@ void profileimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_p
 	});
 }
 
+// The cached image file is still current, it just needs to be associated with the new URL
+void profileimgdlconn::NotifyDoneNotModified(CURL *easy, std::unique_ptr<mcurlconn> &&this_owner) {
+	LogMsgFormat(LOGT::NETACT, "Profile image not modified: %s for user id %" llFmtSpec "d (@%s), conn ID: %d", cstr(url), user->id, cstr(user->GetUser().screen_name), id);
+
+	profimglocal::clear_dl_flags(user);
+	if (url != user->GetUser().profile_img_url) {
+		profimglocal::bad_url_handler(url, user);
+		return;
+	}
+
+	user->cached_profile_img_url = url;
+	if (resp_validators.IsValid()) {
+		user->cached_profile_img_validators = std::move(resp_validators);
+	}
+	user->profile_img_last_used = time(nullptr);
+	user->lastupdate_wrotetodb = 0;    //force user to be written out to database
+	DBC_InsertUser(user);
+
+	if (user->udc_flags & UDC::PROFILE_BITMAP_SET) {
+		user->CheckPendingTweets();
+	} else {
+		// Load the cached file, this checks the hash
+		user->ImgIsReady(PENDING_REQ::PROFIMG_DOWNLOAD);
+	}
+}
+
 std::string profileimgdlconn::GetConnTypeName() {
 	return string_format("Profile image download for user id %" llFmtSpec "d (@%s)", user->id, cstr(user->GetUser().screen_name));
 }
@@ -257,10 +462,48 @@ mediaimgdlconn *mediaimgdlconn::new_with_opt_acc_oauth(const std::string &imgurl
 	}
 }
 
-void mediaimgdlconn::NewConnWithOptAccOAuth(const std::string &imgurl_, media_id_type media_id_, flagwrapper<MIDC> flags_, const taccount *acc) {
+void mediaimgdlconn::NewConnWithOptAccOAuth(const std::string &imgurl_, media_id_type media_id_, flagwrapper<MIDC> flags_, const taccount *acc,
+		DLPRI pri, flagwrapper<DLSF> dlflags) {
 	std::unique_ptr<mediaimgdlconn> conn(new_with_opt_acc_oauth(imgurl_, media_id_, flags_, acc));
-	CURL *ch = conn->curlHandle;
-	sm.AddConn(ch, std::move(conn));
+	sm.dlsched->Submit(std::move(conn), pri, dlflags);
+}
+
+// The in progress flags set by other's Init are cleared by this on completion
+bool mediaimgdlconn::MergeDuplicate(dlconn &other) {
+	mediaimgdlconn *o = dynamic_cast<mediaimgdlconn *>(&other);
+	if (!o || !(o->media_id == media_id) || !(o->flags & MIDC::VIDEO) != !(flags & MIDC::VIDEO)) {
+		return false;
+	}
+	flags |= o->flags;
+	return true;
+}
+
+void mediaimgdlconn::NotifyCancelled() {
+	observer_ptr<media_entity> m = media_entity::GetExisting(media_id);
+	if (m) {
+		media_entity &me = *m;
+		if (flags & MIDC::FULLIMG) {
+			me.flags &= ~MEF::FULL_NET_INPROGRESS;
+		}
+		if (flags & MIDC::THUMBIMG) {
+			me.flags &= ~MEF::THUMB_NET_INPROGRESS;
+		}
+		if (flags & MIDC::VIDEO) {
+			me.NotifyVideoLoadFailure(url);
+		}
+	}
+}
+
+std::unique_ptr<dlsink> mediaimgdlconn::MakeSink() {
+	if (flags & MIDC::VIDEO) {
+		max_size = dl_video_max_size;
+		return std::unique_ptr<dlsink>(new dlsink_file(media_entity::cached_video_filename(media_id, url)));
+	}
+	max_size = dl_image_max_size;
+	if (flags & MIDC::FULLIMG && gc.cachemedia && !gc.readonlymode) {
+		return std::unique_ptr<dlsink>(new dlsink_hash_tee(dlconn::MakeSink()));
+	}
+	return dlconn::MakeSink();
 }
 
 void mediaimgdlconn::DoRetry(std::unique_ptr<mcurlconn> &&this_owner) {
@@ -296,7 +539,7 @@ void mediaimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr
 	LogMsgFormat(LOGT::NETACT, "Media image downloaded: %s, id: %" llFmtSpec "d/%" llFmtSpec "d, flags: %X, conn ID: %d",
 			cstr(url), media_id.m_id, media_id.t_id, flags, id);
 
-	if (data.size() == 0) {
+	if (sink->GetSize() == 0) {
 		char *req_url = nullptr;
 		curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &req_url);
 
@@ -313,27 +556,14 @@ void mediaimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr
 			return;
 		}
 
-		struct video_job_data {
-			std::string fulldata;
-			media_id_type media_id;
-			std::string url;
-			temp_file_holder video_file;
-		};
-		auto job_data = std::make_shared<video_job_data>();
-		job_data->fulldata = std::move(data);
-		job_data->media_id = media_id;
-		job_data->url = std::move(url);
-		job_data->video_file.Init(me->cached_video_filename(media_id, job_data->url));
-		wxGetApp().EnqueueThreadJob([job_data]() {
-			wxFile file(wxstrstd(job_data->video_file.GetFilename()), wxFile::write);
-			file.Write(job_data->fulldata.data(), job_data->fulldata.size());
-		},
-		[job_data]() {
-			observer_ptr<media_entity> m = media_entity::GetExisting(job_data->media_id);
-			if (m) {
-				m->NotifyVideoLoadSuccess(job_data->url, std::move(job_data->video_file));
-			}
-		});
+		// The body has already been written to the cache file as it arrived
+		dlsink_file *fs = FindSink<dlsink_file>();
+		if (!fs || !fs->Close()) {
+			LogMsgFormat(LOGT::FILEIOERR, "Media video download could not be written to file, handling as failure, url: %s, conn ID: %u", cstr(url), id);
+			HandleFailure(0, res, std::move(this_owner));
+			return;
+		}
+		me->NotifyVideoLoadSuccess(url, fs->TakeFile());
 		return;
 	}
 
@@ -348,7 +578,11 @@ void mediaimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr
 		bool thumbok = false;
 	};
 	auto job_data = std::make_shared<midc_job_data>();
-	job_data->fulldata = std::move(data);
+	job_data->fulldata = std::move(FindSink<dlsink_memory>()->data);
+	dlsink_hash_tee *tee = FindSink<dlsink_hash_tee>();
+	if (tee) {
+		job_data->full_hash = tee->GetHash();
+	}
 	job_data->media_id = media_id;
 	job_data->flags = flags;
 	job_data->url = std::move(url);
@@ -393,7 +627,12 @@ void mediaimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr
 			if (gc.cachemedia && !gc.readonlymode) {
 				wxFile file(media_entity::cached_full_filename(job_data->media_id), wxFile::write);
 				file.Write(job_data->fulldata.data(), job_data->fulldata.size());
-				job_data->full_hash = hash_block(job_data->fulldata.data(), job_data->fulldata.size());
+				if (!job_data->full_hash) {
+					// FULLIMG was merged in after the sink was created
+					job_data->full_hash = hash_block(job_data->fulldata.data(), job_data->fulldata.size());
+				}
+			} else {
+				job_data->full_hash.reset();
 			}
 		}
 	},
@@ -447,3 +686,230 @@ void mediaimgdlconn::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr
 std::string mediaimgdlconn::GetConnTypeName() {
 	return "Media image download";
 }
+
+namespace {
+	// This is only used to group downloads by host, it does not need to handle every valid URL
+	std::string GetUrlHost(const std::string &url) {
+		size_t start = url.find("://");
+		start = (start == std::string::npos) ? 0 : start + 3;
+		size_t end = url.find_first_of("/?#", start);
+		std::string host = url.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+		size_t at = host.rfind('@');
+		if (at != std::string::npos) {
+			host.erase(0, at + 1);
+		}
+		return host;
+	}
+
+	// Returns DLPRI_COUNT if pri_mask is empty
+	unsigned int QueueIndex(unsigned int pri_mask) {
+		for (unsigned int i = 0; i < DLPRI_COUNT; i++) {
+			if (pri_mask & (1 << i)) {
+				return i;
+			}
+		}
+		return DLPRI_COUNT;
+	}
+};
+
+void dlscheduler::AddPriority(queued_dl &q, DLPRI pri, flagwrapper<DLSF> dlflags) {
+	unsigned int bit = 1 << static_cast<unsigned int>(pri);
+	if (dlflags & DLSF::CANCEL_ON_HIDE) {
+		if (!(q.pri_mask & bit)) {
+			q.hide_mask |= bit;
+		}
+	} else {
+		q.hide_mask &= ~bit;
+	}
+	q.pri_mask |= bit;
+}
+
+// func is called for each queued download, and returns true if it changed pri_mask or hide_mask
+// Changed downloads are moved to the back of the queue for their new most urgent priority class,
+// or cancelled if they have no priority classes left
+template <typename F> void dlscheduler::UpdateQueued(F func) {
+	std::vector<queued_dl> changed;
+	for (unsigned int i = 0; i < DLPRI_COUNT; i++) {
+		std::deque<queued_dl> &queue = queues[i];
+		for (auto it = queue.begin(); it != queue.end();) {
+			if (func(*it) && QueueIndex(it->pri_mask) != i) {
+				changed.push_back(std::move(*it));
+				it = queue.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	for (auto &it : changed) {
+		unsigned int index = QueueIndex(it.pri_mask);
+		if (index < DLPRI_COUNT) {
+			queues[index].push_back(std::move(it));
+		} else {
+			cancelled++;
+			LogMsgFormat(LOGT::SOCKTRACE, "dlscheduler: cancelling queued download as no longer wanted: type: %s, conn ID: %d, url: %s",
+					cstr(it.conn->GetConnTypeName()), it.conn->id, cstr(it.conn->url));
+			it.conn->NotifyCancelled();
+		}
+	}
+}
+
+void dlscheduler::Submit(std::unique_ptr<dlconn> conn, DLPRI pri, flagwrapper<DLSF> dlflags) {
+	for (auto &it : active) {
+		if (it.conn->url == conn->url && it.conn->MergeDuplicate(*conn)) {
+			merged++;
+			LogMsgFormat(LOGT::SOCKTRACE, "dlscheduler: merged request into active download: type: %s, conn ID: %d, url: %s",
+					cstr(it.conn->GetConnTypeName()), it.conn->id, cstr(it.conn->url));
+			return;
+		}
+	}
+
+	bool done = false;
+	UpdateQueued([&](queued_dl &q) -> bool {
+		if (done || q.conn->url != conn->url || !q.conn->MergeDuplicate(*conn)) {
+			return false;
+		}
+		done = true;
+		AddPriority(q, pri, dlflags);
+		return true;
+	});
+	if (done) {
+		merged++;
+		LogMsgFormat(LOGT::SOCKTRACE, "dlscheduler: merged request into queued download: url: %s", cstr(conn->url));
+		return;
+	}
+
+	queued_dl q;
+	q.host = GetUrlHost(conn->url);
+	q.conn = std::move(conn);
+	q.pri_mask = 0;
+	q.hide_mask = 0;
+	AddPriority(q, pri, dlflags);
+	queues[static_cast<unsigned int>(pri)].push_back(std::move(q));
+	ScheduleDispatch();
+}
+
+void dlscheduler::RaiseMediaPriority(media_id_type media_id, DLPRI pri, flagwrapper<DLSF> dlflags) {
+	UpdateQueued([&](queued_dl &q) -> bool {
+		if (!(q.conn->GetMediaId() == media_id)) {
+			return false;
+		}
+		AddPriority(q, pri, dlflags);
+		return true;
+	});
+}
+
+void dlscheduler::RaiseProfileImagePriority(udc_ptr_p user, DLPRI pri) {
+	UpdateQueued([&](queued_dl &q) -> bool {
+		profileimgdlconn *conn = dynamic_cast<profileimgdlconn *>(q.conn.get());
+		if (!conn || conn->user.get() != user.get()) {
+			return false;
+		}
+		AddPriority(q, pri, 0);
+		return true;
+	});
+}
+
+void dlscheduler::ReleaseMedia(media_id_type media_id) {
+	released_media.push_back(media_id);
+	ScheduleDispatch();
+}
+
+// This is deferred to the dispatch event so that tweets which are immediately redisplayed do not lose their queue position
+void dlscheduler::ProcessReleasedMedia() {
+	if (released_media.empty()) {
+		return;
+	}
+
+	std::vector<media_id_type> released = std::move(released_media);
+	released_media.clear();
+	container_unordered_remove_if (released, [](const media_id_type &media_id) {
+		observer_ptr<media_entity> me = media_entity::GetExisting(media_id);
+		return me && me->display_refs;
+	});
+	if (released.empty()) {
+		return;
+	}
+
+	UpdateQueued([&](queued_dl &q) -> bool {
+		if (!q.hide_mask || std::find(released.begin(), released.end(), q.conn->GetMediaId()) == released.end()) {
+			return false;
+		}
+		q.pri_mask &= ~q.hide_mask;
+		q.hide_mask = 0;
+		return true;
+	});
+}
+
+void dlscheduler::NotifyConnDestroyed(dlconn &conn) {
+	container_unordered_remove_if (active, [&](const active_dl &a) {
+		return a.conn == &conn;
+	});
+	ScheduleDispatch();
+}
+
+void dlscheduler::ScheduleDispatch() {
+	if (dispatch_pending || !sm->MultiIOHandlerInited) {
+		return;
+	}
+	dispatch_pending = true;
+	wxCommandEvent ev(wxextDLSCHED_DISPATCH_EVENT);
+	sm->AddPendingEvent(ev);
+}
+
+unsigned int dlscheduler::ActiveHostCount(const std::string &host) const {
+	unsigned int count = 0;
+	for (auto &it : active) {
+		if (it.host == host) {
+			count++;
+		}
+	}
+	return count;
+}
+
+void dlscheduler::Dispatch() {
+	dispatch_pending = false;
+	ProcessReleasedMedia();
+	if (!sm->MultiIOHandlerInited) {
+		return;
+	}
+
+	while (!gc.mediadlmaxconns || active.size() < gc.mediadlmaxconns) {
+		// Find the first queued download in priority order whose host is not at its limit
+		// The queues are searched again each time, as starting a download can re-enter the scheduler
+		std::deque<queued_dl> *queue = nullptr;
+		std::deque<queued_dl>::iterator next;
+		for (unsigned int i = 0; i < DLPRI_COUNT && !queue; i++) {
+			for (auto it = queues[i].begin(); it != queues[i].end(); ++it) {
+				if (!gc.mediadlmaxhostconns || ActiveHostCount(it->host) < gc.mediadlmaxhostconns) {
+					queue = &queues[i];
+					next = it;
+					break;
+				}
+			}
+		}
+		if (!queue) {
+			break;
+		}
+
+		std::unique_ptr<dlconn> conn = std::move(next->conn);
+		active.push_back({ conn.get(), std::move(next->host) });
+		queue->erase(next);
+		conn->dlsched_active = true;
+		dispatched++;
+
+		LogMsgFormat(LOGT::SOCKTRACE, "dlscheduler: starting download: type: %s, conn ID: %d, url: %s",
+				cstr(conn->GetConnTypeName()), conn->id, cstr(conn->url));
+		CURL *ch = conn->curlHandle;
+		sm->AddConn(ch, std::move(conn));
+	}
+}
+
+std::string dlscheduler::GetStatsString() const {
+	return string_format("queued: %u visible, %u near viewport, %u prefetch, %u background, active: %u, "
+			"started: %u, merged: %u, cancelled: %u",
+			(unsigned int) queues[static_cast<unsigned int>(DLPRI::VISIBLE)].size(),
+			(unsigned int) queues[static_cast<unsigned int>(DLPRI::NEAR_VIEWPORT)].size(),
+			(unsigned int) queues[static_cast<unsigned int>(DLPRI::PREFETCH)].size(),
+			(unsigned int) queues[static_cast<unsigned int>(DLPRI::BACKGROUND)].size(),
+			(unsigned int) active.size(), dispatched, merged, cancelled);
+}
@@ -21,26 +21,143 @@
 
 #include "univdefs.h"
 #include "socket.h"
+#include "socket-common.h"
 #include "media_id_type.h"
 #include "flags.h"
 #include "ptr_types.h"
+#include "hash.h"
+#include "fileutil.h"
 #include "libtwitcurl/oauthlib.h"
+#include <wx/file.h>
+#include <deque>
+#include <string>
+#include <vector>
 
 struct taccount;
 
+// Download priority classes, in decreasing order of urgency
+enum class DLPRI : unsigned int {
+	VISIBLE = 0,          // currently displayed, or explicitly requested by the user
+	NEAR_VIEWPORT,        // needed before pending content can be displayed
+	PREFETCH,             // speculative, eg. thumbnails fetched on tweet arrival
+	BACKGROUND,           // cache fill
+};
+static const unsigned int DLPRI_COUNT = 4;
+
+enum class DLSF {
+	CANCEL_ON_HIDE        = 1<<0,    // only wanted whilst the media is displayed, see dlscheduler::ReleaseMedia
+};
+template<> struct enum_traits<DLSF> { static constexpr bool flags = true; };
+
+// Destination for the body of a dlconn download
+struct dlsink {
+	virtual ~dlsink() { }
+
+	// Returns false to abort the transfer
+	virtual bool Write(const char *data, size_t length) = 0;
+
+	// Discards everything written so far
+	virtual void Reset() = 0;
+
+	virtual uint64_t GetSize() const = 0;
+
+	// Whether a retry can continue from GetSize() using a range request, rather than calling Reset()
+	virtual bool CanResume() const { return false; }
+
+	// For sinks which pass data on to another sink
+	virtual dlsink *GetNext() const { return nullptr; }
+};
+
+struct dlsink_memory : public dlsink {
+	std::string data;
+
+	bool Write(const char *data, size_t length) override;
+	void Reset() override { data.clear(); }
+	uint64_t GetSize() const override { return data.size(); }
+};
+
+// The file is deleted when this is destructed, unless it has been taken using TakeFile
+struct dlsink_file : public dlsink {
+	dlsink_file(const std::string &filename);
+	bool Write(const char *data, size_t length) override;
+	void Reset() override;
+	uint64_t GetSize() const override { return size; }
+	bool CanResume() const override { return ok; }
+
+	// Returns false if the file could not be opened or written
+	bool Close();
+
+	temp_file_holder TakeFile() { return std::move(holder); }
+
+	private:
+	wxFile file;
+	temp_file_holder holder;
+	uint64_t size = 0;
+	bool ok;
+};
+
+// This hashes the data as it is written, and passes it on to next
+struct dlsink_hash_tee : public dlsink {
+	dlsink_hash_tee(std::unique_ptr<dlsink> next_) : next(std::move(next_)) { }
+	bool Write(const char *data, size_t length) override;
+	void Reset() override;
+	uint64_t GetSize() const override { return next->GetSize(); }
+	bool CanResume() const override { return next->CanResume(); }
+	dlsink *GetNext() const override { return next.get(); }
+
+	// Call this once, when the download is complete
+	shb_iptr GetHash() { return hasher.Final(); }
+
+	private:
+	std::unique_ptr<dlsink> next;
+	sha1_hasher hasher;
+};
+
 struct dlconn : public mcurlconn {
 	CURL* curlHandle = nullptr;
-	std::string data;
+	std::unique_ptr<dlsink> sink;
+	uint64_t max_size = 0;          // 0 is no limit
 	struct curl_slist *extra_headers = nullptr;
 	std::unique_ptr<oAuth> auth_obj;
+	bool dlsched_active = false;    // counted against the download scheduler's concurrency limits
+	http_validators req_validators;     // if set, the request is conditional, see mcurlconn::NotifyDoneNotModified
+	http_validators resp_validators;    // from the most recent response
 
-	static int curlCallback(char* data, size_t size, size_t nmemb, dlconn *obj);
+	static size_t curlCallback(char* data, size_t size, size_t nmemb, dlconn *obj);
+	static size_t curlHeaderCallback(char* data, size_t size, size_t nmemb, dlconn *obj);
 	void Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &url_, std::unique_ptr<oAuth> auth_obj_ = nullptr);
 	~dlconn();
 	CURL *GenGetCurlHandle() { return curlHandle; }
 
+	// Finds a sink of type T in the chain starting at sink
+	template <typename T> T *FindSink() const {
+		for (dlsink *s = sink.get(); s; s = s->GetNext()) {
+			T *t = dynamic_cast<T *>(s);
+			if (t) {
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	// Called by the download scheduler when other has the same URL as this queued or active download
+	// Returns true if this download will also do the job of other, which is then discarded
+	virtual bool MergeDuplicate(dlconn &other) { return false; }
+
+	// Called by the download scheduler when this is dropped from the queue without having been started
+	virtual void NotifyCancelled() { }
+
+	virtual media_id_type GetMediaId() const { return media_id_type(); }
+
 	protected:
 	dlconn() { }
+
+	// Called by Init when there is no existing sink, the default is a dlsink_memory
+	virtual std::unique_ptr<dlsink> MakeSink();
+
+	private:
+	bool body_checked = false;
+	bool discard_body = false;
 };
 
 struct profileimgdlconn : public dlconn {
@@ -49,13 +166,17 @@ struct profileimgdlconn : public dlconn {
 	void Init(std::unique_ptr<mcurlconn> &&this_owner, const std::string &imgurl_, udc_ptr_p user_);
 
 	void NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) override;
+	void NotifyDoneNotModified(CURL *easy, std::unique_ptr<mcurlconn> &&this_owner) override;
 	void DoRetry(std::unique_ptr<mcurlconn> &&this_owner) override;
 	void HandleFailure(long httpcode, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) override;
-	static void NewConn(const std::string &imgurl_, udc_ptr_p user_);
+	static void NewConn(const std::string &imgurl_, udc_ptr_p user_, DLPRI pri = DLPRI::NEAR_VIEWPORT);
 	virtual std::string GetConnTypeName() override;
+	virtual bool MergeDuplicate(dlconn &other) override;
+	virtual void NotifyCancelled() override;
 
 	protected:
 	profileimgdlconn() { }
+	virtual std::unique_ptr<dlsink> MakeSink() override;
 };
 
 enum class MIDC {
@@ -79,16 +200,75 @@ struct mediaimgdlconn : public dlconn {
 	void DoRetry(std::unique_ptr<mcurlconn> &&this_owner);
 	void HandleFailure(long httpcode, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) override;
 	virtual std::string GetConnTypeName() override;
+	virtual bool MergeDuplicate(dlconn &other) override;
+	virtual void NotifyCancelled() override;
+	virtual media_id_type GetMediaId() const override { return media_id; }
 
-	static void NewConnWithOptAccOAuth(const std::string &imgurl_, media_id_type media_id_, flagwrapper<MIDC> flags_ = 0, const taccount *acc = nullptr);
+	static void NewConnWithOptAccOAuth(const std::string &imgurl_, media_id_type media_id_, flagwrapper<MIDC> flags_ = 0, const taccount *acc = nullptr,
+			DLPRI pri = DLPRI::VISIBLE, flagwrapper<DLSF> dlflags = 0);
 
 	protected:
 	mediaimgdlconn(const std::string &imgurl_, media_id_type media_id_, flagwrapper<MIDC> flags_ = 0, std::unique_ptr<oAuth> auth_obj_ = nullptr) {
 		Init(nullptr, imgurl_, media_id_, flags_, std::move(auth_obj_));
 	}
 
+	virtual std::unique_ptr<dlsink> MakeSink() override;
+
 	static mediaimgdlconn *new_with_opt_acc_oauth(const std::string &imgurl_, media_id_type media_id_, flagwrapper<MIDC> flags_ = 0,
 			const taccount *acc = nullptr);
 };
 
+// This sits between the media and profile image downloads and the socketmanager
+// Downloads are queued by priority class and started subject to global and per-host concurrency limits
+// Duplicate URLs are merged, and queued downloads which are only wanted for display are cancelled when no longer displayed
+struct dlscheduler {
+	dlscheduler(socketmanager *sm_) : sm(sm_) { }
+
+	// conn must not already have been added to the socketmanager
+	void Submit(std::unique_ptr<dlconn> conn, DLPRI pri, flagwrapper<DLSF> dlflags = 0);
+
+	// For queued downloads of this media, equivalent to submitting a duplicate with the given priority and flags
+	void RaiseMediaPriority(media_id_type media_id, DLPRI pri, flagwrapper<DLSF> dlflags = 0);
+
+	// As RaiseMediaPriority, for a queued profile image download of this user
+	void RaiseProfileImagePriority(udc_ptr_p user, DLPRI pri);
+
+	// Called when a media entity stops being displayed, this is processed asynchronously
+	void ReleaseMedia(media_id_type media_id);
+
+	// Starts as many queued downloads as the limits allow, this is normally called via ScheduleDispatch
+	void Dispatch();
+
+	void NotifyConnDestroyed(dlconn &conn);
+	std::string GetStatsString() const;
+
+	private:
+	struct queued_dl {
+		std::unique_ptr<dlconn> conn;
+		std::string host;
+		unsigned int pri_mask;     // bit for each priority class requested
+		unsigned int hide_mask;    // of which, only wanted whilst displayed
+	};
+	struct active_dl {
+		dlconn *conn;
+		std::string host;
+	};
+
+	std::deque<queued_dl> queues[DLPRI_COUNT];
+	std::vector<active_dl> active;
+	std::vector<media_id_type> released_media;
+	bool dispatch_pending = false;
+	socketmanager *sm;
+
+	unsigned int dispatched = 0;
+	unsigned int merged = 0;
+	unsigned int cancelled = 0;
+
+	void ScheduleDispatch();
+	void ProcessReleasedMedia();
+	template <typename F> void UpdateQueued(F func);
+	static void AddPriority(queued_dl &q, DLPRI pri, flagwrapper<DLSF> dlflags);
+	unsigned int ActiveHostCount(const std::string &host) const;
+};
+
 #endif
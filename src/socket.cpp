@@ -17,11 +17,13 @@
 
 #include "univdefs.h"
 #include "socket.h"
+#include "socket-ops.h"
 #include "log.h"
 #include "cfg.h"
 #include "util.h"
 #include <wx/event.h>
 #include <algorithm>
+#include <ctime>
 
 #ifdef RCS_WSAASYNCSELMODE
 	#include <windows.h>
@@ -29,6 +31,14 @@
 #ifdef RCS_POLLTHREADMODE
 	#include <poll.h>
 #endif
+#ifdef RCS_EPOLLMODE
+	#include <sys/epoll.h>
+	#include <sys/timerfd.h>
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <string.h>
+#endif
 #ifdef RCS_GTKSOCKMODE
 	#include <glib.h>
 #endif
@@ -67,7 +77,7 @@ std::unique_ptr<mcurlconn> mcurlconn::RemoveConn() {
 	return RemoveConnCommon("RemoveConn");
 }
 
-// This checks both the retry list and the active list for removal
+// This checks the retry list, the parse list and the active list for removal
 std::unique_ptr<mcurlconn> mcurlconn::RemoveConnCommon(const char *logprefix) {
 	std::unique_ptr<mcurlconn> conn = sm.UnregisterRetryConn(*this);
 	if (conn) {
@@ -75,6 +85,12 @@ std::unique_ptr<mcurlconn> mcurlconn::RemoveConnCommon(const char *logprefix) {
 		return std::move(conn);
 	}
 
+	conn = sm.UnregisterParseConn(*this);
+	if (conn) {
+		LogMsgFormat(LOGT::SOCKTRACE, "%s (parse list): conn ID: %d", logprefix, id);
+		return std::move(conn);
+	}
+
 	conn = sm.RemoveConn(GenGetCurlHandle());
 	if (conn) {
 		LogMsgFormat(LOGT::SOCKTRACE, "%s: conn ID: %d", logprefix, id);
@@ -86,7 +102,12 @@ std::unique_ptr<mcurlconn> mcurlconn::RemoveConnCommon(const char *logprefix) {
 }
 
 void mcurlconn::NotifyDone(CURL *easy, long httpcode, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) {
-	if (httpcode != 200 || res != CURLE_OK) {
+	// 206 is only possible if the connection made a range request to resume an earlier attempt
+	if (httpcode == 304 && res == CURLE_OK && mcflags & MCF::CONDITIONAL) {
+		CheckRetryNowOnSuccessFlag();
+		errorcount = 0;
+		NotifyDoneNotModified(easy, std::move(this_owner));
+	} else if ((httpcode != 200 && httpcode != 206) || res != CURLE_OK) {
 		HandleError(easy, httpcode, res, std::move(this_owner));    //this may re-add the connection
 	} else {
 		CheckRetryNowOnSuccessFlag();
@@ -95,6 +116,10 @@ void mcurlconn::NotifyDone(CURL *easy, long httpcode, CURLcode res, std::unique_
 	}
 }
 
+void mcurlconn::NotifyDoneNotModified(CURL *easy, std::unique_ptr<mcurlconn> &&this_owner) {
+	HandleFailure(304, CURLE_OK, std::move(this_owner));
+}
+
 bool mcurlconn::CheckRetryNowOnSuccessFlag() {
 	if (mcflags & MCF::RETRY_NOW_ON_SUCCESS) {
 		mcflags &= ~MCF::RETRY_NOW_ON_SUCCESS;
@@ -196,7 +221,7 @@ static void check_multi_info(socketmanager *smp) {
 	}
 	if (sm.curnumsocks == 0) {
 		LogMsgFormat(LOGT::SOCKTRACE, "No Sockets Left, Stopping Timer");
-		smp->st->Stop();
+		smp->StopSocketTimer();
 	}
 }
 
@@ -216,9 +241,9 @@ static int multi_timer_cb(CURLM *multi, long timeout_ms, socketmanager *smp) {
 	LogMsgFormat(LOGT::SOCKTRACE, "Socket Timer Callback: %d ms", timeout_ms);
 
 	if (timeout_ms > 0) {
-		smp->st->Start(timeout_ms,wxTIMER_ONE_SHOT);
+		smp->StartSocketTimer(timeout_ms);
 	} else {
-		smp->st->Stop();
+		smp->StopSocketTimer();
 	}
 	if (!timeout_ms) {
 		smp->st->Notify();
@@ -227,10 +252,43 @@ static int multi_timer_cb(CURLM *multi, long timeout_ms, socketmanager *smp) {
 	return 0;
 }
 
-socketmanager::socketmanager() { }
+socketmanager::socketmanager() : dlsched(new dlscheduler(this)) { }
 
 socketmanager::~socketmanager() {
 	DeInitMultiIOHandler();
+	if (connect_to) {
+		curl_slist_free_all(connect_to);
+	}
+}
+
+// If gc.apiredirect is set, all connections are made to that loopback host:port instead, with the URLs otherwise unchanged
+// This is for running against a local stand-in for the Twitter API and media hosts
+// Returns true if the redirect is active
+bool socketmanager::ApplyConnectRedirect(CURL *ch) {
+#if LIBCURL_VERSION_NUM >= 0x073100
+	if (connect_to_target != gc.apiredirect) {
+		if (connect_to) {
+			curl_slist_free_all(connect_to);
+			connect_to = nullptr;
+		}
+		connect_to_target = gc.apiredirect;
+		if (!connect_to_target.empty()) {
+			connect_to = curl_slist_append(nullptr, ("::" + connect_to_target).c_str());
+			LogMsgFormat(LOGT::SOCKTRACE, "Redirecting all connections to: %s", cstr(connect_to_target));
+		}
+	}
+	curl_easy_setopt(ch, CURLOPT_CONNECT_TO, connect_to);
+	if (connect_to) {
+		// The local server cannot present a valid certificate for the original host names
+		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0L);
+		return true;
+	} else {
+		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, 1L);
+		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 2L);
+	}
+#endif
+	return false;
 }
 
 curl_socket_t pre_connect_func(void *clientp, curl_socket_t curlfd, curlsocktype purpose) {
@@ -242,7 +300,9 @@ curl_socket_t pre_connect_func(void *clientp, curl_socket_t curlfd, curlsocktype
 }
 
 bool socketmanager::AddConn(CURL* ch, std::unique_ptr<mcurlconn> cs) {
-	if (asyncdns) {
+	bool redirected = ApplyConnectRedirect(ch);
+
+	if (asyncdns && !redirected) {
 		// This can conditionally steal cs, if it does it returns true and we stop here
 		if (asyncdns->CheckAsync(ch, std::move(cs))) {
 			return true;
@@ -257,7 +317,12 @@ bool socketmanager::AddConn(CURL* ch, std::unique_ptr<mcurlconn> cs) {
 		curl_easy_setopt(ch, CURLOPT_SOCKOPTFUNCTION, &pre_connect_func);
 		curl_easy_setopt(ch, CURLOPT_SOCKOPTDATA, cs.get());
 	}
-	if (gc.setproxy) {
+	if (redirected) {
+		// Loopback connections should never go via a proxy
+		curl_easy_setopt(ch, CURLOPT_PROXY, "");
+		curl_easy_setopt(ch, CURLOPT_NOPROXY, nullptr);
+		curl_easy_setopt(ch, CURLOPT_HTTPPROXYTUNNEL, 0);
+	} else if (gc.setproxy) {
 		curl_easy_setopt(ch, CURLOPT_PROXY, gc.proxyurl.c_str());
 		curl_easy_setopt(ch, CURLOPT_NOPROXY, gc.noproxylist.c_str());
 		curl_easy_setopt(ch, CURLOPT_HTTPPROXYTUNNEL, gc.proxyhttptunnel ? 1 : 0);
@@ -266,7 +331,7 @@ bool socketmanager::AddConn(CURL* ch, std::unique_ptr<mcurlconn> cs) {
 		curl_easy_setopt(ch, CURLOPT_NOPROXY, nullptr);
 		curl_easy_setopt(ch, CURLOPT_HTTPPROXYTUNNEL, 0);
 	}
-	if (!gc.netiface.empty()) {
+	if (!gc.netiface.empty() && !redirected) {
 		curl_easy_setopt(ch, CURLOPT_INTERFACE, gc.netiface.c_str());
 	} else {
 		curl_easy_setopt(ch, CURLOPT_INTERFACE, nullptr);
@@ -306,30 +371,130 @@ void sockettimeout::Notify() {
 	check_multi_info(&sm);
 }
 
+void socketmanager::StartSocketTimer(long timeout_ms) {
+#ifdef RCS_EPOLLMODE
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = timeout_ms / 1000;
+	its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+	timerfd_settime(timerfd, 0, &its, nullptr);
+#else
+	st->Start(timeout_ms, wxTIMER_ONE_SHOT);
+#endif
+}
+
+void socketmanager::StopSocketTimer() {
+#ifdef RCS_EPOLLMODE
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(timerfd, 0, &its, nullptr);
+#else
+	st->Stop();
+#endif
+}
+
 void socketmanager::NotifySockEvent(curl_socket_t sockfd, int ev_bitmask) {
 	LogMsgFormat(LOGT::SOCKTRACE, "Socket Notify (%d)", sockfd);
 	curl_multi_socket_action(curlmulti, sockfd, ev_bitmask, &curnumsocks);
 	check_multi_info(this);
 }
 
+// Number of resolver pool threads
+static const unsigned int adns_worker_count = 4;
+
+// How long successful and failed lookups are cached for, in seconds
+static const time_t adns_positive_ttl = 300;
+static const time_t adns_negative_ttl = 30;
+
+curl_socket_t stub_socket_func(void *clientp, curlsocktype purpose, struct curl_sockaddr *address) {
+	return CURL_SOCKET_BAD;
+}
+
+// This fills in the DNS cache of the share handle by starting a request which is stopped before it connects
+// The DNS cache timeout is the same as adns_positive_ttl, such that entries which have expired in the adns cache are looked up again
+struct adns_curl_resolver : public adns_resolver {
+	CURLSH *sharehndl;
+
+	adns_curl_resolver(CURLSH *sharehndl_) : sharehndl(sharehndl_) { }
+
+	bool Resolve(const std::string &url, const std::string &hostname, CURLcode &result, double &lookuptime) override {
+		CURL *eh = curl_easy_init();
+		long val = 1;
+		long timeout = adns_positive_ttl;
+		curl_easy_setopt(eh, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(eh, CURLOPT_SHARE, sharehndl);
+		curl_easy_setopt(eh, CURLOPT_NOSIGNAL, val);
+		curl_easy_setopt(eh, CURLOPT_DNS_CACHE_TIMEOUT, timeout);
+		curl_easy_setopt(eh, CURLOPT_OPENSOCKETFUNCTION, &stub_socket_func);
+		result = curl_easy_perform(eh);
+		curl_easy_getinfo(eh, CURLINFO_NAMELOOKUP_TIME, &lookuptime);
+		curl_easy_cleanup(eh);
+		return result == CURLE_COULDNT_CONNECT;
+	}
+};
+
 adns::adns(socketmanager *sm_) : sm(sm_) {
 	NewShareHndl();
+	resolver.reset(new adns_curl_resolver(sharehndl));
 }
 
 adns::~adns() {
-	size_t n = std::distance(dns_threads.begin(), dns_threads.end());
-	if (n) {
-		size_t i = 0;
-		for (auto &it : dns_threads) {
-			LogMsgFormat(LOGT::SOCKTRACE, "Waiting for all DNS threads to terminate: %d of %d", i, n);
-			it.second.Wait();
-			i++;
+	if (!workers.empty()) {
+		LogMsgFormat(LOGT::SOCKTRACE, "Waiting for all DNS threads to terminate: %zu", workers.size());
+		{
+			std::lock_guard<std::mutex> lock(work_mutex);
+			work_quit = true;
+		}
+		work_cv.notify_all();
+		for (auto &it : workers) {
+			it.join();
 		}
 		LogMsg(LOGT::SOCKTRACE, "All DNS threads terminated");
 	}
 	RemoveShareHndl();
 }
 
+void adns::SetResolver(std::unique_ptr<adns_resolver> r) {
+	resolver = std::move(r);
+}
+
+void adns::StartWorkers() {
+	for (unsigned int i = 0; i < adns_worker_count; i++) {
+		workers.emplace_back([this]() {
+			WorkerMain();
+		});
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 12)
+		pthread_setname_np(workers.back().native_handle(), "retcon-adns");
+#endif
+#endif
+	}
+	LogMsgFormat(LOGT::SOCKTRACE, "Created %u DNS lookup threads", adns_worker_count);
+}
+
+void adns::WorkerMain() {
+	while (true) {
+		std::unique_ptr<adns_result> res(new adns_result());
+		{
+			std::unique_lock<std::mutex> lock(work_mutex);
+			work_cv.wait(lock, [&]() {
+				return work_quit || !work_queue.empty();
+			});
+			if (work_quit) {
+				return;
+			}
+			res->url = std::move(work_queue.front().first);
+			res->hostname = std::move(work_queue.front().second);
+			work_queue.pop_front();
+		}
+		res->success = resolver->Resolve(res->url, res->hostname, res->result, res->lookuptime);
+
+		wxCommandEvent ev(wxextDNS_RESOLUTION_EVENT);
+		ev.SetClientData(res.release());
+		sm->AddPendingEvent(ev);
+	}
+}
+
 void adns::Lock(CURL *handle, curl_lock_data data, curl_lock_access access) {
 	mutex.Lock();
 }
@@ -386,46 +551,88 @@ bool adns::CheckAsync(CURL *ch, std::unique_ptr<mcurlconn> &&cs) {
 
 	std::string name = url.substr(name_start, (name_end == std::string::npos) ? std::string::npos : name_end - name_start);
 
-	if (cached_names.count(name)) {
-		return false;	// name already in cache, can go now
+	auto cached = dns_cache.find(name);
+	if (cached != dns_cache.end() && cached->second.expiry > time(nullptr)) {
+		if (cached->second.success) {
+			stats.cache_hits++;
+			return false;	// name already in cache, can go now
+		}
+
+		// Fail the request asynchronously, as for a failed lookup
+		stats.negative_cache_hits++;
+		std::unique_ptr<adns_result> res(new adns_result());
+		res->url = url;
+		res->hostname = name;
+		res->result = CURLE_COULDNT_RESOLVE_HOST;
+		res->ch = ch;
+		res->cs = std::move(cs);
+		wxCommandEvent ev(wxextDNS_RESOLUTION_EVENT);
+		ev.SetClientData(res.release());
+		sm->AddPendingEvent(ev);
+		return true;
 	}
 
 	dns_pending_conns.push_front({ name, ch, std::move(cs) });
 	// cs is now null, don't use again
 
-	for (auto &it : dns_threads) {
-		if (it.first == name) {
-			LogMsgFormat(LOGT::SOCKTRACE, "DNS lookup thread already exists: %s, %s", cstr(url), cstr(name));
-			return true;
-		}
+	if (dns_inflight.count(name)) {
+		stats.coalesced++;
+		LogMsgFormat(LOGT::SOCKTRACE, "DNS lookup already in progress: %s, %s", cstr(url), cstr(name));
+		return true;
 	}
 
-	LogMsgFormat(LOGT::SOCKTRACE, "Creating DNS lookup thread: %s, %s", cstr(url), cstr(name));
-	dns_threads.emplace_front(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(url, name, sm, GetHndl()));
-	adns_thread &ad = dns_threads.front().second;
-	ad.Create();
-#if defined(__GLIBC__)
-#if __GLIBC_PREREQ(2, 12)
-	pthread_setname_np(ad.GetId(), "retcon-adns");
-#endif
-#endif
-	ad.Run();
+	LogMsgFormat(LOGT::SOCKTRACE, "Queueing DNS lookup: %s, %s", cstr(url), cstr(name));
+	stats.lookups++;
+	dns_inflight.insert(name);
+	if (workers.empty()) {
+		StartWorkers();
+	}
+	{
+		std::lock_guard<std::mutex> lock(work_mutex);
+		work_queue.emplace_back(url, name);
+	}
+	work_cv.notify_one();
 
 	return true;
 }
 
+void adns::PruneCache(time_t now) {
+	for (auto it = dns_cache.begin(); it != dns_cache.end();) {
+		if (it->second.expiry <= now) {
+			it = dns_cache.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
 void adns::DNSResolutionEvent(wxCommandEvent &event) {
-	adns_thread *at = static_cast<adns_thread*>(event.GetClientData());
+	std::unique_ptr<adns_result> at(static_cast<adns_result*>(event.GetClientData()));
 	if (!at) return;
 
-	at->Wait();
+	if (at->cs) {
+		std::unique_ptr<mcurlconn> mc = std::move(at->cs);
+		LogMsgFormat(LOGT::SOCKERR, "Request failed due to cached DNS lookup failure: %s, type: %s, conn ID: %d, url: %s",
+				cstr(at->hostname), cstr(mc->GetConnTypeName()), mc->id, cstr(mc->url));
+		mc->HandleError(at->ch, 0, CURLE_COULDNT_RESOLVE_HOST, std::move(mc));
+		return;
+	}
 
+	time_t now = time(nullptr);
+	dns_inflight.erase(at->hostname);
 	if (at->success) {
 		LogMsgFormat(LOGT::SOCKTRACE, "Asynchronous DNS lookup succeeded: %s, %s, time: %fs", cstr(at->hostname), cstr(at->url), at->lookuptime);
-		cached_names.insert(at->hostname);
+		dns_cache[at->hostname] = { now + adns_positive_ttl, true };
 	} else {
+		stats.failures++;
 		LogMsgFormat(LOGT::SOCKERR, "Asynchronous DNS lookup failed: %s, (%s), error: %s (%d), time: %fs", cstr(at->hostname), cstr(at->url), cstr(curl_easy_strerror(at->result)), at->result, at->lookuptime);
+		dns_cache[at->hostname] = { now + adns_negative_ttl, false };
+	}
+	if (dns_cache.size() > 64) {
+		PruneCache(now);
 	}
+	LogMsgFormat(LOGT::SOCKTRACE, "DNS stats: lookups: %u, failures: %u, cache hits: %u, negative cache hits: %u, coalesced: %u, cached names: %zu",
+			stats.lookups, stats.failures, stats.cache_hits, stats.negative_cache_hits, stats.coalesced, dns_cache.size());
 
 	std::vector<dns_pending_conn> current_dns_pending_conns;
 	dns_pending_conns.remove_if ([&](dns_pending_conn &a) -> bool {
@@ -437,10 +644,6 @@ void adns::DNSResolutionEvent(wxCommandEvent &event) {
 		}
 	});
 
-	dns_threads.remove_if ([&](const std::pair<std::string, adns_thread> &a) {
-		return at == &(a.second);
-	});
-
 	for (auto &it : current_dns_pending_conns) {
 		CURL *ch = it.ch;
 		std::unique_ptr<mcurlconn> mc = std::move(it.cs);
@@ -454,42 +657,20 @@ void adns::DNSResolutionEvent(wxCommandEvent &event) {
 	}
 }
 
-curl_socket_t stub_socket_func(void *clientp, curlsocktype purpose, struct curl_sockaddr *address) {
-	return CURL_SOCKET_BAD;
-}
-
-adns_thread::adns_thread(std::string url_, std::string hostname_, socketmanager *sm_, CURLSH *sharehndl)
-		: wxThread(wxTHREAD_JOINABLE), url(url_.c_str(), url_.length()), hostname(hostname_.c_str(), hostname_.length()), sm(sm_) {
-	eh = curl_easy_init();
-	long val = 1;
-	curl_easy_setopt(eh, CURLOPT_URL, url_.c_str());
-	curl_easy_setopt(eh, CURLOPT_SHARE, sharehndl);
-	curl_easy_setopt(eh, CURLOPT_NOSIGNAL, val);
-	curl_easy_setopt(eh, CURLOPT_OPENSOCKETFUNCTION, &stub_socket_func);
-}
-
-wxThread::ExitCode adns_thread::Entry() {
-	result = curl_easy_perform(eh);
-	curl_easy_getinfo(eh, CURLINFO_NAMELOOKUP_TIME, &lookuptime);
-	curl_easy_cleanup(eh);
-	if (result == CURLE_COULDNT_CONNECT) {
-		success = true;
-	}
-	wxCommandEvent ev(wxextDNS_RESOLUTION_EVENT);
-	ev.SetClientData(this);
-	sm->AddPendingEvent(ev);
-	return 0;
-}
-
 BEGIN_EVENT_TABLE(socketmanager, wxEvtHandler)
 	EVT_TIMER(MCCT_RETRY, socketmanager::RetryNotify)
 #ifdef RCS_POLLTHREADMODE
 	EVT_EXTSOCKETNOTIFY(wxID_ANY, socketmanager::NotifySockEventCmd)
+#endif
+#ifdef RCS_EPOLLMODE
+	EVT_EXTSOCKETBATCHNOTIFY(wxID_ANY, socketmanager::NotifySockBatchEventCmd)
 #endif
 	EVT_COMMAND(wxID_ANY, wxextDNS_RESOLUTION_EVENT, socketmanager::DNSResolutionEvent)
+	EVT_COMMAND(wxID_ANY, wxextDLSCHED_DISPATCH_EVENT, socketmanager::DownloadSchedulerEvent)
 END_EVENT_TABLE()
 
 DEFINE_EVENT_TYPE(wxextDNS_RESOLUTION_EVENT)
+DEFINE_EVENT_TYPE(wxextDLSCHED_DISPATCH_EVENT)
 
 void socketmanager::InitMultiIOHandlerCommon() {
 	LogMsg(LOGT::SOCKTRACE, "socketmanager::InitMultiIOHandlerCommon: START");
@@ -553,6 +734,31 @@ std::unique_ptr<mcurlconn> socketmanager::UnregisterRetryConn(mcurlconn &cs) {
 	return std::move(csptr);
 }
 
+void socketmanager::RegisterParseConn(std::unique_ptr<mcurlconn> cs) {
+	cs->mcflags |= mcurlconn::MCF::IN_PARSE_QUEUE;
+	parse_conns.push_back(std::move(cs));
+}
+
+// cs may be dangling, it is not dereferenced unless it is found in the list
+std::unique_ptr<mcurlconn> socketmanager::UnregisterParseConn(const mcurlconn *cs, unsigned int id) {
+	std::unique_ptr<mcurlconn> csptr;
+	container_unordered_remove_if (parse_conns, [&](std::unique_ptr<mcurlconn> &it) {
+		if (it.get() == cs && it->id == id) {
+			csptr = std::move(it);
+			csptr->mcflags &= ~mcurlconn::MCF::IN_PARSE_QUEUE;
+			return true;
+		} else {
+			return false;
+		}
+	});
+	return std::move(csptr);
+}
+
+std::unique_ptr<mcurlconn> socketmanager::UnregisterParseConn(mcurlconn &cs) {
+	if (!(cs.mcflags & mcurlconn::MCF::IN_PARSE_QUEUE)) return nullptr;
+	return UnregisterParseConn(&cs, cs.id);
+}
+
 void socketmanager::RetryConnNow() {
 	std::unique_ptr<mcurlconn> cs;
 	while (true) {
@@ -604,9 +810,15 @@ void socketmanager::RetryNotify(wxTimerEvent& event) {
 void socketmanager::DNSResolutionEvent(wxCommandEvent &event) {
 	if (asyncdns) {
 		asyncdns->DNSResolutionEvent(event);
+	} else {
+		delete static_cast<adns_result*>(event.GetClientData());
 	}
 }
 
+void socketmanager::DownloadSchedulerEvent(wxCommandEvent &event) {
+	dlsched->Dispatch();
+}
+
 #ifdef RCS_WSAASYNCSELMODE
 
 const char *tclassname="____retcon_wsaasyncselect_window";
@@ -1021,6 +1233,198 @@ wxThread::ExitCode socketpollthread::Entry() {
 
 #endif
 
+#ifdef RCS_EPOLLMODE
+
+DEFINE_EVENT_TYPE(wxextSOCK_BATCH_NOTIFY)
+
+wxextSocketBatchNotifyEvent::wxextSocketBatchNotifyEvent(int id)
+		: wxEvent(id, wxextSOCK_BATCH_NOTIFY) {
+	timeout = false;
+}
+wxextSocketBatchNotifyEvent::wxextSocketBatchNotifyEvent(const wxextSocketBatchNotifyEvent &src) : wxEvent(src) {
+	sockets = src.sockets;
+	timeout = src.timeout;
+}
+
+wxEvent *wxextSocketBatchNotifyEvent::Clone() const {
+	return new wxextSocketBatchNotifyEvent(*this);
+}
+
+static int SetEpollInterest(int epollfd, int op, curl_socket_t s, uint32_t events) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events | EPOLLONESHOT;
+	ev.data.fd = s;
+	return epoll_ctl(epollfd, op, s, &ev);
+}
+
+// All socket actions in the batch are performed before completed transfers are handled
+void socketmanager::NotifySockBatchEventCmd(wxextSocketBatchNotifyEvent &event) {
+	if (!MultiIOHandlerInited) return;
+
+	LogMsgFormat(LOGT::SOCKTRACE, "Socket Batch Notify: %zu sockets%s", event.sockets.size(), event.timeout ? ", timeout" : "");
+	for (auto &it : event.sockets) {
+		curl_multi_socket_action(curlmulti, (curl_socket_t) it.first, it.second, &curnumsocks);
+	}
+	for (auto &it : event.sockets) {
+		RearmSockInterest((curl_socket_t) it.first);
+	}
+	if (event.timeout) {
+		curl_multi_socket_action(curlmulti, CURL_SOCKET_TIMEOUT, 0, &curnumsocks);
+	}
+	check_multi_info(this);
+}
+
+void socketmanager::RearmSockInterest(curl_socket_t s) {
+	auto it = sockepollmap.find(s);
+	if (it != sockepollmap.end()) {
+		SetEpollInterest(epollfd, EPOLL_CTL_MOD, s, it->second);
+	}
+}
+
+void socketmanager::InitMultiIOHandler() {
+	if (MultiIOHandlerInited) return;
+	InitMultiIOHandlerCommon();
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	quitfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epollfd < 0 || timerfd < 0 || quitfd < 0) {
+		LogMsgFormat(LOGT::SOCKERR, "socketmanager::InitMultiIOHandler(): Could not create epoll/timerfd/eventfd: %s", cstr(strerror(errno)));
+	}
+
+	// These are level-triggered, and are not one-shot
+	for (int fd : { timerfd, quitfd }) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	epollthread.reset(new socketepollthread(epollfd, timerfd, quitfd));
+	epollthread->Create();
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 12)
+	pthread_setname_np(epollthread->GetId(), "retcon-sockpoll");
+#endif
+#endif
+	epollthread->Run();
+	LogMsgFormat(LOGT::SOCKTRACE, "socketmanager::InitMultiIOHandler(): Created socket epoll thread: %d", epollthread->GetId());
+
+	MultiIOHandlerInited = true;
+}
+
+void socketmanager::DeInitMultiIOHandler() {
+	if (!MultiIOHandlerInited) return;
+
+	uint64_t value = 1;
+	write(quitfd, &value, sizeof(value));
+	epollthread->Wait();
+	epollthread.reset();
+
+	close(quitfd);
+	close(timerfd);
+	close(epollfd);
+	quitfd = timerfd = epollfd = -1;
+	sockepollmap.clear();
+
+	DeInitMultiIOHandlerCommon();
+	MultiIOHandlerInited = false;
+}
+
+void socketmanager::RegisterSockInterest(CURL *e, curl_socket_t s, int what) {
+	uint32_t events = 0;
+	switch (what) {
+		case CURL_POLL_NONE:
+		case CURL_POLL_REMOVE:
+		default:
+			events = 0;
+			break;
+
+		case CURL_POLL_IN:
+			events = EPOLLIN | EPOLLPRI;
+			break;
+
+		case CURL_POLL_OUT:
+			events = EPOLLOUT;
+			break;
+
+		case CURL_POLL_INOUT:
+			events = EPOLLIN | EPOLLPRI | EPOLLOUT;
+			break;
+	}
+
+	auto it = sockepollmap.find(s);
+	if (!events) {
+		if (it != sockepollmap.end()) {
+			epoll_ctl(epollfd, EPOLL_CTL_DEL, s, nullptr);
+			sockepollmap.erase(it);
+		}
+		return;
+	}
+
+	int res;
+	if (it != sockepollmap.end()) {
+		it->second = events;
+		res = SetEpollInterest(epollfd, EPOLL_CTL_MOD, s, events);
+	} else {
+		sockepollmap[s] = events;
+		res = SetEpollInterest(epollfd, EPOLL_CTL_ADD, s, events);
+		if (res < 0 && errno == EEXIST) {
+			res = SetEpollInterest(epollfd, EPOLL_CTL_MOD, s, events);
+		}
+	}
+	if (res < 0) {
+		LogMsgFormat(LOGT::SOCKERR, "socketmanager::RegisterSockInterest: epoll_ctl failed for socket: %d, %s", s, cstr(strerror(errno)));
+	}
+}
+
+wxThread::ExitCode socketepollthread::Entry() {
+	std::vector<struct epoll_event> events(256);
+
+	while (true) {
+		int count = epoll_wait(epollfd, events.data(), events.size(), -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			TSLogMsgFormat(LOGT::SOCKERR, "socketepollthread::Entry: epoll_wait failed: %s", cstr(strerror(errno)));
+			return 0;
+		}
+
+		wxextSocketBatchNotifyEvent event;
+		for (int i = 0; i < count; i++) {
+			int fd = events[i].data.fd;
+			uint32_t revents = events[i].events;
+			if (fd == quitfd) {
+				return 0;
+			} else if (fd == timerfd) {
+				uint64_t expirations;
+				read(timerfd, &expirations, sizeof(expirations));
+				event.timeout = true;
+			} else {
+				int sendbitmask = 0;
+				if (revents & (EPOLLIN | EPOLLPRI)) {
+					sendbitmask |= CURL_CSELECT_IN;
+				}
+				if (revents & EPOLLOUT) {
+					sendbitmask |= CURL_CSELECT_OUT;
+				}
+				if (revents & (EPOLLERR | EPOLLHUP)) {
+					sendbitmask |= CURL_CSELECT_ERR;
+				}
+				event.sockets.emplace_back(fd, sendbitmask);
+			}
+		}
+		if (!event.sockets.empty() || event.timeout) {
+			sm.AddPendingEvent(event);
+		}
+	}
+}
+
+#endif
+
 #ifdef __WINDOWS__
 extern "C" unsigned char cacert_start[] asm("_binary_cacert_pem_zlib_start");
 extern "C" unsigned char cacert_end[] asm("_binary_cacert_pem_zlib_end");
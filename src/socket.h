@@ -25,6 +25,7 @@
 #include <wx/timer.h>
 #include <wx/defs.h>
 #include <wx/version.h>
+#include <wx/thread.h>
 #include <curl/curl.h>
 #include <memory>
 #include <map>
@@ -34,6 +35,10 @@
 #include <deque>
 #include <utility>
 #include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 struct socketmanager;
 struct userdatacontainer;
@@ -41,8 +46,10 @@ struct twitcurlext;
 
 extern socketmanager sm;
 
-#if !(defined(RCS_GTKSOCKMODE) || defined(RCS_WSAASYNCSELMODE) || defined(RCS_POLLTHREADMODE))
-	#if defined(__WXGTK__)
+#if !(defined(RCS_GTKSOCKMODE) || defined(RCS_WSAASYNCSELMODE) || defined(RCS_POLLTHREADMODE) || defined(RCS_EPOLLMODE))
+	#if defined(__linux__)
+		#define RCS_EPOLLMODE
+	#elif defined(__WXGTK__)
 		#define RCS_GTKSOCKMODE
 	#elif defined(__WINDOWS__)
 		#define RCS_WSAASYNCSELMODE
@@ -73,6 +80,8 @@ struct mcurlconn : public wxEvtHandler {
 		IN_RETRY_QUEUE        = 1<<1,
 		RETRY_NOW_ON_SUCCESS  = 1<<2,
 		NORETRY               = 1<<3,
+		CONDITIONAL           = 1<<4,    // request has cache validators, a 304 response is passed to NotifyDoneNotModified
+		IN_PARSE_QUEUE        = 1<<5,    // response is being parsed off the main thread, see socketmanager::RegisterParseConn
 	};
 
 	unsigned int timeout = 180;
@@ -101,6 +110,7 @@ struct mcurlconn : public wxEvtHandler {
 	virtual ~mcurlconn() { }
 
 	virtual void NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) = 0;
+	virtual void NotifyDoneNotModified(CURL *easy, std::unique_ptr<mcurlconn> &&this_owner);
 	virtual void DoRetry(std::unique_ptr<mcurlconn> &&this_owner) = 0;
 	virtual void HandleFailure(long httpcode, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) = 0;
 	virtual std::string GetFailureLogInfo() { return ""; }
@@ -165,9 +175,45 @@ typedef void (wxEvtHandler::*wxextSocketNotifyEventFunction)(wxextSocketNotifyEv
 
 #endif
 
+#ifdef RCS_EPOLLMODE
+
+// This waits on the epoll set, and sends each batch of ready sockets and/or timer expiry to the main thread as a single event
+// Sockets are registered as one-shot, and are re-armed by the main thread after curl has handled them
+struct socketepollthread : public wxThread {
+	int epollfd;
+	int timerfd;
+	int quitfd;
+
+	socketepollthread(int epollfd_, int timerfd_, int quitfd_)
+			: wxThread(wxTHREAD_JOINABLE), epollfd(epollfd_), timerfd(timerfd_), quitfd(quitfd_) { }
+	wxThread::ExitCode Entry();
+};
+
+DECLARE_EVENT_TYPE(wxextSOCK_BATCH_NOTIFY, -1)
+
+struct wxextSocketBatchNotifyEvent : public wxEvent {
+	wxextSocketBatchNotifyEvent(int id = 0);
+	wxextSocketBatchNotifyEvent(const wxextSocketBatchNotifyEvent &src);
+	wxEvent *Clone() const;
+
+	std::vector<std::pair<int, int> > sockets;    // fd, curl event bitmask
+	bool timeout;
+};
+
+typedef void (wxEvtHandler::*wxextSocketBatchNotifyEventFunction)(wxextSocketBatchNotifyEvent&);
+
+#define EVT_EXTSOCKETBATCHNOTIFY(id, fn) \
+	DECLARE_EVENT_TABLE_ENTRY( wxextSOCK_BATCH_NOTIFY, id, -1, \
+	(wxObjectEventFunction) (wxEventFunction) \
+	wxStaticCastEvent( wxextSocketBatchNotifyEventFunction, & fn ), (wxObject *) NULL ),
+
+#endif
+
 DECLARE_EVENT_TYPE(wxextDNS_RESOLUTION_EVENT, -1)
+DECLARE_EVENT_TYPE(wxextDLSCHED_DISPATCH_EVENT, -1)
 
 struct adns;
+struct dlscheduler;
 
 struct socketmanager : public wxEvtHandler {
 	socketmanager();
@@ -180,6 +226,12 @@ struct socketmanager : public wxEvtHandler {
 #ifdef RCS_POLLTHREADMODE
 	void NotifySockEventCmd(wxextSocketNotifyEvent &event);
 #endif
+#ifdef RCS_EPOLLMODE
+	void NotifySockBatchEventCmd(wxextSocketBatchNotifyEvent &event);
+	void RearmSockInterest(curl_socket_t s);
+#endif
+	void StartSocketTimer(long timeout_ms);
+	void StopSocketTimer();
 	void InitMultiIOHandler();
 	void DeInitMultiIOHandler();
 	void InitMultiIOHandlerCommon();
@@ -192,6 +244,12 @@ struct socketmanager : public wxEvtHandler {
 	void RetryNotify(wxTimerEvent& event);
 	std::unique_ptr<mcurlconn> UnregisterRetryConn(mcurlconn &cs);
 
+	// This holds completed connections whilst their response is parsed on the thread pool
+	// cs is returned by UnregisterParseConn, if it has not been killed in the meantime
+	void RegisterParseConn(std::unique_ptr<mcurlconn> cs);
+	std::unique_ptr<mcurlconn> UnregisterParseConn(const mcurlconn *cs, unsigned int id);
+	std::unique_ptr<mcurlconn> UnregisterParseConn(mcurlconn &cs);
+
 	bool MultiIOHandlerInited = false;
 	CURLM *curlmulti = nullptr;
 	std::unique_ptr<sockettimeout> st;
@@ -202,23 +260,40 @@ struct socketmanager : public wxEvtHandler {
 #ifdef RCS_POLLTHREADMODE
 	int pipefd = -1;
 #endif
+#ifdef RCS_EPOLLMODE
+	int epollfd = -1;
+	int timerfd = -1;
+	int quitfd = -1;
+	std::unique_ptr<socketepollthread> epollthread;
+	std::map<curl_socket_t, uint32_t> sockepollmap;    // epoll events of interest, excluding EPOLLONESHOT
+#endif
 #ifdef RCS_GTKSOCKMODE
 	GSource *gs;
 	unsigned int source_id;
 	std::map<curl_socket_t,GPollFD> sockpollmap;
 #endif
 
+	// This must be declared before the connection lists, as it is notified when download connections are destructed
+	std::unique_ptr<dlscheduler> dlsched;
+	void DownloadSchedulerEvent(wxCommandEvent &event);
+
 	struct conninfo {
 		CURL* ch;
 		std::unique_ptr<mcurlconn> cs;
 	};
 	std::vector<conninfo> connlist;
 	std::deque<std::unique_ptr<mcurlconn>> retry_conns;
+	std::vector<std::unique_ptr<mcurlconn>> parse_conns;
 	std::unique_ptr<wxTimer> retry;
 
 	std::unique_ptr<adns> asyncdns;
 	void DNSResolutionEvent(wxCommandEvent &event);
 
+	// For gc.apiredirect, see ApplyConnectRedirect
+	struct curl_slist *connect_to = nullptr;
+	std::string connect_to_target;
+	bool ApplyConnectRedirect(CURL *ch);
+
 	template<typename F> static void IterateConns(F func) {
 		for (auto &it : sm.connlist) {
 			if (it.cs) {
@@ -230,22 +305,44 @@ struct socketmanager : public wxEvtHandler {
 				if (func(*it)) return;
 			}
 		};
+		for (auto &it : sm.parse_conns) {
+			if (it) {
+				if (func(*it)) return;
+			}
+		};
 	}
 
 	DECLARE_EVENT_TABLE()
 };
 
-struct adns_thread : public wxThread {
+// Resolves hostnames for adns, this is called on the resolver pool threads
+// The default implementation fills in the DNS cache of the adns curl share handle
+// This can be replaced using adns::SetResolver, eg. with a fake name table for offline testing
+struct adns_resolver {
+	virtual ~adns_resolver() { }
+
+	// Returns true on success, result and lookuptime are for logging
+	virtual bool Resolve(const std::string &url, const std::string &hostname, CURLcode &result, double &lookuptime) = 0;
+};
+
+struct adns_result {
 	std::string url;
 	std::string hostname;
 	bool success = false;
 	CURLcode result = CURLE_OK;
-	socketmanager *sm = nullptr;
-	CURL *eh = nullptr;
 	double lookuptime = 0.0;
 
-	adns_thread(std::string url_, std::string hostname_, socketmanager *sm_, CURLSH *sharehndl);
-	wxThread::ExitCode Entry();
+	// This is set instead for a request which failed due to a negative cache entry
+	CURL *ch = nullptr;
+	std::unique_ptr<mcurlconn> cs;
+};
+
+struct adns_stats {
+	unsigned int lookups = 0;                // lookups sent to the resolver pool
+	unsigned int failures = 0;               // of which failed
+	unsigned int cache_hits = 0;
+	unsigned int negative_cache_hits = 0;
+	unsigned int coalesced = 0;              // requests which waited for a lookup of the same name which was already in progress
 };
 
 struct adns {
@@ -255,13 +352,25 @@ struct adns {
 	bool CheckAsync(CURL *ch, std::unique_ptr<mcurlconn> &&cs);
 	void DNSResolutionEvent(wxCommandEvent &event);
 
+	// This must be called before any lookups are made
+	void SetResolver(std::unique_ptr<adns_resolver> r);
+	const adns_stats &GetStats() const { return stats; }
+
 	void Lock(CURL *handle, curl_lock_data data, curl_lock_access access);
 	void Unlock(CURL *handle, curl_lock_data data);
 
 	private:
 	void NewShareHndl();
 	void RemoveShareHndl();
-	std::set<std::string> cached_names;
+	void StartWorkers();
+	void WorkerMain();
+	void PruneCache(time_t now);
+
+	struct dns_cache_entry {
+		time_t expiry;
+		bool success;
+	};
+	std::map<std::string, dns_cache_entry> dns_cache;
 
 	struct dns_pending_conn {
 		std::string hostname;
@@ -269,7 +378,17 @@ struct adns {
 		std::unique_ptr<mcurlconn> cs;
 	};
 	std::forward_list<dns_pending_conn> dns_pending_conns;
-	std::forward_list<std::pair<std::string, adns_thread> > dns_threads;
+	std::set<std::string> dns_inflight;      // names which are queued or being looked up
+
+	adns_stats stats;
+	std::unique_ptr<adns_resolver> resolver;
+
+	// Resolver pool, work_queue contains: url, hostname
+	std::vector<std::thread> workers;
+	std::deque<std::pair<std::string, std::string> > work_queue;
+	std::mutex work_mutex;
+	std::condition_variable work_cv;
+	bool work_quit = false;
 
 	CURLSH *sharehndl = nullptr;
 	wxMutex mutex;
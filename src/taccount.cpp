@@ -41,6 +41,7 @@ BEGIN_EVENT_TABLE(taccount, wxEvtHandler)
 	EVT_TIMER(TAF_FAILED_PENDING_CONN_RETRY_TIMER, taccount::OnFailedPendingConnRetryTimer)
 	EVT_TIMER(TAF_STREAM_RESTART_TIMER, taccount::OnStreamRestartTimer)
 	EVT_TIMER(TAF_NOACC_PENDING_CONTENT_TIMER, taccount::OnNoAccPendingContentTimer)
+	EVT_TIMER(TAF_RBFS_RATE_LIMIT_TIMER, taccount::OnRBFSRateLimitTimer)
 END_EVENT_TABLE()
 
 taccount::taccount(genoptconf *incfg) {
@@ -344,6 +345,8 @@ void taccount::NotifyTweetFavouriteEvent(uint64_t tweetid, uint64_t userid, bool
 }
 
 void taccount::NotifyBlockListChange(BLOCKTYPE type, uint64_t userid, bool now_blocked) {
+	block_lists_generation++;
+
 	std::string evttype;
 	switch (type) {
 		case BLOCKTYPE::BLOCK:
@@ -470,6 +473,13 @@ void taccount::GetRestBackfill() {
 			}
 			return false;
 		});
+		rbfs_plan.IterateDeferred([&](const twitcurlext_rbfs &it) {
+			if (it.rbfs && it.rbfs->type == type && it.rbfs->end_tweet_id == 0) {
+				result = false;    //already present, waiting for rate limit reset
+				return true;
+			}
+			return false;
+		});
 		return result;
 	};
 
@@ -531,6 +541,14 @@ void taccount::ExecRBFS(observer_ptr<restbackfillstate> rbfs) {
 	if (rbfs->started) {
 		return;
 	}
+	bool held = false;
+	rbfs_plan.IterateDeferred([&](const twitcurlext_rbfs &it) {
+		held = (it.rbfs.get() == rbfs.get());
+		return held;
+	});
+	if (held) {
+		return;    //already waiting for rate limit reset
+	}
 	std::unique_ptr<twitcurlext_rbfs> twit = twitcurlext_rbfs::make_new(shared_from_this(), rbfs);
 	twit->post_action_flags = PAF::RESOLVE_PENDINGS;
 	twitcurlext::QueueAsyncExec(std::move(twit));
@@ -780,6 +798,8 @@ void taccount::Exec() {
 		streaming_on = false;
 		rest_on = false;
 		failed_pending_conns.clear();
+		rbfs_plan.Clear();
+		rbfs_rate_limit_timer.reset();
 
 		// This is to avoid issues around iterating over the list whilst changing it
 		// Build a list of connections to kill, then kill them individually
@@ -884,6 +904,33 @@ void taccount::AddFailedPendingConn(std::unique_ptr<twitcurlext> conn) {
 	}
 }
 
+void taccount::DeferRBFSConn(std::unique_ptr<twitcurlext_rbfs> conn, RBFS_TYPE type) {
+	bool interactive = conn->IsInteractive();
+	rbfs_plan.Defer(std::move(conn), type, interactive);
+
+	time_t now = time(nullptr);
+	time_t due = rbfs_plan.GetNextDueTime(now);
+	int timeleft = (due > now) ? (due - now) : 0;
+	LogMsgFormat(LOGT::SOCKTRACE, "REST backfill rate limited (account: %s). Next attempt in %d seconds.", cstr(dispname), timeleft);
+	if (!rbfs_rate_limit_timer) {
+		rbfs_rate_limit_timer.reset(new wxTimer(this, TAF_RBFS_RATE_LIMIT_TIMER));
+	}
+	rbfs_rate_limit_timer->Start((timeleft + 1) * 1000, wxTIMER_ONE_SHOT);    //1s of error margin
+}
+
+void taccount::OnRBFSRateLimitTimer(wxTimerEvent& event) {
+	time_t now = time(nullptr);
+	for (auto &it : rbfs_plan.TakeDue(now)) {
+		twitcurlext::QueueAsyncExec(std::move(it));
+	}
+
+	time_t due = rbfs_plan.GetNextDueTime(now);
+	if (due) {
+		int timeleft = (due > now) ? (due - now) : 0;
+		rbfs_rate_limit_timer->Start((timeleft + 1) * 1000, wxTIMER_ONE_SHOT);
+	}
+}
+
 void taccount::OnFailedPendingConnRetryTimer(wxTimerEvent& event) {
 	CheckFailedPendingConns();
 }
@@ -57,6 +57,7 @@ enum {
 	TAF_FAILED_PENDING_CONN_RETRY_TIMER,
 	TAF_STREAM_RESTART_TIMER,
 	TAF_NOACC_PENDING_CONTENT_TIMER,
+	TAF_RBFS_RATE_LIMIT_TIMER,
 };
 
 struct taccount_cfg {
@@ -124,8 +125,20 @@ struct taccount : public wxEvtHandler, public taccount_cfg, std::enable_shared_f
 	useridset muted_users;
 	useridset no_rt_users;
 
+	// Write back change tracking, see WriteBackAccountIdLists
+	// Insertions into tweet_ids/dm_ids should go via these
+	tweetidset_journal tweet_ids_journal;
+	tweetidset_journal dm_ids_journal;
+	uint64_t block_lists_generation = 0;
+	uint64_t block_lists_written_generation = 0;
+	std::string written_dispname;
+
 	std::unordered_map<uint64_t, udc_ptr> pendingusers;
 	std::forward_list<restbackfillstate> pending_rbfs_list;
+	rbfs_planner rbfs_plan;
+	std::unique_ptr<wxTimer> rbfs_rate_limit_timer;
+	void DeferRBFSConn(std::unique_ptr<twitcurlext_rbfs> conn, RBFS_TYPE type);
+	void OnRBFSRateLimitTimer(wxTimerEvent& event);
 
 	std::deque<std::unique_ptr<twitcurlext>> failed_pending_conns;	//strict subset of cp.activeset
 	std::unique_ptr<wxTimer> pending_failed_conn_retry_timer;
@@ -105,12 +105,14 @@ void tpanel::BulkPushTweet(tweetidset ids, flagwrapper<PUSHFLAGS> pushflags, opt
 					actually_added->insert(it);
 				}
 			}
+			tweetlist_generation++;
 		} else {
 			// Panel is empty, fast path
 			if (actually_added) {
 				*actually_added = ids;
 			}
 			tweetlist = std::move(ids);
+			tweetlist_generation++;
 		}
 		RecalculateSets();
 	}
@@ -146,6 +148,7 @@ bool tpanel::RegisterTweet(uint64_t id, optional_tweet_ptr_p t) {
 		return false;
 	} else {
 		tweetlist.insert(id);
+		tweetlist_generation++;
 		return true;
 	}
 }
@@ -154,6 +157,7 @@ bool tpanel::RegisterTweet(uint64_t id, optional_tweet_ptr_p t) {
 bool tpanel::UnRegisterTweet(uint64_t id) {
 	if (tweetlist.count(id)) {
 		tweetlist.erase(id);
+		tweetlist_generation++;
 		cids.RemoveTweet(id);
 		return true;
 	} else {
@@ -450,6 +454,9 @@ void tpanel::RecalculateTweetSet() {
 	std::sort(id_sets.begin(), id_sets.end(), [](observer_ptr<tweetidset> a, observer_ptr<tweetidset> b) {
 		return a->size() < b->size();
 	});
+	if (!id_sets.empty()) {
+		tweetlist_generation++;
+	}
 	if (id_sets.size() == 1) {
 		// Only one set, just copy it
 		tweetlist = *(id_sets[0]);
@@ -461,17 +468,18 @@ void tpanel::RecalculateTweetSet() {
 
 		// Union the two largest sets
 		// This avoids N log N insertion and lots of re-writes/rebalancing if the second set is also large
-		std::set_union(a->begin(), a->end(), b->begin(), b->end(), std::inserter(tweetlist, tweetlist.end()), tweetlist.key_comp());
+		TweetIdSetUnion(tweetlist, *a, *b);
 
-		// Individually insert any remainders
+		// Merge in any remainders, these are individually inserted if small
 		for (auto &it : id_sets) {
-			tweetlist.insert(it->begin(), it->end());
+			TweetIdSetMergeRange(tweetlist, it->begin(), it->end());
 		}
 	}
 
 	if (parent_tpanel) {
 		// tpanels with a parent_tpanel should not have auto sets as above, or be a manual set
 		tweetlist.clear();
+		tweetlist_generation++;
 		std::vector<observer_ptr<tweetidset>> intersection_sets;
 
 		if (intersection_flags & TPF_INTERSECT::UNREAD) {
@@ -487,7 +495,7 @@ void tpanel::RecalculateTweetSet() {
 		}
 		for (auto &it : intersection_sets) {
 			tweetidset result;
-			std::set_intersection(tweetlist.begin(), tweetlist.end(), it->begin(), it->end(), std::inserter(result, result.end()), result.key_comp());
+			TweetIdSetIntersection(result, tweetlist, *it);
 			tweetlist = std::move(result);
 		}
 	}
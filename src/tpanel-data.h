@@ -38,6 +38,8 @@ struct tpanel : std::enable_shared_from_this<tpanel> {
 	std::string name;
 	std::string dispname;
 	tweetidset tweetlist;
+	uint64_t tweetlist_generation = 1;              // incremented whenever tweetlist is modified
+	uint64_t tweetlist_written_generation = 0;      // value of tweetlist_generation when last written to the DB, see WriteBackTpanels
 	std::vector<tpanelparentwin_nt*> twin;
 	flagwrapper<TPF> flags;
 	cached_id_sets cids;
@@ -232,6 +232,32 @@ void MakeTPanelMenu(wxMenu *menuP, tpanelmenudata &map) {
 		TPanelMenuActionCustom(parent, TPF::DELETEONWINCLOSE);
 	};
 	menuP->Append(nextid++, wxT("Custom Combination"));
+
+	if (DBC_IsSearchIndexEnabled()) {
+		map[nextid] = [](mainframe *parent) {
+			wxString str = ::wxGetTextFromUser(wxT("Enter words to search for\nAppend * to a word to match words starting with it"), wxT("Search Archive"));
+			str.Trim(true).Trim(false);
+			if (str.IsEmpty()) {
+				return;
+			}
+			std::string query = stdstrwx(str);
+			DBC_AsyncSearchTweets(query, [query](tweetidset ids, bool complete) {
+				std::string dispname = "Search: " + query;
+				if (!complete) {
+					dispname += " (index incomplete)";
+				}
+				auto tp = tpanel::MkTPanel("___S_" + query, dispname, TPF::DELETEONWINCLOSE);
+				tp->BulkPushTweet(std::move(ids));
+
+				// The mainframe which the menu was opened in may have been closed in the meantime
+				optional_observer_ptr<mainframe> mf = mainframe::GetLastMenuOpenedMainframe();
+				if (mf) {
+					tp->MkTPanelWin(mf.get(), true);
+				}
+			});
+		};
+		menuP->Append(nextid++, wxT("Search Archive..."));
+	}
 	menuP->AppendSeparator();
 
 	map[nextid] = [](mainframe *parent) {
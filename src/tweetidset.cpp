@@ -0,0 +1,88 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+#include "univdefs.h"
+#include "tweetidset.h"
+#include <algorithm>
+#include <iterator>
+
+// When one input is this many times smaller than the other, look up each of its IDs in the larger set
+// instead of walking both sets in step
+static const size_t tweetidset_lookup_ratio = 16;
+
+void TweetIdSetUnion(tweetidset &out, const tweetidset &a, const tweetidset &b) {
+	out.clear();
+	std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(out, out.end()), out.key_comp());
+}
+
+void TweetIdSetIntersection(tweetidset &out, const tweetidset &a, const tweetidset &b) {
+	out.clear();
+	const tweetidset &smaller = (a.size() <= b.size()) ? a : b;
+	const tweetidset &larger = (a.size() <= b.size()) ? b : a;
+	if (smaller.size() * tweetidset_lookup_ratio < larger.size()) {
+		for (auto &id : smaller) {
+			if (larger.find(id) != larger.end()) out.insert(out.end(), id);
+		}
+	} else {
+		std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(out, out.end()), out.key_comp());
+	}
+}
+
+void TweetIdSetDifference(tweetidset &out, const tweetidset &a, const tweetidset &b) {
+	out.clear();
+	if (a.size() * tweetidset_lookup_ratio < b.size()) {
+		for (auto &id : a) {
+			if (b.find(id) == b.end()) out.insert(out.end(), id);
+		}
+	} else {
+		std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(out, out.end()), out.key_comp());
+	}
+}
+
+void TweetIdSetMergeRange(tweetidset &out, tweetidset::const_iterator first, tweetidset::const_iterator last) {
+	if (first == last) return;
+
+	if (out.empty() || *first < *out.rbegin()) {
+		// Entire range is below the existing contents, append in order
+		out.insert(first, last);
+		return;
+	}
+
+	// Only rebuild out if the range is large relative to it, otherwise insert individually
+	size_t range_size = 0;
+	const size_t rebuild_threshold = out.size() / tweetidset_lookup_ratio;
+	for (auto it = first; it != last && range_size <= rebuild_threshold; ++it) {
+		range_size++;
+	}
+	if (range_size <= rebuild_threshold) {
+		for (; first != last; ++first) {
+			out.insert(*first);
+		}
+	} else {
+		tweetidset merged;
+		std::set_union(out.begin(), out.end(), first, last, std::inserter(merged, merged.end()), merged.key_comp());
+		out = std::move(merged);
+	}
+}
+
+tweetidset_snapshot TweetIdSetSnapshot(const tweetidset &set) {
+	tweetidset_snapshot out;
+	out.reserve(set.size());
+	out.insert(out.end(), set.begin(), set.end());
+	return out;
+}
@@ -21,10 +21,93 @@
 
 #include "univdefs.h"
 #include <functional>
-#include "set.h"
+#include <vector>
 
 //note sorted in opposite order
+#ifdef RETCON_PACKED_TWEETIDSET
+#include "packed-idset.h"
+typedef container::packed_id_set tweetidset;
+#else
+#include "set.h"
 typedef container::set<uint64_t, std::greater<uint64_t> > tweetidset;
+#endif
 typedef tweetidset useridset;
 
+// Bulk set algebra
+// These build out in a single ordered pass, which is much cheaper than individually inserting each ID
+// out is cleared first, and must not be the same set as either input
+void TweetIdSetUnion(tweetidset &out, const tweetidset &a, const tweetidset &b);
+void TweetIdSetIntersection(tweetidset &out, const tweetidset &a, const tweetidset &b);
+void TweetIdSetDifference(tweetidset &out, const tweetidset &a, const tweetidset &b);
+
+// Adds [first, last) to out, which must be a range of a different set
+void TweetIdSetMergeRange(tweetidset &out, tweetidset::const_iterator first, tweetidset::const_iterator last);
+
+// Flat copy of the contents of a tweetidset, in the same (descending) order
+// Taking one is much cheaper than encoding the set, so write-backs take these on the main thread and encode them on the DB thread
+typedef std::vector<uint64_t> tweetidset_snapshot;
+tweetidset_snapshot TweetIdSetSnapshot(const tweetidset &set);
+
+// Records changes to a tweetidset since it was last written back
+// Insertions and erasures are recorded individually such that only those need to be written,
+// any other modification requires the whole set to be rewritten
+// The recorded IDs may be repeated or cancel each other out, whether an ID is now in the set should be checked when writing
+struct tweetidset_journal {
+	uint64_t generation = 0;
+	uint64_t written_generation = 0;
+	std::vector<uint64_t> added;        // not sorted, empty if full_rewrite is set
+	std::vector<uint64_t> removed;      // "
+	bool full_rewrite = false;
+
+	// These count journal entries which have been written since the set was last written in full
+	unsigned int written_entries = 0;
+	size_t written_ids = 0;
+
+	// Returns true if id was inserted
+	bool Insert(tweetidset &set, uint64_t id) {
+		if (set.insert(id).second) {
+			generation++;
+			if (!full_rewrite) added.push_back(id);
+			return true;
+		}
+		return false;
+	}
+	template <typename I> void Insert(tweetidset &set, I first, I last) {
+		for (; first != last; ++first) {
+			Insert(set, *first);
+		}
+	}
+	// Returns true if id was erased
+	bool Erase(tweetidset &set, uint64_t id) {
+		if (set.erase(id)) {
+			generation++;
+			if (!full_rewrite) removed.push_back(id);
+			return true;
+		}
+		return false;
+	}
+	void Modified() {
+		generation++;
+		full_rewrite = true;
+		added.clear();
+		removed.clear();
+	}
+	bool IsDirty() const {
+		return generation != written_generation;
+	}
+	size_t PendingIds() const {
+		return added.size() + removed.size();
+	}
+	void MarkWritten(bool full) {
+		written_generation = generation;
+		added.clear();
+		removed.clear();
+		if (full) {
+			full_rewrite = false;
+			written_entries = 0;
+			written_ids = 0;
+		}
+	}
+};
+
 #endif
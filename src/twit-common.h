@@ -186,6 +186,32 @@ struct cached_id_sets {
 	std::string DumpInfo();
 };
 
+//! Records changes to the lists of ad.cids since they were last written back, see WriteBackCIDSLists
+//! All modifications of ad.cids should go through Get(ptr).Insert/Erase, or be followed by Modified()
+struct cached_id_sets_journal {
+	tweetidset_journal unreadids;
+	tweetidset_journal highlightids;
+	tweetidset_journal hiddenids;
+	tweetidset_journal timelinehiddenids;
+	tweetidset_journal deletedids;
+
+	//! ptr is as passed by cached_id_sets::IterateLists
+	tweetidset_journal &Get(tweetidset cached_id_sets::*ptr) {
+		if (ptr == &cached_id_sets::unreadids) return unreadids;
+		if (ptr == &cached_id_sets::highlightids) return highlightids;
+		if (ptr == &cached_id_sets::hiddenids) return hiddenids;
+		if (ptr == &cached_id_sets::timelinehiddenids) return timelinehiddenids;
+		return deletedids;
+	}
+
+	//! All lists will be written in full
+	void Modified() {
+		cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*ptr, unsigned long long tweetflag) {
+			Get(ptr).Modified();
+		});
+	}
+};
+
 enum class UMPTF { //For UnmarkPendingTweet
 	TPDB_NOUPDF        = 1<<0,
 	RMV_LKPINPRGFLG    = 1<<1,  //Clear UDC::LOOKUP_IN_PROGRESS
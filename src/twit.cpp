@@ -36,12 +36,6 @@
 #include "mediawin.h"
 #include "hash.h"
 
-#ifdef __WINDOWS__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#include "../deps/strptime.cpp"
-#pragma GCC diagnostic pop
-#endif
 #include "utf8proc/utf8proc.h"
 #include "utf8.h"
 #include "retcon.h"
@@ -78,8 +72,20 @@ void HandleNewTweet(tweet_ptr_p t, const std::shared_ptr<taccount> &acc, flagwra
 	}
 }
 
+media_entity_raii_updater::media_entity_raii_updater(observer_ptr<media_entity> me_) : me(me_) {
+	me->display_refs++;
+}
+
+media_entity_raii_updater::media_entity_raii_updater(const media_entity_raii_updater &other) : me(other.me) {
+	me->display_refs++;
+}
+
 media_entity_raii_updater::~media_entity_raii_updater() {
 	me->UpdateLastUsed();
+	me->display_refs--;
+	if (!me->display_refs) {
+		sm.dlsched->ReleaseMedia(me->media_id);
+	}
 }
 
 wxString media_entity::cached_full_filename(media_id_type media_id) {
@@ -472,6 +478,10 @@ bool userdatacontainer::ImgIsReady(flagwrapper<PENDING_REQ> preq) {
 		LogMsgFormat(LOGT::OTHERTRACE, "userdatacontainer::ImgIsReady, not downloading profile image url: %s for user id %" llFmtSpec "d (@%s), "
 				"as download is already in progress",
 				cstr(GetUser().profile_img_url), id, cstr(GetUser().screen_name));
+		if ((preq & PENDING_REQ::PROFIMG_DOWNLOAD_FLAG) && !(preq & PENDING_REQ::PROFIMG_BACKGROUND)) {
+			// The download may have been queued at background priority, but is now wanted for display
+			sm.dlsched->RaiseProfileImagePriority(udc_ptr_p(this), DLPRI::NEAR_VIEWPORT);
+		}
 		return false;
 	}
 	if (!(preq & PENDING_REQ::PROFIMG_NEED)) {
@@ -483,7 +493,8 @@ bool userdatacontainer::ImgIsReady(flagwrapper<PENDING_REQ> preq) {
 				return true;
 			}
 			if (preq & PENDING_REQ::PROFIMG_DOWNLOAD_FLAG) {
-				profileimgdlconn::NewConn(user.profile_img_url, udc_ptr_p(this));
+				profileimgdlconn::NewConn(user.profile_img_url, udc_ptr_p(this),
+						(preq & PENDING_REQ::PROFIMG_BACKGROUND) ? DLPRI::BACKGROUND : DLPRI::NEAR_VIEWPORT);
 
 				// New image, bump last used timestamp to prevent it being evicted prior to display
 				profile_img_last_used = time(nullptr);
@@ -540,8 +551,10 @@ bool userdatacontainer::ImgIsReady(flagwrapper<PENDING_REQ> preq) {
 					LogMsgFormat(LOGT::FILEIOERR, "userdatacontainer::ImgIsReady, cached profile image file for user id: %" llFmtSpec "d (%s), file: %s, url: %s, missing, invalid or failed hash check",
 						u->id, cstr(u->GetUser().screen_name), cstr(data->filename), cstr(u->cached_profile_img_url));
 					u->cached_profile_img_url.clear();
+					u->cached_profile_img_validators.Clear();
 					if (preq & PENDING_REQ::PROFIMG_DOWNLOAD_FLAG) {    //the saved image is not loadable, clear cache and re-download
-						profileimgdlconn::NewConn(u->GetUser().profile_img_url, u);
+						profileimgdlconn::NewConn(u->GetUser().profile_img_url, u,
+								(preq & PENDING_REQ::PROFIMG_BACKGROUND) ? DLPRI::BACKGROUND : DLPRI::NEAR_VIEWPORT);
 					}
 				}
 			});
@@ -1074,11 +1087,12 @@ std::string cached_id_sets::DumpInfo() {
 
 void MarkTweetIDSetCIDS(const tweetidset &ids, tpanel *exclude, tweetidset cached_id_sets::* idsetptr, bool remove, std::function<void(tweet_ptr_p )> existingtweetfunc) {
 	tweetidset &globset = ad.cids.*idsetptr;
+	tweetidset_journal &journal = ad.cids_journal.Get(idsetptr);
 
 	if (remove) {
-		for (auto &tweet_id : ids) globset.erase(tweet_id);
+		for (auto &tweet_id : ids) journal.Erase(globset, tweet_id);
 	} else {
-		globset.insert(ids.begin(), ids.end());
+		journal.Insert(globset, ids.begin(), ids.end());
 	}
 
 	if (exclude) {
@@ -1509,16 +1523,14 @@ void tweet::HandleFlagChangeCids(uint64_t id, unsigned long long changemask, uns
 	cached_id_sets::IterateLists([&](const char *name, tweetidset cached_id_sets::*mptr, unsigned long long flagvalue) {
 		if (changemask & flagvalue) {
 			if (newvalue & flagvalue) {
-				auto result = (ad.cids.*mptr).insert(id);
-				if (result.second) {
+				if (ad.cids_journal.Get(mptr).Insert(ad.cids.*mptr, id)) {
 					//new insertion
 					for (auto &tpiter : ad.tpanels) {
 						tpiter.second->NotifyCIDSChange(id, mptr, true, 0);
 					}
 				}
 			} else {
-				size_t erasecount = (ad.cids.*mptr).erase(id);
-				if (erasecount) {
+				if (ad.cids_journal.Get(mptr).Erase(ad.cids.*mptr, id)) {
 					//did remove
 					for (auto &tpiter : ad.tpanels) {
 						tpiter.second->NotifyCIDSChange(id, mptr, false, 0);
@@ -1602,57 +1614,6 @@ struct tm *gmtime_r(const time_t *timer, struct tm *result) {
 #endif
 #endif
 
-// This function is from https://web.nlcindia.com/gpsd/gpsd-3.1/gpsutils.c (BSD license)
-static time_t our_mkgmtime(struct tm * t)
-/* struct tm to seconds since Unix epoch */
-{
-	const int MONTHSPERYEAR = 12;
-
-	int year;
-	time_t result;
-	static const int cumdays[MONTHSPERYEAR] =
-		{ 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
-
-	/*@ +matchanyintegral @*/
-	year = 1900 + t->tm_year + t->tm_mon / MONTHSPERYEAR;
-	result = (year - 1970) * 365 + cumdays[t->tm_mon % MONTHSPERYEAR];
-	result += (year - 1968) / 4;
-	result -= (year - 1900) / 100;
-	result += (year - 1600) / 400;
-	if ((year % 4) == 0 && ((year % 100) != 0 || (year % 400) == 0) &&
-			(t->tm_mon % MONTHSPERYEAR) < 2) {
-		result--;
-	}
-	result += t->tm_mday - 1;
-	result *= 24;
-	result += t->tm_hour;
-	result *= 60;
-	result += t->tm_min;
-	result *= 60;
-	result += t->tm_sec;
-	/*@ -matchanyintegral @*/
-	return (result);
-}
-
-//wxDateTime performs some braindead timezone adjustments and so is unusable
-//mktime and friends also have onerous timezone behaviour
-//use strptime and an implementation of timegm instead
-void ParseTwitterDate(struct tm *createtm, time_t *createtm_t, const std::string &created_at) {
-	struct tm tmp_tm;
-	time_t tmp_time;
-	if (!createtm) {
-		createtm = &tmp_tm;
-	}
-	if (!createtm_t) {
-		createtm_t = &tmp_time;
-	}
-
-	memset(createtm, 0, sizeof(struct tm));
-	*createtm_t = 0;
-	strptime(created_at.c_str(), "%a %b %d %T +0000 %Y", createtm);
-	*createtm_t = our_mkgmtime(createtm);
-}
-
 #define TCO_LINK_LENGTH 22
 #define TCO_LINK_LENGTH_HTTPS 23
 
@@ -1965,7 +1926,7 @@ bool IsTweetAReply(const char *in, size_t inlen) {
 void SpliceTweetIDSet(tweetidset &set, tweetidset &out, uint64_t highlim_inc, uint64_t lowlim_inc, bool clearspliced) {
 	tweetidset::iterator start = set.lower_bound(highlim_inc);
 	tweetidset::iterator end = set.upper_bound(lowlim_inc);
-	out.insert(start, end);
+	TweetIdSetMergeRange(out, start, end);
 	if (clearspliced) {
 		set.erase(start, end);
 	}
@@ -26,6 +26,7 @@
 #include "tpanel-common.h"
 #include "flags.h"
 #include "hash.h"
+#include "socket-common.h"
 #include "media_id_type.h"
 #include "set.h"
 #include "observer_ptr.h"
@@ -66,6 +67,7 @@ enum class PENDING_REQ {
 	PROFIMG_NEED          = 1<<0,
 	PROFIMG_DOWNLOAD_FLAG = 1<<1,
 	USEREXPIRE            = 1<<2,
+	PROFIMG_BACKGROUND    = 1<<3,    // download at background priority
 	PROFIMG_DOWNLOAD      = PROFIMG_NEED | PROFIMG_DOWNLOAD_FLAG,
 	GUI_DEFAULT           = PROFIMG_NEED | PROFIMG_DOWNLOAD | USEREXPIRE,
 	DEFAULT               = GUI_DEFAULT,
@@ -170,6 +172,7 @@ struct userdatacontainer {
 
 	std::string cached_profile_img_url;
 	shb_iptr cached_profile_img_sha1;
+	http_validators cached_profile_img_validators;
 	wxBitmap cached_profile_img;
 	wxBitmap cached_profile_img_half;
 	std::deque<tweet_ptr> pendingtweets;
@@ -531,10 +534,13 @@ enum class MELF {
 };
 template<> struct enum_traits<MELF> { static constexpr bool flags = true; };
 
+// This counts as a display of the media entity, see media_entity::display_refs
 struct media_entity_raii_updater {
 	observer_ptr<media_entity> me;
 
-	media_entity_raii_updater(observer_ptr<media_entity> me_) : me(me_) { }
+	media_entity_raii_updater(observer_ptr<media_entity> me_);
+	media_entity_raii_updater(const media_entity_raii_updater &other);
+	media_entity_raii_updater &operator=(const media_entity_raii_updater &other) = delete;
 	~media_entity_raii_updater();
 };
 
@@ -567,6 +573,7 @@ struct media_entity {
 	std::unique_ptr<video_entity> video;
 	std::map<std::string, temp_file_holder> video_file_cache;
 	std::string alt_text;
+	unsigned int display_refs = 0;    // when this drops to 0, queued downloads which were only for display are cancelled
 
 	struct image_variant {
 		std::string url;
@@ -644,8 +651,6 @@ struct friendlookup {
 	container::set<uint64_t> ids;
 };
 
-void ParseTwitterDate(struct tm *createtm, time_t *createtm_t, const std::string &created_at);
-
 unsigned int TwitterCharCount(const char *in, size_t inlen, unsigned int img_uploads = 0);
 
 inline unsigned int TwitterCharCount(const std::string &str, unsigned int img_uploads = 0) {
@@ -28,8 +28,12 @@
 #include "tpanel.h"
 #include "alldata.h"
 #include "log-util.h"
+#include "retcon.h"
 #include "libtwitcurl/urlencode.h"
 #include <wx/msgdlg.h>
+#include <cstdlib>
+#include <cstring>
+#include <map>
 
 /* * * * * * * * */
 /*  twitcurlext  */
@@ -46,6 +50,8 @@ void twitcurlext::TwInit(std::shared_ptr<taccount> acc) {
 	if (ch) {
 		SetCurlHandleVerboseState(ch, currentlogflags & LOGT::CURLVERB);
 		SetCacerts(ch);
+		curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+		curl_easy_setopt(ch, CURLOPT_HEADERDATA, this);
 	}
 
 	setTwitterApiType(twitCurlTypes::eTwitCurlApiFormatJson);
@@ -56,6 +62,37 @@ void twitcurlext::TwInit(std::shared_ptr<taccount> acc) {
 	acc->ApplyNewTwitCurlExtHook(this);
 }
 
+// This is called once for each complete header line, including the status line
+size_t twitcurlext::curlHeaderCallback(char* data, size_t size, size_t nmemb, twitcurlext *obj) {
+	size_t length = size * nmemb;
+	if (!obj || !data) {
+		return length;
+	}
+
+	auto read_value = [&](const char *name, unsigned long long &value) -> bool {
+		size_t name_len = strlen(name);
+		if (length <= name_len || strncasecmp(data, name, name_len) != 0 || data[name_len] != ':') {
+			return false;
+		}
+		std::string str(data + name_len + 1, length - name_len - 1);
+		value = strtoull(str.c_str(), nullptr, 10);
+		return true;
+	};
+
+	unsigned long long value;
+	if (length > 5 && strncmp(data, "HTTP/", 5) == 0) {
+		// New response, eg. after a redirect
+		obj->rate_limit = api_rate_limit();
+	} else if (read_value("x-rate-limit-limit", value)) {
+		obj->rate_limit.limit = value;
+	} else if (read_value("x-rate-limit-remaining", value)) {
+		obj->rate_limit.remaining = value;
+	} else if (read_value("x-rate-limit-reset", value)) {
+		obj->rate_limit.reset = value;
+	}
+	return length;
+}
+
 void twitcurlext::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr<mcurlconn> &&this_owner) {
 	std::shared_ptr<taccount> acc = tacc.lock();
 	LogMsgFormat(LOGT::OTHERTRACE, "twitcurlext::NotifyDoneSuccess: for conn: %s, account: %s", cstr(GetConnTypeName()), acc ? cstr(acc->dispname) : "none");
@@ -63,22 +100,74 @@ void twitcurlext::NotifyDoneSuccess(CURL *easy, CURLcode res, std::unique_ptr<mc
 		return;
 	}
 
-	if (ownermainframe && std::find(mainframelist.begin(), mainframelist.end(), ownermainframe.get()) == mainframelist.end()) {
-		ownermainframe = nullptr;
+	if (tc_flags & TCF::ISSTREAM) {
+		NotifyDoneParsed(acc, nullptr, easy, res, std::move(this_owner));
+		return;
 	}
 
-	if (!(tc_flags & TCF::ISSTREAM)) {
-		jsonparser jp(acc, this);
+	std::string str;
+	getLastWebResponseMove(str);
+
+	if (tc_flags & TCF::OFFTHREADPARSE && this_owner) {
+		QueueResponseParse(std::move(str), std::move(this_owner));
+		return;
+	}
+
+	jsonparser jp(acc, this);
+	bool ok = jp.ParseString(std::move(str));
+	NotifyDoneParsed(acc, ok ? &jp : nullptr, easy, res, std::move(this_owner));
+}
+
+// The connection is held by the socketmanager whilst the response is parsed, such that it can still be found and killed
+// Everything other than the JSON parse itself is done on the main thread, once the parse is complete
+void twitcurlext::QueueResponseParse(std::string str, std::unique_ptr<mcurlconn> &&this_owner) {
+	struct parse_job {
 		std::string str;
-		getLastWebResponseMove(str);
+		std::shared_ptr<jsonparser::parse_data> data;
+		bool ok = false;
+	};
+	auto job = std::make_shared<parse_job>();
+	job->data = std::make_shared<jsonparser::parse_data>(str.size());
+	job->str = std::move(str);
+
+	const mcurlconn *conn = this;
+	unsigned int conn_id = id;
+	sm.RegisterParseConn(std::move(this_owner));
+
+	wxGetApp().EnqueueThreadJob([job]() {
+		job->ok = jsonparser::ParseStringToData(*(job->data), std::move(job->str));
+	},
+	[job, conn, conn_id]() {
+		std::unique_ptr<mcurlconn> owner = sm.UnregisterParseConn(conn, conn_id);
+		if (!owner) {
+			LogMsgFormat(LOGT::SOCKTRACE, "twitcurlext::QueueResponseParse: discarding parsed response, conn ID: %d has since been removed", conn_id);
+			return;
+		}
 
-		bool ok = jp.ParseString(std::move(str));
-		if (ok) {
-			if (tc_flags & TCF::ALWAYSREPARSE) {
-				jp.data->base_sflags |= JDTP::ALWAYSREPARSE;
-			}
-			ParseHandler(acc, jp);
+		twitcurlext *twit = static_cast<twitcurlext *>(owner.get());
+		std::shared_ptr<taccount> acc = twit->tacc.lock();
+		if (!acc) {
+			return;
+		}
+
+		jsonparser jp(acc, twit);
+		jp.SetData(std::move(job->data));
+		twit->NotifyDoneParsed(acc, job->ok ? &jp : nullptr, twit->GenGetCurlHandle(), CURLE_OK, std::move(owner));
+	});
+}
+
+// jp is null if there is no successfully parsed response
+void twitcurlext::NotifyDoneParsed(const std::shared_ptr<taccount> &acc, optional_observer_ptr<jsonparser> jp, CURL *easy, CURLcode res,
+		std::unique_ptr<mcurlconn> &&this_owner) {
+	if (ownermainframe && std::find(mainframelist.begin(), mainframelist.end(), ownermainframe.get()) == mainframelist.end()) {
+		ownermainframe = nullptr;
+	}
+
+	if (jp) {
+		if (tc_flags & TCF::ALWAYSREPARSE) {
+			jp->data->base_sflags |= JDTP::ALWAYSREPARSE;
 		}
+		ParseHandler(acc, *jp);
 	}
 
 	NotifyDoneSuccessState state(easy, res, std::move(this_owner));
@@ -98,15 +187,19 @@ void twitcurlext::HandleFailure(long httpcode, CURLcode res, std::unique_ptr<mcu
 	}
 
 	auto win = dynamic_cast<panelparentwin_base *>(mp.get());
-	if (win) {
-		win->NotifyRequestFailed();
-	}
 
 	std::string action = GetConnTypeName();
 
+	bool was_owned = static_cast<bool>(this_owner);
 	HandleFailureState state(httpcode, res, std::move(this_owner));
 	HandleFailureHandler(acc, state);
 
+	// If the handler took ownership, the request has been deferred or re-queued rather than failed, eg. a rate-limited backfill page
+	// Telling the window would let a second, duplicate request be started whilst this one is still pending
+	if (win && (!was_owned || state.this_owner)) {
+		win->NotifyRequestFailed();
+	}
+
 	if (state.msgbox) {
 		wxString msg, errtype;
 		if (res == CURLE_OK) {
@@ -193,14 +286,108 @@ void twitcurlext::DoRetry(std::unique_ptr<mcurlconn> &&this_owner) {
 /*  twitcurlext_stream   */
 /* * * * * * * * * * * * */
 
+// Stream messages are parsed on the thread pool, and then processed on the main thread in the order in which they were received
+// This is shared with the pending parse jobs, and so can outlive the connection
+// Anything still pending when the connection is destructed is dropped, as processing it would mark the stream as up again
+// (eg. a late friends message), and could interleave with the messages of a replacement connection
+struct stream_parse_queue {
+	struct item {
+		std::shared_ptr<jsonparser::parse_data> data;
+		bool ok = false;
+	};
+
+	observer_ptr<twitcurlext_stream> conn;    // null once the connection has been destructed
+	uint64_t next_submit = 0;
+	uint64_t next_process = 0;
+	std::map<uint64_t, item> parsed;          // parsed messages which are waiting for an earlier message to complete
+
+	void Submit(std::string str, std::weak_ptr<taccount> wacc);
+	void ProcessParsed(const std::shared_ptr<taccount> &acc);
+	void Detach();
+};
+
+void stream_parse_queue::Submit(std::string str, std::weak_ptr<taccount> wacc) {
+	struct parse_job {
+		std::string str;
+		item result;
+	};
+	auto job = std::make_shared<parse_job>();
+	job->result.data = std::make_shared<jsonparser::parse_data>(str.size());
+	job->str = std::move(str);
+
+	uint64_t seq = next_submit++;
+	std::shared_ptr<stream_parse_queue> self = conn->parse_queue;
+
+	wxGetApp().EnqueueThreadJob([job]() {
+		job->result.ok = jsonparser::ParseStringToData(*(job->result.data), std::move(job->str));
+	},
+	[job, seq, self, wacc]() {
+		if (!self->conn) {
+			return;
+		}
+		self->parsed[seq] = std::move(job->result);
+		std::shared_ptr<taccount> acc = wacc.lock();
+		if (acc) {
+			self->ProcessParsed(acc);
+		} else {
+			self->parsed.clear();
+		}
+	});
+}
+
+void stream_parse_queue::Detach() {
+	conn = nullptr;
+	if (next_submit != next_process) {
+		LogMsgFormat(LOGT::SOCKTRACE, "stream_parse_queue::Detach: dropping %" llFmtSpec "u unprocessed stream messages", next_submit - next_process);
+	}
+	parsed.clear();
+}
+
+void stream_parse_queue::ProcessParsed(const std::shared_ptr<taccount> &acc) {
+	while (true) {
+		auto it = parsed.find(next_process);
+		if (it == parsed.end()) {
+			return;
+		}
+		item current = std::move(it->second);
+		parsed.erase(it);
+		next_process++;
+
+		if (!current.ok) {
+			continue;    // parse error already logged
+		}
+
+		jsonparser jp(acc, conn.get());
+		jp.SetData(std::move(current.data));
+		try {
+			jp.ProcessStreamResponse();
+		} catch (std::exception &e) {
+			LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream: %s\n%s", cstr(e.what()), cstr(jp.data->GetSourceString()));
+		} catch (...) {
+			LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream: %s", cstr(jp.data->GetSourceString()));
+		}
+	}
+}
+
 std::unique_ptr<twitcurlext_stream> twitcurlext_stream::make_new(std::shared_ptr<taccount> acc) {
 	std::unique_ptr<twitcurlext_stream> twit(new twitcurlext_stream());
 	twit->TwInit(std::move(acc));
 	twit->tc_flags |= TCF::ISSTREAM;
+	twit->parse_queue = std::make_shared<stream_parse_queue>();
+	twit->parse_queue->conn = twit.get();
 	return std::move(twit);
 }
 
+static void LogStreamSplitterStats(twitcurlext_stream &stream, const std::shared_ptr<taccount> &acc) {
+	const streamChunkSplitter &splitter = stream.getStreamSplitter();
+	if (splitter.getDroppedCount() || splitter.getResyncCount()) {
+		LogMsgFormat(LOGT::SOCKERR, "Stream connection for account: %s, dropped %u messages larger than %zu bytes, resynchronised %u times",
+				cstr(acc->dispname), splitter.getDroppedCount(), splitter.getMaxMessageSize(), splitter.getResyncCount());
+	}
+}
+
 void twitcurlext_stream::NotifyDoneSuccessHandler(const std::shared_ptr<taccount> &acc, twitcurlext::NotifyDoneSuccessState &state) {
+	LogStreamSplitterStats(*this, acc);
 	if (acc->enabled) {
 		state.do_post_actions = false;
 		LogMsgFormat(LOGT::SOCKERR, "Stream connection interrupted, reconnecting: for account: %s", cstr(acc->dispname));
@@ -214,6 +401,7 @@ void twitcurlext_stream::ParseHandler(const std::shared_ptr<taccount> &acc, json
 }
 
 void twitcurlext_stream::HandleFailureHandler(const std::shared_ptr<taccount> &acc, twitcurlext::HandleFailureState &state) {
+	LogStreamSplitterStats(*this, acc);
 	bool was_stream_mode = (acc->stream_fail_count == 0);
 	if (was_stream_mode) {
 		acc->last_rest_backfill = time(nullptr);	//don't immediately query REST api
@@ -256,6 +444,9 @@ void twitcurlext_stream::RemoveFromRetryQueueNotify() {
 }
 
 twitcurlext_stream::~twitcurlext_stream() {
+	if (parse_queue) {
+		parse_queue->Detach();
+	}
 	if (auto acc = tacc.lock()) {
 		if (acc && acc->ta_flags & taccount::TAF::STREAM_UP) {
 			acc->ta_flags &= ~taccount::TAF::STREAM_UP;
@@ -273,7 +464,7 @@ twitcurlext_stream::~twitcurlext_stream() {
 	}
 }
 
-void twitcurlext_stream::StreamCallback(std::string &data, twitCurl *pTwitCurlObj, void *userdata) {
+void twitcurlext_stream::StreamCallback(const char *data, size_t size, twitCurl *pTwitCurlObj, void *userdata) {
 	twitcurlext_stream *obj = static_cast<twitcurlext_stream*>(pTwitCurlObj);
 	std::shared_ptr<taccount> acc = obj->tacc.lock();
 	if (!acc) {
@@ -291,19 +482,9 @@ void twitcurlext_stream::StreamCallback(std::string &data, twitCurl *pTwitCurlOb
 		sm.RetryConnLater();
 	}
 
-	LogMsgFormat(LOGT::SOCKTRACE, "StreamCallback: Received: %s, conn ID: %d", cstr(data), obj->id);
-	jsonparser jp(acc, obj);
-	try {
-		bool ok = jp.ParseString(std::move(data));
-		if (ok) {
-			jp.ProcessStreamResponse();
-		}
-	} catch (std::exception &e) {
-		LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream: %s\n%s", cstr(e.what()), cstr(jp.data->source_str));
-	} catch (...) {
-		LogMsgFormat(LOGT::PARSEERR, "Failed to parse line from stream: %s", cstr(jp.data->source_str));
-	}
-	data.clear();
+	std::string str(data, size);
+	LogMsgFormat(LOGT::SOCKTRACE, "StreamCallback: Received: %s, conn ID: %d", cstr(str), obj->id);
+	obj->parse_queue->Submit(std::move(str), acc);
 }
 
 void twitcurlext_stream::StreamActivityCallback(twitCurl *pTwitCurlObj, void *userdata) {
@@ -347,12 +528,16 @@ static twitcurlext_rbfs::CONNTYPE RbfsTypeToConntype(RBFS_TYPE type) {
 std::unique_ptr<twitcurlext_rbfs> twitcurlext_rbfs::make_new(std::shared_ptr<taccount> acc, observer_ptr<restbackfillstate> rbfs) {
 	std::unique_ptr<twitcurlext_rbfs> twit(new twitcurlext_rbfs());
 	twit->TwInit(std::move(acc));
+	twit->tc_flags |= TCF::OFFTHREADPARSE;
 	twit->rbfs = rbfs;
 	twit->conntype = RbfsTypeToConntype(rbfs->type);
 	return std::move(twit);
 }
 
 void twitcurlext_rbfs::NotifyDoneSuccessHandler(const std::shared_ptr<taccount> &acc, NotifyDoneSuccessState &state) {
+	if (issued_type != RBFS_NULL) {
+		acc->rbfs_plan.UpdateRateLimit(issued_type, rate_limit);
+	}
 	if (rbfs) {
 		state.do_post_actions = false;
 		DoExecRestGetTweetBackfill(std::move(state.this_owner));
@@ -393,6 +578,15 @@ void twitcurlext_rbfs::ParseHandler(const std::shared_ptr<taccount> &acc, jsonpa
 }
 
 void twitcurlext_rbfs::HandleFailureHandler(const std::shared_ptr<taccount> &acc, twitcurlext::HandleFailureState &state) {
+	if (rbfs && issued_type != RBFS_NULL && state.httpcode == 429 && state.res == CURLE_OK) {
+		// Hold this until the rate limit window resets, rather than retrying or giving up
+		acc->rbfs_plan.NotifyRateLimited(issued_type, rate_limit, time(nullptr));
+		acc->DeferRBFSConn(static_pointer_cast<twitcurlext_rbfs>(std::move(state.this_owner)), issued_type);
+		return;
+	}
+	if (issued_type != RBFS_NULL) {
+		acc->rbfs_plan.UpdateRateLimit(issued_type, rate_limit);
+	}
 	if (rbfs) {
 		bool delrbfs = false;
 
@@ -438,7 +632,12 @@ void twitcurlext_rbfs::DoExecRestGetTweetBackfill(std::unique_ptr<mcurlconn> thi
 		acc->pending_rbfs_list.remove_if ([&](restbackfillstate &r) { return (&r == rbfs.get()); });
 		rbfs = nullptr;
 		acc->DoPostAction(*this);
+	} else if (!acc->rbfs_plan.TryIssue(rbfs->type, IsInteractive(), time(nullptr))) {
+		LogMsgFormat(LOGT::NETACT, "REST timeline fetch held until rate limit reset: acc: %s, type: %d, start_id: %" llFmtSpec "d, end_id: %" llFmtSpec "d",
+				cstr(acc->dispname), rbfs->type, rbfs->start_tweet_id, rbfs->end_tweet_id);
+		acc->DeferRBFSConn(static_pointer_cast<twitcurlext_rbfs>(std::move(this_owner)), rbfs->type);
 	} else {
+		issued_type = rbfs->type;
 		rbfs->lastop_recvcount = 0;
 		struct timelineparams tmps = {
 			tweets_to_get,
@@ -534,6 +733,14 @@ std::string twitcurlext_rbfs::GetConnTypeNameBase() {
 	return name;
 }
 
+// Rate limiting is handled by HandleFailureHandler and rbfs_planner, retrying before the window resets would just fail again
+MCC_HTTPERRTYPE twitcurlext_rbfs::CheckHTTPErrType(long httpcode) {
+	if (httpcode == 429) {
+		return MCC_FAILED;
+	}
+	return twitcurlext::CheckHTTPErrType(httpcode);
+}
+
 void twitcurlext_rbfs::HandleQueueAsyncExec(const std::shared_ptr<taccount> &acc, std::unique_ptr<mcurlconn> &&this_owner) {
 	DoExecRestGetTweetBackfill(std::move(this_owner));
 
@@ -24,6 +24,7 @@
 #include "twit-common.h"
 #include "libtwitcurl/twitcurl.h"
 #include "socket.h"
+#include "rbfs.h"
 #include "safe_observer_ptr.h"
 #include "flags.h"
 #include "observer_ptr.h"
@@ -39,6 +40,7 @@ struct streamconntimeout;
 struct userlookup;
 struct mainframe;
 struct jsonparser;
+struct stream_parse_queue;
 struct twitcurlext_upload_media_state;
 
 struct TwitterErrorMsg {
@@ -50,6 +52,7 @@ struct twitcurlext: public twitCurl, public mcurlconn {
 	enum class TCF {
 		ISSTREAM       = 1<<0,
 		ALWAYSREPARSE  = 1<<1,
+		OFFTHREADPARSE = 1<<2,    // parse the response on the thread pool, see QueueResponseParse
 	};
 
 	std::weak_ptr<taccount> tacc;
@@ -58,6 +61,7 @@ struct twitcurlext: public twitCurl, public mcurlconn {
 	flagwrapper<PAF> post_action_flags = 0;
 	observer_ptr<mainframe> ownermainframe;
 	safe_observer_untyped_ptr mp;
+	api_rate_limit rate_limit;    // from the most recent response
 
 	struct NotifyDoneSuccessState {
 		bool do_post_actions = true;
@@ -98,6 +102,12 @@ struct twitcurlext: public twitCurl, public mcurlconn {
 	twitcurlext() { }
 	void DoQueueAsyncExec(std::unique_ptr<mcurlconn> this_owner);
 
+	private:
+	static size_t curlHeaderCallback(char* data, size_t size, size_t nmemb, twitcurlext *obj);
+	void QueueResponseParse(std::string str, std::unique_ptr<mcurlconn> &&this_owner);
+	void NotifyDoneParsed(const std::shared_ptr<taccount> &acc, optional_observer_ptr<jsonparser> jp, CURL *easy, CURLcode res,
+			std::unique_ptr<mcurlconn> &&this_owner);
+
 	public:
 	template<typename T> static void QueueAsyncExec(std::unique_ptr<T> conn) {
 		// This is to make sure we don't dereference conn to get the vtable/this,
@@ -123,6 +133,7 @@ template<> struct enum_traits<twitcurlext::TCF> { static constexpr bool flags =
 
 struct twitcurlext_stream: public twitcurlext {
 	std::unique_ptr<streamconntimeout> scto;
+	std::shared_ptr<stream_parse_queue> parse_queue;
 
 	static std::unique_ptr<twitcurlext_stream> make_new(std::shared_ptr<taccount> acc);
 
@@ -137,7 +148,7 @@ struct twitcurlext_stream: public twitcurlext {
 	~twitcurlext_stream();
 
 	private:
-	static void StreamCallback(std::string &data, twitCurl *pTwitCurlObj, void *userdata);
+	static void StreamCallback(const char *data, size_t size, twitCurl *pTwitCurlObj, void *userdata);
 	static void StreamActivityCallback(twitCurl *pTwitCurlObj, void *userdata);
 };
 
@@ -152,6 +163,7 @@ struct twitcurlext_rbfs: public twitcurlext {
 
 	CONNTYPE conntype;
 	observer_ptr<restbackfillstate> rbfs;
+	RBFS_TYPE issued_type = RBFS_NULL;    // type of the page most recently issued, rbfs->type can change between pages
 
 	static std::unique_ptr<twitcurlext_rbfs> make_new(std::shared_ptr<taccount> acc, observer_ptr<restbackfillstate> rbfs);
 
@@ -160,6 +172,10 @@ struct twitcurlext_rbfs: public twitcurlext {
 	virtual void HandleFailureHandler(const std::shared_ptr<taccount> &acc, HandleFailureState &state) override;
 	virtual std::string GetConnTypeNameBase() override;
 	virtual void HandleQueueAsyncExec(const std::shared_ptr<taccount> &acc, std::unique_ptr<mcurlconn> &&this_owner) override;
+	virtual MCC_HTTPERRTYPE CheckHTTPErrType(long httpcode) override;
+
+	// True if this is for a panel or window which the user is looking at, rather than a background backfill
+	bool IsInteractive() const { return mp.get() != nullptr; }
 
 	protected:
 	void DoExecRestGetTweetBackfill(std::unique_ptr<mcurlconn> this_owner);
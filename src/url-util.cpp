@@ -0,0 +1,133 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+
+#include "univdefs.h"
+#include "url-util.h"
+
+namespace {
+	inline char ascii_lower(char c) {
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	}
+
+	bool ascii_equals_nocase(const char *a, const char *b, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			if (ascii_lower(a[i]) != ascii_lower(b[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline bool is_alpha(char c) {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	}
+
+	inline bool is_scheme_char(char c) {
+		return is_alpha(c) || (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.';
+	}
+
+	// Returns the offset of the first of c1, c2 or c3 at or after start, or end
+	inline size_t find_first(const char *s, size_t start, size_t end, char c1, char c2, char c3) {
+		for (size_t i = start; i < end; i++) {
+			char c = s[i];
+			if (c == c1 || c == c2 || c == c3) {
+				return i;
+			}
+		}
+		return end;
+	}
+
+	inline url_part make_part(const char *s, size_t start, size_t end) {
+		url_part p;
+		p.data = s + start;
+		p.size = end - start;
+		return p;
+	}
+};
+
+bool url_part::EqualsNoCase(const char *s) const {
+	return size == strlen(s) && ascii_equals_nocase(data, s, size);
+}
+
+bool url_part::EndsWithNoCase(const char *s) const {
+	size_t len = strlen(s);
+	return size >= len && ascii_equals_nocase(data + size - len, s, len);
+}
+
+void url_parts::Parse(const char *url, size_t length) {
+	*this = url_parts();
+	if (!url) {
+		url = "";
+		length = 0;
+	}
+
+	size_t pos = 0;
+
+	// scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." ) ":"
+	if (length && is_alpha(url[0])) {
+		size_t i = 1;
+		while (i < length && is_scheme_char(url[i])) {
+			i++;
+		}
+		if (i < length && url[i] == ':') {
+			scheme = make_part(url, 0, i);
+			pos = i + 1;
+		}
+	}
+
+	if (length - pos >= 2 && url[pos] == '/' && url[pos + 1] == '/') {
+		size_t auth_start = pos + 2;
+		size_t auth_end = find_first(url, auth_start, length, '/', '?', '#');
+		size_t host_start = auth_start;
+
+		for (size_t i = auth_end; i > auth_start; i--) {
+			if (url[i - 1] == '@') {
+				userinfo = make_part(url, auth_start, i - 1);
+				host_start = i;
+				break;
+			}
+		}
+
+		// The port separator is the first ':' after the host, skipping over any IPv6 literal
+		size_t port_search = host_start;
+		if (host_start < auth_end && url[host_start] == '[') {
+			port_search = find_first(url, host_start, auth_end, ']', ']', ']');
+		}
+		size_t host_end = find_first(url, port_search, auth_end, ':', ':', ':');
+		host = make_part(url, host_start, host_end);
+		if (host_end < auth_end && url[host_end] == ':') {
+			port = make_part(url, host_end + 1, auth_end);
+		}
+		pos = auth_end;
+	}
+
+	size_t path_end = find_first(url, pos, length, '?', '#', '#');
+	path = make_part(url, pos, path_end);
+	pos = path_end;
+
+	if (pos < length && url[pos] == '?') {
+		size_t query_end = find_first(url, pos + 1, length, '#', '#', '#');
+		query = make_part(url, pos + 1, query_end);
+		pos = query_end;
+	}
+
+	if (pos < length && url[pos] == '#') {
+		fragment = make_part(url, pos + 1, length);
+	}
+}
@@ -0,0 +1,72 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+
+#ifndef HGUARD_SRC_URL_UTIL
+#define HGUARD_SRC_URL_UTIL
+
+#include "univdefs.h"
+#include <cstring>
+#include <string>
+
+// A substring of a URL, this does not own the referenced characters
+struct url_part {
+	const char *data = nullptr;     // null if the component is not present
+	size_t size = 0;
+
+	bool IsPresent() const { return data != nullptr; }
+	bool IsEmpty() const { return size == 0; }
+	std::string str() const { return std::string(data ? data : "", size); }
+
+	bool Equals(const char *s) const { return size == strlen(s) && (!size || memcmp(data, s, size) == 0); }
+	bool EqualsNoCase(const char *s) const;
+	bool StartsWith(const char *s) const {
+		size_t len = strlen(s);
+		return size >= len && (!len || memcmp(data, s, len) == 0);
+	}
+	bool EndsWith(const char *s) const {
+		size_t len = strlen(s);
+		return size >= len && (!len || memcmp(data + size - len, s, len) == 0);
+	}
+	bool EndsWithNoCase(const char *s) const;
+};
+
+// Splits a URL or relative reference into its components, following the generic syntax of RFC 3986
+// This does not allocate, decode or validate, the parts reference the input which must outlive this
+// Host names are not case-normalised, use the NoCase comparisons
+struct url_parts {
+	url_part scheme;        // without the trailing ':'
+	url_part userinfo;      // without the trailing '@'
+	url_part host;          // IPv6 literals include the enclosing []
+	url_part port;          // without the leading ':'
+	url_part path;          // always present, may be empty
+	url_part query;         // without the leading '?'
+	url_part fragment;      // without the leading '#'
+
+	url_parts() { }
+	url_parts(const char *url, size_t length) { Parse(url, length); }
+	explicit url_parts(const std::string &url) { Parse(url.data(), url.size()); }
+	url_parts(std::string &&url) = delete;     // the parts would refer to a destroyed temporary
+
+	void Parse(const char *url, size_t length);
+
+	// True if the URL has an authority component, ie. "//" follows the scheme or begins a relative reference
+	bool HasAuthority() const { return host.IsPresent(); }
+};
+
+#endif
@@ -62,6 +62,25 @@ void hash_block(sha1_hash_block &out, const void *data, size_t length) {
 	hashblk.GetHash(static_cast<unsigned char*>(out.hash_sha1));
 }
 
+sha1_hasher::sha1_hasher() : ctx(new CSHA1) { }
+
+sha1_hasher::~sha1_hasher() { }
+
+void sha1_hasher::Update(const void *data, size_t length) {
+	ctx->Update(static_cast<const unsigned char*>(data), length);
+}
+
+void sha1_hasher::Reset() {
+	ctx->Reset();
+}
+
+shb_iptr sha1_hasher::Final() {
+	std::shared_ptr<sha1_hash_block> hash = std::make_shared<sha1_hash_block>();
+	ctx->Final();
+	ctx->GetHash(static_cast<unsigned char*>(hash->hash_sha1));
+	return std::move(hash);
+}
+
 std::string rc_strftime(const std::string &format, const struct tm *tm, time_t timestamp, bool localtime) {
 	#ifdef __WINDOWS__
 				//%z is broken in MSVCRT, use a replacement
@@ -0,0 +1,273 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+// Differential test for ParseTwitterDate
+// Checks that whenever the fixed-layout fast path (ParseTwitterDateFixed) accepts an input,
+// it gives exactly the same result as the strptime/our_mkgmtime path which is used otherwise.
+// Also checks that well-formed dates from 1970 onwards do take the fast path.
+//
+// Build and run with: make -C tools/datetest check
+// Usage: datetest [random seed]
+// Returns non-zero if any mismatches are found.
+
+#include "date-util.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace {
+	const char * const weekdays[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	const char * const months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+	unsigned long long checked = 0;
+	unsigned long long fast_path = 0;
+	unsigned long long failures = 0;
+
+	void Report(const char *what, const std::string &in) {
+		failures++;
+		if (failures <= 50) {
+			std::string printable;
+			for (unsigned char c : in) {
+				if (c >= 0x20 && c < 0x7F) {
+					printable += c;
+				} else {
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\x%02X", c);
+					printable += buf;
+				}
+			}
+			fprintf(stderr, "FAIL: %s: \"%s\"\n", what, printable.c_str());
+		} else if (failures == 51) {
+			fprintf(stderr, "Further failures not shown\n");
+		}
+	}
+
+	// Returns true if the fast path accepted the input
+	bool Check(const std::string &in) {
+		checked++;
+
+		struct tm fixed_tm;
+		time_t fixed_t = -1;
+		memset(&fixed_tm, 0xAA, sizeof(fixed_tm));
+		if (!ParseTwitterDateFixed(&fixed_tm, &fixed_t, in)) {
+			return false;
+		}
+		fast_path++;
+
+		struct tm ref_tm;
+		time_t ref_t = -1;
+		ParseTwitterDateStrptime(&ref_tm, &ref_t, in);
+
+		// Only the fields which ParseTwitterDateFixed sets are compared, strptime may also fill in tm_yday
+		if (fixed_t != ref_t) {
+			Report("time_t differs", in);
+		} else if (fixed_tm.tm_sec != ref_tm.tm_sec || fixed_tm.tm_min != ref_tm.tm_min || fixed_tm.tm_hour != ref_tm.tm_hour ||
+				fixed_tm.tm_mday != ref_tm.tm_mday || fixed_tm.tm_mon != ref_tm.tm_mon || fixed_tm.tm_year != ref_tm.tm_year ||
+				fixed_tm.tm_wday != ref_tm.tm_wday) {
+			Report("struct tm differs", in);
+		}
+
+		// Null outputs must be accepted, and must not change the result
+		time_t only_t = -1;
+		if (!ParseTwitterDateFixed(nullptr, &only_t, in) || only_t != fixed_t) {
+			Report("time_t only result differs", in);
+		}
+		if (!ParseTwitterDateFixed(nullptr, nullptr, in)) {
+			Report("no output result differs", in);
+		}
+		return true;
+	}
+
+	void CheckMustAccept(const std::string &in) {
+		if (!Check(in)) {
+			Report("well-formed date did not take the fast path", in);
+		}
+	}
+
+	std::string MakeDate(const char *wday, const char *mon, unsigned int mday, unsigned int hour, unsigned int min, unsigned int sec, unsigned int year) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%s %s %02u %02u:%02u:%02u +0000 %04u", wday, mon, mday, hour, min, sec, year);
+		return buf;
+	}
+
+	// Every day 00 - 39 of every month of every year 0000 - 9999, with the correct weekday where the date exists
+	void CalendarSweep() {
+		for (unsigned int year = 0; year <= 9999; year++) {
+			for (unsigned int mon = 0; mon < 12; mon++) {
+				for (unsigned int mday = 0; mday <= 39; mday++) {
+					struct tm t;
+					memset(&t, 0, sizeof(t));
+					t.tm_year = year - 1900;
+					t.tm_mon = mon;
+					t.tm_mday = mday;
+					t.tm_hour = 12;
+					timegm(&t);
+					const char *wday = weekdays[(t.tm_wday + 7) % 7];
+					std::string in = MakeDate(wday, months[mon], mday, 13, 37, 42, year);
+					if (year >= 1970 && mday >= 1 && mday <= 31) {
+						CheckMustAccept(in);
+					} else {
+						Check(in);
+					}
+				}
+			}
+		}
+	}
+
+	// Every hh:mm:ss from 00:00:00 to 99:99:99, on a few dates
+	void TimeSweep() {
+		static const char * const dates[][4] = {
+			{ "Thu", "Jan", "01", "1970" },
+			{ "Wed", "Feb", "29", "2012" },
+			{ "Fri", "Dec", "31", "9999" },
+		};
+		for (auto &d : dates) {
+			for (unsigned int hour = 0; hour <= 99; hour++) {
+				for (unsigned int min = 0; min <= 99; min++) {
+					for (unsigned int sec = 0; sec <= 99; sec++) {
+						std::string in = MakeDate(d[0], d[1], atoi(d[2]), hour, min, sec, atoi(d[3]));
+						if (hour <= 23 && min <= 59 && sec <= 59) {
+							CheckMustAccept(in);
+						} else {
+							Check(in);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Every weekday and month name, including case variants and invalid names
+	void NameSweep() {
+		for (unsigned int w = 0; w < 7; w++) {
+			for (unsigned int m = 0; m < 12; m++) {
+				CheckMustAccept(MakeDate(weekdays[w], months[m], 15, 1, 2, 3, 2016));
+
+				std::string lower_w = weekdays[w];
+				std::string upper_m = months[m];
+				lower_w[0] += 'a' - 'A';
+				for (char &c : upper_m) {
+					if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+				}
+				Check(MakeDate(lower_w.c_str(), months[m], 15, 1, 2, 3, 2016));
+				Check(MakeDate(weekdays[w], upper_m.c_str(), 15, 1, 2, 3, 2016));
+			}
+		}
+	}
+
+	const char * const samples[] = {
+		"Wed Aug 27 13:08:45 +0000 2008",
+		"Thu Jan 01 00:00:00 +0000 1970",
+		"Mon Feb 29 23:59:59 +0000 2016",
+		"Sun Dec 31 23:59:60 +0000 2017",
+		"Fri Dec 31 23:59:59 +0000 9999",
+		"Tue Mar 01 00:00:00 +0000 2100",
+	};
+
+	// Every byte value at every position of each sample, and at each position of a one byte longer or shorter string
+	void ByteSweep() {
+		for (const char *sample : samples) {
+			const std::string s = sample;
+			for (size_t pos = 0; pos < s.size(); pos++) {
+				for (unsigned int c = 0; c < 256; c++) {
+					std::string in = s;
+					in[pos] = static_cast<char>(c);
+					Check(in);
+
+					std::string ins = s;
+					ins.insert(ins.begin() + pos, static_cast<char>(c));
+					Check(ins);
+				}
+				std::string del = s;
+				del.erase(pos, 1);
+				Check(del);
+			}
+			for (unsigned int c = 0; c < 256; c++) {
+				Check(s + static_cast<char>(c));
+			}
+		}
+	}
+
+	// Every truncation, and every swap of two characters, of each sample
+	void TruncateSwapSweep() {
+		for (const char *sample : samples) {
+			const std::string s = sample;
+			for (size_t len = 0; len <= s.size(); len++) {
+				Check(s.substr(0, len));
+				Check(s.substr(s.size() - len));
+			}
+			for (size_t i = 0; i < s.size(); i++) {
+				for (size_t j = i + 1; j < s.size(); j++) {
+					std::string in = s;
+					std::swap(in[i], in[j]);
+					Check(in);
+				}
+			}
+		}
+	}
+
+	// Random mutations of the samples, mostly drawn from the characters which occur in dates
+	void RandomSweep(unsigned long long seed, unsigned long long count) {
+		static const char alphabet[] = "0123456789 :+-ADFJMNOSTWabceghilnoprtuvy";
+		std::mt19937_64 rng(seed);
+		for (unsigned long long n = 0; n < count; n++) {
+			std::string in = samples[rng() % (sizeof(samples) / sizeof(samples[0]))];
+			unsigned int mutations = 1 + (rng() % 4);
+			for (unsigned int m = 0; m < mutations; m++) {
+				size_t pos = rng() % in.size();
+				char c = (rng() % 8) ? alphabet[rng() % (sizeof(alphabet) - 1)] : static_cast<char>(rng());
+				in[pos] = c;
+			}
+			Check(in);
+		}
+	}
+};
+
+int main(int argc, char **argv) {
+	unsigned long long seed = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 1;
+
+	struct {
+		const char *name;
+		void (*func)();
+	} sweeps[] = {
+		{ "calendar", CalendarSweep },
+		{ "time", TimeSweep },
+		{ "names", NameSweep },
+		{ "bytes", ByteSweep },
+		{ "truncate/swap", TruncateSwapSweep },
+	};
+	for (auto &sweep : sweeps) {
+		unsigned long long before_checked = checked;
+		unsigned long long before_fast = fast_path;
+		sweep.func();
+		printf("%-16s %10llu inputs, %10llu took the fast path\n", sweep.name, checked - before_checked, fast_path - before_fast);
+	}
+	unsigned long long before_checked = checked;
+	unsigned long long before_fast = fast_path;
+	RandomSweep(seed, 5000000);
+	printf("%-16s %10llu inputs, %10llu took the fast path (seed: %llu)\n", "random", checked - before_checked, fast_path - before_fast, seed);
+
+	if (failures) {
+		printf("%llu failures\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,633 @@
+#!/usr/bin/env python3
+#  retcon
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version. See: COPYING-GPL.txt
+#
+#  This program  is distributed in the  hope that it will  be useful, but
+#  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+#  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+#  General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+#  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+#==========================================================================
+
+# Loopback-only stand-in for the Twitter REST, streaming and media hosts, serving recorded fixture files
+# Run retcon with --api-redirect <host>:<port> (or set the equivalent advanced network option) to use it
+# See doc/mock_api_server.txt
+
+import argparse
+import copy
+import ipaddress
+import json
+import mimetypes
+import os
+import shutil
+import socket
+import ssl
+import subprocess
+import tempfile
+import threading
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+API_HOSTS = { 'api.twitter.com', 'upload.twitter.com' }
+STREAM_HOSTS = { 'userstream.twitter.com', 'stream.twitter.com', 'sitestream.twitter.com' }
+
+# List endpoints which return {"ids": [...], "next_cursor": 0}
+ID_LIST_ENDPOINTS = { 'friends/ids', 'followers/ids', 'blocks/ids', 'mutes/users/ids', 'friendships/incoming', 'friendships/outgoing' }
+USER_ACTION_ENDPOINTS = { 'friendships/create', 'friendships/destroy', 'blocks/create', 'blocks/destroy', 'mutes/users/create', 'mutes/users/destroy' }
+
+
+def is_tweet_like(d):
+	return 'text' in d or 'full_text' in d
+
+
+def offset_ids(obj, offset, tag):
+	# Returns a copy of a fixture object with all tweet, DM and media IDs moved by offset
+	# Media URLs are made unique by tag so that the client fetches them again
+	if isinstance(obj, list):
+		return [ offset_ids(v, offset, tag) for v in obj ]
+	if not isinstance(obj, dict):
+		return obj
+	out = {}
+	rewrite = is_tweet_like(obj) or 'media_url' in obj or 'media_url_https' in obj or ('user_id' in obj and 'id' in obj)
+	for k, v in obj.items():
+		if rewrite and k in ('id', 'in_reply_to_status_id', 'quoted_status_id') and isinstance(v, int):
+			out[k] = v + offset
+		elif rewrite and k in ('id_str', 'in_reply_to_status_id_str', 'quoted_status_id_str') and isinstance(v, str):
+			out[k] = str(int(v) + offset)
+		elif k in ('media_url', 'media_url_https') and isinstance(v, str) and tag:
+			root, ext = os.path.splitext(v)
+			out[k] = root + tag + ext
+		elif k == 'user':
+			out[k] = v
+		else:
+			out[k] = offset_ids(v, offset, tag)
+	return out
+
+
+def collect_ids(obj, into):
+	if isinstance(obj, list):
+		for v in obj:
+			collect_ids(v, into)
+	elif isinstance(obj, dict):
+		if is_tweet_like(obj) and isinstance(obj.get('id'), int):
+			into.append(obj['id'])
+		for k, v in obj.items():
+			if k != 'user':
+				collect_ids(v, into)
+
+
+def media_urls(obj, into):
+	if isinstance(obj, list):
+		for v in obj:
+			media_urls(v, into)
+	elif isinstance(obj, dict):
+		for k, v in obj.items():
+			if k == 'media_url_https' and isinstance(v, str):
+				into.add(normalise_media_path(v))
+			else:
+				media_urls(v, into)
+	return into
+
+
+def normalise_media_path(url):
+	# Strip scheme, query and any :size suffix, eg. https://pbs.twimg.com/media/X.png:small -> pbs.twimg.com/media/X.png
+	parts = urllib.parse.urlsplit(url if '//' in url else '//' + url)
+	path = parts.path
+	slash = path.rfind('/')
+	colon = path.find(':', slash + 1)
+	if colon >= 0:
+		path = path[:colon]
+	return parts.hostname + path
+
+
+class Fixtures:
+	def __init__(self, path, history_copies = 1, stream_repeats = 1):
+		self.path = path
+		with open(os.path.join(path, 'manifest.json')) as f:
+			manifest = json.load(f)
+
+		self.users = self.load_json(manifest['users'])
+		self.users_by_id = { u['id']: u for u in self.users }
+		self.users_by_name = { u['screen_name'].lower(): u for u in self.users }
+		self.account = self.users_by_id[manifest['account_user_id']]
+
+		timelines = { name: self.load_json(file) for name, file in manifest.get('timelines', {}).items() }
+		stream_msgs = { name: self.load_stream(file) for name, file in manifest.get('streams', {}).items() }
+
+		ids = []
+		collect_ids(list(timelines.values()), ids)
+		collect_ids(list(stream_msgs.values()), ids)
+		span = (max(ids) - min(ids) + 1) if ids else 1
+		self.next_id = max(ids) + span * stream_repeats + 1 if ids else 1
+
+		# Extra copies of the timelines go further into the past, so that backfill has more pages to fetch
+		self.timelines = {}
+		for name, tweets in timelines.items():
+			all_tweets = list(tweets)
+			for k in range(1, history_copies):
+				all_tweets.extend(offset_ids(tweets, -k * span, '-h%d' % k))
+			all_tweets.sort(key = lambda t: -t['id'])
+			self.timelines[name] = all_tweets
+
+		# Stream repeats go further into the future, the friends list is only sent once
+		self.streams = {}
+		for name, msgs in stream_msgs.items():
+			out = []
+			for k in range(stream_repeats):
+				for msg in msgs:
+					if k > 0 and 'friends' in msg:
+						continue
+					out.append(offset_ids(msg, k * span, '-r%d' % k if k else ''))
+			self.streams[name] = [ (json.dumps(m, separators = (',', ':'), ensure_ascii = False).encode('utf-8'), m) for m in out ]
+
+		self.tweets_by_id = {}
+		for tweets in self.timelines.values():
+			for t in tweets:
+				self.tweets_by_id.setdefault(t['id'], t)
+		for msgs in self.streams.values():
+			for raw, m in msgs:
+				if is_tweet_like(m) and 'user' in m:
+					self.tweets_by_id.setdefault(m['id'], m)
+
+		self.media_dir = os.path.join(path, 'media')
+		self.media_default = {}
+		for ext, file in manifest.get('media_default', {}).items():
+			with open(os.path.join(path, file), 'rb') as f:
+				self.media_default[ext] = f.read()
+
+		self.id_lock = threading.Lock()
+
+	def load_json(self, file):
+		with open(os.path.join(self.path, file), encoding = 'utf-8') as f:
+			return json.load(f)
+
+	def load_stream(self, file):
+		# Same format as the stream import: one JSON message per line
+		msgs = []
+		with open(os.path.join(self.path, file), encoding = 'utf-8') as f:
+			for line in f:
+				line = line.strip()
+				if line:
+					msgs.append(json.loads(line))
+		return msgs
+
+	def new_id(self):
+		with self.id_lock:
+			self.next_id += 1
+			return self.next_id
+
+	def find_user(self, query):
+		if 'user_id' in query:
+			return self.users_by_id.get(int(query['user_id']))
+		if 'screen_name' in query:
+			return self.users_by_name.get(query['screen_name'].lower())
+		return None
+
+	def page(self, name, query):
+		tweets = self.timelines[name]
+		count = min(int(query.get('count', 20)), 200)
+		since_id = int(query.get('since_id', 0))
+		max_id = int(query.get('max_id', 0)) or None
+		user = self.find_user(query) if name == 'statuses/user_timeline' else None
+		out = []
+		for t in tweets:
+			if len(out) >= count or t['id'] <= since_id:
+				break
+			if max_id is not None and t['id'] > max_id:
+				continue
+			if user is not None and t['user']['id'] != user['id']:
+				continue
+			out.append(t)
+		return out
+
+
+class RateLimiter:
+	def __init__(self, limit, window):
+		self.limit = limit
+		self.window = window
+		self.buckets = {}
+		self.lock = threading.Lock()
+
+	# Returns (allowed, limit, remaining, reset)
+	def take(self, bucket):
+		now = time.time()
+		with self.lock:
+			remaining, reset = self.buckets.get(bucket, (self.limit, int(now) + self.window))
+			if now >= reset:
+				remaining, reset = self.limit, int(now) + self.window
+			allowed = remaining > 0
+			if allowed:
+				remaining -= 1
+			self.buckets[bucket] = (remaining, reset)
+			return allowed, self.limit, remaining, reset
+
+
+class Recorder:
+	# Timestamped event log shared with the replay driver, times are time.monotonic()
+	def __init__(self):
+		self.events = []
+		self.lock = threading.Lock()
+		self.last_activity = time.monotonic()
+
+	def add(self, kind, **fields):
+		now = time.monotonic()
+		fields['kind'] = kind
+		fields['t'] = now
+		with self.lock:
+			self.events.append(fields)
+			self.last_activity = now
+
+	def snapshot(self):
+		with self.lock:
+			return list(self.events)
+
+
+class MockHandler(BaseHTTPRequestHandler):
+	protocol_version = 'HTTP/1.1'
+	server_version = 'retcon-mockapi'
+	sys_version = ''
+	timeout = 120
+
+	def setup(self):
+		super().setup()
+		if isinstance(self.request, ssl.SSLSocket):
+			try:
+				self.request.do_handshake()
+			except (ssl.SSLError, OSError) as e:
+				self.log_message('TLS handshake failed: %s', e)
+				self.close_connection = True
+				raise
+
+	def log_message(self, format, *args):
+		if self.server.opts.verbose:
+			super().log_message(format, *args)
+
+	def do_GET(self):
+		self.dispatch()
+
+	def do_POST(self):
+		self.dispatch()
+
+	def dispatch(self):
+		host = (self.headers.get('Host') or '').lower()
+		if host.startswith('['):
+			host = host[:host.find(']') + 1]
+		else:
+			host = host.split(':', 1)[0]
+		url = urllib.parse.urlsplit(self.path)
+		query = dict(urllib.parse.parse_qsl(url.query))
+		length = int(self.headers.get('Content-Length') or 0)
+		if length:
+			body = self.rfile.read(length)
+			if (self.headers.get('Content-Type') or '').startswith('application/x-www-form-urlencoded'):
+				query.update(urllib.parse.parse_qsl(body.decode('utf-8', 'replace')))
+
+		path = url.path
+		if path.endswith('.json'):
+			path = path[:-5]
+		if path.startswith('/1.1/'):
+			path = path[5:]
+
+		rec = self.server.recorder
+		if rec:
+			rec.add('request', host = host, method = self.command, path = path, query = query)
+
+		try:
+			if host in STREAM_HOSTS:
+				self.serve_stream(path, query)
+			elif host in API_HOSTS:
+				self.serve_api(path, query)
+			else:
+				self.serve_media(host, url.path)
+		except (BrokenPipeError, ConnectionResetError, ssl.SSLError, socket.timeout) as e:
+			self.close_connection = True
+			if rec:
+				rec.add('disconnect', host = host, path = path, error = str(e))
+
+	def send_body(self, code, body, content_type, headers = ()):
+		self.send_response(code)
+		self.send_header('Content-Type', content_type)
+		self.send_header('Content-Length', str(len(body)))
+		for name, value in headers:
+			self.send_header(name, value)
+		self.end_headers()
+		self.wfile.write(body)
+
+	def send_json(self, code, obj, headers = ()):
+		self.send_body(code, json.dumps(obj, ensure_ascii = False).encode('utf-8'), 'application/json; charset=utf-8', headers)
+
+	def serve_api(self, path, query):
+		opts = self.server.opts
+		fx = self.server.fixtures
+		rec = self.server.recorder
+
+		if opts.rest_delay:
+			time.sleep(opts.rest_delay / 1000)
+
+		bucket = path
+		for prefix in ('statuses/show/', 'statuses/retweet/', 'statuses/destroy/'):
+			if path.startswith(prefix):
+				bucket = prefix.rstrip('/')
+		allowed, limit, remaining, reset = self.server.rate_limiter.take(bucket)
+		headers = [ ('x-rate-limit-limit', str(limit)), ('x-rate-limit-remaining', str(remaining)), ('x-rate-limit-reset', str(reset)) ]
+		if not allowed:
+			if rec:
+				rec.add('rate_limited', path = path)
+			self.send_json(429, { 'errors': [ { 'code': 88, 'message': 'Rate limit exceeded' } ] }, headers)
+			return
+
+		status, obj = self.api_response(path, query)
+		self.send_json(status, obj, headers)
+		if rec and path in fx.timelines:
+			ids = [ t['id'] for t in obj ]
+			rec.add('page', path = path, count = len(ids), min_id = min(ids) if ids else None, max_id = max(ids) if ids else None,
+					media = sorted(media_urls(obj, set())))
+
+	def api_response(self, path, query):
+		fx = self.server.fixtures
+		if path in fx.timelines:
+			return 200, fx.page(path, query)
+		if path == 'account/verify_credentials':
+			return 200, fx.account
+		if path == 'users/show':
+			user = fx.find_user(query)
+			return (200, user) if user else (404, { 'errors': [ { 'code': 50, 'message': 'User not found.' } ] })
+		if path == 'users/lookup':
+			found = []
+			for uid in filter(None, query.get('user_id', '').split(',')):
+				if int(uid) in fx.users_by_id:
+					found.append(fx.users_by_id[int(uid)])
+			for name in filter(None, query.get('screen_name', '').split(',')):
+				if name.lower() in fx.users_by_name:
+					found.append(fx.users_by_name[name.lower()])
+			return 200, found
+		if path in ID_LIST_ENDPOINTS:
+			ids = []
+			if path == 'friends/ids':
+				ids = [ u['id'] for u in fx.users if u is not fx.account and not u.get('protected') ]
+			elif path == 'followers/ids':
+				ids = [ u['id'] for u in fx.users if u is not fx.account ]
+			return 200, { 'ids': ids, 'next_cursor': 0, 'next_cursor_str': '0', 'previous_cursor': 0, 'previous_cursor_str': '0' }
+		if path == 'friendships/no_retweets/ids':
+			return 200, []
+		if path == 'friendships/lookup':
+			out = []
+			for uid in filter(None, query.get('user_id', '').split(',')):
+				user = fx.users_by_id.get(int(uid))
+				if user:
+					out.append({ 'id': user['id'], 'id_str': user['id_str'], 'name': user['name'], 'screen_name': user['screen_name'],
+							'connections': [ 'following', 'followed_by' ] })
+			return 200, out
+		if path == 'friendships/show':
+			target = int(query.get('target_id', 0))
+			return 200, { 'relationship': {
+					'source': { 'id': fx.account['id'], 'following': True, 'followed_by': True, 'want_retweets': True, 'blocking': False, 'muting': False },
+					'target': { 'id': target, 'following': True, 'followed_by': True } } }
+		if path.startswith('statuses/show'):
+			tid = int(path.rsplit('/', 1)[1]) if path.startswith('statuses/show/') else int(query.get('id', 0))
+			tweet = fx.tweets_by_id.get(tid)
+			return (200, tweet) if tweet else (404, { 'errors': [ { 'code': 144, 'message': 'No status found with that ID.' } ] })
+		if path == 'statuses/update':
+			tid = fx.new_id()
+			return 200, { 'id': tid, 'id_str': str(tid), 'created_at': time.strftime('%a %b %d %H:%M:%S +0000 %Y', time.gmtime()),
+					'text': query.get('status', ''), 'user': fx.account, 'retweet_count': 0, 'favorite_count': 0,
+					'entities': { 'hashtags': [], 'urls': [], 'user_mentions': [] } }
+		if path == 'media/upload':
+			mid = fx.new_id()
+			return 200, { 'media_id': mid, 'media_id_string': str(mid) }
+		if path in ('favorites/create', 'favorites/destroy') or path.startswith(('statuses/retweet/', 'statuses/destroy/')):
+			tid = int(query.get('id', 0)) if path.startswith('favorites/') else int(path.rsplit('/', 1)[1])
+			tweet = fx.tweets_by_id.get(tid)
+			if not tweet:
+				return 404, { 'errors': [ { 'code': 144, 'message': 'No status found with that ID.' } ] }
+			tweet = copy.copy(tweet)
+			tweet['favorited'] = (path == 'favorites/create')
+			return 200, tweet
+		if path in USER_ACTION_ENDPOINTS:
+			user = fx.find_user(query)
+			return (200, user) if user else (404, { 'errors': [ { 'code': 50, 'message': 'User not found.' } ] })
+		if path == 'account/rate_limit_status':
+			return 200, { 'resources': {} }
+
+		if self.server.opts.verbose:
+			self.log_message('No fixture for: %s %s', self.command, path)
+		return 200, ([] if self.command == 'GET' else {})
+
+	def send_chunk(self, data):
+		self.wfile.write(b'%x\r\n' % len(data) + data + b'\r\n')
+
+	def serve_stream(self, path, query):
+		opts = self.server.opts
+		fx = self.server.fixtures
+		rec = self.server.recorder
+		msgs = fx.streams.get(path)
+		if msgs is None:
+			self.send_json(404, { 'errors': [ { 'code': 34, 'message': 'Sorry, that page does not exist.' } ] })
+			return
+
+		delimited = (query.get('delimited') == 'length')
+		self.request.settimeout(None)
+		if opts.stream_sndbuf:
+			self.request.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, opts.stream_sndbuf)
+
+		self.send_response(200)
+		self.send_header('Content-Type', 'application/json')
+		self.send_header('Transfer-Encoding', 'chunked')
+		self.end_headers()
+		if rec:
+			rec.add('stream_open', path = path, messages = len(msgs))
+
+		start = time.monotonic()
+		sent_bytes = 0
+		for i, (raw, msg) in enumerate(msgs):
+			if self.server.stopping.is_set():
+				return
+			if opts.stream_rate:
+				delay = start + i / opts.stream_rate - time.monotonic()
+				if delay > 0:
+					time.sleep(delay)
+
+			payload = raw + b'\r\n'
+			if delimited:
+				payload = b'%d\r\n' % len(payload) + payload
+
+			# Split each message into chunks of at most stream_chunk bytes, to exercise reassembly of partial messages
+			step = opts.stream_chunk or len(payload)
+			for offset in range(0, len(payload), step):
+				if offset and opts.chunk_delay:
+					time.sleep(opts.chunk_delay / 1000)
+				self.send_chunk(payload[offset:offset + step])
+			sent_bytes += len(payload)
+
+			if rec:
+				rec.add('stream_msg', path = path, index = i, bytes = len(payload), id = msg.get('id') if is_tweet_like(msg) else None,
+						media = sorted(media_urls(msg, set())))
+
+			if opts.stall_every and (i + 1) % opts.stall_every == 0 and i + 1 < len(msgs):
+				# Send nothing at all, not even keep-alives, for the duration of the stall
+				if rec:
+					rec.add('stream_stall', path = path, index = i, seconds = opts.stall_secs)
+				self.server.stopping.wait(opts.stall_secs)
+
+		if rec:
+			rec.add('stream_done', path = path, messages = len(msgs), bytes = sent_bytes, seconds = time.monotonic() - start)
+
+		if opts.stream_end:
+			self.wfile.write(b'0\r\n\r\n')
+			self.close_connection = True
+			return
+
+		# Keep the connection open with blank line keep-alives, as the real streaming API does
+		while not self.server.stopping.wait(opts.keepalive):
+			self.send_chunk(b'\r\n')
+
+	def serve_media(self, host, path):
+		opts = self.server.opts
+		fx = self.server.fixtures
+		rec = self.server.recorder
+		if opts.media_delay:
+			time.sleep(opts.media_delay / 1000)
+
+		key = normalise_media_path('//' + host + path)
+		name = os.path.basename(key)
+		ext = os.path.splitext(name)[1].lower()
+		body = None
+		file = os.path.join(fx.media_dir, name)
+		if name and os.path.isfile(file):
+			with open(file, 'rb') as f:
+				body = f.read()
+		elif ext in fx.media_default:
+			body = fx.media_default[ext]
+
+		if rec:
+			rec.add('media', key = key, found = body is not None)
+		if body is None:
+			self.send_body(404, b'Not Found', 'text/plain')
+		else:
+			self.send_body(200, body, mimetypes.guess_type(name)[0] or 'application/octet-stream')
+
+
+class MockServer(ThreadingHTTPServer):
+	daemon_threads = True
+
+	def __init__(self, opts, fixtures, recorder):
+		self.opts = opts
+		self.fixtures = fixtures
+		self.recorder = recorder
+		self.rate_limiter = RateLimiter(opts.rate_limit, opts.rate_limit_window)
+		self.stopping = threading.Event()
+		self.address_family = socket.AF_INET6 if ':' in opts.host else socket.AF_INET
+		super().__init__((opts.host, opts.port), MockHandler)
+
+	def handle_error(self, request, client_address):
+		if self.opts.verbose:
+			super().handle_error(request, client_address)
+
+	def stop(self):
+		self.stopping.set()
+		self.shutdown()
+		self.server_close()
+
+
+def check_loopback(host):
+	if host == 'localhost':
+		return
+	try:
+		if ipaddress.ip_address(host).is_loopback:
+			return
+	except ValueError:
+		pass
+	raise SystemExit('Refusing to listen on non-loopback address: %s' % host)
+
+
+def make_ssl_context(opts):
+	ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+	if opts.cert:
+		ctx.load_cert_chain(opts.cert, opts.key)
+		return ctx
+
+	# Throwaway self-signed certificate, the client does not verify certificates whilst redirected
+	tmpdir = tempfile.mkdtemp(prefix = 'retcon-mockapi-')
+	try:
+		cert = os.path.join(tmpdir, 'cert.pem')
+		key = os.path.join(tmpdir, 'key.pem')
+		try:
+			subprocess.run([ 'openssl', 'req', '-x509', '-newkey', 'rsa:2048', '-nodes', '-days', '2', '-subj', '/CN=localhost',
+					'-keyout', key, '-out', cert ], check = True, stdout = subprocess.DEVNULL, stderr = subprocess.DEVNULL)
+		except (OSError, subprocess.CalledProcessError):
+			raise SystemExit('Failed to generate a certificate with openssl, use --cert/--key, or --plain with SSL disabled for the account')
+		ctx.load_cert_chain(cert, key)
+	finally:
+		shutil.rmtree(tmpdir, ignore_errors = True)
+	return ctx
+
+
+def add_server_args(parser):
+	here = os.path.dirname(os.path.abspath(__file__))
+	g = parser.add_argument_group('server')
+	g.add_argument('--host', default = '127.0.0.1', help = 'loopback address to listen on (default: %(default)s)')
+	g.add_argument('--port', type = int, default = 8443, help = 'port to listen on, 0 for any (default: %(default)s)')
+	g.add_argument('--fixtures', default = os.path.join(here, 'fixtures'), help = 'fixture directory containing manifest.json')
+	g.add_argument('--plain', action = 'store_true', help = 'serve plain HTTP instead of HTTPS')
+	g.add_argument('--cert', help = 'PEM certificate to use instead of a generated self-signed one')
+	g.add_argument('--key', help = 'PEM private key for --cert')
+	g.add_argument('--history-copies', type = int, default = 1, help = 'serve this many copies of each timeline, going back in time (default: %(default)s)')
+	g.add_argument('--stream-repeats', type = int, default = 1, help = 'replay each stream recording this many times with new IDs (default: %(default)s)')
+	g.add_argument('--stream-rate', type = float, default = 0, help = 'stream messages per second, 0 to send as fast as the client reads (default: %(default)s)')
+	g.add_argument('--stream-chunk', type = int, default = 0, help = 'split stream messages into HTTP chunks of at most this many bytes, 0 for one chunk per message')
+	g.add_argument('--chunk-delay', type = float, default = 0, help = 'milliseconds between the chunks of one stream message')
+	g.add_argument('--stall-every', type = int, default = 0, help = 'stall the stream after every N messages')
+	g.add_argument('--stall-secs', type = float, default = 100, help = 'length of each stream stall in seconds (default: %(default)s)')
+	g.add_argument('--stream-end', action = 'store_true', help = 'close streams at the end of the recording, instead of sending keep-alives')
+	g.add_argument('--keepalive', type = float, default = 30, help = 'seconds between stream keep-alives (default: %(default)s)')
+	g.add_argument('--stream-sndbuf', type = int, default = 0, help = 'socket send buffer size for streams, small values make the stream rate follow the client ingest rate')
+	g.add_argument('--rate-limit', type = int, default = 180, help = 'requests per endpoint per rate limit window, before 429s are returned (default: %(default)s)')
+	g.add_argument('--rate-limit-window', type = int, default = 900, help = 'rate limit window in seconds (default: %(default)s)')
+	g.add_argument('--rest-delay', type = float, default = 0, help = 'milliseconds to delay each REST response')
+	g.add_argument('--media-delay', type = float, default = 0, help = 'milliseconds to delay each media response')
+	g.add_argument('-v', '--verbose', action = 'store_true', help = 'log each request and unknown endpoints')
+
+
+def start_server(opts, recorder = None):
+	check_loopback(opts.host)
+	fixtures = Fixtures(opts.fixtures, max(opts.history_copies, 1), max(opts.stream_repeats, 1))
+	server = MockServer(opts, fixtures, recorder)
+	if not opts.plain:
+		server.socket = make_ssl_context(opts).wrap_socket(server.socket, server_side = True, do_handshake_on_connect = False)
+	thread = threading.Thread(target = server.serve_forever, name = 'mockapi', daemon = True)
+	thread.start()
+	return server
+
+
+def redirect_target(server):
+	host, port = server.server_address[:2]
+	if ':' in host:
+		host = '[%s]' % host
+	return '%s:%d' % (host, port)
+
+
+def main():
+	parser = argparse.ArgumentParser(description = 'Loopback stand-in for the Twitter API, for use with retcon --api-redirect')
+	add_server_args(parser)
+	opts = parser.parse_args()
+	server = start_server(opts)
+	print('Listening on %s://%s, run: retcon --api-redirect %s' % ('http' if opts.plain else 'https', redirect_target(server), redirect_target(server)), flush = True)
+	try:
+		while True:
+			time.sleep(3600)
+	except KeyboardInterrupt:
+		pass
+	server.stop()
+
+
+if __name__ == '__main__':
+	main()
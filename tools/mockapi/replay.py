@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+#  retcon
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version. See: COPYING-GPL.txt
+#
+#  This program  is distributed in the  hope that it will  be useful, but
+#  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+#  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+#  General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+#  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+#==========================================================================
+
+# Replay driver: runs the mock API server, optionally launches retcon against it with a copy of a data directory,
+# and reports end-to-end ingest throughput and latency as seen from the server side
+# See doc/mock_api_server.txt
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+import mockapi
+
+
+def stats(samples):
+	if not samples:
+		return None
+	s = sorted(samples)
+	def pct(p):
+		return s[min(len(s) - 1, int(round(p * (len(s) - 1))))]
+	return { 'n': len(s), 'mean_ms': 1000 * sum(s) / len(s), 'p50_ms': 1000 * pct(0.5), 'p95_ms': 1000 * pct(0.95), 'max_ms': 1000 * s[-1] }
+
+
+def analyse(events, start):
+	report = {}
+	requests = [ e for e in events if e['kind'] == 'request' ]
+	if requests:
+		report['first_request_s'] = requests[0]['t'] - start
+	for e in requests:
+		if e['path'] == 'account/verify_credentials':
+			report['verify_credentials_s'] = e['t'] - start
+			break
+
+	per_endpoint = {}
+	for e in requests:
+		name = e['host'] + ' ' + (e['path'] if e['host'] in mockapi.API_HOSTS | mockapi.STREAM_HOSTS else '(media)')
+		per_endpoint[name] = per_endpoint.get(name, 0) + 1
+	report['requests'] = per_endpoint
+	report['rate_limited'] = sum(1 for e in events if e['kind'] == 'rate_limited')
+	report['disconnects'] = sum(1 for e in events if e['kind'] == 'disconnect')
+
+	# Page turnaround: time from a timeline page being sent, to the client requesting the next (older) page of that timeline
+	# This covers parsing, DB insertion and whatever else the client does before continuing a backfill
+	turnaround = []
+	pages = {}
+	page_tweets = 0
+	last_page = {}
+	for e in events:
+		if e['kind'] == 'page':
+			pages[e['path']] = pages.get(e['path'], 0) + 1
+			page_tweets += e['count']
+			if e['count']:
+				last_page[e['path']] = e
+		elif e['kind'] == 'request' and 'max_id' in e['query'] and e['path'] in last_page:
+			turnaround.append(e['t'] - last_page.pop(e['path'])['t'])
+	report['rest'] = { 'pages': pages, 'tweets': page_tweets, 'page_turnaround': stats(turnaround) }
+
+	# Stream throughput: the server writes as fast as the client reads, so with a small socket send buffer this follows the client's ingest rate
+	msgs = [ e for e in events if e['kind'] == 'stream_msg' ]
+	stall_secs = sum(e['seconds'] for e in events if e['kind'] == 'stream_stall')
+	if msgs:
+		secs = msgs[-1]['t'] - msgs[0]['t'] - stall_secs
+		total_bytes = sum(e['bytes'] for e in msgs)
+		report['stream'] = {
+			'connections': sum(1 for e in events if e['kind'] == 'stream_open'),
+			'messages': len(msgs),
+			'bytes': total_bytes,
+			'seconds': secs,
+			'msgs_per_s': len(msgs) / secs if secs > 0 else None,
+			'mb_per_s': total_bytes / (secs * 1024 * 1024) if secs > 0 else None,
+			'stalls': sum(1 for e in events if e['kind'] == 'stream_stall'),
+			'completed': any(e['kind'] == 'stream_done' for e in events),
+		}
+
+	# Media latency: time from a tweet referencing an image being sent, to the client fetching that image
+	origin = {}
+	for e in events:
+		if e['kind'] in ('stream_msg', 'page'):
+			for key in e['media']:
+				origin.setdefault(key, e['t'])
+	media_latency = []
+	fetched = set()
+	other_media = 0
+	for e in events:
+		if e['kind'] != 'media':
+			continue
+		if e['key'] in origin:
+			if e['key'] not in fetched:
+				fetched.add(e['key'])
+				media_latency.append(e['t'] - origin[e['key']])
+		else:
+			other_media += 1
+	report['media'] = { 'referenced': len(origin), 'fetched': len(fetched), 'other_fetches': other_media, 'latency': stats(media_latency) }
+	return report
+
+
+def fmt_stats(s):
+	if not s:
+		return 'no samples'
+	return 'n=%d mean=%.1fms p50=%.1fms p95=%.1fms max=%.1fms' % (s['n'], s['mean_ms'], s['p50_ms'], s['p95_ms'], s['max_ms'])
+
+
+def print_report(report):
+	print('=== replay report ===')
+	if 'first_request_s' in report:
+		print('first request:        %.3fs after start' % report['first_request_s'])
+	if 'verify_credentials_s' in report:
+		print('verify credentials:   %.3fs after start' % report['verify_credentials_s'])
+	rest = report['rest']
+	print('REST pages:           %s (%d tweets)' % (', '.join('%s: %d' % it for it in sorted(rest['pages'].items())) or 'none', rest['tweets']))
+	print('page turnaround:      %s' % fmt_stats(rest['page_turnaround']))
+	print('rate limited:         %d, disconnects: %d' % (report['rate_limited'], report['disconnects']))
+	stream = report.get('stream')
+	if stream:
+		print('stream:               %d msgs, %d bytes in %.3fs over %d connection(s), %d stall(s)%s' % (stream['messages'], stream['bytes'], stream['seconds'],
+				stream['connections'], stream['stalls'], '' if stream['completed'] else ', INCOMPLETE'))
+		if stream['msgs_per_s'] is not None:
+			print('stream throughput:    %.0f msg/s, %.3f MB/s' % (stream['msgs_per_s'], stream['mb_per_s']))
+	media = report['media']
+	print('media:                %d of %d referenced images fetched, %d other fetches' % (media['fetched'], media['referenced'], media['other_fetches']))
+	print('media latency:        %s' % fmt_stats(media['latency']))
+	print('requests by endpoint:')
+	for name, count in sorted(report['requests'].items()):
+		print('  %6d  %s' % (count, name))
+
+
+def main():
+	parser = argparse.ArgumentParser(description = 'Replay recorded fixtures into retcon via the mock API server, and measure ingest throughput and latency')
+	mockapi.add_server_args(parser)
+	g = parser.add_argument_group('replay')
+	g.add_argument('--retcon', help = 'retcon binary to launch, if not given start retcon manually with the printed --api-redirect argument')
+	g.add_argument('--data-dir', help = 'retcon data directory with a configured account, a temporary copy is used for the run')
+	g.add_argument('--retcon-arg', action = 'append', default = [], help = 'extra argument to pass to retcon, may be repeated')
+	g.add_argument('--duration', type = float, default = 600, help = 'maximum run time in seconds (default: %(default)s)')
+	g.add_argument('--settle', type = float, default = 10, help = 'end the run after this many seconds without client activity, once any stream has completed (default: %(default)s)')
+	g.add_argument('--keep-data-dir', action = 'store_true', help = 'do not delete the temporary data directory copy')
+	g.add_argument('--json', help = 'also write the report and raw event log to this file')
+	opts = parser.parse_args()
+
+	if opts.retcon and not opts.data_dir:
+		parser.error('--retcon requires --data-dir, the directory must contain a configured account')
+
+	recorder = mockapi.Recorder()
+	server = mockapi.start_server(opts, recorder)
+	target = mockapi.redirect_target(server)
+
+	proc = None
+	tmpdir = None
+	log = None
+	try:
+		if opts.retcon:
+			tmpdir = tempfile.mkdtemp(prefix = 'retcon-replay-')
+			data_dir = os.path.join(tmpdir, 'data')
+			shutil.copytree(opts.data_dir, data_dir)
+			log = open(os.path.join(tmpdir, 'retcon.log'), 'w')
+			cmd = [ opts.retcon, '-d', data_dir, '--api-redirect', target ] + opts.retcon_arg
+			print('Launching: %s' % ' '.join(cmd), flush = True)
+			start = time.monotonic()
+			proc = subprocess.Popen(cmd, stdout = log, stderr = subprocess.STDOUT)
+		else:
+			print('Mock API server listening, start retcon with: --api-redirect %s' % target, flush = True)
+			start = time.monotonic()
+
+		deadline = start + opts.duration
+		while time.monotonic() < deadline:
+			time.sleep(0.5)
+			if proc and proc.poll() is not None:
+				print('retcon exited with status %d' % proc.returncode, flush = True)
+				break
+			events = recorder.snapshot()
+			stream_done = any(e['kind'] == 'stream_done' for e in events)
+			streaming = any(e['kind'] == 'stream_open' for e in events)
+			idle = time.monotonic() - recorder.last_activity
+			if events and (stream_done or not streaming) and idle > opts.settle:
+				break
+	except KeyboardInterrupt:
+		pass
+	finally:
+		if proc and proc.poll() is None:
+			proc.terminate()
+			try:
+				proc.wait(10)
+			except subprocess.TimeoutExpired:
+				proc.kill()
+				proc.wait()
+		server.stop()
+		if log:
+			log.close()
+
+	events = recorder.snapshot()
+	report = analyse(events, start)
+	print_report(report)
+	if opts.json:
+		with open(opts.json, 'w') as f:
+			json.dump({ 'report': report, 'events': [ dict(e, t = e['t'] - start) for e in events ] }, f, indent = '\t')
+
+	if tmpdir:
+		if opts.keep_data_dir:
+			print('Data directory and retcon output kept in: %s' % tmpdir)
+		else:
+			shutil.rmtree(tmpdir, ignore_errors = True)
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,280 @@
+//  retcon
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version. See: COPYING-GPL.txt
+//
+//  This program  is distributed in the  hope that it will  be useful, but
+//  WITHOUT   ANY  WARRANTY;   without  even   the  implied   warranty  of
+//  MERCHANTABILITY  or FITNESS  FOR A  PARTICULAR PURPOSE.   See  the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+//  2015 - Jonathan G Rennison <j.g.rennison@gmail.com>
+//==========================================================================
+
+// Test driver for url_parts
+// Checks the expected splits in corpus.txt, then fuzzes the splitter with random and mutated inputs,
+// checking that the parts always lie in order within the input and reassemble to exactly the input.
+// Each input is copied to a buffer of exactly its size, so that any over-read is caught when built with ASan.
+//
+// Build and run with: make -C tools/urltest check
+// Usage: urltest [corpus file] [random seed] [fuzz iterations]
+// Returns non-zero if any failures are found.
+
+#include "url-util.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+	unsigned long long failures = 0;
+
+	std::string Printable(const std::string &in) {
+		std::string out;
+		for (unsigned char c : in) {
+			if (c >= 0x20 && c < 0x7F && c != '\\') {
+				out += c;
+			} else {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\x%02X", c);
+				out += buf;
+			}
+		}
+		return out;
+	}
+
+	void Report(const std::string &in, const std::string &what) {
+		failures++;
+		if (failures <= 50) {
+			fprintf(stderr, "FAIL: \"%s\": %s\n", Printable(in).c_str(), what.c_str());
+		} else if (failures == 51) {
+			fprintf(stderr, "Further failures not shown\n");
+		}
+	}
+
+	const char * const part_names[] = { "scheme", "userinfo", "host", "port", "path", "query", "fragment" };
+
+	std::vector<const url_part *> Parts(const url_parts &u) {
+		return { &u.scheme, &u.userinfo, &u.host, &u.port, &u.path, &u.query, &u.fragment };
+	}
+
+	std::string Reassemble(const url_parts &u) {
+		std::string out;
+		if (u.scheme.IsPresent()) out += u.scheme.str() + ":";
+		if (u.HasAuthority()) {
+			out += "//";
+			if (u.userinfo.IsPresent()) out += u.userinfo.str() + "@";
+			out += u.host.str();
+			if (u.port.IsPresent()) out += ":" + u.port.str();
+		}
+		out += u.path.str();
+		if (u.query.IsPresent()) out += "?" + u.query.str();
+		if (u.fragment.IsPresent()) out += "#" + u.fragment.str();
+		return out;
+	}
+
+	bool Contains(const url_part &p, const char *chars) {
+		for (size_t i = 0; i < p.size; i++) {
+			if (p.data[i] && strchr(chars, p.data[i])) return true;
+		}
+		return false;
+	}
+
+	// Checks the structural invariants of the split of in, returns the split which refers to buf
+	url_parts CheckInvariants(const std::string &in, std::unique_ptr<char[]> &buf) {
+		buf.reset(new char[in.size() ? in.size() : 1]);
+		memcpy(buf.get(), in.data(), in.size());
+		const char *begin = in.size() ? buf.get() : nullptr;
+		url_parts u(begin, in.size());
+
+		const char *last = buf.get();
+		std::vector<const url_part *> parts = Parts(u);
+		for (size_t i = 0; i < parts.size(); i++) {
+			const url_part &p = *parts[i];
+			if (!p.IsPresent()) {
+				if (p.size) Report(in, std::string(part_names[i]) + " is not present but has a size");
+				continue;
+			}
+			if (in.empty() && p.size == 0) continue;
+			if (p.data < last || p.data + p.size > buf.get() + in.size()) {
+				Report(in, std::string(part_names[i]) + " is out of order or outside the input");
+			} else {
+				last = p.data + p.size;
+			}
+		}
+		if (!u.path.IsPresent()) Report(in, "path is not present");
+		if (u.HasAuthority() != u.host.IsPresent()) Report(in, "HasAuthority() does not match the host");
+		if ((u.userinfo.IsPresent() || u.port.IsPresent()) && !u.host.IsPresent()) Report(in, "userinfo or port without a host");
+		if (Contains(u.scheme, ":/?#")) Report(in, "scheme contains a delimiter");
+		if (Contains(u.userinfo, "/?#")) Report(in, "userinfo contains a delimiter");
+		if (Contains(u.host, "/?#@")) Report(in, "host contains a delimiter");
+		if (Contains(u.port, "/?#@")) Report(in, "port contains a delimiter");
+		if (Contains(u.path, "?#")) Report(in, "path contains a delimiter");
+		if (Contains(u.query, "#")) Report(in, "query contains a delimiter");
+
+		std::string out = Reassemble(u);
+		if (out != in) Report(in, "reassembles to \"" + Printable(out) + "\"");
+
+		url_parts from_string(in);
+		if (Reassemble(from_string) != out) Report(in, "std::string constructor gives a different split");
+		return u;
+	}
+
+	std::string Unescape(const std::string &in) {
+		std::string out;
+		for (size_t i = 0; i < in.size(); i++) {
+			if (in[i] == '\\' && i + 1 < in.size() && in[i + 1] == '\\') {
+				out += '\\';
+				i++;
+			} else if (in[i] == '\\' && i + 3 < in.size() && in[i + 1] == 'x') {
+				out += static_cast<char>(strtoul(in.substr(i + 2, 2).c_str(), nullptr, 16));
+				i += 3;
+			} else {
+				out += in[i];
+			}
+		}
+		return out;
+	}
+
+	bool CheckCorpus(const char *filename, std::vector<std::string> &seeds) {
+		std::ifstream file(filename);
+		if (!file) {
+			fprintf(stderr, "Cannot open corpus: %s\n", filename);
+			return false;
+		}
+		std::string line;
+		unsigned int lineno = 0;
+		unsigned int count = 0;
+		while (std::getline(file, line)) {
+			lineno++;
+			if (line.empty() || line[0] == '#') continue;
+
+			std::vector<std::string> fields;
+			size_t start = 0;
+			while (true) {
+				size_t tab = line.find('\t', start);
+				fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+				if (tab == std::string::npos) break;
+				start = tab + 1;
+			}
+			if (fields.size() != 8) {
+				fprintf(stderr, "Corpus line %u: expected 8 fields, found %zu\n", lineno, fields.size());
+				failures++;
+				continue;
+			}
+
+			std::string in = Unescape(fields[0]);
+			seeds.push_back(in);
+			count++;
+			std::unique_ptr<char[]> buf;
+			url_parts u = CheckInvariants(in, buf);
+			std::vector<const url_part *> parts = Parts(u);
+			for (size_t i = 0; i < parts.size(); i++) {
+				const std::string &expected = fields[i + 1];
+				const url_part &p = *parts[i];
+				std::string got = p.IsPresent() ? "\"" + Printable(p.str()) + "\"" : "(none)";
+				if (expected == "(none)") {
+					if (p.IsPresent()) Report(in, std::string(part_names[i]) + ": expected (none), got " + got);
+				} else if (!p.IsPresent() || p.str() != Unescape(expected)) {
+					Report(in, std::string(part_names[i]) + ": expected \"" + Printable(Unescape(expected)) + "\", got " + got);
+				}
+			}
+		}
+		printf("corpus: %u URLs\n", count);
+		return true;
+	}
+
+	void CheckComparisons() {
+		std::string s = "https://WWW.Example.COM/Photo.JPG";
+		url_parts u(s);
+		auto expect = [&](bool value, const char *what) {
+			if (!value) Report(s, what);
+		};
+		expect(u.host.EqualsNoCase("www.example.com"), "EqualsNoCase");
+		expect(!u.host.Equals("www.example.com"), "Equals is case sensitive");
+		expect(u.host.EndsWithNoCase(".example.com"), "EndsWithNoCase");
+		expect(!u.host.EndsWithNoCase("xample.org"), "EndsWithNoCase mismatch");
+		expect(!u.host.EndsWithNoCase("a.www.example.com"), "EndsWithNoCase longer");
+		expect(u.path.StartsWith("/Photo"), "StartsWith");
+		expect(u.path.EndsWith(".JPG"), "EndsWith");
+		expect(!u.query.IsPresent() && u.query.Equals("") && u.query.EqualsNoCase(""), "absent part compares equal to empty");
+		expect(!u.port.StartsWith("x") && u.port.StartsWith(""), "absent part StartsWith");
+	}
+
+	void Fuzz(const std::vector<std::string> &seeds, unsigned long long seed, unsigned long long count) {
+		// Mostly delimiters and characters which are significant to the splitter
+		static const char alphabet[] = ":/?#@[]%.+-ahtpsxAHTP019 ";
+		std::mt19937_64 rng(seed);
+		auto random_char = [&]() -> char {
+			switch (rng() % 8) {
+				case 0:
+					return static_cast<char>(rng());
+				case 1:
+					return "\xC3\xA9\xE4\xBE\x8B\x00"[rng() % 6];
+				default:
+					return alphabet[rng() % (sizeof(alphabet) - 1)];
+			}
+		};
+		for (unsigned long long n = 0; n < count; n++) {
+			std::string in;
+			if (rng() % 2) {
+				size_t len = rng() % 32;
+				for (size_t i = 0; i < len; i++) in += random_char();
+			} else {
+				in = seeds[rng() % seeds.size()];
+				unsigned int mutations = 1 + (rng() % 4);
+				for (unsigned int m = 0; m < mutations; m++) {
+					size_t pos = in.empty() ? 0 : rng() % (in.size() + 1);
+					switch (rng() % 3) {
+						case 0:
+							if (pos < in.size()) {
+								in[pos] = random_char();
+								break;
+							}
+							/* fall through */
+						case 1:
+							in.insert(in.begin() + pos, random_char());
+							break;
+						case 2:
+							if (pos < in.size()) in.erase(pos, 1 + (rng() % 4));
+							break;
+					}
+				}
+			}
+			std::unique_ptr<char[]> buf;
+			CheckInvariants(in, buf);
+		}
+		printf("fuzz: %llu inputs (seed: %llu)\n", count, seed);
+	}
+};
+
+int main(int argc, char **argv) {
+	const char *corpus = (argc > 1) ? argv[1] : "corpus.txt";
+	unsigned long long seed = (argc > 2) ? strtoull(argv[2], nullptr, 0) : 1;
+	unsigned long long count = (argc > 3) ? strtoull(argv[3], nullptr, 0) : 2000000;
+
+	std::vector<std::string> seeds;
+	if (!CheckCorpus(corpus, seeds)) return 2;
+	CheckComparisons();
+
+	url_parts null_parts(nullptr, 0);
+	if (!null_parts.path.IsPresent() || !null_parts.path.IsEmpty() || null_parts.HasAuthority()) Report("", "null input");
+
+	Fuzz(seeds, seed, count);
+
+	if (failures) {
+		printf("%llu failures\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}